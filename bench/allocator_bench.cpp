@@ -0,0 +1,975 @@
+// Replays the same synthetic allocation traces through every allocator in common/memory and through malloc, and
+// reports throughput, per-operation latency percentiles and peak RSS for each trace/allocator pair.
+//
+// usage: bench [--ops N] [--trace name] [--allocator name] [--backing thp|hugetlb|prefault[,...]]
+//        bench --scaling max_threads [--ops N]   (alloc/free churn on one heap shared by 1..max_threads threads)
+//        bench --htable key_count [--threads N]   (hash tables, see htable_bench.cpp)
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "memory/backing_memory.h"
+#include "memory/tlsf.h"
+#include "memory/tlsf_multiheap.h"
+
+#define FREELIST_ALLOCATOR_IMPLEMENTATION
+#include "memory/freelist_alloc.h"
+#define FREELIST2_ALLOCATOR_IMPLEMENTATION
+#include "memory/freelist2_alloc.h"
+#define SMALL_CACHE_ALLOCATOR_IMPLEMENTATION
+#include "memory/small_cache_alloc.h"
+#define FREELIST2_CONCURRENT_IMPLEMENTATION
+#include "memory/freelist2_concurrent.h"
+#define POOL_ALLOCATOR_IMPLEMENTATION
+#include "memory/pool_alloc.h"
+#define LINEAR_ALLOCATOR_IMPLEMENTATION
+#include "memory/linear_alloc.h"
+#include "memory/buddy_alloc.h"
+
+// ============================================================================
+// Traces
+// ============================================================================
+
+enum Op_Kind : uint8_t
+{
+    OP_ALLOC,
+    OP_FREE,
+    OP_FRAME_END, // every allocation of the frame has been freed, arenas reset here.
+};
+
+struct Op
+{
+    Op_Kind  kind;
+    uint32_t slot;
+    uint32_t size;
+};
+
+struct Trace
+{
+    const char     *name;
+    std::vector<Op> ops;
+    uint32_t        slotCount = 0;
+    uint32_t        maxSize = 0;
+    size_t          peakLiveBytes = 0;
+    bool            fixedSize = false;
+    bool            frameBased = false;
+};
+
+/// Tracks live bytes while a trace is generated and closes it off by freeing whatever is still live, so every
+/// allocator ends a replay empty.
+struct Trace_Builder
+{
+    Trace                &trace;
+    std::vector<uint32_t> liveSizes;
+    size_t                liveBytes = 0;
+
+    Trace_Builder(Trace &t, uint32_t slotCount) : trace(t), liveSizes(slotCount, 0) { trace.slotCount = slotCount; }
+
+    void
+    alloc(uint32_t slot, uint32_t size)
+    {
+        trace.ops.push_back({OP_ALLOC, slot, size});
+        liveSizes[slot] = size;
+        liveBytes += size;
+        trace.peakLiveBytes = (std::max)(trace.peakLiveBytes, liveBytes);
+        trace.maxSize = (std::max)(trace.maxSize, size);
+    }
+
+    void
+    free(uint32_t slot)
+    {
+        trace.ops.push_back({OP_FREE, slot, 0});
+        liveBytes -= liveSizes[slot];
+        liveSizes[slot] = 0;
+    }
+
+    void
+    finish()
+    {
+        for (uint32_t slot = 0; slot < liveSizes.size(); ++slot)
+        {
+            if (liveSizes[slot] != 0)
+            {
+                free(slot);
+            }
+        }
+    }
+};
+
+/// Same size churn: a full set of live blocks where a random one is freed and replaced on every step.
+static Trace
+make_fixed_churn_trace(uint32_t opCount, uint32_t seed)
+{
+    Trace trace;
+    trace.name = "fixed_churn";
+    trace.fixedSize = true;
+
+    const uint32_t liveCount = 4096, size = 64;
+    Trace_Builder builder(trace, liveCount);
+    std::mt19937 gen(seed);
+
+    for (uint32_t slot = 0; slot < liveCount; ++slot)
+    {
+        builder.alloc(slot, size);
+    }
+    for (uint32_t i = 0; i < opCount / 2; ++i)
+    {
+        uint32_t slot = gen() % liveCount;
+        builder.free(slot);
+        builder.alloc(slot, size);
+    }
+    builder.finish();
+    return trace;
+}
+
+/// Mostly small blocks with a long tail of big ones: the size class k (16 << k bytes) is picked with probability
+/// ~2^-k, up to 64KiB, and jittered inside the class.
+static Trace
+make_power_law_trace(uint32_t opCount, uint32_t seed)
+{
+    Trace trace;
+    trace.name = "power_law";
+
+    const uint32_t liveCount = 4096;
+    Trace_Builder builder(trace, liveCount);
+    std::mt19937 gen(seed);
+    std::geometric_distribution<uint32_t> classDist(0.5);
+
+    auto next_size = [&]()
+    {
+        uint32_t sizeClass = (std::min)(classDist(gen), 12u);
+        uint32_t low = 16u << sizeClass;
+        return low + (uint32_t)(gen() % low);
+    };
+
+    for (uint32_t slot = 0; slot < liveCount; ++slot)
+    {
+        builder.alloc(slot, next_size());
+    }
+    for (uint32_t i = 0; i < opCount / 2; ++i)
+    {
+        uint32_t slot = gen() % liveCount;
+        builder.free(slot);
+        builder.alloc(slot, next_size());
+    }
+    builder.finish();
+    return trace;
+}
+
+/// Messages go into a queue and are freed in the order they were produced, so blocks are freed roughly in address
+/// order while new ones keep being carved behind them.
+static Trace
+make_producer_consumer_trace(uint32_t opCount, uint32_t seed)
+{
+    Trace trace;
+    trace.name = "producer_consumer";
+
+    const uint32_t queueDepth = 2048;
+    Trace_Builder builder(trace, queueDepth);
+    std::mt19937 gen(seed);
+
+    uint32_t head = 0, tail = 0;
+    for (uint32_t i = 0; i < opCount / 2; ++i)
+    {
+        // Bursty producer: the queue fills up and drains in waves.
+        uint32_t burst = 1 + gen() % 64;
+        for (uint32_t b = 0; b < burst && tail - head < queueDepth; ++b, ++tail)
+        {
+            builder.alloc(tail % queueDepth, 32 + gen() % 2016);
+        }
+        uint32_t drain = 1 + gen() % 64;
+        for (uint32_t d = 0; d < drain && head < tail; ++d, ++head)
+        {
+            builder.free(head % queueDepth);
+        }
+    }
+    builder.finish();
+    return trace;
+}
+
+/// Per-frame scratch memory: a frame allocates a batch of small blocks and releases all of them when it ends.
+static Trace
+make_frame_arena_trace(uint32_t opCount, uint32_t seed)
+{
+    Trace trace;
+    trace.name = "frame_arena";
+    trace.frameBased = true;
+
+    const uint32_t allocsPerFrame = 1000;
+    Trace_Builder builder(trace, allocsPerFrame);
+    std::mt19937 gen(seed);
+
+    uint32_t frameCount = (std::max)(1u, opCount / (2 * allocsPerFrame));
+    for (uint32_t frame = 0; frame < frameCount; ++frame)
+    {
+        for (uint32_t slot = 0; slot < allocsPerFrame; ++slot)
+        {
+            builder.alloc(slot, 16 + gen() % 496);
+        }
+        for (uint32_t slot = 0; slot < allocsPerFrame; ++slot)
+        {
+            builder.free(slot);
+        }
+        trace.ops.push_back({OP_FRAME_END, 0, 0});
+    }
+    return trace;
+}
+
+// ============================================================================
+// Allocator adapters
+// ============================================================================
+
+/// Backing memory for the allocators that manage a caller-provided buffer. Generous enough that fragmentation
+/// never makes a replay fail, a power of 2 for the buddy allocator.
+static size_t
+backing_size_for(const Trace &trace)
+{
+    size_t size = 16ull << 20;
+    while (size < trace.peakLiveBytes * 4)
+    {
+        size <<= 1;
+    }
+    return size;
+}
+
+/// Flags for the buffers of the caller-provided-buffer allocators, 0 keeps them on malloc.
+static uint32_t g_backingFlags = 0;
+static std::vector<Backing_Memory> g_backings;
+
+static void *
+bench_buffer_alloc(size_t size)
+{
+    if (g_backingFlags == 0)
+    {
+        return aligned_alloc(64, size);
+    }
+    Backing_Memory mem;
+    if (!backing_memory_acquire(&mem, size, g_backingFlags, -1))
+    {
+        return nullptr;
+    }
+    g_backings.push_back(mem);
+    return mem.data;
+}
+
+static void
+bench_buffer_free(void *memory)
+{
+    for (size_t i = 0; i < g_backings.size(); ++i)
+    {
+        if (g_backings[i].data == memory)
+        {
+            backing_memory_release(&g_backings[i]);
+            g_backings.erase(g_backings.begin() + i);
+            return;
+        }
+    }
+    ::free(memory);
+}
+
+struct Malloc_Bench
+{
+    static constexpr const char *name = "malloc";
+    std::vector<void *> slots;
+
+    static bool supports(const Trace &) { return true; }
+    void init(const Trace &trace) { slots.assign(trace.slotCount, nullptr); }
+    void *alloc(uint32_t slot, uint32_t size) { return slots[slot] = malloc(size); }
+    void free(uint32_t slot) { ::free(slots[slot]); }
+    void frame_end() {}
+    void destroy() {}
+};
+
+struct Tlsf_Bench
+{
+    static constexpr const char *name = "tlsf";
+    Tlsf::Allocator                *allocator = nullptr;
+    std::vector<Tlsf::Allocation>   slots;
+
+    static bool supports(const Trace &) { return true; }
+    void
+    init(const Trace &trace)
+    {
+        allocator = new Tlsf::Allocator(trace.slotCount + 64);
+        slots.assign(trace.slotCount, {});
+    }
+    void *
+    alloc(uint32_t slot, uint32_t size)
+    {
+        slots[slot] = allocator->allocate(size);
+        return allocator->getPointer(slots[slot]);
+    }
+    void free(uint32_t slot) { allocator->free(slots[slot]); }
+    void frame_end() {}
+    void destroy() { delete allocator; }
+};
+
+struct Freelist_Bench
+{
+    static constexpr const char *name = "freelist";
+    Freelist            fl;
+    void               *memory = nullptr;
+    std::vector<void *> slots;
+
+    static bool supports(const Trace &) { return true; }
+    void
+    init(const Trace &trace)
+    {
+        size_t size = backing_size_for(trace);
+        memory = bench_buffer_alloc(size);
+        freelist_init(&fl, memory, size, DEFAULT_ALIGNMENT);
+        fl.policy = PLACEMENT_POLICY_FIND_BEST;
+        slots.assign(trace.slotCount, nullptr);
+    }
+    void *alloc(uint32_t slot, uint32_t size) { return slots[slot] = freelist_alloc(&fl, size); }
+    void free(uint32_t slot) { freelist_free(&fl, slots[slot]); }
+    void frame_end() {}
+    void destroy() { bench_buffer_free(memory); }
+};
+
+struct Freelist2_Bench
+{
+    static constexpr const char *name = "freelist2";
+    Freelist2           fl;
+    void               *memory = nullptr;
+    std::vector<void *> slots;
+
+    static bool supports(const Trace &) { return true; }
+    void
+    init(const Trace &trace)
+    {
+        size_t size = backing_size_for(trace);
+        memory = bench_buffer_alloc(size);
+        freelist2_init(&fl, memory, size, DEFAULT_ALIGNMENT);
+        slots.assign(trace.slotCount, nullptr);
+    }
+    void *alloc(uint32_t slot, uint32_t size) { return slots[slot] = freelist2_alloc(&fl, size); }
+    void free(uint32_t slot) { freelist2_free(&fl, slots[slot]); }
+    void frame_end() {}
+    void
+    destroy()
+    {
+        freelist2_destroy(&fl);
+        bench_buffer_free(memory);
+    }
+};
+
+struct Freelist_Cache_Bench
+{
+    static constexpr const char *name = "freelist+cache";
+    Freelist            fl;
+    Small_Cache         cache;
+    void               *memory = nullptr;
+    std::vector<void *> slots;
+
+    static bool supports(const Trace &) { return true; }
+    void
+    init(const Trace &trace)
+    {
+        size_t size = backing_size_for(trace);
+        memory = bench_buffer_alloc(size);
+        freelist_init(&fl, memory, size, DEFAULT_ALIGNMENT);
+        fl.policy = PLACEMENT_POLICY_FIND_BEST;
+        small_cache_init_freelist(&cache, &fl);
+        slots.assign(trace.slotCount, nullptr);
+    }
+    void *alloc(uint32_t slot, uint32_t size) { return slots[slot] = small_cache_alloc(&cache, size); }
+    void free(uint32_t slot) { small_cache_free(&cache, slots[slot]); }
+    void frame_end() {}
+    void destroy() { bench_buffer_free(memory); }
+};
+
+struct Freelist2_Cache_Bench
+{
+    static constexpr const char *name = "freelist2+cache";
+    Freelist2           fl;
+    Small_Cache         cache;
+    void               *memory = nullptr;
+    std::vector<void *> slots;
+
+    static bool supports(const Trace &) { return true; }
+    void
+    init(const Trace &trace)
+    {
+        size_t size = backing_size_for(trace);
+        memory = bench_buffer_alloc(size);
+        freelist2_init(&fl, memory, size, DEFAULT_ALIGNMENT);
+        small_cache_init_freelist2(&cache, &fl);
+        slots.assign(trace.slotCount, nullptr);
+    }
+    void *alloc(uint32_t slot, uint32_t size) { return slots[slot] = small_cache_alloc(&cache, size); }
+    void free(uint32_t slot) { small_cache_free(&cache, slots[slot]); }
+    void frame_end() {}
+    void
+    destroy()
+    {
+        freelist2_destroy(&fl);
+        bench_buffer_free(memory);
+    }
+};
+
+struct Buddy_Bench
+{
+    static constexpr const char *name = "buddy";
+    buddy_allocator     buddy;
+    void               *memory = nullptr;
+    std::vector<void *> slots;
+
+    static bool supports(const Trace &) { return true; }
+    void
+    init(const Trace &trace)
+    {
+        size_t size = backing_size_for(trace);
+        memory = bench_buffer_alloc(size);
+        buddy_allocator_init(&buddy, memory, size, DEFAULT_ALIGNMENT);
+        slots.assign(trace.slotCount, nullptr);
+    }
+    void *alloc(uint32_t slot, uint32_t size) { return slots[slot] = buddy_allocator_alloc(&buddy, size); }
+    void free(uint32_t slot) { buddy_allocator_free(&buddy, slots[slot]); }
+    void frame_end() {}
+    void destroy() { bench_buffer_free(memory); }
+};
+
+/// Fixed-size chunks only, so it runs the fixed size trace only.
+struct Pool_Bench
+{
+    static constexpr const char *name = "pool";
+    Pool                pool;
+    void               *memory = nullptr;
+    std::vector<void *> slots;
+
+    static bool supports(const Trace &trace) { return trace.fixedSize; }
+    void
+    init(const Trace &trace)
+    {
+        size_t size = (size_t)trace.slotCount * trace.maxSize * 2;
+        memory = bench_buffer_alloc(size);
+        pool_init(&pool, memory, size, trace.maxSize, DEFAULT_ALIGNMENT);
+        slots.assign(trace.slotCount, nullptr);
+    }
+    void *alloc(uint32_t slot, uint32_t) { return slots[slot] = pool_alloc(&pool); }
+    void free(uint32_t slot) { pool_free(&pool, slots[slot]); }
+    void frame_end() {}
+    void destroy() { bench_buffer_free(memory); }
+};
+
+/// Individual frees are no-ops, memory only comes back at the end of a frame, so it runs the frame trace only.
+struct Arena_Bench
+{
+    static constexpr const char *name = "arena";
+    Arena arena;
+    void *memory = nullptr;
+
+    static bool supports(const Trace &trace) { return trace.frameBased; }
+    void
+    init(const Trace &trace)
+    {
+        size_t size = backing_size_for(trace);
+        memory = bench_buffer_alloc(size);
+        arena_init(&arena, memory, size);
+    }
+    void *alloc(uint32_t, uint32_t size) { return arena_alloc(&arena, size); }
+    void free(uint32_t) {}
+    void frame_end() { arena_free_all(&arena); }
+    void destroy() { bench_buffer_free(memory); }
+};
+
+// ============================================================================
+// Replay and reporting
+// ============================================================================
+
+struct Result
+{
+    double ops_per_sec;
+    double p50, p99, p999;
+    double peak_rss_mib;
+};
+
+#ifdef __linux__
+/// Reads a "Key:   1234 kB" line of /proc/self/status.
+static double
+proc_status_mib(const char *key)
+{
+    double result = 0.0;
+    FILE *file = fopen("/proc/self/status", "r");
+    if (file)
+    {
+        char line[256];
+        size_t keyLength = strlen(key);
+        while (fgets(line, sizeof(line), file))
+        {
+            if (strncmp(line, key, keyLength) == 0 && line[keyLength] == ':')
+            {
+                result = (double)strtoull(line + keyLength + 1, nullptr, 10) / 1024.0;
+                break;
+            }
+        }
+        fclose(file);
+    }
+    return result;
+}
+#endif
+
+/// Peak RSS is reported relative to the RSS when the case starts, so the traces themselves do not count. Only Linux
+/// can reset the high-water mark, elsewhere this is the peak of the whole process.
+static double
+reset_peak_rss()
+{
+#ifdef __linux__
+    FILE *file = fopen("/proc/self/clear_refs", "w");
+    if (file)
+    {
+        fputs("5", file);
+        fclose(file);
+    }
+    return proc_status_mib("VmRSS");
+#else
+    return 0.0;
+#endif
+}
+
+static double
+peak_rss_mib()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return (double)counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+#elif defined(__linux__)
+    return proc_status_mib("VmHWM");
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (double)usage.ru_maxrss / (1024.0 * 1024.0);
+#endif
+}
+
+template <typename Bench>
+static inline void
+replay_op(Bench &bench, const Op &op)
+{
+    switch (op.kind)
+    {
+        case OP_ALLOC:
+        {
+            // Touch the block like a real user would, this is what makes it show up in the RSS.
+            unsigned char *p = (unsigned char *)bench.alloc(op.slot, op.size);
+            if (p == nullptr)
+            {
+                fprintf(stderr, "%s: out of memory on a %u byte allocation\n", Bench::name, op.size);
+                exit(1);
+            }
+            p[0] = (unsigned char)op.slot;
+        } break;
+        case OP_FREE: bench.free(op.slot); break;
+        case OP_FRAME_END: bench.frame_end(); break;
+    }
+}
+
+/// One untimed-per-op pass for throughput, then a second pass on a fresh allocator timing every operation.
+template <typename Bench>
+static Result
+run_bench(const Trace &trace)
+{
+    using Clock = std::chrono::steady_clock;
+    Result result = {};
+
+    // Touched up front so the latency samples are part of the baseline.
+    std::vector<uint32_t> latencies(trace.ops.size(), 1);
+    double baselineRss = reset_peak_rss();
+
+    {
+        Bench bench;
+        bench.init(trace);
+        Clock::time_point start = Clock::now();
+        for (const Op &op : trace.ops)
+        {
+            replay_op(bench, op);
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        result.ops_per_sec = (double)trace.ops.size() / seconds;
+        bench.destroy();
+    }
+
+    {
+        Bench bench;
+        bench.init(trace);
+        for (size_t i = 0; i < trace.ops.size(); ++i)
+        {
+            Clock::time_point start = Clock::now();
+            replay_op(bench, trace.ops[i]);
+            latencies[i] = (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start)
+                               .count();
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&](double p) { return (double)latencies[(size_t)(p * (double)(latencies.size() - 1))]; };
+        result.p50 = percentile(0.50);
+        result.p99 = percentile(0.99);
+        result.p999 = percentile(0.999);
+
+        // Sampled while the allocator is still alive, before destroy() hands its memory back.
+        result.peak_rss_mib = peak_rss_mib() - baselineRss;
+        bench.destroy();
+    }
+
+    return result;
+}
+
+/// On POSIX every case runs in a child process so that peak RSS is the one of that case alone. Windows has no
+/// fork, there cases run in-process and the peak RSS column is the running peak of the whole process.
+template <typename Bench>
+static void
+run_case(const Trace &trace, const char *allocatorFilter)
+{
+    if (!Bench::supports(trace) || (allocatorFilter && strcmp(allocatorFilter, Bench::name) != 0))
+    {
+        return;
+    }
+
+    Result result;
+#ifdef _WIN32
+    result = run_bench<Bench>(trace);
+#else
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        perror("pipe");
+        return;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        result = run_bench<Bench>(trace);
+        ssize_t written = write(fds[1], &result, sizeof(result));
+        _exit(written == (ssize_t)sizeof(result) ? 0 : 1);
+    }
+    close(fds[1]);
+    ssize_t got = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (got != (ssize_t)sizeof(result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        printf("%-18s/%-16s  FAILED\n", trace.name, Bench::name);
+        return;
+    }
+#endif
+
+    printf("%-18s/%-16s %14.0f %10.0f %10.0f %10.0f %12.1f\n", trace.name, Bench::name, result.ops_per_sec,
+           result.p50, result.p99, result.p999, result.peak_rss_mib);
+}
+
+// ============================================================================
+// Thread scaling
+// ============================================================================
+
+/// Every thread churns its own slots on the one shared heap: mostly small blocks, now and then a bigger one, and
+/// every 8th block is handed to the next thread to free, so foreign frees are part of the mix.
+template <typename Heap>
+static double
+run_scaling(Heap &heap, unsigned threadCount, uint32_t opsPerThread)
+{
+    using Clock = std::chrono::steady_clock;
+    constexpr uint32_t SLOT_COUNT = 256;
+    constexpr uint32_t MAILBOX_SIZE = 1024;
+    struct Mailbox
+    {
+        std::mutex lock;
+        std::vector<void *> blocks;
+    };
+    std::vector<Mailbox> mailboxes(threadCount);
+
+    auto worker = [&](unsigned id) {
+        std::vector<void *> slots(SLOT_COUNT, nullptr);
+        std::vector<void *> handoff;
+        std::mt19937 rng(id + 1);
+        for (uint32_t op = 0; op < opsPerThread; ++op)
+        {
+            uint32_t r = (uint32_t)rng();
+            uint32_t slot = r % SLOT_COUNT;
+            if (slots[slot])
+            {
+                if ((r >> 8) % 8 == 0)
+                {
+                    handoff.push_back(slots[slot]);
+                }
+                else
+                {
+                    heap.free(slots[slot]);
+                }
+            }
+            uint32_t size = (r >> 12) % 32 == 0 ? 256 + (r >> 17) % 4096 : 8 + (r >> 17) % 248;
+            unsigned char *p = (unsigned char *)heap.alloc(size);
+            if (p == nullptr)
+            {
+                fprintf(stderr, "%s: out of memory on a %u byte allocation\n", Heap::name, size);
+                exit(1);
+            }
+            p[0] = (unsigned char)id;
+            slots[slot] = p;
+
+            if (handoff.size() >= 32)
+            {
+                Mailbox &next = mailboxes[(id + 1) % threadCount];
+                std::lock_guard<std::mutex> guard(next.lock);
+                if (next.blocks.size() < MAILBOX_SIZE)
+                {
+                    next.blocks.insert(next.blocks.end(), handoff.begin(), handoff.end());
+                    handoff.clear();
+                }
+            }
+            if (op % 256 == 0)
+            {
+                std::vector<void *> mine;
+                {
+                    std::lock_guard<std::mutex> guard(mailboxes[id].lock);
+                    mine.swap(mailboxes[id].blocks);
+                }
+                for (void *block : mine)
+                {
+                    heap.free(block);
+                }
+            }
+        }
+        for (void *block : slots)
+        {
+            heap.free(block);
+        }
+        for (void *block : handoff)
+        {
+            heap.free(block);
+        }
+    };
+
+    Clock::time_point start = Clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned id = 0; id < threadCount; ++id)
+    {
+        threads.emplace_back(worker, id);
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    for (Mailbox &mailbox : mailboxes)
+    {
+        for (void *block : mailbox.blocks)
+        {
+            heap.free(block);
+        }
+    }
+    return (double)threadCount * opsPerThread / seconds;
+}
+
+struct Malloc_Shared
+{
+    static constexpr const char *name = "malloc";
+    void *alloc(uint32_t size) { return malloc(size); }
+    void free(void *ptr) { ::free(ptr); }
+};
+
+/// What sharing a Freelist2 between threads takes without Freelist2_Concurrent.
+struct Freelist2_Locked_Shared
+{
+    static constexpr const char *name = "freelist2+lock";
+    Freelist2  fl = {};
+    std::mutex lock;
+
+    explicit Freelist2_Locked_Shared(void *memory, size_t size) { freelist2_init(&fl, memory, size, DEFAULT_ALIGNMENT); }
+    ~Freelist2_Locked_Shared() { freelist2_destroy(&fl); }
+    void *
+    alloc(uint32_t size)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return freelist2_alloc(&fl, size);
+    }
+    void
+    free(void *ptr)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        freelist2_free(&fl, ptr);
+    }
+};
+
+struct Freelist2_Concurrent_Shared
+{
+    static constexpr const char *name = "freelist2-concurrent";
+    Freelist2_Concurrent heap;
+
+    explicit Freelist2_Concurrent_Shared(void *memory, size_t size)
+    {
+        freelist2_concurrent_init(&heap, memory, size, DEFAULT_ALIGNMENT, 0);
+    }
+    ~Freelist2_Concurrent_Shared() { freelist2_concurrent_destroy(&heap); }
+    void *alloc(uint32_t size) { return freelist2_concurrent_alloc(&heap, size); }
+    void free(void *ptr) { freelist2_concurrent_free(&heap, ptr); }
+};
+
+/// MultiHeap hands out (heap, allocation) pairs instead of pointers, the pair is kept in a header in front of the
+/// block. Frees handed to the next thread go through the owning heap's remote-free list.
+struct Tlsf_MultiHeap_Shared
+{
+    static constexpr const char *name = "tlsf-multiheap";
+    static constexpr uint32_t HEADER_SIZE = 16;
+    static_assert(sizeof(Tlsf::HeapAllocation) <= HEADER_SIZE, "The handle has to fit in front of the block!");
+    Tlsf::MultiHeap heaps;
+
+    explicit Tlsf_MultiHeap_Shared(unsigned threadCount) : heaps(threadCount, 4096) {}
+    void *
+    alloc(uint32_t size)
+    {
+        Tlsf::HeapAllocation allocation = heaps.allocate(size + HEADER_SIZE);
+        if (allocation.heapIndex == Tlsf::MultiHeap::INVALID_HEAP || allocation.allocation.offset == 0xffffffff)
+        {
+            return nullptr;
+        }
+        unsigned char *block = (unsigned char *)heaps.getPointer(allocation);
+        memcpy(block, &allocation, sizeof(allocation));
+        return block + HEADER_SIZE;
+    }
+    void
+    free(void *ptr)
+    {
+        Tlsf::HeapAllocation allocation;
+        memcpy(&allocation, (unsigned char *)ptr - HEADER_SIZE, sizeof(allocation));
+        heaps.free(allocation);
+    }
+};
+
+void run_htable_bench(uint32_t keyCount, unsigned maxThreads);
+
+static void
+run_scaling_table(unsigned maxThreads, uint32_t opsPerThread)
+{
+    // room for every thread's slots, mailbox and hand-offs at the biggest size, with plenty to spare.
+    size_t size = (size_t)maxThreads * 16 * 1024 * 1024;
+    void *memory = bench_buffer_alloc(size);
+
+    printf("%-22s %8s %14s\n", "allocator", "threads", "ops/sec");
+    printf("---------------------------------------------\n");
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        Malloc_Shared mallocHeap;
+        printf("%-22s %8u %14.0f\n", Malloc_Shared::name, threads, run_scaling(mallocHeap, threads, opsPerThread));
+        {
+            Freelist2_Locked_Shared locked(memory, size);
+            printf("%-22s %8u %14.0f\n", Freelist2_Locked_Shared::name, threads,
+                   run_scaling(locked, threads, opsPerThread));
+        }
+        {
+            Freelist2_Concurrent_Shared concurrent(memory, size);
+            printf("%-22s %8u %14.0f\n", Freelist2_Concurrent_Shared::name, threads,
+                   run_scaling(concurrent, threads, opsPerThread));
+        }
+        {
+            Tlsf_MultiHeap_Shared multiHeap(threads);
+            printf("%-22s %8u %14.0f\n", Tlsf_MultiHeap_Shared::name, threads,
+                   run_scaling(multiHeap, threads, opsPerThread));
+        }
+    }
+    bench_buffer_free(memory);
+}
+
+int
+main(int argc, char **argv)
+{
+    uint32_t opCount = 100000;
+    const char *traceFilter = nullptr;
+    const char *allocatorFilter = nullptr;
+    unsigned scalingThreads = 0;
+    uint32_t htableKeys = 0;
+    unsigned htableThreads = 8;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--ops") == 0)
+        {
+            opCount = (uint32_t)strtoul(argv[i + 1], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--trace") == 0)
+        {
+            traceFilter = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--allocator") == 0)
+        {
+            allocatorFilter = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--backing") == 0)
+        {
+            g_backingFlags |= strstr(argv[i + 1], "thp") ? BACKING_MEMORY_HUGE_PAGES : 0;
+            g_backingFlags |= strstr(argv[i + 1], "hugetlb") ? BACKING_MEMORY_EXPLICIT_HUGE_PAGES : 0;
+            g_backingFlags |= strstr(argv[i + 1], "prefault") ? BACKING_MEMORY_PREFAULT : 0;
+        }
+        else if (strcmp(argv[i], "--scaling") == 0)
+        {
+            scalingThreads = (unsigned)strtoul(argv[i + 1], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--htable") == 0)
+        {
+            htableKeys = (uint32_t)strtoul(argv[i + 1], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--threads") == 0)
+        {
+            htableThreads = (unsigned)strtoul(argv[i + 1], nullptr, 10);
+        }
+    }
+
+    if (htableKeys > 0)
+    {
+        run_htable_bench(htableKeys, htableThreads);
+        return 0;
+    }
+
+    if (scalingThreads > 0)
+    {
+        run_scaling_table(scalingThreads, opCount);
+        return 0;
+    }
+
+    Trace traces[] = {
+        make_fixed_churn_trace(opCount, 1),
+        make_power_law_trace(opCount, 2),
+        make_producer_consumer_trace(opCount, 3),
+        make_frame_arena_trace(opCount, 4),
+    };
+
+    printf("%-35s %14s %10s %10s %10s %12s\n", "trace/allocator", "ops/sec", "p50(ns)", "p99(ns)", "p999(ns)",
+           "peakRSS(MiB)");
+    printf("------------------------------------------------------------------------------------------------\n");
+    for (const Trace &trace : traces)
+    {
+        if (traceFilter && strcmp(traceFilter, trace.name) != 0)
+        {
+            continue;
+        }
+        run_case<Malloc_Bench>(trace, allocatorFilter);
+        run_case<Tlsf_Bench>(trace, allocatorFilter);
+        run_case<Freelist_Bench>(trace, allocatorFilter);
+        run_case<Freelist2_Bench>(trace, allocatorFilter);
+        run_case<Freelist_Cache_Bench>(trace, allocatorFilter);
+        run_case<Freelist2_Cache_Bench>(trace, allocatorFilter);
+        run_case<Buddy_Bench>(trace, allocatorFilter);
+        run_case<Pool_Bench>(trace, allocatorFilter);
+        run_case<Arena_Bench>(trace, allocatorFilter);
+    }
+    return 0;
+}
@@ -0,0 +1,322 @@
+// The HTABLE_API macro table, which calls hash and compare through the function pointers in htable_functions_##name,
+// against HashTable<> from containers/htable.hpp, which resolves both at compile time. Same layout, same hash
+// functions, same allocator (malloc through a NULL alloc_api), so the difference is the dispatch. Then per-insert
+// latency of the macro table with its stop-the-world resize against ht_set_incremental_resize. Last, a session cache
+// (string keys and values, mostly lookups) shared by 1..max_threads threads: one htable behind a global mutex against
+// the sharded table of containers/concurrent_htable.h.
+//
+// usage: bench --htable key_count [--threads max_threads]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+#define HASHTABLE_IMPLEMENTATION
+#include "containers/htable.h"
+#include "containers/htable.hpp"
+#include "containers/concurrent_htable.h"
+
+HTABLE_API(string32 *, uintptr_t, str_ptr);
+HTABLE_API_IMPL(string32 *, uintptr_t, string32, uintptr, str_ptr)
+HTABLE_API(string32 *, string32 *, str_str);
+HTABLE_API_IMPL_PTR(string32, string32, str_str)
+CONCURRENT_HTABLE_API(string32 *, string32 *, str_str);
+CONCURRENT_HTABLE_API_IMPL(string32 *, string32 *, string32, string32, str_str)
+
+// ============================================================================
+// Adapters
+// ============================================================================
+
+struct Macro_Int_Table
+{
+    static constexpr const char *name = "htable (macro)";
+    htable_ptr_ptr table;
+
+    Macro_Int_Table() { ht_init_ptr_ptr(&table, 16, 0.0f, 0.7f, 31, NULL); }
+    ~Macro_Int_Table() { ht_delete_ptr_ptr(&table); }
+    void add(uintptr_t key, uintptr_t value) { ht_add_ptr_ptr(&table, key, value); }
+    bool get(uintptr_t key, uintptr_t *value) { return ht_get_ptr_ptr(&table, key, value); }
+    bool remove(uintptr_t key) { return ht_remove_key_ptr_ptr(&table, key); }
+};
+
+struct Template_Int_Table
+{
+    static constexpr const char *name = "HashTable<>";
+    HashTable<uintptr_t, uintptr_t> table{16, 0.0f, 0.7f, 31, (const alloc_api *)NULL};
+
+    void add(uintptr_t key, uintptr_t value) { table.add(key, value); }
+    bool get(uintptr_t key, uintptr_t *value) { return table.get(key, value); }
+    bool remove(uintptr_t key) { return table.remove_key(key); }
+};
+
+struct Macro_String_Table
+{
+    static constexpr const char *name = "htable (macro)";
+    htable_str_ptr table;
+
+    Macro_String_Table() { ht_init_str_ptr(&table, 16, 0.0f, 0.7f, 31, NULL); }
+    ~Macro_String_Table() { ht_delete_str_ptr(&table); }
+    void add(string32 *key, uintptr_t value) { ht_add_str_ptr(&table, key, value); }
+    bool get(string32 *key, uintptr_t *value) { return ht_get_str_ptr(&table, key, value); }
+    bool remove(string32 *key) { return ht_remove_key_str_ptr(&table, key); }
+};
+
+struct Template_String_Table
+{
+    static constexpr const char *name = "HashTable<>";
+    HashTable<string32 *, uintptr_t> table{16, 0.0f, 0.7f, 31, (const alloc_api *)NULL};
+
+    void add(string32 *key, uintptr_t value) { table.add(key, value); }
+    bool get(string32 *key, uintptr_t *value) { return table.get(key, value); }
+    bool remove(string32 *key) { return table.remove_key(key); }
+};
+
+// Both caches hand out a copy of the value, with a shared table the stored one can be replaced right after the lookup.
+struct Locked_Session_Cache
+{
+    static constexpr const char *name = "mutex+htable";
+    htable_str_str table;
+    std::mutex lock;
+
+    Locked_Session_Cache() { ht_init_str_str(&table, 16, 0.0f, 0.7f, 31, NULL); }
+    ~Locked_Session_Cache() { ht_delete_str_str(&table); }
+    void
+    put(string32 *key, string32 *value)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        ht_add_str_str(&table, key, value);
+    }
+    string32 *
+    get(string32 *key)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        string32 *value = NULL;
+        return ht_get_str_str(&table, key, &value) ? string32_dup(value, NULL) : NULL;
+    }
+};
+
+struct Concurrent_Session_Cache
+{
+    static constexpr const char *name = "concurrent_htable";
+    concurrent_htable_str_str table;
+
+    Concurrent_Session_Cache() { cht_init_str_str(&table, 16, 0.0f, 0.7f, 31, 0, NULL); }
+    ~Concurrent_Session_Cache() { cht_delete_str_str(&table); }
+    void put(string32 *key, string32 *value) { cht_add_str_str(&table, key, value); }
+    string32 *
+    get(string32 *key)
+    {
+        string32 *value = NULL;
+        return cht_get_str_str(&table, key, &value, NULL) ? value : NULL;
+    }
+};
+
+// ============================================================================
+// Runner
+// ============================================================================
+
+static double
+ns_per_op(std::chrono::steady_clock::time_point start, size_t opCount)
+{
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return seconds * 1e9 / (double)opCount;
+}
+
+/// Inserts every key, looks each one up (hits), looks up keys that are not there (misses), then removes every key.
+/// Lookups are repeated so they are not drowned out by the timer.
+template <typename Table, typename Key>
+static void
+run_table(const char *keyKind, const std::vector<Key> &keys, const std::vector<Key> &missingKeys)
+{
+    using Clock = std::chrono::steady_clock;
+    const int LOOKUP_ROUNDS = 4;
+    volatile uintptr_t sink = 0;
+
+    Table *table = new Table();
+
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        table->add(keys[i], (uintptr_t)i);
+    }
+    double insertNs = ns_per_op(start, keys.size());
+
+    start = Clock::now();
+    for (int round = 0; round < LOOKUP_ROUNDS; ++round)
+    {
+        for (const Key &key : keys)
+        {
+            uintptr_t value = 0;
+            table->get(key, &value);
+            sink = sink + value;
+        }
+    }
+    double hitNs = ns_per_op(start, keys.size() * LOOKUP_ROUNDS);
+
+    start = Clock::now();
+    for (int round = 0; round < LOOKUP_ROUNDS; ++round)
+    {
+        for (const Key &key : missingKeys)
+        {
+            uintptr_t value = 0;
+            sink = sink + (uintptr_t)table->get(key, &value);
+        }
+    }
+    double missNs = ns_per_op(start, missingKeys.size() * LOOKUP_ROUNDS);
+
+    start = Clock::now();
+    for (const Key &key : keys)
+    {
+        table->remove(key);
+    }
+    double removeNs = ns_per_op(start, keys.size());
+
+    delete table;
+    printf("%-10s %-16s %12.1f %10.1f %10.1f %12.1f\n", keyKind, Table::name, insertNs, hitNs, missNs, removeNs);
+}
+
+/// Every insert timed on its own: with a stop-the-world resize the insert that crosses max_load_factor pays for
+/// rehashing the whole table, with incremental resize that work is spread over the following operations.
+static void
+run_insert_latency(const char *mode, const std::vector<uintptr_t> &keys, bool incremental)
+{
+    using Clock = std::chrono::steady_clock;
+    std::vector<uint32_t> latencies(keys.size(), 1);
+
+    htable_ptr_ptr table;
+    ht_init_ptr_ptr(&table, 16, 0.0f, 0.7f, 31, NULL);
+    ht_set_incremental_resize_ptr_ptr(&table, incremental);
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        Clock::time_point start = Clock::now();
+        ht_add_ptr_ptr(&table, keys[i], (uintptr_t)i);
+        latencies[i] = (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    }
+    ht_delete_ptr_ptr(&table);
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) { return (double)latencies[(size_t)(p * (double)(latencies.size() - 1))]; };
+    printf("%-16s %10.0f %10.0f %10.0f %12.0f\n", mode, percentile(0.50), percentile(0.99), percentile(0.9999),
+           (double)latencies.back());
+}
+
+/// Every thread looks up random sessions and renews one in 20, on a cache that already holds every session.
+template <typename Cache>
+static double
+run_session_cache(const std::vector<string32 *> &keys, const std::vector<string32 *> &values, unsigned threadCount,
+                  uint32_t opsPerThread)
+{
+    using Clock = std::chrono::steady_clock;
+    Cache *cache = new Cache();
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        cache->put(keys[i], values[i]);
+    }
+
+    auto worker = [&](unsigned id) {
+        std::mt19937 rng(id + 1);
+        for (uint32_t op = 0; op < opsPerThread; ++op)
+        {
+            uint32_t r = (uint32_t)rng();
+            size_t index = r % keys.size();
+            if ((r >> 24) % 20 == 0)
+            {
+                cache->put(keys[index], values[(index + op) % values.size()]);
+            }
+            else
+            {
+                string32_free(cache->get(keys[index]), NULL);
+            }
+        }
+    };
+
+    Clock::time_point start = Clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned id = 0; id < threadCount; ++id)
+    {
+        threads.emplace_back(worker, id);
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    delete cache;
+    return (double)threadCount * opsPerThread / seconds;
+}
+
+void
+run_htable_bench(uint32_t keyCount, unsigned maxThreads)
+{
+    // integer ids, skipping 0 and 2 which both tables reserve for empty and removed slots.
+    std::vector<uintptr_t> intKeys, missingIntKeys;
+    for (uintptr_t i = 0; i < keyCount; ++i)
+    {
+        intKeys.push_back(i * 2 + 3);
+        missingIntKeys.push_back(i * 2 + 4);
+    }
+
+    // what malloc hands out: 64 byte aligned addresses, the low bits are always zero.
+    std::vector<uintptr_t> pointerKeys, missingPointerKeys;
+    for (uintptr_t i = 0; i < keyCount; ++i)
+    {
+        pointerKeys.push_back(0x7f0000000000ull + i * 128);
+        missingPointerKeys.push_back(0x7f0000000000ull + i * 128 + 64);
+    }
+
+    // a mix of short keys (inline in the string32) and longer ones that live on the heap.
+    std::vector<string32> strings(2 * (size_t)keyCount);
+    std::vector<string32 *> stringKeys, missingStringKeys;
+    for (uint32_t i = 0; i < 2 * keyCount; ++i)
+    {
+        char text[64];
+        if (i % 2)
+        {
+            snprintf(text, sizeof(text), "%x", i);
+        }
+        else
+        {
+            snprintf(text, sizeof(text), "session/%08u/token", i);
+        }
+        strings[i] = string32_create(text, NULL);
+        (i < keyCount ? stringKeys : missingStringKeys).push_back(&strings[i]);
+    }
+
+    printf("%-10s %-16s %12s %10s %10s %12s\n", "keys", "table", "insert(ns)", "hit(ns)", "miss(ns)", "remove(ns)");
+    printf("------------------------------------------------------------------------------\n");
+    run_table<Macro_Int_Table>("integer", intKeys, missingIntKeys);
+    run_table<Template_Int_Table>("integer", intKeys, missingIntKeys);
+    run_table<Macro_Int_Table>("pointer", pointerKeys, missingPointerKeys);
+    run_table<Template_Int_Table>("pointer", pointerKeys, missingPointerKeys);
+    run_table<Macro_String_Table>("string32*", stringKeys, missingStringKeys);
+    run_table<Template_String_Table>("string32*", stringKeys, missingStringKeys);
+
+    printf("\n%-16s %10s %10s %10s %12s\n", "insert resize", "p50(ns)", "p99(ns)", "p9999(ns)", "max(ns)");
+    printf("-------------------------------------------------------------\n");
+    run_insert_latency("stop-the-world", pointerKeys, false);
+    run_insert_latency("incremental", pointerKeys, true);
+
+    // the session strings double as values, a put stores another session's string under the key.
+    const uint32_t SESSION_OPS = 200000;
+    printf("\n%-20s %8s %14s\n", "session cache", "threads", "ops/sec");
+    printf("---------------------------------------------\n");
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        printf("%-20s %8u %14.0f\n", Locked_Session_Cache::name, threads,
+               run_session_cache<Locked_Session_Cache>(stringKeys, missingStringKeys, threads, SESSION_OPS));
+        printf("%-20s %8u %14.0f\n", Concurrent_Session_Cache::name, threads,
+               run_session_cache<Concurrent_Session_Cache>(stringKeys, missingStringKeys, threads, SESSION_OPS));
+    }
+
+    for (string32 &s : strings)
+    {
+        string32_cstr_free(&s, NULL);
+    }
+}
@@ -6,6 +6,7 @@
 #define WIN32_LEAN_AND_MEAN
 #endif
 #endif
+#include <climits>
 #include <cstring>
 
 #ifdef _LIBCPP_CXX03_LANG
@@ -14,9 +15,21 @@
 
 #define max(a,b) (((a) > (b)) ? (a) : (b))
 
-#ifdef __APPLE__
+// NOTE: the secure CRT string functions only exist on Windows, everywhere else they are shimmed here. strlcpy is
+// not in glibc before 2.38, so the copy is spelled out.
+#ifndef _WIN32
 inline size_t strnlen_s(const char *str, size_t maxLen) { return (str) ? strnlen(str, maxLen) : 0; }
-inline size_t strcpy_s(char *dst, size_t dst_size, const char *src) { return strlcpy(dst, src, dst_size); }
+inline size_t
+strcpy_s(char *dst, size_t dst_size, const char *src)
+{
+    size_t len = strlen(src);
+    if (dst_size > 0) {
+        size_t n = len < dst_size ? len : dst_size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
 inline void
 memcpy_s(void *dst, size_t dst_size, const void *src, size_t src_size)
 {
@@ -0,0 +1,407 @@
+#ifndef CONCURRENT_HTABLE_H
+#define CONCURRENT_HTABLE_H
+
+// standard headers first, common.h defines min/max as macros.
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#ifdef CONCURRENT_HASHTABLE_UNIT_TESTS
+#include <vector>
+#endif
+
+#include <common.h>
+#include <memory/memory.h>
+#include <containers/htable.h>
+#include <stdint.h>
+
+/*
+    Hash table that any number of threads can read and write at once. Underneath it is HTABLE_API: the keys are
+    spread over a power of two number of shards, and every shard is an htable_##name of its own (same open
+    addressing layout, same per type functions, same alloc_api) behind its own reader/writer lock.
+
+    A key is hashed once. The top bits of the hash pick the shard and the low bits the slot inside it, so the two
+    only overlap once a single shard has more than 2^(32 - log2(shard_count)) slots.
+
+    Readers lock their shard shared: a lookup waits for a writer of the same shard, never for other readers or for
+    other shards. Writers lock one shard exclusively, with the default of 4 shards per hardware thread two writers
+    rarely meet. Shards grow and shrink on their own and incrementally (ht_set_incremental_resize), a shard that
+    resizes holds its lock for one bounded step per add or remove and the rest of the table does not notice.
+
+    NOTE: reads take a lock and are not lock free. An overwrite or remove frees the old key and value, and a resize
+    the old entry array, through the alloc_api right away. There is no deferred reclamation a lock free reader
+    could count on.
+
+    The alloc_api is called from every writing thread, it has to be thread safe: NULL (malloc) or a
+    Freelist2_Concurrent. cht_init and cht_delete are not thread safe.
+
+    Same per type functions as HTABLE_API, with cht_ in place of ht_. CONCURRENT_HTABLE_API_IMPL(..., name) has to
+    come after HTABLE_API_IMPL(..., name), it is built on its ht_*_hashed_##name functions.
+*/
+
+#define CONCURRENT_HTABLE_MAX_SHARDS 256
+
+#define CONCURRENT_HTABLE_API(tkey, tval, name)                                                                   \
+    typedef struct cht_shard_##name                                                                               \
+    {                                                                                                             \
+        alignas(64) std::shared_mutex lock;                                                                       \
+        htable_##name table;                                                                                      \
+    } cht_shard_##name;                                                                                           \
+                                                                                                                  \
+    typedef struct concurrent_htable_##name                                                                       \
+    {                                                                                                             \
+        cht_shard_##name *shards;                                                                                 \
+        unsigned int shard_count;                                                                                 \
+        unsigned int shard_shift; /* the shard of a key is its hash >> shard_shift */                             \
+        unsigned int seed;                                                                                        \
+        key_hash_func_##name##_t key_hash_func;                                                                   \
+    } concurrent_htable_##name;                                                                                   \
+                                                                                                                  \
+    void cht_init_##name(concurrent_htable_##name *cht, size_t initial_capacity, float min_load_factor,           \
+                         float max_load_factor, unsigned int seed, unsigned int shard_count,                      \
+                         const alloc_api *api);                                                                   \
+    void cht_add_##name(concurrent_htable_##name *cht, const tkey key, tval value);                               \
+    bool cht_get_##name(const concurrent_htable_##name *cht, const tkey key, tval *value,                         \
+                        const alloc_api *value_api);                                                              \
+    bool cht_key_exists_##name(const concurrent_htable_##name *cht, const tkey key);                              \
+    bool cht_remove_key_##name(concurrent_htable_##name *cht, const tkey key_to_remove);                          \
+    size_t cht_count_##name(const concurrent_htable_##name *cht);                                                 \
+    void cht_clear_##name(concurrent_htable_##name *cht);                                                         \
+    void cht_delete_##name(concurrent_htable_##name *cht)
+
+CONCURRENT_HTABLE_API(uintptr_t, uintptr_t, ptr_ptr);
+
+#ifdef HASHTABLE_IMPLEMENTATION
+#define CONCURRENT_HTABLE_API_IMPL(tkey, tval, tkey_name, tval_name, name)                                        \
+    inline void cht_init_##name(concurrent_htable_##name *cht, size_t initial_capacity, float min_load_factor,    \
+                                float max_load_factor, unsigned int seed, unsigned int shard_count,               \
+                                const alloc_api *api)                                                             \
+    {                                                                                                             \
+        if (shard_count == 0)                                                                                     \
+        {                                                                                                         \
+            shard_count = 4 * std::thread::hardware_concurrency();                                                \
+        }                                                                                                         \
+        cht->shard_count = 1;                                                                                     \
+        cht->shard_shift = 32;                                                                                    \
+        while (cht->shard_count < shard_count && cht->shard_count < CONCURRENT_HTABLE_MAX_SHARDS)                 \
+        {                                                                                                         \
+            cht->shard_count *= 2;                                                                                \
+            cht->shard_shift--;                                                                                   \
+        }                                                                                                         \
+        cht->seed = seed;                                                                                         \
+        cht->key_hash_func = tkey_name##_hash;                                                                    \
+                                                                                                                  \
+        /* every shard starts with its part of initial_capacity, the slot index is hash & (capacity - 1). */      \
+        size_t shard_capacity = 2;                                                                                \
+        while (shard_capacity * cht->shard_count < initial_capacity)                                              \
+        {                                                                                                         \
+            shard_capacity *= 2;                                                                                  \
+        }                                                                                                         \
+        cht->shards = new cht_shard_##name[cht->shard_count];                                                     \
+        for (unsigned int i = 0; i < cht->shard_count; ++i)                                                       \
+        {                                                                                                         \
+            ht_init_##name(&cht->shards[i].table, shard_capacity, min_load_factor, max_load_factor, seed, api);   \
+            ht_set_incremental_resize_##name(&cht->shards[i].table, true);                                        \
+        }                                                                                                         \
+    }                                                                                                             \
+                                                                                                                  \
+    static inline cht_shard_##name *cht_shard_of_##name(const concurrent_htable_##name *cht, unsigned int hash)   \
+    {                                                                                                             \
+        /* NOTE: shifted as 64 bits, with a single shard the shift is 32. */                                      \
+        return &cht->shards[(uint64_t)hash >> cht->shard_shift];                                                  \
+    }                                                                                                             \
+                                                                                                                  \
+    inline void cht_add_##name(concurrent_htable_##name *cht, const tkey key, tval value)                         \
+    {                                                                                                             \
+        unsigned int hash = cht->key_hash_func(key, cht->seed);                                                   \
+        cht_shard_##name *shard = cht_shard_of_##name(cht, hash);                                                 \
+        std::unique_lock<std::shared_mutex> guard(shard->lock);                                                   \
+        ht_add_hashed_##name(&shard->table, key, value, hash);                                                    \
+    }                                                                                                             \
+                                                                                                                  \
+    /* The value is copied out with tval_name##_dup into value_api while the shard is locked, the caller frees */ \
+    /* the copy with tval_name##_free. The entry itself can be overwritten or removed as soon as we unlock. */    \
+    inline bool cht_get_##name(const concurrent_htable_##name *cht, const tkey key, tval *value,                  \
+                               const alloc_api *value_api)                                                        \
+    {                                                                                                             \
+        unsigned int hash = cht->key_hash_func(key, cht->seed);                                                   \
+        cht_shard_##name *shard = cht_shard_of_##name(cht, hash);                                                 \
+        std::shared_lock<std::shared_mutex> guard(shard->lock);                                                   \
+        htable_entry_##name *entry = ht_find_entry_hashed_##name(&shard->table, key, hash);                       \
+        if (entry != NULL && value != NULL)                                                                       \
+        {                                                                                                         \
+            *value = shard->table.funcs.value_copy_func(entry->value, value_api);                                 \
+        }                                                                                                         \
+        return entry != NULL;                                                                                     \
+    }                                                                                                             \
+                                                                                                                  \
+    inline bool cht_key_exists_##name(const concurrent_htable_##name *cht, const tkey key)                        \
+    {                                                                                                             \
+        return cht_get_##name(cht, key, NULL, NULL);                                                              \
+    }                                                                                                             \
+                                                                                                                  \
+    inline bool cht_remove_key_##name(concurrent_htable_##name *cht, const tkey key_to_remove)                    \
+    {                                                                                                             \
+        unsigned int hash = cht->key_hash_func(key_to_remove, cht->seed);                                         \
+        cht_shard_##name *shard = cht_shard_of_##name(cht, hash);                                                 \
+        std::unique_lock<std::shared_mutex> guard(shard->lock);                                                   \
+        return ht_remove_hashed_##name(&shard->table, key_to_remove, hash);                                       \
+    }                                                                                                             \
+                                                                                                                  \
+    /* NOTE: shard by shard, with writers running the total is only a snapshot of each shard at its own time. */  \
+    inline size_t cht_count_##name(const concurrent_htable_##name *cht)                                           \
+    {                                                                                                             \
+        size_t count = 0;                                                                                         \
+        for (unsigned int i = 0; i < cht->shard_count; ++i)                                                       \
+        {                                                                                                         \
+            std::shared_lock<std::shared_mutex> guard(cht->shards[i].lock);                                       \
+            count += cht->shards[i].table.count;                                                                  \
+        }                                                                                                         \
+        return count;                                                                                             \
+    }                                                                                                             \
+                                                                                                                  \
+    inline void cht_clear_##name(concurrent_htable_##name *cht)                                                   \
+    {                                                                                                             \
+        for (unsigned int i = 0; i < cht->shard_count; ++i)                                                       \
+        {                                                                                                         \
+            std::unique_lock<std::shared_mutex> guard(cht->shards[i].lock);                                       \
+            ht_clear_##name(&cht->shards[i].table);                                                               \
+        }                                                                                                         \
+    }                                                                                                             \
+                                                                                                                  \
+    inline void cht_delete_##name(concurrent_htable_##name *cht)                                                  \
+    {                                                                                                             \
+        for (unsigned int i = 0; i < cht->shard_count; ++i)                                                       \
+        {                                                                                                         \
+            ht_delete_##name(&cht->shards[i].table);                                                              \
+        }                                                                                                         \
+        delete[] cht->shards;                                                                                     \
+        cht->shards = NULL;                                                                                       \
+        cht->shard_count = 0;                                                                                     \
+    }
+
+CONCURRENT_HTABLE_API_IMPL(uintptr_t, uintptr_t, uintptr, uintptr, ptr_ptr)
+
+#ifdef CONCURRENT_HASHTABLE_UNIT_TESTS
+// the session cache: string keys to string values, both owned by the table.
+HTABLE_API(string32 *, string32 *, session);
+HTABLE_API_IMPL_PTR(string32, string32, session)
+CONCURRENT_HTABLE_API(string32 *, string32 *, session);
+CONCURRENT_HTABLE_API_IMPL(string32 *, string32 *, string32, string32, session)
+
+static void
+test_concurrent_htable_single_thread(const alloc_api *api)
+{
+    enum { KEY_COUNT = 20000, SHARD_COUNT = 16 };
+    concurrent_htable_ptr_ptr table;
+    cht_init_ptr_ptr(&table, 1000, 0.1f, 0.7f, 31, SHARD_COUNT, api);
+    assert(table.shard_count == SHARD_COUNT);
+    for (unsigned int i = 0; i < table.shard_count; ++i) {
+        assert(table.shards[i].table.capacity == 64 && table.shards[i].table.incremental);
+    }
+
+    // pointer-like keys, never 0 or 2 which the htable reserves.
+    for (uintptr_t i = 0; i < KEY_COUNT; ++i) {
+        cht_add_ptr_ptr(&table, (i + 1) * 64, i);
+    }
+    assert(cht_count_ptr_ptr(&table) == KEY_COUNT);
+    for (uintptr_t i = 0; i < KEY_COUNT; ++i) {
+        uintptr_t value = 0;
+        assert(cht_get_ptr_ptr(&table, (i + 1) * 64, &value, api) && value == i);
+        assert(!cht_key_exists_ptr_ptr(&table, (i + 1) * 64 + 1));
+    }
+    // the top bits of the hash spread the keys evenly.
+    for (unsigned int i = 0; i < table.shard_count; ++i) {
+        size_t count = table.shards[i].table.count;
+        assert(count > KEY_COUNT / SHARD_COUNT / 2 && count < KEY_COUNT / SHARD_COUNT * 2);
+    }
+
+    // overwriting keeps the count, removing a missing key is not an error.
+    cht_add_ptr_ptr(&table, 64, 42);
+    uintptr_t value = 0;
+    assert(cht_get_ptr_ptr(&table, 64, &value, api) && value == 42);
+    assert(cht_count_ptr_ptr(&table) == KEY_COUNT);
+    for (uintptr_t i = 0; i < KEY_COUNT; i += 2) {
+        assert(cht_remove_key_ptr_ptr(&table, (i + 1) * 64));
+    }
+    assert(!cht_remove_key_ptr_ptr(&table, 64));
+    assert(cht_count_ptr_ptr(&table) == KEY_COUNT / 2);
+    for (uintptr_t i = 0; i < KEY_COUNT; ++i) {
+        assert(cht_key_exists_ptr_ptr(&table, (i + 1) * 64) == (i % 2 == 1));
+    }
+
+    cht_clear_ptr_ptr(&table);
+    assert(cht_count_ptr_ptr(&table) == 0);
+    cht_delete_ptr_ptr(&table);
+
+    // shard counts are rounded up to a power of two, and capped.
+    cht_init_ptr_ptr(&table, 0, 0.0f, 0.7f, 31, 5, api);
+    assert(table.shard_count == 8 && table.shard_shift == 29);
+    cht_delete_ptr_ptr(&table);
+    cht_init_ptr_ptr(&table, 0, 0.0f, 0.7f, 31, 100000, api);
+    assert(table.shard_count == CONCURRENT_HTABLE_MAX_SHARDS);
+    cht_delete_ptr_ptr(&table);
+    cht_init_ptr_ptr(&table, 0, 0.0f, 0.7f, 31, 1, api);
+    assert(table.shard_shift == 32);
+    cht_add_ptr_ptr(&table, 64, 1);
+    assert(cht_key_exists_ptr_ptr(&table, 64));
+    cht_delete_ptr_ptr(&table);
+    cht_init_ptr_ptr(&table, 0, 0.0f, 0.7f, 31, 0, api);
+    assert(table.shard_count >= 1 && (table.shard_count & (table.shard_count - 1)) == 0);
+    cht_delete_ptr_ptr(&table);
+}
+
+static void
+test_concurrent_htable_strings(const alloc_api *api)
+{
+    enum { KEY_COUNT = 300 };
+    string32 keys[KEY_COUNT];
+    string32 values[KEY_COUNT];
+    char buffer[64];
+    for (int i = 0; i < KEY_COUNT; ++i) {
+        snprintf(buffer, sizeof(buffer), "session/%d", i);
+        keys[i] = string32_create(buffer, api);
+        snprintf(buffer, sizeof(buffer), "user %d", i);
+        values[i] = string32_create(buffer, api);
+    }
+
+    concurrent_htable_session table;
+    cht_init_session(&table, 16, 0.0f, 0.7f, 31, 4, api);
+    for (int i = 0; i < KEY_COUNT; ++i) {
+        cht_add_session(&table, &keys[i], &values[i]);
+    }
+    // a lookup hands out a copy of its own, the table keeps its value.
+    for (int i = 0; i < KEY_COUNT; ++i) {
+        string32 *value = NULL;
+        assert(cht_get_session(&table, &keys[i], &value, api));
+        assert(value != &values[i] && string32_compare(value, &values[i]));
+        string32_free(value, api);
+    }
+    cht_add_session(&table, &keys[0], &values[1]);
+    string32 *value = NULL;
+    assert(cht_get_session(&table, &keys[0], &value, api) && string32_compare(value, &values[1]));
+    string32_free(value, api);
+    for (int i = 0; i < KEY_COUNT; i += 3) {
+        assert(cht_remove_key_session(&table, &keys[i]));
+    }
+    assert(cht_count_session(&table) == KEY_COUNT - (KEY_COUNT + 2) / 3);
+    cht_delete_session(&table);
+
+    for (int i = 0; i < KEY_COUNT; ++i) {
+        string32_cstr_free(&keys[i], api);
+        string32_cstr_free(&values[i], api);
+    }
+}
+
+// NOTE: malloc underneath, the freelists are not thread safe. Run under TSan/ASan to catch what the asserts can't.
+static void
+test_concurrent_htable_threads()
+{
+    enum { THREAD_COUNT = 8, KEYS_PER_THREAD = 20000, SESSION_COUNT = 256, ROUNDS = 20000 };
+
+    // every thread grows the table with keys of its own, so the shards resize while the others read and write.
+    concurrent_htable_ptr_ptr numbers;
+    cht_init_ptr_ptr(&numbers, 0, 0.1f, 0.7f, 31, 8, NULL);
+    auto fill = [&](uintptr_t id) {
+        uintptr_t first = (id * KEYS_PER_THREAD + 1) * 64;
+        for (uintptr_t i = 0; i < KEYS_PER_THREAD; ++i) {
+            cht_add_ptr_ptr(&numbers, first + i * 64, id);
+        }
+        for (uintptr_t i = 0; i < KEYS_PER_THREAD; ++i) {
+            uintptr_t value = 0;
+            assert(cht_get_ptr_ptr(&numbers, first + i * 64, &value, NULL) && value == id);
+        }
+        for (uintptr_t i = 0; i < KEYS_PER_THREAD; i += 2) {
+            assert(cht_remove_key_ptr_ptr(&numbers, first + i * 64));
+        }
+    };
+    std::vector<std::thread> threads;
+    for (uintptr_t id = 0; id < THREAD_COUNT; ++id) {
+        threads.emplace_back(fill, id);
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+    assert(cht_count_ptr_ptr(&numbers) == THREAD_COUNT * KEYS_PER_THREAD / 2);
+    for (uintptr_t key = 64; key <= THREAD_COUNT * KEYS_PER_THREAD * 64; key += 64) {
+        uintptr_t value = 0;
+        bool found = cht_get_ptr_ptr(&numbers, key, &value, NULL);
+        assert(found == ((key / 64 - 1) % 2 == 1));
+        assert(!found || value == (key / 64 - 1) / KEYS_PER_THREAD);
+    }
+    cht_delete_ptr_ptr(&numbers);
+
+    // the session cache: mostly lookups, now and then a session is renewed or dropped. Every value a lookup gets
+    // has to belong to its key, a copy of a value freed under it would show up as garbage.
+    concurrent_htable_session sessions;
+    cht_init_session(&sessions, SESSION_COUNT, 0.0f, 0.7f, 31, 8, NULL);
+    string32 keys[SESSION_COUNT];
+    char buffer[64];
+    for (int i = 0; i < SESSION_COUNT; ++i) {
+        snprintf(buffer, sizeof(buffer), "session/%d", i);
+        keys[i] = string32_create(buffer, NULL);
+        snprintf(buffer, sizeof(buffer), "user %d generation 0", i);
+        string32 value = string32_create(buffer, NULL);
+        cht_add_session(&sessions, &keys[i], &value);
+        string32_cstr_free(&value, NULL);
+    }
+    auto churn = [&](uint32_t id) {
+        uint32_t state = 0x9e3779b9u * (id + 1);
+        char text[64];
+        for (int round = 0; round < ROUNDS; ++round) {
+            state = state * 1664525u + 1013904223u;
+            int key = (int)((state >> 8) % SESSION_COUNT);
+            uint32_t op = (state >> 20) % 16;
+            if (op == 0) {
+                snprintf(text, sizeof(text), "user %d generation %d", key, round);
+                string32 value = string32_create(text, NULL);
+                cht_add_session(&sessions, &keys[key], &value);
+                string32_cstr_free(&value, NULL);
+            } else if (op == 1) {
+                cht_remove_key_session(&sessions, &keys[key]);
+            } else {
+                string32 *value = NULL;
+                if (cht_get_session(&sessions, &keys[key], &value, NULL)) {
+                    int user = -1, generation = -1;
+                    assert(sscanf(string32_cstr(value), "user %d generation %d", &user, &generation) == 2);
+                    assert(user == key && generation >= 0 && generation < ROUNDS);
+                    string32_free(value, NULL);
+                }
+            }
+        }
+    };
+    for (uint32_t id = 0; id < THREAD_COUNT; ++id) {
+        threads.emplace_back(churn, id);
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    assert(cht_count_session(&sessions) <= SESSION_COUNT);
+    cht_delete_session(&sessions);
+    for (int i = 0; i < SESSION_COUNT; ++i) {
+        string32_cstr_free(&keys[i], NULL);
+    }
+}
+
+#ifndef FREELIST_ALLOCATOR_IMPLEMENTATION
+#define FREELIST_ALLOCATOR_IMPLEMENTATION
+#endif
+#include <memory/freelist_alloc.h>
+
+void concurrent_htable_unit_tests()
+{
+    freelist_create(fl, MEGABYTES(64), 0, PLACEMENT_POLICY_FIND_BEST);
+    alloc_api *api = freelist_get_api(&fl);
+
+    test_concurrent_htable_single_thread(api);
+    assert(fl.used == 0);
+    test_concurrent_htable_strings(api);
+    assert(fl.used == 0);
+    test_concurrent_htable_threads();
+
+    free(fl.data);
+}
+#endif
+#endif
+
+#endif // CONCURRENT_HTABLE_H
@@ -2,6 +2,7 @@
 #define HTABLE_H
 
 #include <common.h>
+#include <hash.h>
 #include <memory/memory.h>
 #ifndef STRING32_IMPLEMENTATION
 #define STRING32_IMPLEMENTATION
@@ -11,6 +12,17 @@
 
 #define HTABLE_LOAD_FACTOR_CHECK(ht) (float)((ht)->count + 1) / (float)((ht)->capacity)
 
+/* Incremental resize (ht_set_incremental_resize): slots of the next table zeroed, and slots of the old table moved,
+   per ht_add / ht_remove_key while a resize is in flight. A resize has to be done before the live table fills up or
+   the next one is due, which takes a CLEAR_STEP above 2 / (1 - max_load_factor) and a MIGRATE_STEP above
+   1 / max_load_factor. Below that the resize is finished in one go, like without the incremental mode. */
+#ifndef HTABLE_CLEAR_STEP
+#define HTABLE_CLEAR_STEP 1024
+#endif
+#ifndef HTABLE_MIGRATE_STEP
+#define HTABLE_MIGRATE_STEP 64
+#endif
+
 #if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
 #define DEFAULT_FUNCS(T, name)                                                                                    \
     inline bool name##_compare(T a, T b) { return a == b; }                                                       \
@@ -77,6 +89,15 @@ DEFAULT_FUNCS(float, float)
         unsigned int seed;                                                                                        \
         float max_load_factor;                                                                                    \
         float min_load_factor;                                                                                    \
+                                                                                                                  \
+        /* incremental resize, see ht_set_incremental_resize. Both stay NULL otherwise. */                        \
+        bool incremental;                                                                                         \
+        htable_entry_##name *next_entries; /* being zeroed, entries is still the live table */                    \
+        size_t next_capacity;                                                                                     \
+        size_t clear_index;                                                                                       \
+        htable_entry_##name *old_entries; /* being moved into entries, lookups check both */                      \
+        size_t old_capacity;                                                                                      \
+        size_t migrate_index;                                                                                     \
     } htable_##name;                                                                                              \
                                                                                                                   \
     void ht_init_##name(htable_##name *ht, size_t initial_capacity, float min_load_factor, float max_load_factor, \
@@ -86,6 +107,7 @@ DEFAULT_FUNCS(float, float)
     bool ht_key_exists_##name(const htable_##name *ht, const tkey key);                                           \
     void ht_resize_##name(htable_##name *ht, size_t new_capacity);                                                \
     bool ht_remove_key_##name(htable_##name *ht, const tkey key_to_remove);                                       \
+    void ht_set_incremental_resize_##name(htable_##name *ht, bool enable);                                        \
     void ht_clear_##name(htable_##name *ht);                                                                      \
     void ht_delete_##name(htable_##name *ht)
 
@@ -95,6 +117,7 @@ DEFAULT_FUNCS(float, float)
 #define htkeyexists(name,pTable,k) ht_key_exists_##name(pTable,k)
 #define htresize(name,pTable,newCap) ht_resize_##name(pTable,newCap)
 #define htdel(name,pTable,k) ht_remove_key_##name(pTable,k)
+#define htincremental(name,pTable,enable) ht_set_incremental_resize_##name(pTable,enable)
 #define htclear(name,pTable) ht_clear_##name(pTable)
 #define htdestroy(name, pTable) ht_delete_##name(pTable)
 
@@ -135,102 +158,209 @@ HTABLE_API(uintptr_t, uintptr_t, ptr_ptr);
         memset(ht->entries, 0, sizeof(htable_entry_##name) * initial_capacity);                                   \
     }                                                                                                             \
                                                                                                                   \
-    static inline bool ht_find_entry_##name(const htable_##name *ht, const tkey key_to_find,                      \
-                                            size_t *out_entry_index)                                              \
+    static inline htable_entry_##name *ht_probe_##name(const htable_##name *ht, htable_entry_##name *entries,     \
+                                                       size_t capacity, const tkey key_to_find,                   \
+                                                       unsigned int hash)                                         \
     {                                                                                                             \
-        unsigned int hash = ht->funcs.key_hash_func(key_to_find, ht->seed);                                       \
-        unsigned int index = hash & (ht->capacity - 1);                                                           \
-        htable_entry_##name *curr = ht->entries + index;                                                          \
+        size_t index = hash & (capacity - 1);                                                                     \
+        htable_entry_##name *curr = entries + index;                                                              \
         htable_entry_##name *iter = curr;                                                                         \
-        bool found = false;                                                                                       \
-        if (iter->ht_key.key != (tkey)0)                                                                          \
+        do                                                                                                        \
+        {                                                                                                         \
+            tkey key = iter->ht_key.key;                                                                          \
+            if (key == (tkey)0)                                                                                   \
+                break;                                                                                            \
+            if (key != ht->tombstone && ht->funcs.key_comparator_func(key, key_to_find))                          \
+            {                                                                                                     \
+                return iter;                                                                                      \
+            }                                                                                                     \
+            index = (index + 1) & (capacity - 1);                                                                 \
+            iter = entries + index;                                                                               \
+        } while (iter != curr);                                                                                   \
+        return NULL;                                                                                              \
+    }                                                                                                             \
+                                                                                                                  \
+    /* NOTE: while an incremental resize moves entries over, every key is in exactly one of the two tables. */    \
+    static inline htable_entry_##name *ht_find_entry_hashed_##name(const htable_##name *ht,                       \
+                                                                   const tkey key_to_find, unsigned int hash)     \
+    {                                                                                                             \
+        htable_entry_##name *entry = ht_probe_##name(ht, ht->entries, ht->capacity, key_to_find, hash);           \
+        if (entry == NULL && ht->old_entries != NULL)                                                             \
+        {                                                                                                         \
+            entry = ht_probe_##name(ht, ht->old_entries, ht->old_capacity, key_to_find, hash);                    \
+        }                                                                                                         \
+        return entry;                                                                                             \
+    }                                                                                                             \
+                                                                                                                  \
+    static inline htable_entry_##name *ht_find_entry_##name(const htable_##name *ht, const tkey key_to_find)      \
+    {                                                                                                             \
+        return ht_find_entry_hashed_##name(ht, key_to_find, ht->funcs.key_hash_func(key_to_find, ht->seed));      \
+    }                                                                                                             \
+                                                                                                                  \
+    static inline float ht_load_factor_##name(const htable_##name *ht)                                            \
+    {                                                                                                             \
+        float lf = (float)ht->count / (float)ht->capacity;                                                        \
+        return lf;                                                                                                \
+    }                                                                                                             \
+                                                                                                                  \
+    /* One bounded slice of an incremental resize: HTABLE_CLEAR_STEP slots of the next table are zeroed or, */    \
+    /* once that table is live, HTABLE_MIGRATE_STEP slots of the old one are moved into it. */                    \
+    static inline void ht_resize_step_##name(htable_##name *ht)                                                   \
+    {                                                                                                             \
+        if (ht->next_entries != NULL)                                                                             \
         {                                                                                                         \
-            do                                                                                                    \
+            size_t n = ht->next_capacity - ht->clear_index;                                                       \
+            if (n > HTABLE_CLEAR_STEP)                                                                            \
+                n = HTABLE_CLEAR_STEP;                                                                            \
+            memset(ht->next_entries + ht->clear_index, 0, sizeof(htable_entry_##name) * n);                       \
+            ht->clear_index += n;                                                                                 \
+            if (ht->clear_index == ht->next_capacity)                                                             \
             {                                                                                                     \
-                tkey key = iter->ht_key.key;                                                                      \
-                if (key == (tkey)0)                                                                               \
-                    break;                                                                                        \
-                if (key != ht->tombstone && ht->funcs.key_comparator_func(key, key_to_find))    \
+                ht->old_entries = ht->entries;                                                                    \
+                ht->old_capacity = ht->capacity;                                                                  \
+                ht->migrate_index = 0;                                                                            \
+                ht->entries = ht->next_entries;                                                                   \
+                ht->capacity = ht->next_capacity;                                                                 \
+                ht->next_entries = NULL;                                                                          \
+                ht->next_capacity = 0;                                                                            \
+            }                                                                                                     \
+        }                                                                                                         \
+        else if (ht->old_entries != NULL)                                                                         \
+        {                                                                                                         \
+            size_t end = ht->migrate_index + HTABLE_MIGRATE_STEP;                                                 \
+            if (end > ht->old_capacity)                                                                           \
+                end = ht->old_capacity;                                                                           \
+            for (; ht->migrate_index < end; ++ht->migrate_index)                                                  \
+            {                                                                                                     \
+                htable_entry_##name *entry = ht->old_entries + ht->migrate_index;                                 \
+                tkey key = entry->ht_key.key;                                                                     \
+                if (key != (tkey)0 && key != ht->tombstone)                                                       \
                 {                                                                                                 \
-                    found = true;                                                                                 \
-                    if (out_entry_index != NULL)                                                                  \
+                    size_t index = entry->ht_key.hash & (ht->capacity - 1);                                       \
+                    tkey k = ht->entries[index].ht_key.key;                                                       \
+                    while (k != (tkey)0 && k != ht->tombstone)                                                    \
                     {                                                                                             \
-                        *out_entry_index = index;                                                                 \
+                        index = (index + 1) & (ht->capacity - 1);                                                 \
+                        k = ht->entries[index].ht_key.key;                                                        \
                     }                                                                                             \
-                    break;                                                                                        \
+                    ht->entries[index] = *entry;                                                                  \
+                    /* a tombstone, not empty: the keys further along this run have to stay reachable. */         \
+                    entry->ht_key.key = ht->tombstone;                                                            \
                 }                                                                                                 \
-                index = (index + 1) & (ht->capacity - 1);                                                         \
-                iter = ht->entries + index;                                                                       \
-            } while (iter != curr);                                                                               \
+            }                                                                                                     \
+            if (ht->migrate_index == ht->old_capacity)                                                            \
+            {                                                                                                     \
+                shfree(ht->api, ht->old_entries);                                                                 \
+                ht->old_entries = NULL;                                                                           \
+                ht->old_capacity = 0;                                                                             \
+            }                                                                                                     \
         }                                                                                                         \
-        return found;                                                                                             \
     }                                                                                                             \
                                                                                                                   \
-    static inline float ht_load_factor_##name(const htable_##name *ht)                                            \
+    static inline void ht_resize_finish_##name(htable_##name *ht)                                                 \
     {                                                                                                             \
-        float lf = (float)ht->count / (float)ht->capacity;                                                        \
-        return lf;                                                                                                \
+        while (ht->next_entries != NULL || ht->old_entries != NULL)                                               \
+        {                                                                                                         \
+            ht_resize_step_##name(ht);                                                                            \
+        }                                                                                                         \
     }                                                                                                             \
                                                                                                                   \
-    inline void ht_add_##name(htable_##name *ht, const tkey key, tval value)                                      \
+    static inline void ht_resize_begin_##name(htable_##name *ht, size_t new_capacity)                             \
     {                                                                                                             \
-        if (HTABLE_LOAD_FACTOR_CHECK(ht) > ht->max_load_factor)                                                   \
+        if (!ht->incremental)                                                                                     \
+        {                                                                                                         \
+            ht_resize_##name(ht, new_capacity);                                                                   \
+            return;                                                                                               \
+        }                                                                                                         \
+        ht_resize_finish_##name(ht);                                                                              \
+        /* NOTE: not zeroed here, on a big table that memset alone is a latency spike. */                         \
+        ht->next_entries = shalloc_arr(ht->api, htable_entry_##name, new_capacity);                               \
+        ht->next_capacity = new_capacity;                                                                         \
+        ht->clear_index = 0;                                                                                      \
+    }                                                                                                             \
+                                                                                                                  \
+    /* NOTE: the *_hashed variants take the hash of key from the caller, concurrent_htable.h hashes once for */   \
+    /* both the shard and the slot. */                                                                            \
+    static inline void ht_add_hashed_##name(htable_##name *ht, const tkey key, tval value, unsigned int hash)     \
+    {                                                                                                             \
+        ht_resize_step_##name(ht);                                                                                \
+        if (ht->next_entries == NULL && HTABLE_LOAD_FACTOR_CHECK(ht) > ht->max_load_factor)                       \
         {                                                                                                         \
             if (ht->capacity == 0)                                                                                \
             {                                                                                                     \
-                ht_resize_##name(ht, 2);                                                                          \
+                ht_resize_begin_##name(ht, 2);                                                                    \
             }                                                                                                     \
             else                                                                                                  \
             {                                                                                                     \
-                ht_resize_##name(ht, ht->capacity * 2);                                                           \
+                ht_resize_begin_##name(ht, ht->capacity * 2);                                                     \
             }                                                                                                     \
         }                                                                                                         \
-        unsigned int hash = ht->funcs.key_hash_func(key, ht->seed);                                               \
+        if (ht->next_entries != NULL && ht->count + 1 >= ht->capacity)                                            \
+        {                                                                                                         \
+            /* the live table keeps taking inserts while the next one is zeroed, it must never fill up. */        \
+            ht_resize_finish_##name(ht);                                                                          \
+        }                                                                                                         \
         unsigned int index = hash & (ht->capacity - 1);                                                           \
         htable_entry_##name *entry = ht->entries + index;                                                         \
         htable_entry_##name *start_entry = entry;                                                                 \
-        tkey k = entry->ht_key.key;                                                                               \
-        bool found = false;                                                                                       \
+        htable_entry_##name *free_entry = NULL;                                                                   \
+        htable_entry_##name *found = NULL;                                                                        \
+        /* NOTE: a tombstone does not end the search, the key can still be further along. */                      \
+        /* The first tombstone is where a new key goes. */                                                        \
         do                                                                                                        \
         {                                                                                                         \
-            if (k == (tkey)0 || k == ht->tombstone)                                                               \
+            tkey k = entry->ht_key.key;                                                                           \
+            if (k == (tkey)0)                                                                                     \
             {                                                                                                     \
+                if (free_entry == NULL)                                                                           \
+                    free_entry = entry;                                                                           \
                 break;                                                                                            \
             }                                                                                                     \
-            if (ht->funcs.key_comparator_func(k, key))                                                            \
+            if (k == ht->tombstone)                                                                               \
+            {                                                                                                     \
+                if (free_entry == NULL)                                                                           \
+                    free_entry = entry;                                                                           \
+            }                                                                                                     \
+            else if (ht->funcs.key_comparator_func(k, key))                                                       \
             {                                                                                                     \
-                found = true;                                                                                     \
+                found = entry;                                                                                    \
                 break;                                                                                            \
             }                                                                                                     \
             index = (index + 1) & (ht->capacity - 1);                                                             \
             entry = ht->entries + index;                                                                          \
-            k = entry->ht_key.key;                                                                                \
         } while (entry != start_entry);                                                                           \
-        if (!found)                                                                                               \
+        if (found == NULL && ht->old_entries != NULL)                                                             \
+        {                                                                                                         \
+            found = ht_probe_##name(ht, ht->old_entries, ht->old_capacity, key, hash);                            \
+        }                                                                                                         \
+        if (found == NULL)                                                                                        \
         {                                                                                                         \
-            htable_key_##name *hkey = &entry->ht_key;                                                             \
-            hkey->key = ht->funcs.key_copy_func(key, ht->api);                                                    \
-            hkey->hash = hash;                                                                                    \
-            entry->ht_key = *hkey;                                                                                \
+            assert(free_entry != NULL);                                                                           \
+            free_entry->ht_key.key = ht->funcs.key_copy_func(key, ht->api);                                       \
+            free_entry->ht_key.hash = hash;                                                                       \
             ++ht->count;                                                                                          \
+            found = free_entry;                                                                                   \
         }                                                                                                         \
         else                                                                                                      \
         {                                                                                                         \
-            ht->funcs.value_free_func(entry->value, ht->api);                                                     \
+            ht->funcs.value_free_func(found->value, ht->api);                                                     \
         }                                                                                                         \
-        entry->value = ht->funcs.value_copy_func(value, ht->api);                                                 \
+        found->value = ht->funcs.value_copy_func(value, ht->api);                                                 \
+    }                                                                                                             \
+                                                                                                                  \
+    inline void ht_add_##name(htable_##name *ht, const tkey key, tval value)                                      \
+    {                                                                                                             \
+        ht_add_hashed_##name(ht, key, value, ht->funcs.key_hash_func(key, ht->seed));                             \
     }                                                                                                             \
                                                                                                                   \
     inline bool ht_get_##name(const htable_##name *ht, const tkey key_to_search, tval *out_value_ptr)             \
     {                                                                                                             \
-        size_t index = 0;                                                                                         \
-        bool found = ht_find_entry_##name(ht, key_to_search, &index);                                             \
-        htable_entry_##name *entry = ht->entries + index;                                                         \
-        if (found && out_value_ptr != NULL)                                                                       \
+        htable_entry_##name *entry = ht_find_entry_##name(ht, key_to_search);                                     \
+        if (entry != NULL && out_value_ptr != NULL)                                                               \
         {                                                                                                         \
             *out_value_ptr = entry->value;                                                                        \
         }                                                                                                         \
-        return found;                                                                                             \
+        return entry != NULL;                                                                                     \
     }                                                                                                             \
                                                                                                                   \
     inline bool ht_key_exists_##name(const htable_##name *ht, const tkey key)                                     \
@@ -258,6 +388,7 @@ HTABLE_API(uintptr_t, uintptr_t, ptr_ptr);
                                                                                                                   \
     inline void ht_resize_##name(htable_##name *ht, size_t new_capacity)                                          \
     {                                                                                                             \
+        ht_resize_finish_##name(ht);                                                                              \
         htable_entry_##name *old_entries = ht->entries;                                                           \
         size_t old_count = ht->count;                                                                             \
         size_t old_cap = ht->capacity;                                                                            \
@@ -281,37 +412,59 @@ HTABLE_API(uintptr_t, uintptr_t, ptr_ptr);
         }                                                                                                         \
     }                                                                                                             \
                                                                                                                   \
-    inline bool ht_remove_key_##name(htable_##name *ht, const tkey key_to_remove)                                 \
+    static inline bool ht_remove_hashed_##name(htable_##name *ht, const tkey key_to_remove, unsigned int hash)    \
     {                                                                                                             \
-        size_t index = 0xffffffffffffffffULL;                                                                     \
-        bool found = ht_find_entry_##name(ht, key_to_remove, &index);                                             \
-        if (!found)                                                                                               \
+        ht_resize_step_##name(ht);                                                                                \
+        htable_entry_##name *entry = ht_find_entry_hashed_##name(ht, key_to_remove, hash);                        \
+        if (entry == NULL)                                                                                        \
         {                                                                                                         \
-            char buffer[128];                                                                                     \
-            ht->funcs.key_display_func(key_to_remove, buffer, sizeof(buffer));                                    \
-            printf("The key '%s' is not present in the hashtable.\n", buffer);                                    \
             return false;                                                                                         \
         }                                                                                                         \
-        assert(index != 0xffffffffffffffffULL);                                                                   \
-        htable_entry_##name *entry = ht->entries + index;                                                         \
         ht->funcs.key_free_func(entry->ht_key.key, ht->api);                                                      \
         ht->funcs.value_free_func(entry->value, ht->api);                                                         \
         entry->ht_key.key = ht->tombstone;                                                                        \
         entry->value = 0;                                                                                         \
         ht->count--;                                                                                              \
-        if (ht_load_factor_##name(ht) <= ht->min_load_factor)                                                     \
+        bool resizing = ht->next_entries != NULL || ht->old_entries != NULL;                                      \
+        if (!resizing && ht_load_factor_##name(ht) <= ht->min_load_factor)                                        \
+        {                                                                                                         \
+            ht_resize_begin_##name(ht, ht->capacity / 2);                                                         \
+        }                                                                                                         \
+        return true;                                                                                              \
+    }                                                                                                             \
+                                                                                                                  \
+    inline bool ht_remove_key_##name(htable_##name *ht, const tkey key_to_remove)                                 \
+    {                                                                                                             \
+        if (!ht_remove_hashed_##name(ht, key_to_remove, ht->funcs.key_hash_func(key_to_remove, ht->seed)))        \
+        {                                                                                                         \
+            char buffer[128];                                                                                     \
+            ht->funcs.key_display_func(key_to_remove, buffer, sizeof(buffer));                                    \
+            printf("The key '%s' is not present in the hashtable.\n", buffer);                                    \
+            return false;                                                                                         \
+        }                                                                                                         \
+        return true;                                                                                              \
+    }                                                                                                             \
+                                                                                                                  \
+    /* With incremental resize on, growing or shrinking no longer rehashes the whole table inside one ht_add */   \
+    /* or ht_remove_key: the next table is zeroed and then filled a bounded number of slots per add and */        \
+    /* remove, and lookups check both tables until the old one is empty. Turning it off finishes a resize in */   \
+    /* flight. */                                                                                                 \
+    inline void ht_set_incremental_resize_##name(htable_##name *ht, bool enable)                                  \
+    {                                                                                                             \
+        if (!enable)                                                                                              \
         {                                                                                                         \
-            ht_resize_##name(ht, ht->capacity / 2);                                                               \
+            ht_resize_finish_##name(ht);                                                                          \
         }                                                                                                         \
-        return found;                                                                                             \
+        ht->incremental = enable;                                                                                 \
     }                                                                                                             \
                                                                                                                   \
     inline void ht_display_##name(const htable_##name *ht)                                                        \
     {                                                                                                             \
         printf("Hash Table:\n");                                                                                  \
-        for (size_t i = 0; i < ht->capacity; ++i)                                                                 \
+        for (size_t i = 0; i < ht->capacity + ht->old_capacity; ++i)                                              \
         {                                                                                                         \
-            htable_entry_##name *entry = ht->entries + i;                                                         \
+            htable_entry_##name *entry =                                                                          \
+                i < ht->capacity ? ht->entries + i : ht->old_entries + (i - ht->capacity);                        \
             tkey key = entry->ht_key.key;                                                                         \
             if (key != (tkey)0 && key != ht->tombstone)                                                           \
             {                                                                                                     \
@@ -327,6 +480,7 @@ HTABLE_API(uintptr_t, uintptr_t, ptr_ptr);
                                                                                                                   \
     inline void ht_clear_##name(htable_##name *ht)                                                                \
     {                                                                                                             \
+        ht_resize_finish_##name(ht);                                                                              \
         for (size_t i = 0; i < ht->capacity; ++i)                                                                 \
         {                                                                                                         \
             tkey key = ht->entries[i].ht_key.key;                                                                 \
@@ -353,9 +507,7 @@ HTABLE_API(uintptr_t, uintptr_t, ptr_ptr);
 inline unsigned int
 uintptr_hash(const uintptr_t n, unsigned int seed)
 {
-    unsigned int result = seed;
-    result ^= n;
-    result *= 16777619;
+    unsigned int result = (unsigned int)hash_u64(n, seed);
     return result;
 }
 
@@ -947,6 +1099,111 @@ test_hashtable_stress_test(const alloc_api *api)
     free(keys);
 }
 
+static void
+test_hashtable_incremental_resize(const alloc_api *api)
+{
+    printf("Running Hash Table Incremental Resize Test...\n");
+
+    // pointer keys, checked against a plain array after every operation that can move entries around.
+    const uintptr_t KEY_COUNT = 20000;
+    uintptr_t *expected = (uintptr_t *)calloc(KEY_COUNT, sizeof(uintptr_t));
+    htable_ptr_ptr table;
+    ht_init_ptr_ptr(&table, 4, 0.2f, 0.7f, 31, api);
+    ht_set_incremental_resize_ptr_ptr(&table, true);
+
+    bool saw_clear = false, saw_migrate = false;
+    for (uintptr_t i = 0; i < KEY_COUNT; i++)
+    {
+        ht_add_ptr_ptr(&table, (i + 1) * 16, i);
+        expected[i] = i;
+        saw_clear |= table.next_entries != NULL;
+        saw_migrate |= table.old_entries != NULL;
+        if (table.old_entries != NULL && (i % 7) == 0)
+        {
+            // while keys are split between both tables: overwrite and remove keys that may sit in either.
+            uintptr_t k = i / 2;
+            ht_add_ptr_ptr(&table, (k + 1) * 16, k + 1000000);
+            expected[k] = k + 1000000;
+            k = i / 3;
+            if (expected[k] != (uintptr_t)-1)
+            {
+                TEST_ASSERT(ht_remove_key_ptr_ptr(&table, (k + 1) * 16), "Remove while migrating");
+                expected[k] = (uintptr_t)-1;
+            }
+        }
+        if ((i & (i - 1)) == 0 || i == KEY_COUNT - 1)
+        {
+            size_t live = 0;
+            for (uintptr_t j = 0; j <= i; j++)
+            {
+                uintptr_t value = 0;
+                bool found = ht_get_ptr_ptr(&table, (j + 1) * 16, &value);
+                TEST_ASSERT(found == (expected[j] != (uintptr_t)-1), "Key presence during incremental resize");
+                TEST_ASSERT(!found || value == expected[j], "Value during incremental resize");
+                live += found;
+            }
+            TEST_ASSERT(live == table.count, "Count during incremental resize");
+        }
+    }
+    TEST_ASSERT(saw_clear && saw_migrate, "Resizes went through both incremental phases");
+
+    // removed keys come back exactly once, never as a duplicate of a copy in the other table.
+    for (uintptr_t i = 0; i < KEY_COUNT; i++)
+    {
+        ht_add_ptr_ptr(&table, (i + 1) * 16, i);
+    }
+    TEST_ASSERT(table.count == KEY_COUNT, "Re-adding removed keys");
+
+    // shrinking is incremental too, and turning the mode off finishes whatever is in flight.
+    size_t peak_capacity = table.capacity;
+    for (uintptr_t i = 0; i < KEY_COUNT - 10; i++)
+    {
+        TEST_ASSERT(ht_remove_key_ptr_ptr(&table, (i + 1) * 16), "Remove while shrinking");
+    }
+    ht_set_incremental_resize_ptr_ptr(&table, false);
+    TEST_ASSERT(table.next_entries == NULL && table.old_entries == NULL, "Disabling finishes the resize");
+    TEST_ASSERT(table.count == 10 && table.capacity < peak_capacity, "Shrunk");
+    for (uintptr_t i = KEY_COUNT - 10; i < KEY_COUNT; i++)
+    {
+        uintptr_t value = 0;
+        TEST_ASSERT(ht_get_ptr_ptr(&table, (i + 1) * 16, &value) && value == i, "Survivors after shrinking");
+    }
+    ht_delete_ptr_ptr(&table);
+    free(expected);
+
+    // owned string keys: deleting in the middle of a resize frees the copies in both tables.
+    string32 keys[300];
+    htable_str_float strings;
+    ht_init_str_float(&strings, 4, 0.0f, 0.7f, 31, api);
+    ht_set_incremental_resize_str_float(&strings, true);
+    bool deleted_mid_resize = false;
+    for (int i = 0; i < 300; i++)
+    {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "IncrementalKey_%d_LongEnoughForTheHeap", i);
+        keys[i] = string32_create(buffer, api);
+        ht_add_str_float(&strings, &keys[i], (float)i);
+        if (i > 100 && strings.old_entries != NULL && !deleted_mid_resize)
+        {
+            for (int j = 0; j <= i; j++)
+            {
+                float value = 0.0f;
+                TEST_ASSERT(ht_get_str_float(&strings, &keys[j], &value) && value == (float)j, "String keys");
+            }
+            ht_delete_str_float(&strings);
+            ht_init_str_float(&strings, 4, 0.0f, 0.7f, 31, api);
+            ht_set_incremental_resize_str_float(&strings, true);
+            deleted_mid_resize = true;
+        }
+    }
+    TEST_ASSERT(deleted_mid_resize, "String table was deleted mid resize");
+    ht_delete_str_float(&strings);
+    for (int i = 0; i < 300; i++)
+    {
+        string32_cstr_free(&keys[i], api);
+    }
+}
+
 #ifndef FREELIST_ALLOCATOR_IMPLEMENTATION
 #define FREELIST_ALLOCATOR_IMPLEMENTATION
 #endif
@@ -974,6 +1231,8 @@ void htable_unit_tests()
     assert(fl.used == 0);
     test_hashtable_stress_test(api);
     assert(fl.used == 0);
+    test_hashtable_incremental_resize(api);
+    assert(fl.used == 0);
 
     printf("ALL HASH TABLE TESTS PASSED SUCCESSFULLY!\n");
 
@@ -0,0 +1,477 @@
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <common.h>
+#include <hash.h>
+#include <memory/memory.h>
+#ifndef STRING32_IMPLEMENTATION
+#define STRING32_IMPLEMENTATION
+#endif
+#include <containers/string_utils.h>
+
+/*
+    C++ front end for the HTABLE_API hash table.
+
+    The macro version keeps eight function pointers per table (htable_functions_##name) and calls key_hash_func and
+    key_comparator_func through them on every probe, so neither can be inlined. Here hash and compare are template
+    parameters and resolve at compile time; the table itself is the same: open addressing, linear probing,
+    power-of-two capacity, (K)0 marks an empty slot and (K)2 a removed one, the hash is stored next to the key so a
+    resize never rehashes.
+
+        Hash    unsigned int operator()(const K &key, unsigned int seed) const      (same contract as key_hash_func)
+        Eq      bool operator()(const K &a, const K &b) const                       (same as key_comparator_func)
+        Alloc   where the entry array lives: void *allocate(size_t), void deallocate(void *), and get_api(), the
+                alloc_api key and value copies are made with. Htable_Api_Alloc wraps any alloc_api, NULL is malloc.
+
+    Key and value ownership is what the tkey_name##_dup / tkey_name##_free pairs do in the macro version: specialize
+    Htable_Traits<T>. The default copies by value and frees nothing, string32 * keys are duplicated on insert and
+    freed on removal, exactly like the str_* instantiations.
+*/
+
+template <typename T>
+struct Htable_Traits
+{
+    static T copy(const T &value, const alloc_api *api) { (void)api; return value; }
+    static void release(T &value, const alloc_api *api) { (void)value; (void)api; }
+};
+
+template <>
+struct Htable_Traits<string32 *>
+{
+    static string32 *copy(string32 *const &value, const alloc_api *api) { return string32_dup(value, api); }
+    static void release(string32 *&value, const alloc_api *api) { string32_free(value, api); }
+};
+
+/// @brief uintptr_hash for anything that converts to uintptr_t (integers, pointers, enums).
+template <typename K>
+struct Htable_Hash
+{
+    unsigned int operator()(const K &key, unsigned int seed) const
+    {
+        return (unsigned int)hash_u64((uint64_t)(uintptr_t)key, seed);
+    }
+};
+
+template <>
+struct Htable_Hash<string32 *>
+{
+    unsigned int operator()(const string32 *key, unsigned int seed) const { return string32_hash(key, seed); }
+};
+
+template <typename K>
+struct Htable_Eq
+{
+    bool operator()(const K &a, const K &b) const { return a == b; }
+};
+
+template <>
+struct Htable_Eq<string32 *>
+{
+    bool operator()(const string32 *a, const string32 *b) const { return string32_compare(a, b); }
+};
+
+struct Htable_Api_Alloc
+{
+    const alloc_api *api = nullptr;
+
+    void *allocate(size_t size) { return shalloc(api, size); }
+    void deallocate(void *ptr) { shfree(api, ptr); }
+    const alloc_api *get_api() const { return api; }
+};
+
+template <typename K, typename V, typename Hash = Htable_Hash<K>, typename Eq = Htable_Eq<K>,
+          typename Alloc = Htable_Api_Alloc>
+class HashTable {
+  public:
+    struct Entry {
+        K key;
+        unsigned int hash;
+        V value;
+    };
+
+    HashTable(size_t initialCapacity, float minLoadFactor, float maxLoadFactor, unsigned int seed,
+              Alloc alloc = Alloc(), Hash hash = Hash(), Eq eq = Eq())
+        : alloc_(alloc), hash_(hash), eq_(eq), seed_(seed), minLoadFactor_(minLoadFactor),
+          maxLoadFactor_(maxLoadFactor)
+    {
+        // NOTE: the probes in add and find end at an empty slot. A table allowed to fill up has none and never stops,
+        // one with a max load factor of 0 doubles on every add. Release builds get the nearest usable value.
+        assert(maxLoadFactor > 0.0f && maxLoadFactor < 1.0f && "maxLoadFactor has to be in (0, 1)");
+        if (!(maxLoadFactor_ < 0.99f)) {
+            maxLoadFactor_ = 0.99f;
+        } else if (!(maxLoadFactor_ > 0.01f)) {
+            maxLoadFactor_ = 0.01f;
+        }
+        size_t capacity = 2;
+        while (capacity < initialCapacity) {
+            capacity *= 2;
+        }
+        entries_ = allocate_entries(capacity);
+        capacity_ = capacity;
+    }
+
+    /// @brief same as ht_init with an alloc_api, for the default allocator.
+    HashTable(size_t initialCapacity, float minLoadFactor, float maxLoadFactor, unsigned int seed,
+              const alloc_api *api)
+        : HashTable(initialCapacity, minLoadFactor, maxLoadFactor, seed, Alloc{api})
+    {
+    }
+
+    HashTable(const HashTable &other) = delete;
+    HashTable(HashTable &&other) = delete;
+    HashTable &operator=(const HashTable &other) = delete;
+    HashTable &operator=(HashTable &&other) = delete;
+
+    ~HashTable()
+    {
+        if (entries_) {
+            clear();
+            alloc_.deallocate(entries_);
+        }
+    }
+
+    /// @brief inserts a copy of key and value, or replaces the value when the key is already there.
+    void add(const K &key, const V &value)
+    {
+        if ((float)(count_ + deleted_ + 1) / (float)capacity_ > maxLoadFactor_) {
+            // NOTE: a table that is mostly tombstones is rebuilt at the same size instead of doubling.
+            resize((float)(count_ + 1) / (float)capacity_ > maxLoadFactor_ / 2 ? capacity_ * 2 : capacity_);
+        }
+        unsigned int hash = hash_(key, seed_);
+        size_t mask = capacity_ - 1;
+        size_t index = hash & mask;
+        Entry *tombstone = nullptr;
+        // NOTE: tombstones do not end the probe, the key may still sit further along. The first one is reused.
+        for (;;) {
+            Entry *entry = entries_ + index;
+            if (entry->key == empty_key()) {
+                if (tombstone != nullptr) {
+                    entry = tombstone;
+                    --deleted_;
+                }
+                entry->key = Htable_Traits<K>::copy(key, alloc_.get_api());
+                entry->hash = hash;
+                entry->value = Htable_Traits<V>::copy(value, alloc_.get_api());
+                ++count_;
+                return;
+            }
+            if (entry->key == tombstone_key()) {
+                if (tombstone == nullptr) {
+                    tombstone = entry;
+                }
+            } else if (entry->hash == hash && eq_(entry->key, key)) {
+                Htable_Traits<V>::release(entry->value, alloc_.get_api());
+                entry->value = Htable_Traits<V>::copy(value, alloc_.get_api());
+                return;
+            }
+            index = (index + 1) & mask;
+        }
+    }
+
+    bool get(const K &key, V *outValue) const
+    {
+        const Entry *entry = find(key);
+        if (entry != nullptr && outValue != nullptr) {
+            *outValue = entry->value;
+        }
+        return entry != nullptr;
+    }
+
+    /// @brief pointer to the stored value, nullptr when the key is not there. Valid until the next add or remove.
+    V *find_value(const K &key)
+    {
+        Entry *entry = const_cast<Entry *>(find(key));
+        return entry != nullptr ? &entry->value : nullptr;
+    }
+
+    [[nodiscard]]
+    bool key_exists(const K &key) const { return find(key) != nullptr; }
+
+    bool remove_key(const K &key)
+    {
+        Entry *entry = const_cast<Entry *>(find(key));
+        if (entry == nullptr) {
+            return false;
+        }
+        Htable_Traits<K>::release(entry->key, alloc_.get_api());
+        Htable_Traits<V>::release(entry->value, alloc_.get_api());
+        entry->key = tombstone_key();
+        entry->value = V{};
+        --count_;
+        ++deleted_;
+        if (capacity_ > 2 && (float)count_ / (float)capacity_ <= minLoadFactor_) {
+            resize(capacity_ / 2);
+        }
+        return true;
+    }
+
+    /// @brief rebuilds the table with newCapacity slots (rounded up to a power of two), dropping every tombstone.
+    void resize(size_t newCapacity)
+    {
+        size_t capacity = 2;
+        while (capacity < newCapacity || capacity < count_ + 1) {
+            capacity *= 2;
+        }
+        Entry *oldEntries = entries_;
+        size_t oldCapacity = capacity_;
+        entries_ = allocate_entries(capacity);
+        capacity_ = capacity;
+        deleted_ = 0;
+        size_t mask = capacity - 1;
+        for (size_t i = 0; i < oldCapacity; ++i) {
+            Entry *entry = oldEntries + i;
+            if (entry->key != empty_key() && entry->key != tombstone_key()) {
+                size_t index = entry->hash & mask;
+                while (entries_[index].key != empty_key()) {
+                    index = (index + 1) & mask;
+                }
+                entries_[index] = *entry;
+            }
+        }
+        alloc_.deallocate(oldEntries);
+    }
+
+    void clear()
+    {
+        for (size_t i = 0; i < capacity_; ++i) {
+            Entry *entry = entries_ + i;
+            if (entry->key != empty_key() && entry->key != tombstone_key()) {
+                Htable_Traits<K>::release(entry->key, alloc_.get_api());
+                Htable_Traits<V>::release(entry->value, alloc_.get_api());
+            }
+        }
+        memset((void *)entries_, 0, sizeof(Entry) * capacity_);
+        count_ = 0;
+        deleted_ = 0;
+    }
+
+    /// @brief calls fn(key, value) for every entry, in slot order.
+    template <typename Fn>
+    void for_each(Fn &&fn) const
+    {
+        for (size_t i = 0; i < capacity_; ++i) {
+            const Entry *entry = entries_ + i;
+            if (entry->key != empty_key() && entry->key != tombstone_key()) {
+                fn(entry->key, entry->value);
+            }
+        }
+    }
+
+    [[nodiscard]]
+    inline size_t count() const noexcept { return count_; }
+    [[nodiscard]]
+    inline size_t capacity() const noexcept { return capacity_; }
+    [[nodiscard]]
+    inline bool empty() const noexcept { return count_ == 0; }
+
+  private:
+    Entry *entries_ = nullptr;
+    size_t capacity_ = 0;
+    size_t count_ = 0;
+    size_t deleted_ = 0;
+
+    [[no_unique_address]] Alloc alloc_;
+    [[no_unique_address]] Hash hash_;
+    [[no_unique_address]] Eq eq_;
+
+    unsigned int seed_;
+    float minLoadFactor_;
+    float maxLoadFactor_;
+
+    static inline K empty_key() { return (K)0; }
+    static inline K tombstone_key() { return (K)2; }
+
+    Entry *allocate_entries(size_t capacity)
+    {
+        Entry *entries = static_cast<Entry *>(alloc_.allocate(capacity * sizeof(Entry)));
+        assert(entries && "entry allocation failed");
+        memset((void *)entries, 0, capacity * sizeof(Entry));
+        return entries;
+    }
+
+    const Entry *find(const K &key) const
+    {
+        unsigned int hash = hash_(key, seed_);
+        size_t mask = capacity_ - 1;
+        size_t index = hash & mask;
+        // NOTE: the load factor is < 1, so there is always an empty slot to stop at.
+        for (;;) {
+            const Entry *entry = entries_ + index;
+            if (entry->key == empty_key()) {
+                return nullptr;
+            }
+            if (entry->hash == hash && entry->key != tombstone_key() && eq_(entry->key, key)) {
+                return entry;
+            }
+            index = (index + 1) & mask;
+        }
+    }
+};
+
+#ifdef HASHTABLE_TEMPLATE_UNIT_TESTS
+#ifndef FREELIST_ALLOCATOR_IMPLEMENTATION
+#define FREELIST_ALLOCATOR_IMPLEMENTATION
+#endif
+#include <memory/freelist_alloc.h>
+
+static void
+test_hashtable_template_integers()
+{
+    const uintptr_t KEY_COUNT = 20000;
+    HashTable<uintptr_t, uintptr_t> table(16, 0.1f, 0.7f, 31, (const alloc_api *)NULL);
+
+    // pointer-like keys, never 0 or 2.
+    for (uintptr_t i = 1; i <= KEY_COUNT; ++i) {
+        table.add(i * 16, i);
+    }
+    assert(table.count() == KEY_COUNT);
+    for (uintptr_t i = 1; i <= KEY_COUNT; ++i) {
+        uintptr_t value = 0;
+        bool found = table.get(i * 16, &value);
+        assert(found && value == i);
+        assert(!table.key_exists(i * 16 + 1));
+    }
+
+    // replacing keeps the count.
+    table.add(16, 100);
+    uintptr_t value = 0;
+    table.get(16, &value);
+    assert(value == 100 && table.count() == KEY_COUNT);
+
+    // remove every other key, then re-add them: the tombstones are reused and no key ends up in the table twice.
+    for (uintptr_t i = 1; i <= KEY_COUNT; i += 2) {
+        bool removed = table.remove_key(i * 16);
+        assert(removed);
+    }
+    assert(!table.remove_key(16));
+    assert(table.count() == KEY_COUNT / 2);
+    for (uintptr_t i = 1; i <= KEY_COUNT; ++i) {
+        table.add(i * 16, i + 1);
+    }
+    assert(table.count() == KEY_COUNT);
+    size_t seen = 0;
+    table.for_each([&](uintptr_t k, uintptr_t v) {
+        assert(v == k / 16 + 1);
+        ++seen;
+    });
+    assert(seen == KEY_COUNT);
+
+    // shrinking on removal.
+    for (uintptr_t i = 1; i <= KEY_COUNT; ++i) {
+        table.remove_key(i * 16);
+    }
+    assert(table.empty() && table.capacity() < 64);
+}
+
+struct Colliding_Hash
+{
+    unsigned int operator()(const uintptr_t &key, unsigned int seed) const
+    {
+        (void)seed;
+        return (unsigned int)(key & 3);
+    }
+};
+
+static void
+test_hashtable_template_collisions()
+{
+    // every key lands in one of four buckets, so every lookup walks a long run with tombstones in it.
+    HashTable<uintptr_t, uintptr_t, Colliding_Hash> table(8, 0.0f, 0.75f, 0, (const alloc_api *)NULL);
+    for (uintptr_t i = 4; i < 1004; ++i) {
+        table.add(i, i * 3);
+    }
+    for (int round = 0; round < 8; ++round) {
+        for (uintptr_t i = 4 + round; i < 1004; i += 8) {
+            table.remove_key(i);
+        }
+        for (uintptr_t i = 4 + round; i < 1004; i += 8) {
+            table.add(i, i * 3);
+        }
+        assert(table.count() == 1000);
+    }
+    for (uintptr_t i = 4; i < 1004; ++i) {
+        uintptr_t value = 0;
+        assert(table.get(i, &value) && value == i * 3);
+    }
+}
+
+static void
+test_hashtable_template_full()
+{
+    // the highest load factor the table accepts still leaves an empty slot for a lookup that misses to stop at.
+    HashTable<uintptr_t, uintptr_t, Colliding_Hash> table(2, 0.0f, 0.99f, 0, (const alloc_api *)NULL);
+    for (uintptr_t i = 4; i < 132; ++i) {
+        table.add(i, i);
+        assert(!table.key_exists(i + 1000));
+    }
+    for (uintptr_t i = 4; i < 132; i += 2) {
+        assert(table.remove_key(i));
+        assert(!table.key_exists(i));
+    }
+    assert(table.count() == 64);
+}
+
+static void
+test_hashtable_template_strings(Freelist *fl)
+{
+    const alloc_api *api = &fl->api;
+    const char *words[] = {"Hello", "There", "Universe", "PI", "a much longer key than the sso buffer",
+                           "another one that goes to the heap", "x", ""};
+    const size_t WORD_COUNT = sizeof(words) / sizeof(words[0]);
+
+    string32 keys[WORD_COUNT];
+    for (size_t i = 0; i < WORD_COUNT; ++i) {
+        keys[i] = string32_create(words[i], api);
+    }
+    size_t usedBefore = fl->used;
+    {
+        HashTable<string32 *, float> table(4, 0.0f, 0.7f, 31, api);
+        for (size_t i = 0; i < WORD_COUNT; ++i) {
+            table.add(&keys[i], (float)i);
+        }
+        assert(table.count() == WORD_COUNT);
+
+        // the table owns copies: a different string32 with the same text finds the entry.
+        string32 probe = string32_create("a much longer key than the sso buffer", api);
+        float value = 0.0f;
+        assert(table.get(&probe, &value) && value == 4.0f);
+        table.add(&probe, 40.0f);
+        assert(table.count() == WORD_COUNT);
+        assert(table.get(&keys[4], &value) && value == 40.0f);
+        assert(table.remove_key(&probe));
+        assert(!table.key_exists(&keys[4]));
+        string32_cstr_free(&probe, api);
+
+        table.clear();
+        assert(table.empty());
+        for (size_t i = 0; i < WORD_COUNT; ++i) {
+            table.add(&keys[i], (float)i);
+        }
+    }
+    // the destructor gave back every key copy and the entry array.
+    assert(fl->used == usedBefore);
+
+    for (size_t i = 0; i < WORD_COUNT; ++i) {
+        string32_cstr_free(&keys[i], api);
+    }
+}
+
+void
+hashtable_template_unit_tests()
+{
+    test_hashtable_template_integers();
+    test_hashtable_template_collisions();
+    test_hashtable_template_full();
+
+    size_t size = 1024 * 1024;
+    void *mem = malloc(size);
+    Freelist fl;
+    freelist_init(&fl, mem, size, DEFAULT_ALIGNMENT);
+    test_hashtable_template_strings(&fl);
+    free(mem);
+}
+#endif
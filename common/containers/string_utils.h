@@ -2,6 +2,7 @@
 #define STRING_UTILS_H
 
 #include "common.h"
+#include <hash.h>
 #include <memory/memory.h>
 #include <stdio.h>
 
@@ -204,15 +205,7 @@ string32_dup(const string32 *string_to_copy, const alloc_api *api)
 inline unsigned int
 string32_hash(const string32 *str, unsigned int seed)
 {
-    unsigned int result = seed;
-    const char *s = string32_cstr(str);
-
-    for (size_t i = 0; i < str->length; ++i) {
-        char c = s[i];
-        result ^= c;
-        result *= 16777619;
-    }
-
+    unsigned int result = (unsigned int)hash_bytes(string32_cstr(str), str->length, seed);
     return result;
 }
 
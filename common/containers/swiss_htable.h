@@ -0,0 +1,612 @@
+#ifndef SWISS_HTABLE_H
+#define SWISS_HTABLE_H
+
+#include <common.h>
+#include <memory/memory.h>
+#include <containers/htable.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef HAS_AVX2
+#include <immintrin.h>
+#elif defined(HAS_SSE2)
+#include <emmintrin.h>
+#endif
+
+/*
+    Open addressing hash table in the layout of Abseil's Swiss tables: next to the entries there is an array of
+    1-byte control tags, one per slot. A full slot's tag is the low 7 bits of the key's hash (H2), the other values
+    mark an empty or a deleted slot. A lookup starts at H1 (the rest of the hash) and compares the tags of a whole
+    group of slots against H2 at once, 32 with AVX2, 16 with SSE2 and 8 in a 64-bit word otherwise. Keys are only
+    compared for the slots whose tag matches, which for a missing key is almost never, and the probe stops at the
+    first group that has an empty slot.
+
+    Same interface and the same per type functions (name##_compare, name##_hash, ...) as HTABLE_API, with sht_
+    in place of ht_. Unlike htable, keys need no reserved values, 0 is a key like any other.
+*/
+
+#define SWISS_HTABLE_EMPTY ((uint8_t)0x80)
+#define SWISS_HTABLE_DELETED ((uint8_t)0xfe)
+#define SWISS_HTABLE_IS_FULL(tag) (((tag) & 0x80) == 0)
+#define SWISS_HTABLE_H1(hash) ((size_t)(hash) >> 7)
+#define SWISS_HTABLE_H2(hash) ((uint8_t)((hash) & 0x7f))
+/// @brief above 7/8 full the groups have too few empty slots left to stop a probe early.
+#define SWISS_HTABLE_MAX_LOAD_FACTOR 0.875f
+
+// NOTE: a match mask has one bit per slot of the group (one bit per byte for the 64-bit word fallback), lowest
+// bit first. swiss_group_slot turns the lowest set bit into a slot offset.
+#if defined(HAS_AVX2)
+#define SWISS_HTABLE_GROUP_WIDTH 32
+
+static inline uint64_t
+swiss_group_match(const uint8_t *group, uint8_t tag)
+{
+    __m256i tags = _mm256_loadu_si256((const __m256i *)group);
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(tags, _mm256_set1_epi8((char)tag)));
+}
+
+static inline uint64_t
+swiss_group_match_empty(const uint8_t *group)
+{
+    return swiss_group_match(group, SWISS_HTABLE_EMPTY);
+}
+
+static inline uint64_t
+swiss_group_match_free(const uint8_t *group)
+{
+    return (uint32_t)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)group));
+}
+
+static inline size_t
+swiss_group_slot(uint64_t mask)
+{
+    return lsb_index64(mask);
+}
+#elif defined(HAS_SSE2)
+#define SWISS_HTABLE_GROUP_WIDTH 16
+
+static inline uint64_t
+swiss_group_match(const uint8_t *group, uint8_t tag)
+{
+    __m128i tags = _mm_loadu_si128((const __m128i *)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(tags, _mm_set1_epi8((char)tag)));
+}
+
+static inline uint64_t
+swiss_group_match_empty(const uint8_t *group)
+{
+    return swiss_group_match(group, SWISS_HTABLE_EMPTY);
+}
+
+static inline uint64_t
+swiss_group_match_free(const uint8_t *group)
+{
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+}
+
+static inline size_t
+swiss_group_slot(uint64_t mask)
+{
+    return lsb_index64(mask);
+}
+#else
+#define SWISS_HTABLE_GROUP_WIDTH 8
+#define SWISS_HTABLE_LSBS 0x0101010101010101ULL
+#define SWISS_HTABLE_MSBS 0x8080808080808080ULL
+
+// NOTE: little endian only, byte i of the group has to end up in bits 8i..8i+7.
+static inline uint64_t
+swiss_group_load(const uint8_t *group)
+{
+    uint64_t word;
+    memcpy(&word, group, sizeof(word));
+    return word;
+}
+
+// NOTE: can report a byte right after a real match as a match too, never misses one. The key compare sorts it out.
+static inline uint64_t
+swiss_group_match(const uint8_t *group, uint8_t tag)
+{
+    uint64_t x = swiss_group_load(group) ^ (SWISS_HTABLE_LSBS * tag);
+    return (x - SWISS_HTABLE_LSBS) & ~x & SWISS_HTABLE_MSBS;
+}
+
+// NOTE: empty and deleted both have the high bit set, only deleted has bit 1 set too.
+static inline uint64_t
+swiss_group_match_empty(const uint8_t *group)
+{
+    uint64_t word = swiss_group_load(group);
+    return word & ~(word << 6) & SWISS_HTABLE_MSBS;
+}
+
+static inline uint64_t
+swiss_group_match_free(const uint8_t *group)
+{
+    return swiss_group_load(group) & SWISS_HTABLE_MSBS;
+}
+
+static inline size_t
+swiss_group_slot(uint64_t mask)
+{
+    return lsb_index64(mask) >> 3;
+}
+#endif
+
+/// @brief slots for a table meant to hold about count entries: a power of 2, at least one group.
+static inline size_t
+swiss_htable_capacity_for(size_t count)
+{
+    size_t capacity = SWISS_HTABLE_GROUP_WIDTH;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+/// @brief entries a table of that capacity takes before it grows, there is always at least one empty slot left.
+static inline size_t
+swiss_htable_max_count(size_t capacity, float max_load_factor)
+{
+    size_t max_count = (size_t)((float)capacity * max_load_factor);
+    return max_count < capacity ? max_count : capacity - 1;
+}
+
+#define SWISS_HTABLE_API(tkey, tval, name)                                                                        \
+    typedef bool (*sht_key_comparator_func_##name##_t)(const tkey a, const tkey b);                               \
+    typedef unsigned int (*sht_key_hash_func_##name##_t)(const tkey key, unsigned int seed);                      \
+    typedef tkey (*sht_key_copy_func_##name##_t)(const tkey key, const alloc_api *api);                           \
+    typedef void (*sht_key_free_func_##name##_t)(tkey key, const alloc_api *api);                                 \
+    typedef void (*sht_key_display_func_##name##_t)(const tkey key, char *buffer, size_t max_len);                \
+    typedef tval (*sht_value_copy_func_##name##_t)(const tval value, const alloc_api *api);                       \
+    typedef void (*sht_value_free_func_##name##_t)(tval value, const alloc_api *api);                             \
+    typedef void (*sht_value_display_func_##name##_t)(const tval value, char *buffer, size_t max_len);            \
+                                                                                                                  \
+    typedef struct sht_functions_##name                                                                           \
+    {                                                                                                             \
+        sht_key_comparator_func_##name##_t key_comparator_func;                                                   \
+        sht_key_hash_func_##name##_t key_hash_func;                                                               \
+        sht_key_copy_func_##name##_t key_copy_func;                                                               \
+        sht_key_free_func_##name##_t key_free_func;                                                               \
+        sht_key_display_func_##name##_t key_display_func;                                                         \
+        sht_value_copy_func_##name##_t value_copy_func;                                                           \
+        sht_value_free_func_##name##_t value_free_func;                                                           \
+        sht_value_display_func_##name##_t value_display_func;                                                     \
+    } sht_functions_##name;                                                                                       \
+                                                                                                                  \
+    typedef struct sht_entry_##name                                                                               \
+    {                                                                                                             \
+        tkey key;                                                                                                 \
+        tval value;                                                                                               \
+        unsigned int hash;                                                                                        \
+    } sht_entry_##name;                                                                                           \
+                                                                                                                  \
+    typedef struct swiss_htable_##name                                                                            \
+    {                                                                                                             \
+        size_t capacity;                                                                                          \
+        size_t count;                                                                                             \
+        size_t deleted;                                                                                           \
+        size_t growth_left;                                                                                       \
+        uint8_t *ctrl;                                                                                            \
+        sht_entry_##name *entries;                                                                                \
+                                                                                                                  \
+        sht_functions_##name funcs;                                                                               \
+                                                                                                                  \
+        const alloc_api *api;                                                                                     \
+        unsigned int seed;                                                                                        \
+        float max_load_factor;                                                                                    \
+        float min_load_factor;                                                                                    \
+    } swiss_htable_##name;                                                                                        \
+                                                                                                                  \
+    void sht_init_##name(swiss_htable_##name *ht, size_t initial_capacity, float min_load_factor,                 \
+                         float max_load_factor, unsigned int seed, const alloc_api *api);                         \
+    void sht_add_##name(swiss_htable_##name *ht, const tkey key, tval value);                                     \
+    bool sht_get_##name(const swiss_htable_##name *ht, const tkey key, tval *value);                              \
+    bool sht_key_exists_##name(const swiss_htable_##name *ht, const tkey key);                                    \
+    void sht_resize_##name(swiss_htable_##name *ht, size_t new_capacity);                                         \
+    bool sht_remove_key_##name(swiss_htable_##name *ht, const tkey key_to_remove);                                \
+    void sht_clear_##name(swiss_htable_##name *ht);                                                               \
+    void sht_delete_##name(swiss_htable_##name *ht)
+
+SWISS_HTABLE_API(uintptr_t, uintptr_t, ptr_ptr);
+
+#ifdef HASHTABLE_IMPLEMENTATION
+#define SWISS_HTABLE_API_IMPL(tkey, tval, tkey_name, tval_name, name)                                             \
+    static inline void sht_set_ctrl_##name(swiss_htable_##name *ht, size_t index, uint8_t tag)                    \
+    {                                                                                                             \
+        ht->ctrl[index] = tag;                                                                                    \
+        if (index < SWISS_HTABLE_GROUP_WIDTH)                                                                     \
+        {                                                                                                         \
+            ht->ctrl[ht->capacity + index] = tag;                                                                 \
+        }                                                                                                         \
+    }                                                                                                             \
+                                                                                                                  \
+    static inline void sht_alloc_slots_##name(swiss_htable_##name *ht, size_t capacity)                           \
+    {                                                                                                             \
+        ht->capacity = capacity;                                                                                  \
+        ht->ctrl = shalloc_arr(ht->api, uint8_t, capacity + SWISS_HTABLE_GROUP_WIDTH);                            \
+        memset(ht->ctrl, SWISS_HTABLE_EMPTY, capacity + SWISS_HTABLE_GROUP_WIDTH);                                \
+        ht->entries = shalloc_arr(ht->api, sht_entry_##name, capacity);                                           \
+        ht->count = 0;                                                                                            \
+        ht->deleted = 0;                                                                                          \
+        ht->growth_left = swiss_htable_max_count(capacity, ht->max_load_factor);                                  \
+    }                                                                                                             \
+                                                                                                                  \
+    inline void sht_init_##name(swiss_htable_##name *ht, size_t initial_capacity, float min_load_factor,          \
+                                float max_load_factor, unsigned int seed, const alloc_api *api)                   \
+    {                                                                                                             \
+        memset(ht, 0, sizeof(swiss_htable_##name));                                                               \
+        ht->seed = seed;                                                                                          \
+        ht->min_load_factor = min_load_factor;                                                                    \
+        ht->max_load_factor = max_load_factor < SWISS_HTABLE_MAX_LOAD_FACTOR ? max_load_factor                    \
+                                                                              : SWISS_HTABLE_MAX_LOAD_FACTOR;     \
+        ht->api = api;                                                                                            \
+        ht->funcs.key_comparator_func = tkey_name##_compare;                                                      \
+        ht->funcs.key_copy_func = tkey_name##_dup;                                                                \
+        ht->funcs.key_free_func = tkey_name##_free;                                                               \
+        ht->funcs.key_hash_func = tkey_name##_hash;                                                               \
+        ht->funcs.key_display_func = tkey_name##_to_string;                                                       \
+        ht->funcs.value_display_func = tval_name##_to_string;                                                     \
+        ht->funcs.value_free_func = tval_name##_free;                                                             \
+        ht->funcs.value_copy_func = tval_name##_dup;                                                              \
+        sht_alloc_slots_##name(ht, swiss_htable_capacity_for(initial_capacity));                                  \
+    }                                                                                                             \
+                                                                                                                  \
+    /* NOTE: the tags of a whole group are compared at once, a key is only compared on a tag match. */            \
+    static inline bool sht_find_entry_##name(const swiss_htable_##name *ht, const tkey key_to_find,               \
+                                             unsigned int hash, size_t *out_entry_index)                          \
+    {                                                                                                             \
+        size_t mask = ht->capacity - 1;                                                                           \
+        uint8_t tag = SWISS_HTABLE_H2(hash);                                                                      \
+        size_t pos = SWISS_HTABLE_H1(hash) & mask;                                                                \
+        for (size_t stride = SWISS_HTABLE_GROUP_WIDTH; ; stride += SWISS_HTABLE_GROUP_WIDTH)                      \
+        {                                                                                                         \
+            const uint8_t *group = ht->ctrl + pos;                                                                \
+            for (uint64_t match = swiss_group_match(group, tag); match != 0; match &= match - 1)                  \
+            {                                                                                                     \
+                size_t index = (pos + swiss_group_slot(match)) & mask;                                            \
+                const sht_entry_##name *entry = ht->entries + index;                                              \
+                if (entry->hash == hash && ht->funcs.key_comparator_func(entry->key, key_to_find))                \
+                {                                                                                                 \
+                    *out_entry_index = index;                                                                     \
+                    return true;                                                                                  \
+                }                                                                                                 \
+            }                                                                                                     \
+            if (swiss_group_match_empty(group) != 0 || stride > ht->capacity)                                     \
+            {                                                                                                     \
+                return false;                                                                                     \
+            }                                                                                                     \
+            pos = (pos + stride) & mask;                                                                          \
+        }                                                                                                         \
+    }                                                                                                             \
+                                                                                                                  \
+    /* NOTE: the first empty or deleted slot on the probe sequence of hash, there always is one. */               \
+    static inline size_t sht_find_free_##name(const swiss_htable_##name *ht, unsigned int hash)                   \
+    {                                                                                                             \
+        size_t mask = ht->capacity - 1;                                                                           \
+        size_t pos = SWISS_HTABLE_H1(hash) & mask;                                                                \
+        for (size_t stride = SWISS_HTABLE_GROUP_WIDTH; ; stride += SWISS_HTABLE_GROUP_WIDTH)                      \
+        {                                                                                                         \
+            uint64_t free_slots = swiss_group_match_free(ht->ctrl + pos);                                         \
+            if (free_slots != 0)                                                                                  \
+            {                                                                                                     \
+                return (pos + swiss_group_slot(free_slots)) & mask;                                               \
+            }                                                                                                     \
+            pos = (pos + stride) & mask;                                                                          \
+        }                                                                                                         \
+    }                                                                                                             \
+                                                                                                                  \
+    static inline float sht_load_factor_##name(const swiss_htable_##name *ht)                                     \
+    {                                                                                                             \
+        float lf = (float)ht->count / (float)ht->capacity;                                                        \
+        return lf;                                                                                                \
+    }                                                                                                             \
+                                                                                                                  \
+    inline void sht_add_##name(swiss_htable_##name *ht, const tkey key, tval value)                               \
+    {                                                                                                             \
+        unsigned int hash = ht->funcs.key_hash_func(key, ht->seed);                                               \
+        size_t index = 0;                                                                                         \
+        if (sht_find_entry_##name(ht, key, hash, &index))                                                         \
+        {                                                                                                         \
+            sht_entry_##name *entry = ht->entries + index;                                                        \
+            ht->funcs.value_free_func(entry->value, ht->api);                                                     \
+            entry->value = ht->funcs.value_copy_func(value, ht->api);                                             \
+            return;                                                                                               \
+        }                                                                                                         \
+                                                                                                                  \
+        index = sht_find_free_##name(ht, hash);                                                                   \
+        if (ht->growth_left == 0 && ht->ctrl[index] != SWISS_HTABLE_DELETED)                                      \
+        {                                                                                                         \
+            /* mostly tombstones: rehashing in place gets rid of them, otherwise the table grows. */              \
+            if (ht->count + 1 <= swiss_htable_max_count(ht->capacity, ht->max_load_factor) / 2)                   \
+            {                                                                                                     \
+                sht_resize_##name(ht, ht->capacity);                                                              \
+            }                                                                                                     \
+            else                                                                                                  \
+            {                                                                                                     \
+                sht_resize_##name(ht, ht->capacity * 2);                                                          \
+            }                                                                                                     \
+            index = sht_find_free_##name(ht, hash);                                                               \
+        }                                                                                                         \
+        if (ht->ctrl[index] == SWISS_HTABLE_DELETED)                                                              \
+        {                                                                                                         \
+            ht->deleted--;                                                                                        \
+        }                                                                                                         \
+        else                                                                                                      \
+        {                                                                                                         \
+            ht->growth_left--;                                                                                    \
+        }                                                                                                         \
+        sht_set_ctrl_##name(ht, index, SWISS_HTABLE_H2(hash));                                                    \
+        sht_entry_##name *entry = ht->entries + index;                                                            \
+        entry->key = ht->funcs.key_copy_func(key, ht->api);                                                       \
+        entry->value = ht->funcs.value_copy_func(value, ht->api);                                                 \
+        entry->hash = hash;                                                                                       \
+        ++ht->count;                                                                                              \
+    }                                                                                                             \
+                                                                                                                  \
+    inline bool sht_get_##name(const swiss_htable_##name *ht, const tkey key_to_search, tval *out_value_ptr)      \
+    {                                                                                                             \
+        size_t index = 0;                                                                                         \
+        bool found = sht_find_entry_##name(ht, key_to_search, ht->funcs.key_hash_func(key_to_search, ht->seed),   \
+                                           &index);                                                               \
+        if (found && out_value_ptr != NULL)                                                                       \
+        {                                                                                                         \
+            *out_value_ptr = ht->entries[index].value;                                                            \
+        }                                                                                                         \
+        return found;                                                                                             \
+    }                                                                                                             \
+                                                                                                                  \
+    inline bool sht_key_exists_##name(const swiss_htable_##name *ht, const tkey key)                              \
+    {                                                                                                             \
+        return sht_get_##name(ht, key, NULL);                                                                     \
+    }                                                                                                             \
+                                                                                                                  \
+    /* NOTE: also used with the same capacity, to drop the tombstones. Entries move over as they are. */          \
+    inline void sht_resize_##name(swiss_htable_##name *ht, size_t new_capacity)                                   \
+    {                                                                                                             \
+        new_capacity = swiss_htable_capacity_for(new_capacity);                                                   \
+        while (swiss_htable_max_count(new_capacity, ht->max_load_factor) <= ht->count)                            \
+        {                                                                                                         \
+            new_capacity *= 2;                                                                                    \
+        }                                                                                                         \
+        uint8_t *old_ctrl = ht->ctrl;                                                                             \
+        sht_entry_##name *old_entries = ht->entries;                                                              \
+        size_t old_count = ht->count;                                                                             \
+        size_t old_cap = ht->capacity;                                                                            \
+                                                                                                                  \
+        sht_alloc_slots_##name(ht, new_capacity);                                                                 \
+        for (size_t i = 0; i < old_cap; ++i)                                                                      \
+        {                                                                                                         \
+            if (SWISS_HTABLE_IS_FULL(old_ctrl[i]))                                                                \
+            {                                                                                                     \
+                size_t index = sht_find_free_##name(ht, old_entries[i].hash);                                     \
+                sht_set_ctrl_##name(ht, index, old_ctrl[i]);                                                      \
+                ht->entries[index] = old_entries[i];                                                              \
+            }                                                                                                     \
+        }                                                                                                         \
+        ht->count = old_count;                                                                                    \
+        ht->growth_left -= old_count;                                                                             \
+        shfree(ht->api, old_ctrl);                                                                                \
+        shfree(ht->api, old_entries);                                                                             \
+    }                                                                                                             \
+                                                                                                                  \
+    inline bool sht_remove_key_##name(swiss_htable_##name *ht, const tkey key_to_remove)                          \
+    {                                                                                                             \
+        size_t index = 0;                                                                                         \
+        if (!sht_find_entry_##name(ht, key_to_remove, ht->funcs.key_hash_func(key_to_remove, ht->seed), &index))  \
+        {                                                                                                         \
+            return false;                                                                                         \
+        }                                                                                                         \
+        sht_entry_##name *entry = ht->entries + index;                                                            \
+        ht->funcs.key_free_func(entry->key, ht->api);                                                             \
+        ht->funcs.value_free_func(entry->value, ht->api);                                                         \
+        /* a tombstone keeps the probe sequences running through this slot intact, a resize drops it. */          \
+        sht_set_ctrl_##name(ht, index, SWISS_HTABLE_DELETED);                                                     \
+        ht->deleted++;                                                                                            \
+        ht->count--;                                                                                              \
+        if (sht_load_factor_##name(ht) <= ht->min_load_factor && ht->capacity > SWISS_HTABLE_GROUP_WIDTH)         \
+        {                                                                                                         \
+            sht_resize_##name(ht, ht->capacity / 2);                                                              \
+        }                                                                                                         \
+        return true;                                                                                              \
+    }                                                                                                             \
+                                                                                                                  \
+    inline void sht_display_##name(const swiss_htable_##name *ht)                                                 \
+    {                                                                                                             \
+        printf("Hash Table:\n");                                                                                  \
+        for (size_t i = 0; i < ht->capacity; ++i)                                                                 \
+        {                                                                                                         \
+            if (SWISS_HTABLE_IS_FULL(ht->ctrl[i]))                                                                \
+            {                                                                                                     \
+                char buffer[128];                                                                                 \
+                ht->funcs.key_display_func(ht->entries[i].key, buffer, sizeof(buffer));                           \
+                printf("[\"%s\"]:= ", buffer);                                                                    \
+                                                                                                                  \
+                ht->funcs.value_display_func(ht->entries[i].value, buffer, sizeof(buffer));                       \
+                printf("%s.\n", buffer);                                                                          \
+            }                                                                                                     \
+        }                                                                                                         \
+    }                                                                                                             \
+                                                                                                                  \
+    inline void sht_clear_##name(swiss_htable_##name *ht)                                                         \
+    {                                                                                                             \
+        for (size_t i = 0; i < ht->capacity; ++i)                                                                 \
+        {                                                                                                         \
+            if (SWISS_HTABLE_IS_FULL(ht->ctrl[i]))                                                                \
+            {                                                                                                     \
+                ht->funcs.key_free_func(ht->entries[i].key, ht->api);                                             \
+                ht->funcs.value_free_func(ht->entries[i].value, ht->api);                                         \
+            }                                                                                                     \
+        }                                                                                                         \
+        memset(ht->ctrl, SWISS_HTABLE_EMPTY, ht->capacity + SWISS_HTABLE_GROUP_WIDTH);                            \
+        ht->count = 0;                                                                                            \
+        ht->deleted = 0;                                                                                          \
+        ht->growth_left = swiss_htable_max_count(ht->capacity, ht->max_load_factor);                              \
+    }                                                                                                             \
+                                                                                                                  \
+    inline void sht_delete_##name(swiss_htable_##name *ht)                                                        \
+    {                                                                                                             \
+        sht_clear_##name(ht);                                                                                     \
+        shfree(ht->api, ht->ctrl);                                                                                \
+        shfree(ht->api, ht->entries);                                                                             \
+        ht->ctrl = NULL;                                                                                          \
+        ht->entries = NULL;                                                                                       \
+        ht->capacity = 0;                                                                                         \
+    }
+
+#define SWISS_HTABLE_API_IMPL_PTR(TKey, TVal, name) SWISS_HTABLE_API_IMPL(TKey*, TVal*, TKey, TVal, name)
+
+SWISS_HTABLE_API_IMPL(uintptr_t, uintptr_t, uintptr, uintptr, ptr_ptr)
+
+#ifdef SWISS_HASHTABLE_UNIT_TESTS
+SWISS_HTABLE_API(string32 *, float, str_float);
+SWISS_HTABLE_API_IMPL(string32 *, float, string32, float, str_float)
+
+// every key in the same group, with the same tag: nothing but full key compares can tell them apart.
+inline unsigned int colliding_hash(const uintptr_t n, unsigned int seed) { (void)n; return seed; }
+DEFAULT_FUNCS(uintptr_t, colliding)
+SWISS_HTABLE_API(uintptr_t, uintptr_t, colliding);
+SWISS_HTABLE_API_IMPL(uintptr_t, uintptr_t, colliding, uintptr, colliding)
+
+static void
+test_swiss_htable_uintptr(const alloc_api *api)
+{
+    enum { KEY_COUNT = 20000 };
+    swiss_htable_ptr_ptr table;
+    sht_init_ptr_ptr(&table, 0, 0.0f, 0.875f, 31, api);
+    assert(table.capacity == SWISS_HTABLE_GROUP_WIDTH);
+
+    // 0 is a key like any other, and pointer-like keys share their low bits.
+    for (uintptr_t i = 0; i < KEY_COUNT; ++i) {
+        sht_add_ptr_ptr(&table, i * 64, i);
+    }
+    assert(table.count == KEY_COUNT);
+    assert(table.count <= swiss_htable_max_count(table.capacity, table.max_load_factor));
+    for (uintptr_t i = 0; i < KEY_COUNT; ++i) {
+        uintptr_t value = 0;
+        assert(sht_get_ptr_ptr(&table, i * 64, &value) && value == i);
+        assert(!sht_key_exists_ptr_ptr(&table, i * 64 + 1));
+    }
+
+    // overwriting keeps the count.
+    sht_add_ptr_ptr(&table, 0, 42);
+    uintptr_t value = 0;
+    assert(sht_get_ptr_ptr(&table, 0, &value) && value == 42 && table.count == KEY_COUNT);
+
+    // remove every other key, the rest has to stay reachable past the tombstones.
+    for (uintptr_t i = 0; i < KEY_COUNT; i += 2) {
+        assert(sht_remove_key_ptr_ptr(&table, i * 64));
+    }
+    assert(!sht_remove_key_ptr_ptr(&table, 0));
+    assert(table.count == KEY_COUNT / 2 && table.deleted > 0);
+    for (uintptr_t i = 0; i < KEY_COUNT; ++i) {
+        assert(sht_key_exists_ptr_ptr(&table, i * 64) == (i % 2 == 1));
+    }
+
+    // churn at a constant size reuses tombstones and rehashes in place instead of growing.
+    size_t capacity = table.capacity;
+    for (int round = 0; round < 32; ++round) {
+        for (uintptr_t i = 0; i < KEY_COUNT; i += 8) {
+            sht_add_ptr_ptr(&table, (i + KEY_COUNT * (round + 1)) * 64, i);
+        }
+        for (uintptr_t i = 0; i < KEY_COUNT; i += 8) {
+            assert(sht_remove_key_ptr_ptr(&table, (i + KEY_COUNT * (round + 1)) * 64));
+        }
+    }
+    assert(table.capacity == capacity && table.count == KEY_COUNT / 2);
+
+    // below the min load factor it shrinks.
+    table.min_load_factor = 0.1f;
+    for (uintptr_t i = 1; i < KEY_COUNT; i += 2) {
+        assert(sht_remove_key_ptr_ptr(&table, i * 64));
+    }
+    assert(table.count == 0 && table.capacity < capacity);
+
+    sht_clear_ptr_ptr(&table);
+    assert(table.count == 0 && table.deleted == 0);
+    sht_delete_ptr_ptr(&table);
+}
+
+static void
+test_swiss_htable_collisions(const alloc_api *api)
+{
+    swiss_htable_colliding table;
+    sht_init_colliding(&table, 64, 0.0f, 0.875f, 7, api);
+    for (uintptr_t i = 0; i < 300; ++i) {
+        sht_add_colliding(&table, i, i * 3);
+    }
+    for (uintptr_t i = 0; i < 300; ++i) {
+        uintptr_t value = 0;
+        assert(sht_get_colliding(&table, i, &value) && value == i * 3);
+    }
+    assert(!sht_key_exists_colliding(&table, 300));
+    for (uintptr_t i = 0; i < 300; i += 3) {
+        assert(sht_remove_key_colliding(&table, i));
+    }
+    for (uintptr_t i = 0; i < 300; ++i) {
+        assert(sht_key_exists_colliding(&table, i) == (i % 3 != 0));
+    }
+    sht_delete_colliding(&table);
+}
+
+static void
+test_swiss_htable_strings(Freelist *fl)
+{
+    const alloc_api *api = &fl->api;
+    enum { KEY_COUNT = 500 };
+    string32 keys[KEY_COUNT];
+    char buffer[32];
+    for (int i = 0; i < KEY_COUNT; ++i) {
+        snprintf(buffer, sizeof(buffer), "key number %d", i);
+        keys[i] = string32_create(buffer, api);
+    }
+    size_t used = fl->used;
+
+    swiss_htable_str_float table;
+    sht_init_str_float(&table, 16, 0.0f, 0.75f, 31, api);
+    for (int i = 0; i < KEY_COUNT; ++i) {
+        sht_add_str_float(&table, &keys[i], (float)i);
+    }
+    for (int i = 0; i < KEY_COUNT; ++i) {
+        float value = 0.0f;
+        assert(sht_get_str_float(&table, &keys[i], &value) && value == (float)i);
+    }
+    string32 missing = string32_create("not a key at all", api);
+    assert(!sht_key_exists_str_float(&table, &missing));
+    string32_cstr_free(&missing, api);
+
+    // the table owns copies of its keys, removing and clearing gives them back.
+    for (int i = 0; i < KEY_COUNT; i += 5) {
+        assert(sht_remove_key_str_float(&table, &keys[i]));
+    }
+    sht_clear_str_float(&table);
+    sht_delete_str_float(&table);
+    assert(fl->used == used);
+
+    for (int i = 0; i < KEY_COUNT; ++i) {
+        string32_cstr_free(&keys[i], api);
+    }
+}
+
+#ifndef FREELIST_ALLOCATOR_IMPLEMENTATION
+#define FREELIST_ALLOCATOR_IMPLEMENTATION
+#endif
+#include <memory/freelist_alloc.h>
+
+void swiss_htable_unit_tests()
+{
+    freelist_create(fl, MEGABYTES(64), 0, PLACEMENT_POLICY_FIND_BEST);
+    alloc_api *api = freelist_get_api(&fl);
+
+    test_swiss_htable_uintptr(api);
+    assert(fl.used == 0);
+    test_swiss_htable_collisions(api);
+    assert(fl.used == 0);
+    test_swiss_htable_strings(&fl);
+    assert(fl.used == 0);
+
+    free(fl.data);
+}
+#endif
+#endif
+
+#endif // SWISS_HTABLE_H
@@ -0,0 +1,270 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#pragma intrinsic(_umul128)
+#elif defined(_MSC_VER) && defined(_M_ARM64)
+#include <intrin.h>
+#endif
+
+/*
+    Hashing for the hash tables, in the style of wyhash (public domain).
+
+    Everything is built on one primitive: multiply two 64-bit words to 128 bits and fold the halves together. Every
+    input bit reaches every output bit after one of those, so the low bits that hash & (capacity - 1) keeps are as
+    good as the high ones. Aligned pointers, whose low 4-6 bits are always zero, spread over the whole table.
+
+        hash_u64        integers and pointers, two multiplies.
+        hash_bytes      any byte string. It reads 8 bytes at a time, plus overlapping loads for the tail, and has
+                        three independent lanes for long inputs. A string costs about one multiply per 16 bytes,
+                        not one per byte like FNV.
+        hash_cstr_ignore_case
+                        hash_bytes over the ASCII lower-cased string. The string is lowered 8 bytes at a time.
+
+    The results depend on the byte order of the host. Nothing here is meant to be stored or sent over the wire.
+*/
+
+#define HASH_SECRET0 0xa0761d6478bd642full
+#define HASH_SECRET1 0xe7037ed1a0b428dbull
+#define HASH_SECRET2 0x8ebc6af09c88c6e3ull
+#define HASH_SECRET3 0x589965cc75374cc3ull
+
+uint64_t hash_mix64(uint64_t a, uint64_t b);
+uint64_t hash_u64(uint64_t key, uint64_t seed);
+uint64_t hash_bytes(const void *data, size_t length, uint64_t seed);
+uint64_t hash_cstr_ignore_case(const char *str, uint64_t seed);
+
+#ifdef HASH_UNIT_TESTS
+void hash_unit_tests();
+#endif
+
+/// @brief 64x64 -> 128 bit multiply, low half in *a and high half in *b.
+static inline void
+hash_mum(uint64_t *a, uint64_t *b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    *a = _umul128(*a, *b, b);
+#elif defined(_MSC_VER) && defined(_M_ARM64)
+    uint64_t lo = *a * *b;
+    *b = __umulh(*a, *b);
+    *a = lo;
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    *a = lo;
+#endif
+}
+
+inline uint64_t
+hash_mix64(uint64_t a, uint64_t b)
+{
+    hash_mum(&a, &b);
+    return a ^ b;
+}
+
+// NOTE: memcpy is how unaligned loads are spelled portably, every compiler turns it into a single mov.
+static inline uint64_t
+hash_read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t
+hash_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/// @brief 1 to 3 bytes: first, middle and last byte, which together cover all of them.
+static inline uint64_t
+hash_read_small(const uint8_t *p, size_t length)
+{
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[length >> 1] << 8) | p[length - 1];
+}
+
+inline uint64_t
+hash_u64(uint64_t key, uint64_t seed)
+{
+    // NOTE: one multiply is not enough on its own, the top bits of key only move the product by a fixed amount.
+    uint64_t a = key ^ HASH_SECRET0, b = seed ^ HASH_SECRET1;
+    hash_mum(&a, &b);
+    return hash_mix64(a ^ HASH_SECRET0, b ^ HASH_SECRET1);
+}
+
+inline uint64_t
+hash_bytes(const void *data, size_t length, uint64_t seed)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint64_t a, b;
+    seed ^= hash_mix64(seed ^ HASH_SECRET0, HASH_SECRET1);
+    if (length <= 16) {
+        if (length >= 4) {
+            // two pairs of 4 byte loads that overlap as needed, so 4..16 bytes take no loop and no branch per byte.
+            size_t middle = (length >> 3) << 2;
+            a = (hash_read32(p) << 32) | hash_read32(p + middle);
+            b = (hash_read32(p + length - 4) << 32) | hash_read32(p + length - 4 - middle);
+        } else if (length > 0) {
+            a = hash_read_small(p, length);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t remaining = length;
+        if (remaining > 48) {
+            uint64_t seed1 = seed, seed2 = seed;
+            do {
+                seed = hash_mix64(hash_read64(p) ^ HASH_SECRET1, hash_read64(p + 8) ^ seed);
+                seed1 = hash_mix64(hash_read64(p + 16) ^ HASH_SECRET2, hash_read64(p + 24) ^ seed1);
+                seed2 = hash_mix64(hash_read64(p + 32) ^ HASH_SECRET3, hash_read64(p + 40) ^ seed2);
+                p += 48;
+                remaining -= 48;
+            } while (remaining > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (remaining > 16) {
+            seed = hash_mix64(hash_read64(p) ^ HASH_SECRET1, hash_read64(p + 8) ^ seed);
+            p += 16;
+            remaining -= 16;
+        }
+        // the last 16 bytes, overlapping what the loop already consumed when the length is not a multiple of 16.
+        a = hash_read64(p + remaining - 16);
+        b = hash_read64(p + remaining - 8);
+    }
+    a ^= HASH_SECRET1;
+    b ^= seed;
+    hash_mum(&a, &b);
+    return hash_mix64(a ^ HASH_SECRET0 ^ length, b ^ HASH_SECRET1);
+}
+
+/// @brief ASCII 'A'..'Z' to 'a'..'z' in all 8 bytes of w at once, every other byte is left alone.
+static inline uint64_t
+hash_lower8(uint64_t w)
+{
+    const uint64_t ones = 0x0101010101010101ull;
+    uint64_t low7 = w & (0x7f * ones);
+    // the high bit of a byte becomes set once it is >= 'A' in the first sum, and once it is > 'Z' in the second.
+    uint64_t from_a = low7 + (0x80 - 'A') * ones;
+    uint64_t past_z = low7 + (0x80 - 'Z' - 1) * ones;
+    uint64_t upper = (from_a ^ past_z) & ~w & (0x80 * ones);
+    return w | (upper >> 2);
+}
+
+inline uint64_t
+hash_cstr_ignore_case(const char *str, uint64_t seed)
+{
+    // NOTE: lowered in 64 byte chunks on the stack, each chunk's hash seeds the next.
+    uint8_t chunk[64];
+    size_t length = strlen(str);
+    const uint8_t *p = (const uint8_t *)str;
+    uint64_t result = seed;
+    do {
+        size_t n = length < sizeof(chunk) ? length : sizeof(chunk);
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            uint64_t w = hash_lower8(hash_read64(p + i));
+            memcpy(chunk + i, &w, sizeof(w));
+        }
+        for (; i < n; ++i) {
+            chunk[i] = (p[i] >= 'A' && p[i] <= 'Z') ? (uint8_t)(p[i] | 0x20) : p[i];
+        }
+        result = hash_bytes(chunk, n, result);
+        p += n;
+        length -= n;
+    } while (length > 0);
+    return result;
+}
+
+#ifdef HASH_UNIT_TESTS
+#include <assert.h>
+#include <stdlib.h>
+
+inline void
+hash_unit_tests()
+{
+    // deterministic, seed dependent, and every length reads only its own bytes (run under ASan to check that).
+    uint8_t bytes[300];
+    for (size_t i = 0; i < sizeof(bytes); ++i) {
+        bytes[i] = (uint8_t)(i * 131 + 7);
+    }
+    for (size_t length = 0; length <= sizeof(bytes); ++length) {
+        uint8_t *copy = (uint8_t *)malloc(length ? length : 1);
+        memcpy(copy, bytes, length);
+        uint64_t h = hash_bytes(copy, length, 42);
+        assert(h == hash_bytes(bytes, length, 42));
+        assert(h != hash_bytes(bytes, length, 43));
+        if (length > 0) {
+            assert(h != hash_bytes(bytes, length - 1, 42));
+            // flipping any single bit of the input changes the hash.
+            for (size_t bit = 0; bit < length * 8; bit += 7) {
+                copy[bit / 8] ^= (uint8_t)(1u << (bit % 8));
+                assert(hash_bytes(copy, length, 42) != h);
+                copy[bit / 8] ^= (uint8_t)(1u << (bit % 8));
+            }
+        }
+        free(copy);
+    }
+
+    // aligned pointers: 4096 keys 64 bytes apart into 8192 buckets by the low bits. One XOR and one multiply put
+    // them all into 128 buckets, a proper mix leaves roughly 8192 * (1 - e^-0.5) ~ 3200 buckets in use.
+    static uint8_t used[8192];
+    memset(used, 0, sizeof(used));
+    size_t buckets = 0;
+    for (uint64_t i = 0; i < 4096; ++i) {
+        uint64_t h = hash_u64(0x7f0000001000ull + i * 64, 31);
+        if (!used[h & 8191]) {
+            used[h & 8191] = 1;
+            ++buckets;
+        }
+    }
+    assert(buckets > 3000);
+
+    // each output bit flips for about half of the single-bit input changes.
+    for (int bit = 0; bit < 64; ++bit) {
+        int flips[64] = {};
+        for (uint64_t key = 1; key <= 1000; ++key) {
+            uint64_t diff = hash_u64(key * 0x9e3779b97f4a7c15ull, 7) ^
+                            hash_u64((key * 0x9e3779b97f4a7c15ull) ^ (1ull << bit), 7);
+            for (int out = 0; out < 64; ++out) {
+                flips[out] += (int)((diff >> out) & 1);
+            }
+        }
+        for (int out = 0; out < 64; ++out) {
+            assert(flips[out] > 350 && flips[out] < 650);
+        }
+    }
+
+    // ASCII case folding, 8 bytes at a time and in the tail.
+    const char *mixed = "Hello, World! @[`{ THE QUICK BROWN FOX JUMPS OVER the lazy dog 0123456789 \xc3\x84 AZaz";
+    const char *lower = "hello, world! @[`{ the quick brown fox jumps over the lazy dog 0123456789 \xc3\x84 azaz";
+    assert(hash_cstr_ignore_case(mixed, 5) == hash_cstr_ignore_case(lower, 5));
+    assert(hash_cstr_ignore_case("@[`{", 5) != hash_cstr_ignore_case("`{@[", 5));
+    assert(hash_cstr_ignore_case("", 5) == hash_bytes("", 0, 5));
+    assert(hash_cstr_ignore_case("ABC", 5) == hash_bytes("abc", 3, 5));
+    for (int c = 0; c < 256; ++c) {
+        uint64_t w = hash_lower8(0x0101010101010101ull * (uint64_t)c);
+        uint8_t expected = (c >= 'A' && c <= 'Z') ? (uint8_t)(c | 0x20) : (uint8_t)c;
+        assert(w == 0x0101010101010101ull * expected);
+    }
+}
+#endif
+
+#endif // HASH_H
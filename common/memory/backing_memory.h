@@ -0,0 +1,263 @@
+#ifndef BACKING_MEMORY_H
+#define BACKING_MEMORY_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "virtual_memory.h"
+
+#ifndef _WIN32
+#include <sys/syscall.h>
+#endif
+
+/*
+    Backing buffers for the allocators that take a caller provided buffer (arena_init, pool_init, freelist2_init,
+    buddy_allocator_init, ...). Nothing changes for the allocator, it gets data/size as always, only the pages
+    behind them are different:
+
+        BACKING_MEMORY_HUGE_PAGES           transparent huge pages: the buffer is 2 MiB aligned and the kernel is
+                                            asked (madvise) to back it with huge pages wherever it can.
+        BACKING_MEMORY_EXPLICIT_HUGE_PAGES  pages from the reserved huge page pool (MAP_HUGETLB, MEM_LARGE_PAGES).
+                                            When the pool is empty or not set up this falls back to transparent
+                                            huge pages.
+        BACKING_MEMORY_PREFAULT             every page is touched up front, so no page fault lands in the middle of
+                                            an allocation later on.
+
+    numa_node binds the pages to that NUMA node, -1 leaves the placement to the OS. Binding happens before any page
+    is touched, including by the prefault.
+
+    Every request is best effort: Backing_Memory::flags and numa_node say what the buffer actually got.
+*/
+
+enum Backing_Memory_Flags {
+    BACKING_MEMORY_HUGE_PAGES = 1 << 0,
+    BACKING_MEMORY_EXPLICIT_HUGE_PAGES = 1 << 1,
+    BACKING_MEMORY_PREFAULT = 1 << 2,
+};
+
+#define BACKING_MEMORY_HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+
+typedef struct Backing_Memory {
+    void *data;
+    size_t size;
+    /// @brief what was actually granted out of the requested flags.
+    uint32_t flags;
+    /// @brief the node the pages are bound to, -1 if they are not.
+    int numa_node;
+
+    void *mapping;
+    size_t mapping_size;
+} Backing_Memory;
+
+bool backing_memory_acquire(Backing_Memory *mem, size_t size, uint32_t flags, int numa_node);
+void backing_memory_release(Backing_Memory *mem);
+
+#ifdef BACKING_MEMORY_UNIT_TESTS
+void backing_memory_unit_tests();
+#endif
+
+// NOTE: writes one byte per page, which is what makes the OS back it. Pages are zero-filled either way.
+static inline void
+backing_memory_prefault(void *data, size_t size, size_t page_size)
+{
+    volatile unsigned char *bytes = (volatile unsigned char *)data;
+    for (size_t offset = 0; offset < size; offset += page_size) {
+        bytes[offset] = 0;
+    }
+}
+
+static inline bool
+backing_memory_bind(void *data, size_t size, int numa_node)
+{
+#ifdef __linux__
+    // NOTE: straight to the syscall, libnuma is not needed for a single bind.
+    const int MPOL_BIND_ = 2;
+    unsigned long nodemask[16] = {};
+    const unsigned long max_node = sizeof(nodemask) * 8;
+    if (numa_node < 0 || (unsigned long)numa_node >= max_node) {
+        return false;
+    }
+    nodemask[numa_node / (8 * sizeof(unsigned long))] |= 1ul << (numa_node % (8 * sizeof(unsigned long)));
+    return syscall(SYS_mbind, data, size, MPOL_BIND_, nodemask, max_node + 1, 0) == 0;
+#else
+    (void)data;
+    (void)size;
+    (void)numa_node;
+    return false;
+#endif
+}
+
+inline bool
+backing_memory_acquire(Backing_Memory *mem, size_t size, uint32_t flags, int numa_node)
+{
+    assert(mem != NULL && size > 0);
+    memset(mem, 0, sizeof(Backing_Memory));
+    mem->numa_node = -1;
+    size_t page_size = vmem_page_size();
+
+#ifdef _WIN32
+    if (flags & BACKING_MEMORY_EXPLICIT_HUGE_PAGES) {
+        // needs SeLockMemoryPrivilege, without it this fails and the buffer gets normal pages.
+        size_t large_page_size = GetLargePageMinimum();
+        if (large_page_size != 0) {
+            size_t large_size = (size + large_page_size - 1) & ~(large_page_size - 1);
+            DWORD type = MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES;
+            void *data = numa_node >= 0 ?
+                VirtualAllocExNuma(GetCurrentProcess(), NULL, large_size, type, PAGE_READWRITE, (DWORD)numa_node) :
+                VirtualAlloc(NULL, large_size, type, PAGE_READWRITE);
+            if (data != NULL) {
+                // large pages are always resident, there is nothing left to prefault.
+                mem->flags = BACKING_MEMORY_EXPLICIT_HUGE_PAGES | (flags & BACKING_MEMORY_PREFAULT);
+                mem->numa_node = numa_node;
+                page_size = large_page_size;
+                mem->mapping = data;
+                mem->mapping_size = large_size;
+            }
+        }
+    }
+    if (mem->mapping == NULL) {
+        // no transparent huge pages on Windows.
+        size_t mapping_size = (size + page_size - 1) & ~(page_size - 1);
+        DWORD type = MEM_RESERVE | MEM_COMMIT;
+        mem->mapping = numa_node >= 0 ?
+            VirtualAllocExNuma(GetCurrentProcess(), NULL, mapping_size, type, PAGE_READWRITE, (DWORD)numa_node) :
+            VirtualAlloc(NULL, mapping_size, type, PAGE_READWRITE);
+        if (mem->mapping == NULL) {
+            return false;
+        }
+        mem->mapping_size = mapping_size;
+        mem->numa_node = numa_node;
+        if (flags & BACKING_MEMORY_PREFAULT) {
+            backing_memory_prefault(mem->mapping, mapping_size, page_size);
+            mem->flags |= BACKING_MEMORY_PREFAULT;
+        }
+    }
+    mem->data = mem->mapping;
+    mem->size = size;
+    return true;
+#else
+#ifdef MAP_HUGETLB
+    if (flags & BACKING_MEMORY_EXPLICIT_HUGE_PAGES) {
+        size_t huge_size = (size + BACKING_MEMORY_HUGE_PAGE_SIZE - 1) & ~(BACKING_MEMORY_HUGE_PAGE_SIZE - 1);
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << 26)
+#endif
+        void *data = mmap(NULL, huge_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+        if (data != MAP_FAILED) {
+            mem->mapping = data;
+            mem->mapping_size = huge_size;
+            mem->data = data;
+            mem->flags |= BACKING_MEMORY_EXPLICIT_HUGE_PAGES;
+            page_size = BACKING_MEMORY_HUGE_PAGE_SIZE;
+        } else {
+            // no huge page pool, transparent huge pages are the next best thing.
+            flags |= BACKING_MEMORY_HUGE_PAGES;
+        }
+    }
+#else
+    if (flags & BACKING_MEMORY_EXPLICIT_HUGE_PAGES) {
+        flags |= BACKING_MEMORY_HUGE_PAGES;
+    }
+#endif
+
+    if (mem->mapping == NULL) {
+        size_t mapping_size = (size + page_size - 1) & ~(page_size - 1);
+        size_t alignment = page_size;
+        if (flags & BACKING_MEMORY_HUGE_PAGES) {
+            // a huge page needs a 2 MiB aligned range, so map one huge page more and trim both ends.
+            mapping_size = (size + BACKING_MEMORY_HUGE_PAGE_SIZE - 1) & ~(BACKING_MEMORY_HUGE_PAGE_SIZE - 1);
+            alignment = BACKING_MEMORY_HUGE_PAGE_SIZE;
+        }
+        size_t over_size = mapping_size + alignment - page_size;
+        void *over = mmap(NULL, over_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (over == MAP_FAILED) {
+            return false;
+        }
+        uintptr_t start = ((uintptr_t)over + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        if (start != (uintptr_t)over) {
+            munmap(over, start - (uintptr_t)over);
+        }
+        size_t tail = (uintptr_t)over + over_size - (start + mapping_size);
+        if (tail != 0) {
+            munmap((void *)(start + mapping_size), tail);
+        }
+        mem->mapping = (void *)start;
+        mem->mapping_size = mapping_size;
+        mem->data = mem->mapping;
+
+#ifdef MADV_HUGEPAGE
+        if ((flags & BACKING_MEMORY_HUGE_PAGES) && madvise(mem->mapping, mapping_size, MADV_HUGEPAGE) == 0) {
+            mem->flags |= BACKING_MEMORY_HUGE_PAGES;
+        }
+#endif
+    }
+
+    if (numa_node >= 0 && backing_memory_bind(mem->mapping, mem->mapping_size, numa_node)) {
+        mem->numa_node = numa_node;
+    }
+    if (flags & BACKING_MEMORY_PREFAULT) {
+        backing_memory_prefault(mem->mapping, mem->mapping_size, page_size);
+        mem->flags |= BACKING_MEMORY_PREFAULT;
+    }
+    mem->size = size;
+    return true;
+#endif
+}
+
+inline void
+backing_memory_release(Backing_Memory *mem)
+{
+    assert(mem != NULL);
+    vmem_release(mem->mapping, mem->mapping_size);
+    memset(mem, 0, sizeof(Backing_Memory));
+    mem->numa_node = -1;
+}
+
+#ifdef BACKING_MEMORY_UNIT_TESTS
+inline void
+backing_memory_unit_tests()
+{
+    // plain pages, zero filled.
+    Backing_Memory mem;
+    bool ok = backing_memory_acquire(&mem, 100000, 0, -1);
+    assert(ok && mem.data != NULL && mem.size == 100000 && mem.flags == 0 && mem.numa_node == -1);
+    assert(((uintptr_t)mem.data & (vmem_page_size() - 1)) == 0);
+    for (size_t i = 0; i < mem.size; i += 4096) {
+        assert(((unsigned char *)mem.data)[i] == 0);
+    }
+    memset(mem.data, 0xab, mem.size);
+    backing_memory_release(&mem);
+    assert(mem.data == NULL);
+
+    // whatever is granted, the buffer is usable and the granted flags are a subset of the requested ones.
+    const uint32_t requests[] = {
+        BACKING_MEMORY_HUGE_PAGES,
+        BACKING_MEMORY_HUGE_PAGES | BACKING_MEMORY_PREFAULT,
+        BACKING_MEMORY_EXPLICIT_HUGE_PAGES | BACKING_MEMORY_PREFAULT,
+    };
+    for (uint32_t flags : requests) {
+        ok = backing_memory_acquire(&mem, 5 * 1024 * 1024 + 17, flags, 0);
+        assert(ok && mem.data != NULL);
+        assert((mem.flags & ~(flags | BACKING_MEMORY_HUGE_PAGES)) == 0);
+        assert((mem.flags & BACKING_MEMORY_PREFAULT) == (flags & BACKING_MEMORY_PREFAULT));
+        assert(mem.numa_node == -1 || mem.numa_node == 0);
+#ifndef _WIN32
+        if (mem.flags & (BACKING_MEMORY_HUGE_PAGES | BACKING_MEMORY_EXPLICIT_HUGE_PAGES)) {
+            assert(((uintptr_t)mem.data & (BACKING_MEMORY_HUGE_PAGE_SIZE - 1)) == 0);
+        }
+#endif
+        memset(mem.data, 0x5a, mem.size);
+        backing_memory_release(&mem);
+    }
+
+    // a node that cannot exist is not bound to, the memory is still there.
+    ok = backing_memory_acquire(&mem, 4096, 0, 1 << 20);
+    assert(ok && mem.numa_node == -1);
+    backing_memory_release(&mem);
+}
+#endif
+
+#endif // BACKING_MEMORY_H
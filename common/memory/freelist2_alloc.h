@@ -5,15 +5,34 @@
 #include "memory.h"
 #include <cstdint>
 
-#ifndef HASHTABLE_IMPLEMENTATION
-#define HASHTABLE_IMPLEMENTATION
-#endif
-#include <containers/htable.h>
-
 #ifdef _DEBUG
 #define ALLOCATOR_DEBUG
 #endif
 
+/* NOTE: with FREELIST2_COMPACT_HEADER defined the header is 16 bytes instead of 48, for heaps of small objects. The
+   alignment is stored as its log2 next to the padding, and the owner links move out of the header into a side table
+   (Freelist2_Owner_Record) that only allocations with an owner get an entry in. */
+#ifdef FREELIST2_COMPACT_HEADER
+typedef struct Freelist2_Allocation_Header {
+    /// @brief this includes required size, size for header and size for alignment padding.
+    size_t block_size;
+    uint32_t alignment_padding : 26;
+    uint32_t alignment_log2 : 6;
+    /// @brief index of this allocation's Freelist2_Owner_Record, 0 if it has none.
+    uint32_t owner_index;
+#ifdef ALLOCATOR_DEBUG
+    const char *allocation_label;
+    unsigned char _unused[8];
+#endif
+} Freelist2_Allocation_Header;
+
+typedef struct Freelist2_Owner_Record {
+    void **pOwner;
+    /// @brief record index of the child allocation, 0 if there is none.
+    uint32_t child_index;
+    uint32_t next_free;
+} Freelist2_Owner_Record;
+#else
 typedef struct Freelist2_Allocation_Header {
     /// @brief this includes required size, size for header and size for alignment padding.
     size_t block_size;
@@ -34,12 +53,54 @@ typedef struct Freelist2_Allocation_Header {
     unsigned char _unused[8];
 #endif
 } Freelist2_Allocation_Header;
+#endif
 
+/* NOTE: every free block is indexed twice. next/prev keep all free blocks in address order, which is what coalescing
+   and the defragmentor walk. bin_next/bin_prev link it into the segregated size class its block_size falls in,
+   which is what allocation searches. */
 typedef struct Freelist2_Node {
+    /// @brief always FREELIST2_TAG_FREE, see the block tags below.
+    size_t tag;
     struct Freelist2_Node *next;
     size_t block_size;
+    struct Freelist2_Node *prev;
+    struct Freelist2_Node *bin_next;
+    struct Freelist2_Node *bin_prev;
 } Freelist2_Node;
 
+/* Size classes: one first level class per power of two, split linearly into FREELIST2_SL_COUNT second level
+   classes. A block of size s lives in the class s rounds down to. */
+#define FREELIST2_SL_SHIFT 2
+#define FREELIST2_SL_COUNT (1 << FREELIST2_SL_SHIFT)
+#define FREELIST2_BIN_COUNT (64 * FREELIST2_SL_COUNT)
+#define FREELIST2_BIN_WORDS (FREELIST2_BIN_COUNT / 64)
+
+/* The managed buffer is split into regions of this size. For each region the allocator remembers the lowest free
+   block that starts inside it, which is how free() finds its address-ordered neighbours without walking the list. */
+#define FREELIST2_REGION_SHIFT 16
+
+/* How many more blocks of a size class FIND_BEST looks at once it has found one that fits. */
+#ifndef FREELIST2_BEST_FIT_SCAN_LIMIT
+#define FREELIST2_BEST_FIT_SCAN_LIMIT 16
+#endif
+
+/* Block tags: the first word of every block (free or allocated) says what the block is, so the defragmentor and the
+   coalescer can step from a block to its physical neighbour at block + block_size without any lookup.
+     - free block:                   FREELIST2_TAG_FREE (the tag field of its Freelist2_Node).
+     - allocation with no padding:   the header sits at the block start, this is its block_size.
+     - allocation with padding:      FREELIST2_TAG_PADDED | alignment_padding, the header is that far in.
+   Alignment padding is therefore never 1 to 7 bytes, it is bumped by one more alignment step if it would be. */
+#define FREELIST2_TAG_PADDED ((size_t)1 << (sizeof(size_t) * 8 - 1))
+#define FREELIST2_TAG_FREE (FREELIST2_TAG_PADDED | ((size_t)1 << (sizeof(size_t) * 8 - 2)))
+
+/* A freed block has to have room for its Freelist2_Node. The full header is already as big as the node, a compact one
+   needs a payload of at least the difference. */
+#ifdef FREELIST2_COMPACT_HEADER
+#define FREELIST2_MIN_ALLOCATION_SIZE (sizeof(Freelist2_Node) - sizeof(Freelist2_Allocation_Header))
+#else
+#define FREELIST2_MIN_ALLOCATION_SIZE 16
+#endif
+
 typedef struct Freelist2 {
     alloc_api api;
 
@@ -47,24 +108,46 @@ typedef struct Freelist2 {
     size_t size;
     size_t used;
     Freelist2_Node *head;
+    Freelist2_Node *tail;
+
+    Freelist2_Node *bins[FREELIST2_BIN_COUNT];
+    uint64_t bin_bitmap[FREELIST2_BIN_WORDS];
+
+    Freelist2_Node **region_heads;
+    uint64_t *region_bitmap;
+    size_t region_count;
+
+#ifdef FREELIST2_COMPACT_HEADER
+    /// @brief owner side table, allocated when the first owner is set. Record 0 is never used.
+    Freelist2_Owner_Record *owners;
+    uint32_t owner_count;
+    uint32_t owner_capacity;
+    uint32_t owner_free;
+#endif
 
-    htable_ptr_ptr table;
     Placement_Policy policy;
     int block_count;
 } Freelist2;
 
-void        freelist2_init(Freelist2 *fl, void *data, size_t size, size_t alignment);
+/* NOTE: freelist2_init mallocs the region index (region_heads/region_bitmap) next to the caller's buffer, so every
+   successful init must be paired with freelist2_destroy, also before calling init again on the same Freelist2: init
+   can not tell a previous init's arrays from garbage in a fresh struct, so it never frees them. It returns false and
+   leaves *fl zeroed when those mallocs fail. */
+bool        freelist2_init(Freelist2 *fl, void *data, size_t size, size_t alignment);
 alloc_api  *freelist2_get_api(Freelist2 *fl);
 void       *freelist2_alloc(void *fl, size_t size);
 void       *freelist2_alloc_align(void *fl, size_t size, size_t alignment);
 void        freelist2_free(void *fl, void *ptr);
 void       *freelist2_realloc(void *fl, void *ptr, size_t new_size);
+void       *freelist2_realloc_align(void *fl, void *ptr, size_t new_size, size_t alignment);
 void        freelist2_defragment(Freelist2 *fl);
+bool        freelist2_defragment_step(Freelist2 *fl, size_t budget_bytes);
 bool        freelist2_set_allocation_owner(Freelist2 *fl, void *ptr, void **owner);
 void        freelist2_destroy(Freelist2 *fl);
 
 void        freelist2_free_all(void *fl);
 size_t      freelist2_remaining_space(Freelist2 *fl);
+size_t      freelist2_largest_free_block(Freelist2 *fl);
 
 #ifdef ALLOCATOR_DEBUG
 void        freelist2_set_allocation_label(Freelist2 *fl, void *memory, const char *label);
@@ -104,6 +187,226 @@ freelist2_get_header(void *allocation)
     return header;
 }
 
+static_assert(sizeof(Freelist2_Allocation_Header) % 16 == 0,
+              "The header must keep allocations at the default alignment without padding!");
+#ifndef FREELIST2_COMPACT_HEADER
+static_assert(sizeof(Freelist2_Node) <= sizeof(Freelist2_Allocation_Header),
+              "A freed block must be able to hold its free node!");
+#endif
+
+static inline size_t
+freelist2_header_alignment(Freelist2_Allocation_Header *header)
+{
+#ifdef FREELIST2_COMPACT_HEADER
+    return (size_t)1 << header->alignment_log2;
+#else
+    return header->alignment_requirement;
+#endif
+}
+
+static inline void
+freelist2_header_set_alignment(Freelist2_Allocation_Header *header, size_t alignment)
+{
+#ifdef FREELIST2_COMPACT_HEADER
+    // alignment padding is less than alignment + 8, this keeps it inside its 26 bits.
+    assert((alignment & (alignment - 1)) == 0 && alignment < ((size_t)1 << 25));
+    header->alignment_log2 = lsb_index64((uint64_t)alignment);
+#else
+    header->alignment_requirement = alignment;
+#endif
+}
+
+static inline bool
+freelist2_block_is_free(uintptr_t block)
+{
+    return *(size_t *)block == FREELIST2_TAG_FREE;
+}
+
+// NOTE: header of the allocation that starts at block. block has to be the start of an allocated block.
+static inline Freelist2_Allocation_Header *
+freelist2_block_header(uintptr_t block)
+{
+    size_t tag = *(size_t *)block;
+    assert(tag != FREELIST2_TAG_FREE);
+    size_t alignment_padding = (tag & FREELIST2_TAG_PADDED) ? (tag & ~FREELIST2_TAG_PADDED) : 0;
+    return (Freelist2_Allocation_Header *)(block + alignment_padding);
+}
+
+static inline void
+freelist2_write_block_tag(uintptr_t block, size_t alignment_padding)
+{
+    if (alignment_padding > 0) {
+        assert(alignment_padding >= sizeof(size_t));
+        *(size_t *)block = FREELIST2_TAG_PADDED | alignment_padding;
+    }
+}
+
+// NOTE: padding + header needed in front of an allocation placed at block. alignment must be at least 8.
+static inline size_t
+freelist2_calc_padding(uintptr_t block, size_t alignment)
+{
+    size_t padding = calc_padding_with_header(block, alignment, sizeof(Freelist2_Allocation_Header));
+    size_t alignment_padding = padding - sizeof(Freelist2_Allocation_Header);
+    if (alignment_padding > 0 && alignment_padding < sizeof(size_t)) {
+        // no room for the block tag.
+        padding += alignment;
+    }
+    return padding;
+}
+
+static inline uint32_t
+freelist2_bin_index(size_t size)
+{
+    assert(size >= FREELIST2_SL_COUNT);
+    uint32_t fl_index = msb_index64((uint64_t)size);
+    uint32_t sl_index = (uint32_t)(size >> (fl_index - FREELIST2_SL_SHIFT)) & (FREELIST2_SL_COUNT - 1);
+    return fl_index * FREELIST2_SL_COUNT + sl_index;
+}
+
+// NOTE: the class every block of which is at least size bytes.
+static inline uint32_t
+freelist2_bin_index_roundup(size_t size)
+{
+    uint32_t fl_index = msb_index64((uint64_t)size);
+    size += ((size_t)1 << (fl_index - FREELIST2_SL_SHIFT)) - 1;
+    return freelist2_bin_index(size);
+}
+
+// NOTE: first non-empty bin at or after bin, FREELIST2_BIN_COUNT if there is none.
+static inline uint32_t
+freelist2_find_bin(Freelist2 *fl, uint32_t bin)
+{
+    if (bin >= FREELIST2_BIN_COUNT) {
+        return FREELIST2_BIN_COUNT;
+    }
+    uint32_t word = bin >> 6;
+    uint64_t mask = fl->bin_bitmap[word] & (~0ull << (bin & 63));
+    while (mask == 0) {
+        if (++word == FREELIST2_BIN_WORDS) {
+            return FREELIST2_BIN_COUNT;
+        }
+        mask = fl->bin_bitmap[word];
+    }
+    return (word << 6) + lsb_index64(mask);
+}
+
+static inline void
+freelist2_bin_insert(Freelist2 *fl, Freelist2_Node *node)
+{
+    uint32_t bin = freelist2_bin_index(node->block_size);
+    node->bin_prev = NULL;
+    node->bin_next = fl->bins[bin];
+    if (node->bin_next != NULL) {
+        node->bin_next->bin_prev = node;
+    }
+    fl->bins[bin] = node;
+    fl->bin_bitmap[bin >> 6] |= 1ull << (bin & 63);
+}
+
+static inline void
+freelist2_bin_remove(Freelist2 *fl, Freelist2_Node *node)
+{
+    uint32_t bin = freelist2_bin_index(node->block_size);
+    if (node->bin_prev != NULL) {
+        node->bin_prev->bin_next = node->bin_next;
+    } else {
+        assert(fl->bins[bin] == node);
+        fl->bins[bin] = node->bin_next;
+        if (fl->bins[bin] == NULL) {
+            fl->bin_bitmap[bin >> 6] &= ~(1ull << (bin & 63));
+        }
+    }
+    if (node->bin_next != NULL) {
+        node->bin_next->bin_prev = node->bin_prev;
+    }
+}
+
+// NOTE: free blocks change size class when they grow or shrink in place.
+static inline void
+freelist2_node_resize(Freelist2 *fl, Freelist2_Node *node, size_t new_size)
+{
+    freelist2_bin_remove(fl, node);
+    node->block_size = new_size;
+    freelist2_bin_insert(fl, node);
+}
+
+static inline size_t
+freelist2_region_index(Freelist2 *fl, uintptr_t address)
+{
+    assert(address >= (uintptr_t)fl->data);
+    return (size_t)(address - (uintptr_t)fl->data) >> FREELIST2_REGION_SHIFT;
+}
+
+// NOTE: first region at or after region that has a free block starting in it, region_count if there is none.
+static inline size_t
+freelist2_next_region(Freelist2 *fl, size_t region)
+{
+    size_t word_count = (fl->region_count + 63) >> 6;
+    size_t word = region >> 6;
+    if (word >= word_count) {
+        return fl->region_count;
+    }
+    uint64_t mask = fl->region_bitmap[word] & (~0ull << (region & 63));
+    while (mask == 0) {
+        if (++word == word_count) {
+            return fl->region_count;
+        }
+        mask = fl->region_bitmap[word];
+    }
+    return (word << 6) + lsb_index64(mask);
+}
+
+// NOTE: the lowest free block that starts after address, NULL if there is none. Only walks the free blocks of the
+// region address is in.
+static inline Freelist2_Node *
+freelist2_find_successor(Freelist2 *fl, uintptr_t address)
+{
+    if (address >= (uintptr_t)fl->data + fl->size) {
+        return NULL;
+    }
+
+    size_t region = freelist2_region_index(fl, address);
+    Freelist2_Node *node = fl->region_heads[region];
+    if (node == NULL) {
+        region = freelist2_next_region(fl, region + 1);
+        return region < fl->region_count ? fl->region_heads[region] : NULL;
+    }
+
+    while (node != NULL && (uintptr_t)node <= address) {
+        node = node->next;
+    }
+    return node;
+}
+
+static inline bool
+freelist2_owns_address(Freelist2 *fl, void *address)
+{
+    return (uintptr_t)address >= (uintptr_t)fl->data && (uintptr_t)address < ((uintptr_t)fl->data + fl->size);
+}
+
+#ifdef FREELIST2_COMPACT_HEADER
+static inline uint32_t
+freelist2_owner_record_alloc(Freelist2 *fl)
+{
+    uint32_t index = fl->owner_free;
+    if (index != 0) {
+        fl->owner_free = fl->owners[index].next_free;
+    } else {
+        if (fl->owner_count >= fl->owner_capacity) {
+            fl->owner_capacity = fl->owner_capacity != 0 ? fl->owner_capacity * 2 : 64;
+            fl->owners = (Freelist2_Owner_Record *)realloc(fl->owners,
+                                                           fl->owner_capacity * sizeof(Freelist2_Owner_Record));
+            assert(fl->owners != NULL);
+        }
+        index = fl->owner_count++;
+    }
+    fl->owners[index].pOwner = NULL;
+    fl->owners[index].child_index = 0;
+    fl->owners[index].next_free = 0;
+    return index;
+}
+#endif
+
 // NOTE: Only works for valid allocations.
 inline size_t
 freelist2_get_block_offset(Freelist2 *fl, void *ptr)
@@ -131,25 +434,137 @@ freelist2_set_allocation_owner(Freelist2 *fl, void *allocation, void **pOwner)
     size_t metadata_size = (header->alignment_padding + sizeof(Freelist2_Allocation_Header));
     assert((uintptr_t)allocation > metadata_size);
     uintptr_t start_boundary = (uintptr_t)allocation - metadata_size;
+    (void)start_boundary;
 
     assert(start_boundary >= (uintptr_t)fl->data &&
            start_boundary < ((uintptr_t)fl->data + fl->size));
 
-    uintptr_t val = 0;
-    bool exists = htget(ptr_ptr, &fl->table, start_boundary, &val);
-    assert(exists && val == (uintptr_t)allocation);
+    assert(freelist2_block_header(start_boundary) == header);
+#ifdef FREELIST2_COMPACT_HEADER
+    if (header->owner_index == 0) {
+        header->owner_index = freelist2_owner_record_alloc(fl);
+    }
+    fl->owners[header->owner_index].pOwner = pOwner;
+#else
     header->pOwner = pOwner;
+#endif
 
     // checking if the parent of this allocation is being managed too.
-    if ((uintptr_t)pOwner >= (uintptr_t)fl->data &&
-        (uintptr_t)pOwner < ((uintptr_t)fl->data + fl->size))
+    if (freelist2_owns_address(fl, pOwner))
     {
         // the owner of this allocation is itself being managed by the allocator, so it's parent can be moved.
         Freelist2_Allocation_Header *parentHeader = freelist2_get_header((void *)pOwner);
+#ifdef FREELIST2_COMPACT_HEADER
+        if (parentHeader->owner_index == 0) {
+            parentHeader->owner_index = freelist2_owner_record_alloc(fl);
+        }
+        fl->owners[parentHeader->owner_index].child_index = header->owner_index;
+#else
         parentHeader->child_header = header;
+#endif
     }
 
-    return exists;
+    return true;
+}
+
+// NOTE: a freed allocation's parent must not keep pointing at it, or defragmentation writes through a stale link.
+static inline void
+freelist2_owner_release(Freelist2 *fl, Freelist2_Allocation_Header *header)
+{
+#ifdef FREELIST2_COMPACT_HEADER
+    uint32_t index = header->owner_index;
+    if (index == 0) {
+        return;
+    }
+    void **pOwner = fl->owners[index].pOwner;
+    if (freelist2_owns_address(fl, pOwner)) {
+        Freelist2_Allocation_Header *parent_header = freelist2_get_header((void *)pOwner);
+        if (parent_header->owner_index != 0 && fl->owners[parent_header->owner_index].child_index == index) {
+            fl->owners[parent_header->owner_index].child_index = 0;
+        }
+    }
+    fl->owners[index].next_free = fl->owner_free;
+    fl->owner_free = index;
+    header->owner_index = 0;
+#else
+    if (freelist2_owns_address(fl, header->pOwner)) {
+        Freelist2_Allocation_Header *parent_header = freelist2_get_header((void *)header->pOwner);
+        if (parent_header->child_header == header) {
+            parent_header->child_header = NULL;
+        }
+    }
+#endif
+}
+
+/* NOTE: the allocation at old_header is being replaced by the one at new_header (realloc that could not grow in
+   place). The owner, the parent and the child are told about the new one, the old one is left without an owner. */
+static inline void
+freelist2_owner_transfer(Freelist2 *fl, Freelist2_Allocation_Header *old_header,
+                         Freelist2_Allocation_Header *new_header)
+{
+    void *new_memory = (void *)((uintptr_t)new_header + sizeof(Freelist2_Allocation_Header));
+#ifdef FREELIST2_COMPACT_HEADER
+    uint32_t index = old_header->owner_index;
+    old_header->owner_index = 0;
+    new_header->owner_index = index;
+    if (index == 0) {
+        return;
+    }
+    // the parent refers to the record, not the header, so only the owner and the child need updating.
+    Freelist2_Owner_Record *record = &fl->owners[index];
+    if (record->child_index != 0) {
+        fl->owners[record->child_index].pOwner = (void **)new_memory;
+    }
+    if (record->pOwner != NULL) {
+        *record->pOwner = new_memory;
+    }
+#else
+    new_header->pOwner = old_header->pOwner;
+    new_header->child_header = old_header->child_header;
+    old_header->pOwner = NULL;
+    old_header->child_header = NULL;
+    if (freelist2_owns_address(fl, new_header->pOwner)) {
+        freelist2_get_header((void *)new_header->pOwner)->child_header = new_header;
+    }
+    if (new_header->child_header != NULL) {
+        new_header->child_header->pOwner = (void **)new_memory;
+    }
+    if (new_header->pOwner != NULL) {
+        *new_header->pOwner = new_memory;
+    }
+#endif
+}
+
+/* NOTE: the defragmentor is about to move the allocation at header so that its header ends up at new_header. Tells
+   the owner, the parent and the child, header itself has not moved yet. */
+static inline void
+freelist2_owner_moved(Freelist2 *fl, Freelist2_Allocation_Header *header, uintptr_t new_header)
+{
+    void *new_memory = (void *)(new_header + sizeof(Freelist2_Allocation_Header));
+#ifdef FREELIST2_COMPACT_HEADER
+    assert(header->owner_index != 0 && "Only allocations with an owner can be moved!");
+    Freelist2_Owner_Record *record = &fl->owners[header->owner_index];
+    *record->pOwner = new_memory;
+    if (record->child_index != 0) {
+        fl->owners[record->child_index].pOwner = (void **)new_memory;
+    }
+#else
+    /* telling my daddy to point to my new address now, AND daddy's allocation header to my header. */
+    *header->pOwner = new_memory;
+    if (freelist2_owns_address(fl, header->pOwner))
+    {
+        Freelist2_Allocation_Header *parent_header = freelist2_get_header(header->pOwner);
+        parent_header->child_header = (Freelist2_Allocation_Header *)new_header;
+    }
+    /*
+        telling the child allocation(if any), that I, your daddy, moved, so that when he moves, he can tell me,
+        his daddy(the correct one), his new address after memmove. to be honest, I never thought I would write
+        this sentence ever in my life.
+    */
+    if (header->child_header) {
+        header->child_header->pOwner = (void **)new_memory;
+    }
+#endif
 }
 
 inline size_t
@@ -175,6 +590,26 @@ freelist2_remaining_space(Freelist2 *fl)
     return space;
 }
 
+// NOTE: only the highest non-empty size class can hold the largest free block, so only that one is walked.
+inline size_t
+freelist2_largest_free_block(Freelist2 *fl)
+{
+    for (int word = FREELIST2_BIN_WORDS - 1; word >= 0; --word) {
+        if (fl->bin_bitmap[word] == 0) {
+            continue;
+        }
+        uint32_t bin = ((uint32_t)word << 6) + msb_index64(fl->bin_bitmap[word]);
+        size_t largest = 0;
+        for (Freelist2_Node *node = fl->bins[bin]; node != NULL; node = node->bin_next) {
+            if (node->block_size > largest) {
+                largest = node->block_size;
+            }
+        }
+        return largest;
+    }
+    return 0;
+}
+
 #ifdef ALLOCATOR_DEBUG
 inline void
 freelist2_set_allocation_label(Freelist2 *fl, void *memory, const char *label)
@@ -186,37 +621,66 @@ freelist2_set_allocation_label(Freelist2 *fl, void *memory, const char *label)
 }
 #endif
 
+// NOTE: forgets every free block, without touching the managed memory itself.
+static inline void
+freelist2_reset_free_blocks(Freelist2 *freelist)
+{
+    freelist->head = NULL;
+    freelist->tail = NULL;
+    freelist->block_count = 0;
+    memset(freelist->bins, 0, sizeof(freelist->bins));
+    memset(freelist->bin_bitmap, 0, sizeof(freelist->bin_bitmap));
+    memset(freelist->region_heads, 0, freelist->region_count * sizeof(Freelist2_Node *));
+    memset(freelist->region_bitmap, 0, ((freelist->region_count + 63) >> 6) * sizeof(uint64_t));
+}
+
 inline void
 freelist2_free_all(void *fl)
 {
     Freelist2 *freelist = (Freelist2 *)fl;
     freelist->used = 0;
+    freelist2_reset_free_blocks(freelist);
+#ifdef FREELIST2_COMPACT_HEADER
+    freelist->owner_count = 1;
+    freelist->owner_free = 0;
+#endif
+
     Freelist2_Node *first_node = (Freelist2_Node *)freelist->data;
     first_node->block_size = freelist->size;
-    first_node->next = NULL;
-    freelist->head = first_node;
-    freelist->block_count = 1;
+    freelist2_node_insert(freelist, NULL, first_node);
 }
 
-inline void
+inline bool
 freelist2_init(Freelist2 *fl, void *data, size_t size, size_t alignment)
 {
     fl->data = data;
     fl->size = size;
+    fl->region_count = (size + ((size_t)1 << FREELIST2_REGION_SHIFT) - 1) >> FREELIST2_REGION_SHIFT;
+    fl->region_heads = (Freelist2_Node **)malloc(fl->region_count * sizeof(Freelist2_Node *));
+    fl->region_bitmap = (uint64_t *)malloc(((fl->region_count + 63) >> 6) * sizeof(uint64_t));
+    if (fl->region_heads == NULL || fl->region_bitmap == NULL) {
+        free(fl->region_heads);
+        free(fl->region_bitmap);
+        memset(fl, 0, sizeof(Freelist2));
+        return false;
+    }
+#ifdef FREELIST2_COMPACT_HEADER
+    fl->owners = NULL;
+    fl->owner_capacity = 0;
+#endif
     freelist2_free_all(fl);
     fl->policy = PLACEMENT_POLICY_FIND_BEST;
 
-    htinit(ptr_ptr, &fl->table, 1024, .2f, .7f, 217, NULL);
-
     fl->api.alloc = freelist2_alloc;
     fl->api.alloc_align = freelist2_alloc_align;
     fl->api.realloc = freelist2_realloc;
-    // fl->api.realloc_align = freelist2_realloc;
+    fl->api.realloc_align = freelist2_realloc_align;
     fl->api.free = freelist2_free;
     fl->api.free_all = freelist2_free_all;
 
     fl->api.alignment = alignment;
     fl->api.allocator = (void *)fl;
+    return true;
 }
 
 inline alloc_api *
@@ -226,57 +690,80 @@ freelist2_get_api(Freelist2 *fl)
     return api;
 }
 
+/* NOTE: FIND_FIRST takes the first block of the first size class that is guaranteed to fit whatever padding the
+   block's address needs (good fit, O(1)), and only looks at the classes below that when there is none. */
 inline Freelist2_Node *
 freelist2_find_first(Freelist2 *fl, size_t size, size_t alignment, size_t *padding_, Freelist2_Node **prev_node_)
 {
-    Freelist2_Node *node = fl->head;
-    Freelist2_Node *prev_node = NULL;
-
+    Freelist2_Node *node = NULL;
     size_t padding = 0;
 
-    while(node != NULL) {
-        padding = calc_padding_with_header((uintptr_t)node, alignment, sizeof(Freelist2_Allocation_Header));
-        size_t required_space = size + padding;
-
-        if (node->block_size >= required_space) {
-            break;
+    size_t worst_case = size + sizeof(Freelist2_Allocation_Header) + alignment + sizeof(size_t) - 1;
+    uint32_t bin = freelist2_find_bin(fl, freelist2_bin_index_roundup(worst_case));
+    if (bin < FREELIST2_BIN_COUNT) {
+        node = fl->bins[bin];
+        padding = freelist2_calc_padding((uintptr_t)node, alignment);
+        assert(node->block_size >= size + padding);
+    } else {
+        for (bin = freelist2_find_bin(fl, freelist2_bin_index(size + sizeof(Freelist2_Allocation_Header)));
+             bin < FREELIST2_BIN_COUNT && node == NULL;
+             bin = freelist2_find_bin(fl, bin + 1))
+        {
+            for (Freelist2_Node *curr = fl->bins[bin]; curr != NULL; curr = curr->bin_next) {
+                padding = freelist2_calc_padding((uintptr_t)curr, alignment);
+                if (curr->block_size >= size + padding) {
+                    node = curr;
+                    break;
+                }
+            }
         }
-        prev_node = node;
-        node = node->next;
     }
 
     if (padding_)   *padding_ = padding;
-    if (prev_node_) *prev_node_ = prev_node;
+    if (prev_node_) *prev_node_ = node != NULL ? node->prev : NULL;
     return node;
 }
 
+/* NOTE: FIND_BEST looks at the size classes from the smallest one a fit could be in upwards, and returns the fitting
+   block that wastes the least space (lowest address on a tie) from the first class that has one. Blocks in a higher
+   class are never smaller than the ones in a lower class, so that is the best fit overall. An exact fit is taken as
+   soon as it is seen, and once a class has produced a fit only FREELIST2_BEST_FIT_SCAN_LIMIT more of its blocks are
+   looked at, so a class holding thousands of blocks costs a bounded walk instead of all of them. */
 inline Freelist2_Node *
 freelist2_find_best(Freelist2 *fl, size_t size, size_t alignment, size_t *padding_, Freelist2_Node **prev_node_)
 {
     size_t smallest_diff = ~(size_t)0;
+    Freelist2_Node *best_node = NULL;
+    size_t best_padding = 0;
 
-    Freelist2_Node *node = fl->head,
-                  *prev_node = NULL,
-                  *best_node = NULL;
-
-    size_t padding = 0;
-    while (node != NULL) {
-        padding = calc_padding_with_header((uintptr_t)node, (uintptr_t)alignment,
-                                           sizeof(Freelist2_Allocation_Header));
-        size_t required_space = size + padding;
-        if ((node->block_size >= required_space) &&
-            (node->block_size - required_space) < smallest_diff)
-        {
-            best_node = node;
-            smallest_diff = (node->block_size - required_space);
-            break;
+    for (uint32_t bin = freelist2_find_bin(fl, freelist2_bin_index(size + sizeof(Freelist2_Allocation_Header)));
+         bin < FREELIST2_BIN_COUNT && best_node == NULL;
+         bin = freelist2_find_bin(fl, bin + 1))
+    {
+        uint32_t scanned_after_fit = 0;
+        for (Freelist2_Node *node = fl->bins[bin]; node != NULL; node = node->bin_next) {
+            if (best_node != NULL && scanned_after_fit++ >= FREELIST2_BEST_FIT_SCAN_LIMIT) {
+                break;
+            }
+            size_t padding = freelist2_calc_padding((uintptr_t)node, alignment);
+            size_t required_space = size + padding;
+            if (node->block_size < required_space) {
+                continue;
+            }
+            size_t diff = node->block_size - required_space;
+            if (diff < smallest_diff || (diff == smallest_diff && (uintptr_t)node < (uintptr_t)best_node)) {
+                best_node = node;
+                best_padding = padding;
+                smallest_diff = diff;
+                if (diff == 0) {
+                    break;
+                }
+            }
         }
-        prev_node = node;
-        node = node->next;
     }
 
-    if (padding_) *padding_ = padding;
-    if (prev_node_) *prev_node_ = prev_node;
+    if (padding_) *padding_ = best_padding;
+    if (prev_node_) *prev_node_ = best_node != NULL ? best_node->prev : NULL;
     return best_node;
 }
 
@@ -302,8 +789,11 @@ freelist2_alloc_align(void *fl, size_t size, size_t alignment)
 
     // we have to save info about the free node which this alloc will be when we free it. So we need enough space
     // to store free_node info.
-    if (size < sizeof(Freelist2_Node)) size = sizeof(Freelist2_Node);
+    if (size < FREELIST2_MIN_ALLOCATION_SIZE) size = FREELIST2_MIN_ALLOCATION_SIZE;
     if (alignment < 8) alignment = 8;
+    // NOTE: sizes are kept a multiple of the node alignment, so the free node a split leaves behind every block
+    // (node + required_space here, curr + extra_space and ptr + new_size in realloc) is aligned as well.
+    size = align_forward(size, alignof(Freelist2_Node));
 
     if (freelist->policy == PLACEMENT_POLICY_FIND_BEST) {
         node = freelist2_find_best(freelist, size, alignment, &padding, &prev_node);
@@ -347,12 +837,12 @@ freelist2_alloc_align(void *fl, size_t size, size_t alignment)
 
     header_ptr->block_size = required_space;
     header_ptr->alignment_padding = alignment_padding;
-    header_ptr->alignment_requirement = alignment;
+    freelist2_header_set_alignment(header_ptr, alignment);
+    freelist2_write_block_tag((uintptr_t)node, alignment_padding);
 
     freelist->used += required_space;
 
     void *memory = (void *)((uintptr_t)header_ptr + alloc_header_size);
-    htpush(ptr_ptr, &freelist->table, (uintptr_t)node, (uintptr_t)memory);
     return memory;
 }
 
@@ -379,59 +869,68 @@ freelist2_free(void *fl, void *ptr)
 
     // the actual header comes after padding.
     free_node = (Freelist2_Node *)((uintptr_t)header - header->alignment_padding);
-    free_node->block_size = header->block_size;
-    free_node->next = NULL;
-
-    bool ht_removed = htdel(ptr_ptr, &freelist->table, (uintptr_t)free_node);
-    assert(ht_removed);
-    assert(freelist->used >= free_node->block_size);
-    freelist->used -= free_node->block_size;
-    if (freelist->head != NULL) {
-        Freelist2_Node *node = freelist->head;
-        Freelist2_Node *prev_node = NULL;
-        while (node != NULL) {
-            if (ptr < (void *)node) {
-                freelist2_node_insert(freelist, prev_node, free_node);
-                break;
-            }
-            prev_node = node;
-            node = node->next;
-        }
-        freelist_merge_blocks_if_adjacent(freelist, prev_node, free_node);
+    size_t block_size = header->block_size;
+    assert(freelist2_block_header((uintptr_t)free_node) == header);
+
+    freelist2_owner_release(freelist, header);
+
+    assert(freelist->used >= block_size);
+    freelist->used -= block_size;
+
+    // the physical neighbour after this block being free is also the address-ordered successor, no search needed.
+    uintptr_t block_end = (uintptr_t)free_node + block_size;
+    Freelist2_Node *next_node = NULL;
+    if (block_end < (uintptr_t)freelist->data + freelist->size && freelist2_block_is_free(block_end)) {
+        next_node = (Freelist2_Node *)block_end;
     } else {
-        freelist->head = free_node;
-        freelist->block_count = 1;
+        next_node = freelist2_find_successor(freelist, (uintptr_t)free_node);
     }
+    Freelist2_Node *prev_node = next_node != NULL ? next_node->prev : freelist->tail;
+
+    free_node->block_size = block_size;
+    freelist2_node_insert(freelist, prev_node, free_node);
+    freelist_merge_blocks_if_adjacent(freelist, prev_node, free_node);
 }
 
 inline void
 freelist_merge_blocks_if_adjacent(Freelist2 *fl, Freelist2_Node *prev_node, Freelist2_Node *free_node)
 {
-    if ((free_node->next != NULL) &&
-        (void *)((uintptr_t)free_node + free_node->block_size) == free_node->next)
+    Freelist2_Node *next_node = free_node->next;
+    if ((next_node != NULL) &&
+        (void *)((uintptr_t)free_node + free_node->block_size) == next_node)
     {
-        free_node->block_size += free_node->next->block_size;
+        size_t merged_size = free_node->block_size + next_node->block_size;
         assert(fl->block_count >= 2);
-        freelist2_node_remove(fl, free_node, free_node->next);
+        freelist2_node_remove(fl, free_node, next_node);
+        freelist2_node_resize(fl, free_node, merged_size);
     }
 
-    if ((prev_node != NULL && prev_node->next != NULL) &&
+    if ((prev_node != NULL) &&
         (void *)((uintptr_t)prev_node + prev_node->block_size) == free_node)
     {
-        prev_node->block_size += free_node->block_size;
+        size_t merged_size = prev_node->block_size + free_node->block_size;
         assert(fl->block_count >= 2);
         freelist2_node_remove(fl, prev_node, free_node);
+        freelist2_node_resize(fl, prev_node, merged_size);
     }
     assert(fl->block_count > 0);
 }
 
 inline void *
 freelist2_realloc(void *fl, void *ptr, size_t new_size)
+{
+    return freelist2_realloc_align(fl, ptr, new_size, DEFAULT_ALIGNMENT);
+}
+
+/// @brief grows into the free block right after the allocation whenever that one is big enough, and moves the
+/// allocation (alloc + copy + free) only when it is not, or when ptr lacks the alignment asked for.
+inline void *
+freelist2_realloc_align(void *fl, void *ptr, size_t new_size, size_t alignment)
 {
     assert(fl != NULL);
     if (ptr == NULL) {
         // should behave like alloc.
-        return freelist2_alloc(fl, new_size);
+        return freelist2_alloc_align(fl, new_size, alignment);
     }
     if (new_size == 0) {
         freelist2_free(fl, ptr);
@@ -447,29 +946,43 @@ freelist2_realloc(void *fl, void *ptr, size_t new_size)
     }
 
     Freelist2_Allocation_Header *header = freelist2_get_header(ptr);
-    if ((uintptr_t)ptr % header->alignment_requirement != 0) {
+    size_t block_alignment = freelist2_header_alignment(header);
+    if ((uintptr_t)ptr % block_alignment != 0) {
         // printf("Misaligned memory!\n");
         return NULL;
     }
+    if (alignment < block_alignment) {
+        alignment = block_alignment;
+    }
     size_t header_align_padding = sizeof(Freelist2_Allocation_Header) + header->alignment_padding;
     size_t old_size             = header->block_size - header_align_padding;
+    // the block has to stay big enough to hold a free node, same as in alloc.
+    if (new_size < FREELIST2_MIN_ALLOCATION_SIZE) new_size = FREELIST2_MIN_ALLOCATION_SIZE;
+    new_size = align_forward(new_size, alignof(Freelist2_Node));
+
+    if (((uintptr_t)ptr & (alignment - 1)) != 0) {
+        // the block cannot become more aligned where it is, whatever its size.
+        void *new_ptr = freelist2_alloc_align(freelist, new_size, alignment);
+        if (new_ptr != NULL) {
+            shumemcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+            freelist2_owner_transfer(freelist, header, freelist2_get_header(new_ptr));
+            freelist2_free(freelist, ptr);
+        }
+        return new_ptr;
+    }
     if (old_size == new_size) {
         return ptr;
     }
-    size_t remaining_space = freelist2_remaining_space(freelist);
-    if (new_size > old_size) {
-        assert(remaining_space >= sizeof(Freelist2_Allocation_Header));
-    }
-    if ((new_size > old_size) &&
-        (new_size - old_size) > (remaining_space - sizeof(Freelist2_Allocation_Header)))
-    {
+    // NOTE: used is kept up to date, the free space does not need a walk over the free list.
+    size_t remaining_space = freelist->size - freelist->used;
+    if ((new_size > old_size) && (new_size - old_size) > remaining_space) {
         // printf("Not enough space in the backing buffer!\n");
         return NULL;
     }
 
-    void *new_ptr = freelist2_realloc_sized(fl, ptr, old_size, new_size, header->alignment_requirement);
+    void *new_ptr = freelist2_realloc_sized(fl, ptr, old_size, new_size, alignment);
 
-    assert((freelist2_remaining_space(freelist) + freelist->used) == freelist->size);
+    assert((freelist->size - freelist->used) == freelist2_remaining_space(freelist));
     return new_ptr;
 }
 
@@ -480,54 +993,42 @@ freelist2_realloc_sized(void *fl, void *ptr, size_t old_size, size_t new_size, s
 
     Freelist2 *freelist = (Freelist2 *)fl;
     Freelist2_Allocation_Header *alloc_header = freelist2_get_header(ptr);
+    // the block ends at ptr + old_size, the tag of whatever comes next says whether it is free. no search needed.
+    uintptr_t addr_after_allocation = (uintptr_t)ptr + old_size;
+    bool next_is_free = addr_after_allocation < (uintptr_t)freelist->data + freelist->size &&
+                        freelist2_block_is_free(addr_after_allocation);
     if (old_size < new_size) {
         size_t extra_space = new_size - old_size;
-        for (Freelist2_Node *curr = freelist->head, *prev = NULL;
-             curr != NULL;
-             prev = curr, curr = curr->next)
-        {
-            if ((uintptr_t)curr == ((uintptr_t)ptr + old_size) &&
-                (curr->block_size >= extra_space))
+        Freelist2_Node *curr = (Freelist2_Node *)addr_after_allocation;
+        if (next_is_free && curr->block_size >= extra_space) {
+            Freelist2_Node *prev = curr->prev;
+            const size_t remaining = curr->block_size - extra_space;
+            // NOTE: the new node can overlap the old one, so the old one has to be unlinked first.
+            freelist2_node_remove(freelist, prev, curr);
+            if (remaining > sizeof(Freelist2_Allocation_Header) &&
+                remaining > sizeof(Freelist2_Node))
             {
-                const size_t remaining = curr->block_size - extra_space;
-                if (remaining > sizeof(Freelist2_Allocation_Header) &&
-                    remaining > sizeof(Freelist2_Node))
-                {
-                    Freelist2_Node *new_node = (Freelist2_Node *)((uintptr_t)curr + extra_space);
-                    new_node->next = curr->next;
-                    new_node->block_size = remaining;
-                    if (prev) {
-                        prev->next = new_node;
-                    } else {
-                        freelist->head = new_node;
-                    }
-                } else {
-                    // remaining size in the free block is too small to even store freeblock metadata. Add it to
-                    // the current allocation and remove the whole free block from the freelist.
-                    extra_space += remaining;
-                    freelist2_node_remove(freelist, prev, curr);
-                }
-                alloc_header->block_size += extra_space;
-                freelist->used += extra_space;
-                return ptr;
+                Freelist2_Node *new_node = (Freelist2_Node *)((uintptr_t)curr + extra_space);
+                new_node->block_size = remaining;
+                freelist2_node_insert(freelist, prev, new_node);
+            } else {
+                // remaining size in the free block is too small to even store freeblock metadata. Add it to
+                // the current allocation and remove the whole free block from the freelist.
+                extra_space += remaining;
             }
+            alloc_header->block_size += extra_space;
+            freelist->used += extra_space;
+            return ptr;
         }
 
         // did not find an immediate contiguous freeblock fitting the new size, allocating an entirely new memory
         // block and copyign the old data there.
-        void **original_owner = alloc_header->pOwner;
         void *new_memory_ptr = freelist2_alloc_align(freelist, new_size, alignment);
         if (new_memory_ptr) {
             shumemcpy(new_memory_ptr, ptr, old_size);
+            // the new allocation takes over the owner (and the links to parent and child) of the old one.
+            freelist2_owner_transfer(freelist, alloc_header, freelist2_get_header(new_memory_ptr));
             freelist2_free(freelist, ptr);
-
-            if (original_owner != NULL) {
-                Freelist2_Allocation_Header *header = freelist2_get_header(new_memory_ptr);
-                // copy over the address of the original memory owner to this new header.
-                header->pOwner = original_owner;
-                // make the original allocation owner point to this new memory that was allocated.
-                *header->pOwner = new_memory_ptr;
-            }
             return new_memory_ptr;
         }
 
@@ -541,24 +1042,15 @@ freelist2_realloc_sized(void *fl, void *ptr, size_t old_size, size_t new_size, s
     if (free_space < sizeof(Freelist2_Node)) {
         // cannot make a free node just containing free_space.
         // checking if there is a free block immediately after old allocation.
-        Freelist2_Node *curr = freelist->head;
-        Freelist2_Node *prev = NULL;
-        while (curr != NULL && (uintptr_t)curr < (uintptr_t)ptr) {
-            prev = curr;
-            curr = curr->next;
-        }
-        uintptr_t addr_after_allocation = (uintptr_t)ptr + old_size;
-        if ((uintptr_t)curr == (uintptr_t)(addr_after_allocation)) {
+        if (next_is_free) {
             // lining up
+            Freelist2_Node *curr = (Freelist2_Node *)addr_after_allocation;
+            Freelist2_Node *prev = curr->prev;
             size_t new_block_size = curr->block_size + free_space;
+            freelist2_node_remove(freelist, prev, curr);
             Freelist2_Node *new_node = (Freelist2_Node *)(addr_after_allocation - free_space);
-            new_node->next = curr->next;
             new_node->block_size = new_block_size;
-            if (prev) {
-                prev->next = new_node;
-            } else {
-                freelist->head = new_node;
-            }
+            freelist2_node_insert(freelist, prev, new_node);
             assert(freelist->used > free_space);
             freelist->used -= free_space;
             assert(alloc_header->block_size > free_space);
@@ -575,30 +1067,16 @@ freelist2_realloc_sized(void *fl, void *ptr, size_t old_size, size_t new_size, s
 
     Freelist2_Node *new_node = (Freelist2_Node *)((uintptr_t)ptr + new_size);
     new_node->block_size = free_space;
-    new_node->next = NULL;
 
     assert(freelist->used >= free_space);
     freelist->used -= free_space;
 
-    Freelist2_Node *curr = freelist->head;
-    Freelist2_Node *prev = NULL;
-
-    while (curr && (uintptr_t)curr < (uintptr_t)new_node) {
-        prev = curr;
-        curr = curr->next;
-    }
+    Freelist2_Node *next = next_is_free ? (Freelist2_Node *)addr_after_allocation
+                                        : freelist2_find_successor(freelist, (uintptr_t)new_node);
+    Freelist2_Node *prev = next != NULL ? next->prev : freelist->tail;
 
     freelist2_node_insert(freelist, prev, new_node);
-
-    if (new_node->next && (uintptr_t)new_node + new_node->block_size == (uintptr_t)new_node->next) {
-        new_node->block_size += new_node->next->block_size;
-        freelist2_node_remove(freelist, new_node, new_node->next);
-    }
-
-    if (prev && (uintptr_t)prev + prev->block_size == (uintptr_t)new_node) {
-        prev->block_size += new_node->block_size;
-        freelist2_node_remove(freelist, prev, new_node);
-    }
+    freelist_merge_blocks_if_adjacent(freelist, prev, new_node);
 
     return ptr;
 }
@@ -608,20 +1086,28 @@ freelist2_node_insert(Freelist2 *fl, Freelist2_Node *prev_node, Freelist2_Node *
 {
     assert(prev_node != new_node);
 
+    Freelist2_Node *next_node = prev_node != NULL ? prev_node->next : fl->head;
+    new_node->tag = FREELIST2_TAG_FREE;
+    new_node->prev = prev_node;
+    new_node->next = next_node;
     if (prev_node == NULL) {
-        if (fl->head != NULL) {
-            new_node->next = fl->head;
-        }
         fl->head = new_node;
     } else {
-        if (prev_node->next == NULL) {
-            prev_node->next = new_node;
-            new_node->next = NULL;
-        } else {
-            new_node->next = prev_node->next;
-            prev_node->next = new_node;
-        }
+        prev_node->next = new_node;
     }
+    if (next_node == NULL) {
+        fl->tail = new_node;
+    } else {
+        next_node->prev = new_node;
+    }
+
+    size_t region = freelist2_region_index(fl, (uintptr_t)new_node);
+    if (fl->region_heads[region] == NULL || (uintptr_t)new_node < (uintptr_t)fl->region_heads[region]) {
+        fl->region_heads[region] = new_node;
+        fl->region_bitmap[region >> 6] |= 1ull << (region & 63);
+    }
+
+    freelist2_bin_insert(fl, new_node);
     ++fl->block_count;
     assert(fl->block_count > 0);
 }
@@ -629,164 +1115,194 @@ freelist2_node_insert(Freelist2 *fl, Freelist2_Node *prev_node, Freelist2_Node *
 inline void
 freelist2_node_remove(Freelist2 *fl, Freelist2_Node *prev_node, Freelist2_Node *del_node)
 {
+    assert(prev_node == del_node->prev);
+    freelist2_bin_remove(fl, del_node);
+
+    size_t region = freelist2_region_index(fl, (uintptr_t)del_node);
+    if (fl->region_heads[region] == del_node) {
+        Freelist2_Node *next_node = del_node->next;
+        if (next_node != NULL && freelist2_region_index(fl, (uintptr_t)next_node) == region) {
+            fl->region_heads[region] = next_node;
+        } else {
+            fl->region_heads[region] = NULL;
+            fl->region_bitmap[region >> 6] &= ~(1ull << (region & 63));
+        }
+    }
+
     if (prev_node == NULL) {
         fl->head = del_node->next;
     } else {
         prev_node->next = del_node->next;
     }
+    if (del_node->next == NULL) {
+        fl->tail = prev_node;
+    } else {
+        del_node->next->prev = prev_node;
+    }
     --fl->block_count;
     assert(fl->block_count >= 0);
 }
 
-inline void
-freelist2_defragment(Freelist2 *fl)
+// NOTE: compacted means all free space is one block at the very end of the managed buffer, or there is none.
+static inline bool
+freelist2_is_compacted(Freelist2 *fl)
+{
+    Freelist2_Node *head = fl->head;
+    return head == NULL ||
+           (head->next == NULL && ((uintptr_t)head + head->block_size) == ((uintptr_t)fl->data + fl->size));
+}
+
+/* Moves the allocation that sits right after the lowest free block down into that block, which pushes the free
+   block (merged with the next one if they now touch) further up the buffer. Returns the number of bytes moved. */
+static inline size_t
+freelist2_defragment_move_next(Freelist2 *fl)
 {
     Freelist2_Node *current_free_header = fl->head;
+    assert(!freelist2_is_compacted(fl));
 
-    // continue while there are more freeblocks or we haven't reached the end of managed memory store.
-    while (current_free_header->next != NULL ||
-           ((uintptr_t)current_free_header + current_free_header->block_size) != ((uintptr_t)fl->data + fl->size))
-    {
-        size_t current_free_size = current_free_header->block_size;
-        const uintptr_t next_allocation_start = (uintptr_t)current_free_header + current_free_size;
-
-        // the allocation pointing to memory that is present immediately after the current freeblock.
-        void *allocation_pointer = NULL;
-        size_t header_size = sizeof(Freelist2_Allocation_Header);
-
-        // Check if there is an allocation immediately after the freeblock.
-        htget(ptr_ptr, &fl->table, next_allocation_start, (uintptr_t *)&allocation_pointer);
-        assert(allocation_pointer != NULL);
-
-        // Get the allocation header that immediately precedes the actual allocation.
-        Freelist2_Allocation_Header *allocation_header = freelist2_get_header(allocation_pointer);
-        uintptr_t current_allocation_end = next_allocation_start + allocation_header->block_size;
-
-        // get the padding that was required to satisfy the alignment_requirement for this allocation.
-        const size_t current_padding = (uintptr_t)allocation_header - (uintptr_t)next_allocation_start;
-        // verify that our padding calculation is indeed correct. fuck me if it isn't
-        assert(current_padding == allocation_header->alignment_padding);
-
-        // this is the actual data + header size without the alignment padding.
-        size_t data_size_without_padding = allocation_header->block_size - current_padding;
-
-        // Calculate the new aligned position for this allocation after it is moved down.
-        uintptr_t new_aligned_address = align_forward((uintptr_t)current_free_header + header_size,
-                                                      allocation_header->alignment_requirement);
-        assert(new_aligned_address >= ((uintptr_t)current_free_header + header_size));
-        const size_t new_padding_size = new_aligned_address - ((uintptr_t)current_free_header + header_size);
-
-        // Update total used space based on padding difference.
-        if (new_padding_size > current_padding) {
-            fl->used += (new_padding_size - current_padding);
-        } else {
-            assert(fl->used >= (current_padding - new_padding_size));
-            fl->used -= (current_padding - new_padding_size);
-        }
+    size_t current_free_size = current_free_header->block_size;
+    const uintptr_t next_allocation_start = (uintptr_t)current_free_header + current_free_size;
 
-        // Calculate new positions and update the header.
-        uintptr_t new_header_position = new_aligned_address - header_size;
-        uintptr_t current_header_position = (uintptr_t)allocation_header;
+    size_t header_size = sizeof(Freelist2_Allocation_Header);
 
-        size_t new_total_size = data_size_without_padding + new_padding_size;
-        allocation_header->block_size = new_total_size;
-        allocation_header->alignment_padding = new_padding_size;
+    // free blocks are always coalesced, so the block right after the current freeblock is an allocation. Its tag
+    // says where its header is.
+    Freelist2_Allocation_Header *allocation_header = freelist2_block_header(next_allocation_start);
+    const size_t current_block_size = allocation_header->block_size;
+    uintptr_t current_allocation_end = next_allocation_start + allocation_header->block_size;
 
-        /* telling my daddy to point to my new address now, AND daddy's allocation header to my header. */
-        *allocation_header->pOwner = (void *)new_aligned_address;
-        if ((uintptr_t)allocation_header->pOwner > (uintptr_t)fl->data &&
-            (uintptr_t)allocation_header->pOwner < ((uintptr_t)fl->data + fl->size))
-        {
-            Freelist2_Allocation_Header *parent_header = freelist2_get_header(allocation_header->pOwner);
-            parent_header->child_header = (Freelist2_Allocation_Header *)new_header_position;
-        }
-        assert((uintptr_t)new_aligned_address >= ((uintptr_t)fl->data + sizeof(Freelist2_Allocation_Header)));
-        /*
-            telling the child allocation(if any), that I, your daddy, moved, so that when he moves, he can tell me,
-            his daddy(the correct one), his new address after memmove. to be honest, I never thought I would write
-            this sentence ever in my life.
-        */
-        if (allocation_header->child_header) {
-            allocation_header->child_header->pOwner = (void **)new_aligned_address;
-        }
+    // get the padding that was required to satisfy the alignment_requirement for this allocation.
+    const size_t current_padding = (uintptr_t)allocation_header - (uintptr_t)next_allocation_start;
+    // verify that our padding calculation is indeed correct. fuck me if it isn't
+    assert(current_padding == allocation_header->alignment_padding);
 
-        // making a copy of the current freenode since after the memmove, its memory will be corrupted.
-        // this could be the free block node that the current node merges with.
-        Freelist2_Node *current_freenode_next = current_free_header->next;
+    // this is the actual data + header size without the alignment padding.
+    size_t data_size_without_padding = allocation_header->block_size - current_padding;
 
-#ifdef ALLOCATOR_DEBUG
-        Freelist2_Allocation_Header old_header = *allocation_header;
-#endif
+    // Calculate the new aligned position for this allocation after it is moved down.
+    const size_t alignment = freelist2_header_alignment(allocation_header);
+    uintptr_t new_aligned_address = align_forward((uintptr_t)current_free_header + header_size, alignment);
+    assert(new_aligned_address >= ((uintptr_t)current_free_header + header_size));
+    size_t new_padding_size = new_aligned_address - ((uintptr_t)current_free_header + header_size);
+    if (new_padding_size > 0 && new_padding_size < sizeof(size_t)) {
+        // no room for the block tag.
+        new_padding_size += alignment;
+        new_aligned_address += alignment;
+    }
+
+    // Calculate new positions and update the header.
+    uintptr_t new_header_position = new_aligned_address - header_size;
+    uintptr_t current_header_position = (uintptr_t)allocation_header;
+
+    size_t new_total_size = data_size_without_padding + new_padding_size;
+    // verify that the allocation was moved down.
+    assert((uintptr_t)current_free_header + new_total_size <= current_allocation_end);
+    size_t new_free_space = current_allocation_end - ((uintptr_t)current_free_header + new_total_size);
+    if (new_free_space < sizeof(Freelist2_Node)) {
+        // too small to be a free block, the allocation keeps it.
+        new_total_size += new_free_space;
+        new_free_space = 0;
+    }
+
+    // Update total used space based on the size difference of the allocation block.
+    assert(fl->used >= current_block_size);
+    fl->used = fl->used - current_block_size + new_total_size;
+
+    allocation_header->block_size = new_total_size;
+    allocation_header->alignment_padding = new_padding_size;
+
+    assert((uintptr_t)new_aligned_address >= ((uintptr_t)fl->data + sizeof(Freelist2_Allocation_Header)));
+    freelist2_owner_moved(fl, allocation_header, new_header_position);
 
-        // move the allocation down to its new position.
-        memmove((void *)new_header_position, (void *)current_header_position, data_size_without_padding);
-        // This is the new header pointer AFTER moving the allocation down.
-        Freelist2_Allocation_Header *new_allocation_header = (Freelist2_Allocation_Header *)new_header_position;
+    // the memmove below can overwrite the current freenode, so take it out of the free block index first.
+    freelist2_node_remove(fl, NULL, current_free_header);
 
 #ifdef ALLOCATOR_DEBUG
-        assert(memcmp(&old_header, new_allocation_header, sizeof(Freelist2_Allocation_Header)) == 0);
-        /* NOTE: The below line won't work since freelist2_get_block_offset only works for valid allocations. Since
-         * we moved memory between regions which could be overlapping, the old header becomes invald after the
-         * memmove operation:-
-         * size_t c = freelist2_get_block_offset(fl, (void *)(current_header_position + sizeof(Freelist2_Allocation_Header)));
-         */
-        size_t old_block_offset = (uintptr_t)(current_header_position - old_header.alignment_padding) - (uintptr_t)fl->data;
-        size_t new_block_offset = freelist2_get_block_offset(fl, (void *)(new_header_position + sizeof(Freelist2_Allocation_Header)));
-        printf("<freelist2_defragment>: Moved %s from offset(%llu) to new offset (%llu) New Block Start is 0x%llx.\n",
-               new_allocation_header->allocation_label, old_block_offset, new_block_offset,
-               (uintptr_t)new_allocation_header - new_allocation_header->alignment_padding);
-        printf("-- <freelist2_defragment::hashtable>: Removing the old block offset (%llu) from the hashtable.\n",
-               (next_allocation_start - (uintptr_t)fl->data));
+    Freelist2_Allocation_Header old_header = *allocation_header;
 #endif
-        // update the hash table with the new position for this allocation(since it was moved).
-        htdel(ptr_ptr, &fl->table, next_allocation_start);
 
-        // the address where the freeblock starts should be the beginning of any allocation
-        // block(alignmentPadding+header+payload). So, verify that this is the case.
-        assert(((uintptr_t)new_allocation_header - new_allocation_header->alignment_padding) ==
-               (uintptr_t)current_free_header);
+    // move the allocation down to its new position.
+    memmove((void *)new_header_position, (void *)current_header_position, data_size_without_padding);
+    // This is the new header pointer AFTER moving the allocation down.
+    Freelist2_Allocation_Header *new_allocation_header = (Freelist2_Allocation_Header *)new_header_position;
+    (void)new_allocation_header;
+
 #ifdef ALLOCATOR_DEBUG
-        printf("-- <freelist2_defragment::hashtable>: Pushing the new allocation block start(%llu) to the "
-               "hashtable.\n",
-               freelist2_get_block_offset(fl, (void *)new_aligned_address));
+    assert(memcmp(&old_header, new_allocation_header, sizeof(Freelist2_Allocation_Header)) == 0);
+    /* NOTE: The below line won't work since freelist2_get_block_offset only works for valid allocations. Since
+     * we moved memory between regions which could be overlapping, the old header becomes invald after the
+     * memmove operation:-
+     * size_t c = freelist2_get_block_offset(fl, (void *)(current_header_position + sizeof(Freelist2_Allocation_Header)));
+     */
+    size_t old_block_offset = (uintptr_t)(current_header_position - old_header.alignment_padding) - (uintptr_t)fl->data;
+    size_t new_block_offset = freelist2_get_block_offset(fl, (void *)(new_header_position + sizeof(Freelist2_Allocation_Header)));
+    printf("<freelist2_defragment>: Moved %s from offset(%llu) to new offset (%llu) New Block Start is 0x%llx.\n",
+           new_allocation_header->allocation_label, old_block_offset, new_block_offset,
+           (uintptr_t)new_allocation_header - new_allocation_header->alignment_padding);
 #endif
-        htpush(ptr_ptr, &fl->table, (uintptr_t)current_free_header, new_aligned_address);
 
-        // Calculate the new freeblock size after moving allocation.
-        uintptr_t new_allocation_end = (uintptr_t)current_free_header + new_total_size;
-        // verify that the allocation was moved down.
-        assert(new_allocation_end <= current_allocation_end);
-        size_t new_free_space = current_allocation_end - new_allocation_end;
+    // the address where the freeblock starts should be the beginning of any allocation
+    // block(alignmentPadding+header+payload). So, verify that this is the case.
+    assert(((uintptr_t)new_allocation_header - new_allocation_header->alignment_padding) ==
+           (uintptr_t)current_free_header);
+    freelist2_write_block_tag((uintptr_t)current_free_header, new_padding_size);
+
+    if (new_free_space == 0) {
+        return data_size_without_padding;
+    }
+
+    // Remove the current freeblock and create a new one.
+    uintptr_t new_allocation_end = (uintptr_t)current_free_header + new_total_size;
+    Freelist2_Node *moved_current_freeblock = (Freelist2_Node *)new_allocation_end;
+    moved_current_freeblock->block_size = new_free_space;
+    // Since this will always be the first block in the freelist, it goes in at the head.
+    freelist2_node_insert(fl, NULL, moved_current_freeblock);
 
-        // Remove the current freeblock and create a new one.
-        Freelist2_Node *moved_current_freeblock = (Freelist2_Node *)new_allocation_end;
-        moved_current_freeblock->block_size = new_free_space;
-        moved_current_freeblock->next = current_freenode_next;
-        // Since this will always be the first block in the freelist, point the head to it.
-        fl->head = moved_current_freeblock;
+    // if the newlyMoved freeblock is adjacent to the next freeblock, merge both of them and set the pointers
+    // correctly. the coalescene function handles the case where these two are not adjacent.
+    freelist_merge_blocks_if_adjacent(fl, NULL, moved_current_freeblock);
+    return data_size_without_padding;
+}
 
-        // if the newlyMoved freeblock is adjacent to the next freeblock, merge both of them and set the pointers
-        // correctly. the coalescene function handles the case where these two are not adjacent.
-        freelist_merge_blocks_if_adjacent(fl, moved_current_freeblock, moved_current_freeblock->next);
-        current_free_header = moved_current_freeblock;
+/* Incremental defragmentation. Moves allocations down one at a time until at least budget_bytes have been moved or
+   the heap is compacted, and returns true once it is. There is no cursor to keep between calls: the next
+   allocation to move is always the one after the lowest free block, so allocations and frees in between steps
+   are fine. A single allocation is never split across calls, so one larger than the budget still moves in one go. */
+inline bool
+freelist2_defragment_step(Freelist2 *fl, size_t budget_bytes)
+{
+    size_t moved = 0;
+    while (!freelist2_is_compacted(fl)) {
+        if (moved >= budget_bytes && moved > 0) {
+            return false;
+        }
+        moved += freelist2_defragment_move_next(fl);
     }
+    return true;
+}
+
+inline void
+freelist2_defragment(Freelist2 *fl)
+{
+    freelist2_defragment_step(fl, ~(size_t)0);
 
-    // verify only one freenode left after defragmentation.
-    assert(current_free_header == fl->head && current_free_header->next == NULL);
-    // the freenode is pushed to the end of the freelist
-    assert(((uintptr_t)current_free_header + current_free_header->block_size) == ((uintptr_t)fl->data + fl->size));
+    // verify only one freenode left after defragmentation, and that it is pushed to the end of the freelist.
+    assert(freelist2_is_compacted(fl));
 
 #ifdef ALLOCATOR_DEBUG
     size_t free_space = freelist2_remaining_space(fl);
-    assert(current_free_header->block_size == free_space);
-    assert(current_free_header->block_size + fl->used == fl->size);
+    assert(fl->used + free_space == fl->size);
 #endif
 }
 
 inline void
 freelist2_destroy(Freelist2 *fl)
 {
-    htdestroy(ptr_ptr, &fl->table);
+    free(fl->region_heads);
+    free(fl->region_bitmap);
+#ifdef FREELIST2_COMPACT_HEADER
+    free(fl->owners);
+#endif
     memset(fl, 0, sizeof(Freelist2));
 }
 
@@ -859,11 +1375,61 @@ freelist2_validate_used_memory(Freelist2 *fl, void *base_addr, size_t total_size
     assert(fl->used <= total_size);
 }
 
+// Helper function to validate the size class bins and the region directory against the address-ordered list
+static void
+freelist2_validate_index(Freelist2 *fl)
+{
+    int binned_count = 0;
+    for (uint32_t bin = 0; bin < FREELIST2_BIN_COUNT; ++bin) {
+        bool has_blocks = (fl->bin_bitmap[bin >> 6] & (1ull << (bin & 63))) != 0;
+        assert(has_blocks == (fl->bins[bin] != NULL));
+        for (Freelist2_Node *node = fl->bins[bin]; node != NULL; node = node->bin_next) {
+            assert(freelist2_bin_index(node->block_size) == bin);
+            assert(node->bin_next == NULL || node->bin_next->bin_prev == node);
+            ++binned_count;
+        }
+    }
+    assert(binned_count == fl->block_count);
+
+    int listed_count = 0;
+    Freelist2_Node *prev = NULL;
+    for (Freelist2_Node *node = fl->head; node != NULL; prev = node, node = node->next) {
+        assert(node->prev == prev);
+        size_t region = freelist2_region_index(fl, (uintptr_t)node);
+        if (prev == NULL || freelist2_region_index(fl, (uintptr_t)prev) != region) {
+            assert(fl->region_heads[region] == node);
+        }
+        ++listed_count;
+    }
+    assert(fl->tail == prev);
+    assert(listed_count == fl->block_count);
+
+    // walk every block through the block tags, they have to tile the buffer exactly.
+    int tagged_free_count = 0;
+    size_t tagged_used = 0;
+    uintptr_t block = (uintptr_t)fl->data;
+    while (block < (uintptr_t)fl->data + fl->size) {
+        if (freelist2_block_is_free(block)) {
+            block += ((Freelist2_Node *)block)->block_size;
+            ++tagged_free_count;
+        } else {
+            Freelist2_Allocation_Header *header = freelist2_block_header(block);
+            assert((uintptr_t)header - header->alignment_padding == block);
+            block += header->block_size;
+            tagged_used += header->block_size;
+        }
+    }
+    assert(block == (uintptr_t)fl->data + fl->size);
+    assert(tagged_free_count == fl->block_count);
+    assert(tagged_used == fl->used);
+}
+
 static void
 freelist2_validate_memory(Freelist2 *fl, void *base_addr, size_t total_size)
 {
     freelist2_validate_order(fl);
     freelist2_validate_used_memory(fl, base_addr, total_size);
+    freelist2_validate_index(fl);
 }
 
 static void
@@ -1046,9 +1612,59 @@ freelist2_realloc_tests()
         freelist2_test_initial_state(&fl);
     }
 
+    // printf("5. In place growth and shrealloc...\n");
+    {
+        // grows into the free block after it without moving, also through the alloc_api like darr/queue do.
+        int *arr = shalloc_arr(api, int, 16);
+        for (int i = 0; i < 16; ++i) arr[i] = i;
+        for (int capacity = 32; capacity <= 4096; capacity *= 2) {
+            int *grown = shrealloc_arr(api, arr, int, capacity);
+            assert(grown == arr);
+            for (int i = 0; i < capacity / 2; ++i) assert(grown[i] == i);
+            for (int i = capacity / 2; i < capacity; ++i) grown[i] = i;
+            freelist2_validate_memory(&fl, memory, mem_size);
+        }
+
+        // with the next block taken it has to move, and the contents go along (unaligned tail included).
+        int *blocker = shalloc_arr(api, int, 8);
+        size_t used = fl.used;
+        unsigned char *moved = (unsigned char *)shrealloc_arr(api, arr, int, 8192 + 3);
+        assert(moved != NULL && moved != (unsigned char *)arr);
+        for (int i = 0; i < 4096; ++i) assert(((int *)moved)[i] == i);
+        assert(fl.used > used);
+        freelist2_validate_memory(&fl, memory, mem_size);
+
+        // a bigger alignment than the block has moves it even when shrinking.
+        void *aligned = freelist2_realloc_align(&fl, moved, 64, 256);
+        assert(aligned != NULL && ((uintptr_t)aligned & 255) == 0);
+        for (int i = 0; i < 16; ++i) assert(((int *)aligned)[i] == i);
+
+        freelist2_free(&fl, aligned);
+        freelist2_free(&fl, blocker);
+        freelist2_validate_memory(&fl, memory, mem_size);
+        freelist2_test_initial_state(&fl);
+    }
+
+    // printf("6. shumemcpy with every source/destination misalignment...\n");
+    {
+        unsigned char src[300], dst[300];
+        for (int i = 0; i < 300; ++i) src[i] = (unsigned char)(i * 7 + 1);
+        for (int s_off = 0; s_off < 16; ++s_off) {
+            for (int d_off = 0; d_off < 16; ++d_off) {
+                for (size_t size = 0; size < 280; size += 13) {
+                    memset(dst, 0, sizeof(dst));
+                    shumemcpy(dst + d_off, src + s_off, size);
+                    assert(memcmp(dst + d_off, src + s_off, size) == 0);
+                    assert(dst[d_off + size] == 0);
+                }
+            }
+        }
+    }
+
     freelist2_test_initial_state(&fl);
     freelist2_free_all(&fl);
     freelist2_test_initial_state(&fl);
+    freelist2_destroy(&fl);
     free(memory);
     // printf("All realloc tests passed successfully!\n");
 }
@@ -1249,6 +1865,7 @@ freelist2_fragmentation_tests()
     // --------------------------------------------------------------------------------------------
 
     // Cleanup
+    freelist2_destroy(&fl);
     free(memory);
     // printf("fragmentation tests passed successfully!\n\n");
 }
@@ -1293,7 +1910,7 @@ freelist2_alignment_tests()
         assert(remaining == mem_size);
         size = mem_size - sizeof(Freelist2_Allocation_Header) - 1;
         ptr1 = freelist2_alloc(&fl, size);
-        // 1 byte free but too small for headers, returns all memory
+        // rounded up to a multiple of 8 it is the whole buffer again
         assert((ptr1 != NULL) && (fl.head == NULL) &&
                (fl.block_count == 0) && (fl.used == mem_size));
         remaining = freelist2_remaining_space(&fl);
@@ -1301,14 +1918,15 @@ freelist2_alignment_tests()
         freelist2_free(&fl, ptr1);
         remaining = freelist2_remaining_space(&fl);
         assert(remaining == mem_size);
-        size = mem_size - (2 * sizeof(Freelist2_Allocation_Header) + 1);
+        size = mem_size - (sizeof(Freelist2_Allocation_Header) + sizeof(Freelist2_Node) + 8);
         ptr1 = freelist2_alloc(&fl, size);
-        // Space left for free node, but only 1 usable byte due to header size
+        // Space left for free node, but only 8 usable bytes due to header size
         remaining = freelist2_remaining_space(&fl);
         assert((ptr1 != NULL) && (fl.head != NULL) && (fl.block_count == 1) &&
                (fl.used == size + sizeof(Freelist2_Allocation_Header)));
-        assert(remaining == sizeof(Freelist2_Allocation_Header)+1);
-        // NOTE: Realloc: Grows allocation by 1 byte (should succeed since we have 1 byte allocatable)
+        assert(remaining == sizeof(Freelist2_Node)+8);
+        // NOTE: Realloc: Grows allocation by 1 byte, which rounds up to 8 (should succeed since we have 8 bytes
+        // allocatable)
         // the edgecase here: when we ask for 1 more byte, the remaining size in the freelist will equal the size
         // of the allocation header. In other words, that freespace is useless for any new allocation, since for
         // each allocation, the freelist needs atleast the header_size bytes, so what the freelist does is allocate
@@ -1318,12 +1936,12 @@ freelist2_alignment_tests()
         remaining = freelist2_remaining_space(&fl);
         assert((ptr1 != NULL) && (fl.head == NULL) &&
                (fl.block_count == 0) && (fl.used == fl.size));
-        // Realloc: Shrinks allocation back to original size. The remaining space will be sizeof(header)+1 byte
+        // Realloc: Shrinks allocation back to original size. The remaining space will be sizeof(node)+8 bytes
         ptr1 = freelist2_realloc(&fl, ptr1, size);
         remaining = freelist2_remaining_space(&fl);
         assert((ptr1 != NULL) && (fl.head != NULL) && (fl.block_count == 1) &&
-               (fl.used == (mem_size - (sizeof(Freelist2_Allocation_Header) + 1))) &&
-               (fl.head->block_size == (sizeof(Freelist2_Allocation_Header) + 1)));
+               (fl.used == (mem_size - (sizeof(Freelist2_Node) + 8))) &&
+               (fl.head->block_size == (sizeof(Freelist2_Node) + 8)));
         freelist2_free(&fl, ptr1);
         remaining = freelist2_remaining_space(&fl);
         assert(remaining == mem_size);
@@ -1416,8 +2034,8 @@ freelist2_alignment_tests()
         size_t total_allocated_minus_padding = 0;
         size_t expected_allocated = 0;
         for (int i = 0; i < sizeof(test_cases)/sizeof(test_cases[0]); ++i) {
-            expected_allocated += test_cases[i].size > sizeof(Freelist2_Node) ? test_cases[i].size
-                                                                             : sizeof(Freelist2_Node);
+            expected_allocated += test_cases[i].size > FREELIST2_MIN_ALLOCATION_SIZE ? test_cases[i].size
+                                                                             : FREELIST2_MIN_ALLOCATION_SIZE;
         }
 
         for (size_t i = 0; i < sizeof(test_cases)/sizeof(test_cases[0]); i++) {
@@ -1433,7 +2051,7 @@ freelist2_alignment_tests()
             allocationHeaders[i] = *header;
             assert((fl.used - used_before) == (header->block_size));
             size_t actual_alloc = (header->block_size - header->alignment_padding - alloc_header_size);
-            assert(actual_alloc == alloc_size || actual_alloc == sizeof(Freelist2_Node));
+            assert(actual_alloc == alloc_size || actual_alloc == FREELIST2_MIN_ALLOCATION_SIZE);
             total_allocated_minus_padding += actual_alloc;
 
             // Fill allocated memory with pattern
@@ -1461,7 +2079,7 @@ freelist2_alignment_tests()
         {
             size_t allocatedBlockIndex = free_order[i];
             size_t size = test_cases[allocatedBlockIndex].size;
-            size_t size_exp = size < sizeof(Freelist2_Node) ? sizeof(Freelist2_Node) : size;
+            size_t size_exp = size < FREELIST2_MIN_ALLOCATION_SIZE ? FREELIST2_MIN_ALLOCATION_SIZE : size;
             size_t alignment = test_cases[allocatedBlockIndex].alignment;
 
             Freelist2_Allocation_Header *header = (Freelist2_Allocation_Header *)((char *)allocations[allocatedBlockIndex] -
@@ -1500,7 +2118,7 @@ freelist2_alignment_tests()
         Freelist2_Allocation_Header *header1 = (Freelist2_Allocation_Header *)((char *)ptr1 - alloc_header_size);
         assert((fl.used - used_before) == header1->block_size);
         size_t actual_alloc1 = (header1->block_size - header1->alignment_padding - alloc_header_size);
-        assert(actual_alloc1 == sizeof(Freelist2_Node)); // Minimum allocation size
+        assert(actual_alloc1 == FREELIST2_MIN_ALLOCATION_SIZE); // Minimum allocation size
 
         void *ptr2 = freelist2_alloc_align(&fl, 1, 8);
         assert(ptr2 != NULL);
@@ -1508,25 +2126,25 @@ freelist2_alignment_tests()
         Freelist2_Allocation_Header *header2 = (Freelist2_Allocation_Header *)((char *)ptr2 - alloc_header_size);
         assert((fl.used - (used_before + header1->block_size)) == header2->block_size);
         size_t actual_alloc2 = (header2->block_size - header2->alignment_padding - alloc_header_size);
-        assert(actual_alloc2 == sizeof(Freelist2_Node)); // Minimum allocation size
+        assert(actual_alloc2 == FREELIST2_MIN_ALLOCATION_SIZE); // Minimum allocation size
 
         void *ptr3 = freelist2_alloc_align(&fl, 1, max_alignment);
         assert(ptr3 != NULL);
         assert((uintptr_t)ptr3 % max_alignment == 0);
         Freelist2_Allocation_Header *header3 = (Freelist2_Allocation_Header *)((char *)ptr3 - alloc_header_size);
         size_t actual_alloc3 = (header3->block_size - header3->alignment_padding - alloc_header_size);
-        assert(actual_alloc3 == sizeof(Freelist2_Node)); // Minimum allocation size
+        assert(actual_alloc3 == FREELIST2_MIN_ALLOCATION_SIZE); // Minimum allocation size
 
         // Verify no overlap
         if (ptr1 < ptr2) {
-            assert((uintptr_t)ptr1 + sizeof(Freelist2_Node) <= (uintptr_t)ptr2);
+            assert((uintptr_t)ptr1 + FREELIST2_MIN_ALLOCATION_SIZE <= (uintptr_t)ptr2);
         } else {
-            assert((uintptr_t)ptr2 + sizeof(Freelist2_Node) <= (uintptr_t)ptr1);
+            assert((uintptr_t)ptr2 + FREELIST2_MIN_ALLOCATION_SIZE <= (uintptr_t)ptr1);
         }
         if (ptr2 < ptr3) {
-            assert((uintptr_t)ptr2 + sizeof(Freelist2_Node) <= (uintptr_t)ptr3);
+            assert((uintptr_t)ptr2 + FREELIST2_MIN_ALLOCATION_SIZE <= (uintptr_t)ptr3);
         } else {
-            assert((uintptr_t)ptr3 + sizeof(Freelist2_Node) <= (uintptr_t)ptr2);
+            assert((uintptr_t)ptr3 + FREELIST2_MIN_ALLOCATION_SIZE <= (uintptr_t)ptr2);
         }
 
         freelist2_free(&fl, ptr1);
@@ -1539,6 +2157,7 @@ freelist2_alignment_tests()
     }
 
     assert((fl.block_count == 1) && (fl.used == 0) && (fl.head->block_size == mem_size));
+    freelist2_destroy(&fl);
     free(memory);
     // printf("All alignment tests passed successfully!\n");
 }
@@ -1622,7 +2241,9 @@ freelist2_test_alternating_patterns()
         }
     }
 
-    free(fl.data);
+    void *data = fl.data;
+    freelist2_destroy(&fl);
+    free(data);
 }
 
 // Test 2: Random allocation sizes
@@ -1669,7 +2290,9 @@ static void freelist2_test_random_sizes() {
         }
     }
 
-    free(fl.data);
+    void *data = fl.data;
+    freelist2_destroy(&fl);
+    free(data);
 }
 
 // Test 3: Edge case - Maximum fragmentation
@@ -1717,7 +2340,9 @@ static void freelist2_test_maximum_fragmentation() {
         }
     }
 
-    free(fl.data);
+    void *data = fl.data;
+    freelist2_destroy(&fl);
+    free(data);
 }
 
 // Test 4: Alignment stress test
@@ -1768,7 +2393,9 @@ static void freelist2_test_alignments() {
         }
     }
 
-    free(fl.data);
+    void *data = fl.data;
+    freelist2_destroy(&fl);
+    free(data);
 }
 
 // Test 5: Fibonacci-based allocation pattern
@@ -1810,7 +2437,9 @@ static void freelist2_test_fibonacci_pattern() {
 
     freelist2_defragment(&fl);
 
-    free(fl.data);
+    void *data = fl.data;
+    freelist2_destroy(&fl);
+    free(data);
 }
 
 // Test 6: Prime number sized allocations
@@ -1855,7 +2484,9 @@ static void freelist2_test_prime_sizes() {
 
     freelist2_defragment(&fl);
 
-    free(fl.data);
+    void *data = fl.data;
+    freelist2_destroy(&fl);
+    free(data);
 }
 
 // Test 7: Pyramid pattern
@@ -1904,7 +2535,9 @@ static void freelist2_test_pyramid_pattern() {
 
     freelist2_defragment(&fl);
 
-    free(fl.data);
+    void *data = fl.data;
+    freelist2_destroy(&fl);
+    free(data);
 }
 
 // Test 8: Extreme alignment requirements
@@ -1947,7 +2580,9 @@ static void freelist2_test_extreme_alignments() {
         }
     }
 
-    free(fl.data);
+    void *data = fl.data;
+    freelist2_destroy(&fl);
+    free(data);
 }
 
 // Test 9: Interlaced allocations
@@ -1987,7 +2622,9 @@ static void freelist2_test_interlaced_pattern() {
 
     freelist2_defragment(&fl);
 
-    free(fl.data);
+    void *data = fl.data;
+    freelist2_destroy(&fl);
+    free(data);
 }
 
 static void
@@ -2001,7 +2638,7 @@ freelist2_test_fragmentation_recovery()
     int count = 0;
     size_t total_allocated = 0;
 
-    size_t allocation_unit = sizeof(Freelist2_Node);  // 16 bytes minimum
+    size_t allocation_unit = FREELIST2_MIN_ALLOCATION_SIZE;
     size_t overhead_per_alloc = sizeof(Freelist2_Allocation_Header);
     size_t total_size_per_alloc = allocation_unit + overhead_per_alloc;
 
@@ -2089,7 +2726,9 @@ freelist2_test_fragmentation_recovery()
 
     // printf("\tVerified %d original allocations remain intact\n", verified);
 
-    free(fl.data);
+    void *data = fl.data;
+    freelist2_destroy(&fl);
+    free(data);
 }
 
 static void
@@ -2115,6 +2754,9 @@ freelist2_test_realloc()
         // Verify we can write to the expanded region
         memset(a + 32, 0xB, 32);
         freelist2_free_all(&fl);
+        void *data = fl.data;
+        freelist2_destroy(&fl);
+        free(data);
     }
     // Test 2: Realloc with size decrease
     {
@@ -2129,6 +2771,9 @@ freelist2_test_realloc()
             assert(a[i] == 0xA);
         }
         freelist2_free_all(&fl);
+        void *data = fl.data;
+        freelist2_destroy(&fl);
+        free(data);
     }
     // Test 3: Realloc between other allocations
     {
@@ -2149,6 +2794,9 @@ freelist2_test_realloc()
             assert(c[i] == 0xC);
         }
         freelist2_free_all(&fl);
+        void *data = fl.data;
+        freelist2_destroy(&fl);
+        free(data);
     }
     // Test 4: Realloc to same size (should be no-op)
     {
@@ -2164,6 +2812,9 @@ freelist2_test_realloc()
             assert(a[i] == 0xA);
         }
         freelist2_free_all(&fl);
+        void *data = fl.data;
+        freelist2_destroy(&fl);
+        free(data);
     }
     // Test 5: Edge case - realloc to zero size
     {
@@ -2173,6 +2824,9 @@ freelist2_test_realloc()
         a = (char *)freelist2_realloc(&fl, a, 0);
         assert(a == NULL);  // Should behave like free
         freelist2_free_all(&fl);
+        void *data = fl.data;
+        freelist2_destroy(&fl);
+        free(data);
     }
     // Test 6: Edge case - realloc null pointer (should behave like alloc)
     {
@@ -2183,6 +2837,9 @@ freelist2_test_realloc()
         assert(a != NULL);
         memset(a, 0xA, 32);  // Should be able to write to memory
         freelist2_free_all(&fl);
+        void *data = fl.data;
+        freelist2_destroy(&fl);
+        free(data);
     }
     // Test 7: Realloc near pool size limit
     {
@@ -2196,10 +2853,252 @@ freelist2_test_realloc()
         // Original allocation should still be valid
         assert(a != NULL);
         freelist2_free_all(&fl);
+        void *data = fl.data;
+        freelist2_destroy(&fl);
+        free(data);
+    }
+    // Test 8: growing in place reads the tag of the block after the allocation: a free one is taken over, an
+    // allocated one forces a move, and a block that ends the buffer has nothing after it to look at.
+    {
+        Freelist2 fl;
+        freelist2_init(&fl, malloc(POOL_SIZE), POOL_SIZE, DEFAULT_ALIGN);
+        char *a = (char *)freelist2_alloc(&fl, 64);
+        char *b = (char *)freelist2_alloc(&fl, 64);
+        char *c = (char *)freelist2_alloc(&fl, 64);
+        memset(a, 0xA, 64);
+        freelist2_free(&fl, b);
+        char *grown = (char *)freelist2_realloc(&fl, a, 96);
+        assert(grown == a);
+        for (int i = 0; i < 64; i++) {
+            assert(grown[i] == 0xA);
+        }
+        freelist2_validate_memory(&fl, fl.data, POOL_SIZE);
+        // c right behind it is allocated, so this has to move.
+        grown = (char *)freelist2_realloc(&fl, grown, 256);
+        assert(grown != NULL && grown != a);
+        assert(grown[0] == 0xA && grown[63] == 0xA);
+        freelist2_validate_memory(&fl, fl.data, POOL_SIZE);
+        freelist2_free(&fl, grown);
+        freelist2_free(&fl, c);
+        freelist2_test_initial_state(&fl);
+
+        // one allocation spanning the whole buffer: shrinking it by less than a node keeps it where it is.
+        size_t whole = POOL_SIZE - sizeof(Freelist2_Allocation_Header);
+        char *d = (char *)freelist2_alloc(&fl, whole);
+        assert(d != NULL && fl.used == POOL_SIZE);
+        assert(freelist2_realloc(&fl, d, whole - 8) == d);
+        assert(freelist2_realloc(&fl, d, whole + 8) == NULL);
+        freelist2_free(&fl, d);
+        freelist2_test_initial_state(&fl);
+        void *data = fl.data;
+        freelist2_destroy(&fl);
+        free(data);
     }
     // printf("All realloc tests completed successfully!\n");
 }
 
+// Test: size class lookup and address-ordered coalescing across regions
+static void
+freelist2_test_segregated_fit()
+{
+    Freelist2 fl = {};
+    void *memory = malloc(MEMORY_SIZE);
+    freelist2_init(&fl, memory, MEMORY_SIZE, DEFAULT_ALIGNMENT);
+
+    void *ptrs[MAX_ALLOCATIONS] = {};
+    unsigned int seed = 1234;
+    for (int i = 0; i < MAX_ALLOCATIONS; i++) {
+        seed = seed * 1103515245u + 12345u;
+        ptrs[i] = freelist2_alloc(&fl, 16 * (1 + (seed >> 16) % 44));
+        assert(ptrs[i] != NULL);
+    }
+    freelist2_validate_memory(&fl, memory, MEMORY_SIZE);
+
+    // punch holes all over the buffer, these span many regions.
+    for (int i = 0; i < MAX_ALLOCATIONS; i += 3) {
+        freelist2_free(&fl, ptrs[i]);
+        ptrs[i] = NULL;
+    }
+    freelist2_validate_memory(&fl, memory, MEMORY_SIZE);
+
+    // best fit: a request the exact size of a hole goes into a hole of that size and leaves no new free block
+    // behind.
+    {
+        int block_count = fl.block_count;
+        Freelist2_Node *hole = fl.head;
+        size_t hole_size = hole->block_size;
+        size_t payload = hole_size - sizeof(Freelist2_Allocation_Header);
+        void *p = freelist2_alloc(&fl, payload);
+        Freelist2_Allocation_Header *header =
+            (Freelist2_Allocation_Header *)((uintptr_t)p - sizeof(Freelist2_Allocation_Header));
+        assert(header->block_size == hole_size);
+        assert(fl.block_count == block_count - 1);
+        freelist2_validate_memory(&fl, memory, MEMORY_SIZE);
+        freelist2_free(&fl, p);
+        assert(fl.block_count == block_count);
+    }
+
+    // first fit: whatever block comes back has to actually fit.
+    fl.policy = PLACEMENT_POLICY_FIND_FIRST;
+    for (int i = 0; i < MAX_ALLOCATIONS; i += 3) {
+        ptrs[i] = freelist2_alloc_align(&fl, 64 + (i % 5) * 100, (size_t)16 << (i % 4));
+        assert(ptrs[i] != NULL && ((uintptr_t)ptrs[i] & (((size_t)16 << (i % 4)) - 1)) == 0);
+        memset(ptrs[i], 0xEE, 64 + (i % 5) * 100);
+    }
+    freelist2_validate_memory(&fl, memory, MEMORY_SIZE);
+    fl.policy = PLACEMENT_POLICY_FIND_BEST;
+
+    // freeing everything in reverse order has to coalesce back into one block.
+    for (int i = MAX_ALLOCATIONS - 1; i >= 0; i--) {
+        if (ptrs[i] != NULL) {
+            freelist2_free(&fl, ptrs[i]);
+        }
+    }
+    freelist2_validate_memory(&fl, memory, MEMORY_SIZE);
+    freelist2_test_initial_state(&fl);
+
+    freelist2_destroy(&fl);
+    free(memory);
+}
+
+// Test: defragmenting a bit at a time, with allocations happening in between steps
+static void
+freelist2_test_incremental_defragment()
+{
+    Freelist2 fl = {};
+    freelist2_init(&fl, malloc(MEMORY_SIZE), MEMORY_SIZE, DEFAULT_ALIGNMENT);
+
+    TestAllocation allocations[200] = {};
+    for (int i = 0; i < 200; i++) {
+        allocations[i].size = MEDIUM_ALLOCATION + (i % 7) * 16;
+        allocations[i].ptr = freelist2_alloc(&fl, allocations[i].size);
+        freelist2_set_allocation_owner(&fl, allocations[i].ptr, &allocations[i].ptr);
+        freelist2_fill_memory_pattern(allocations[i].ptr, allocations[i].size, i);
+        allocations[i].is_active = true;
+    }
+    for (int i = 0; i < 200; i += 2) {
+        freelist2_free(&fl, allocations[i].ptr);
+        allocations[i].is_active = false;
+    }
+
+    int steps = 0;
+    bool done = false;
+    while (!done) {
+        int block_count = fl.block_count;
+        done = freelist2_defragment_step(&fl, 1024);
+        ++steps;
+        // a step only ever removes holes.
+        assert(fl.block_count <= block_count);
+        freelist2_validate_memory(&fl, fl.data, MEMORY_SIZE);
+        for (int i = 1; i < 200; i += 2) {
+            freelist2_verify_memory_contents(allocations[i].ptr, allocations[i].size, i);
+        }
+
+        // reuse one of the freed slots part way through, the next step just carries on from the lowest hole.
+        if (steps == 10) {
+            allocations[0].ptr = freelist2_alloc(&fl, allocations[0].size);
+            freelist2_set_allocation_owner(&fl, allocations[0].ptr, &allocations[0].ptr);
+            freelist2_fill_memory_pattern(allocations[0].ptr, allocations[0].size, 0);
+            allocations[0].is_active = true;
+        }
+    }
+    // 100 live blocks of ~300 bytes with a 1KiB budget cannot be done in a handful of steps.
+    assert(steps > 10);
+    assert(fl.head != NULL && fl.head->next == NULL);
+    assert((uintptr_t)fl.head + fl.head->block_size == (uintptr_t)fl.data + fl.size);
+    freelist2_verify_memory_contents(allocations[0].ptr, allocations[0].size, 0);
+
+    // an already compacted heap is a no-op.
+    assert(freelist2_defragment_step(&fl, 1024));
+
+    void *data = fl.data;
+    freelist2_destroy(&fl);
+    free(data);
+}
+
+typedef struct Freelist2_Test_Parent {
+    // NOTE: an owner slot inside an allocation has to be its first field.
+    unsigned char *child;
+    size_t child_size;
+} Freelist2_Test_Parent;
+
+// parent -> child owner links have to survive realloc moving a child and defragmentation moving both.
+static void
+freelist2_test_owner_links()
+{
+    Freelist2 fl = {};
+    freelist2_init(&fl, malloc(MEMORY_SIZE), MEMORY_SIZE, DEFAULT_ALIGNMENT);
+
+#ifdef FREELIST2_COMPACT_HEADER
+#ifndef ALLOCATOR_DEBUG
+    static_assert(sizeof(Freelist2_Allocation_Header) == 16, "");
+#endif
+    // a small allocation only pays for the header, and is rounded up so it can hold a free node later.
+    void *small = freelist2_alloc(&fl, 16);
+    assert(freelist2_block_size(small) == sizeof(Freelist2_Node));
+    freelist2_free(&fl, small);
+    // no owner, no side table.
+    assert(fl.owners == NULL);
+#endif
+
+    enum { PARENT_COUNT = 64 };
+    Freelist2_Test_Parent *parents[PARENT_COUNT];
+    void *fillers[PARENT_COUNT];
+    for (int i = 0; i < PARENT_COUNT; i++) {
+        parents[i] = (Freelist2_Test_Parent *)freelist2_alloc(&fl, sizeof(Freelist2_Test_Parent));
+        freelist2_set_allocation_owner(&fl, parents[i], (void **)&parents[i]);
+        fillers[i] = freelist2_alloc(&fl, SMALL_ALLOCATION);
+
+        Freelist2_Test_Parent *parent = parents[i];
+        parent->child_size = 16 + (i % 4) * 16;
+        parent->child = (unsigned char *)freelist2_alloc(&fl, parent->child_size);
+        freelist2_set_allocation_owner(&fl, parent->child, (void **)&parent->child);
+        freelist2_fill_memory_pattern(parent->child, parent->child_size, i);
+    }
+#ifdef FREELIST2_COMPACT_HEADER
+    // one record per allocation with an owner, plus the unused record 0.
+    assert(fl.owner_count == 1 + 2 * PARENT_COUNT);
+#endif
+
+    for (int i = 0; i < PARENT_COUNT; i++) {
+        freelist2_free(&fl, fillers[i]);
+    }
+    // the next block is taken by the following parent, so these children have to move to grow.
+    for (int i = 0; i < PARENT_COUNT; i += 3) {
+        Freelist2_Test_Parent *parent = parents[i];
+        unsigned char *old_child = parent->child;
+        void *grown = freelist2_realloc(&fl, parent->child, parent->child_size + 256);
+        assert(grown != NULL && grown == parent->child && grown != old_child);
+        parent->child_size += 256;
+        memset(parent->child + parent->child_size - 256, i, 256);
+    }
+
+    freelist2_defragment(&fl);
+    assert(fl.block_count == 1);
+    freelist2_validate_memory(&fl, fl.data, MEMORY_SIZE);
+    for (int i = 0; i < PARENT_COUNT; i++) {
+        freelist2_verify_memory_contents(parents[i]->child, parents[i]->child_size, i);
+    }
+
+    for (int i = 0; i < PARENT_COUNT; i++) {
+        freelist2_free(&fl, parents[i]->child);
+        freelist2_free(&fl, parents[i]);
+    }
+    assert(fl.used == 0 && fl.block_count == 1);
+#ifdef FREELIST2_COMPACT_HEADER
+    // freed records get reused instead of growing the table.
+    uint32_t owner_count = fl.owner_count;
+    void *reused = freelist2_alloc(&fl, 64);
+    freelist2_set_allocation_owner(&fl, reused, &reused);
+    assert(fl.owner_count == owner_count);
+    freelist2_free(&fl, reused);
+#endif
+
+    void *data = fl.data;
+    freelist2_destroy(&fl);
+    free(data);
+}
+
 static void
 freelist2_test_managed()
 {
@@ -2214,6 +3113,9 @@ freelist2_test_managed()
     freelist2_test_interlaced_pattern();
     freelist2_test_fragmentation_recovery();
     freelist2_test_realloc();
+    freelist2_test_segregated_fit();
+    freelist2_test_incremental_defragment();
+    freelist2_test_owner_links();
 }
 
 inline void
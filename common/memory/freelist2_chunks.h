@@ -0,0 +1,700 @@
+#ifndef FREELIST2_CHUNKS_H
+#define FREELIST2_CHUNKS_H
+
+// standard headers first, memory.h defines min/max as macros.
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "memory.h"
+
+#ifdef FREELIST2_CHUNKS_IMPLEMENTATION
+#ifndef FREELIST2_ALLOCATOR_IMPLEMENTATION
+#define FREELIST2_ALLOCATOR_IMPLEMENTATION
+#endif
+#endif
+#include <memory/freelist2_alloc.h>
+
+#ifdef FREELIST2_COMPACT_HEADER
+// compaction forwards the owner links stored in the headers, the compact header keeps them in a per heap side table.
+#error "Freelist2_Chunks needs the full Freelist2_Allocation_Header."
+#endif
+
+/*
+    A Freelist2 heap split into equally sized chunks, each one a Freelist2 of its own with its own free lists. An
+    allocation lives entirely inside one chunk, so chunks can be compacted independently of each other and
+    freelist2_chunks_defragment compacts all of them in parallel.
+
+    Owner tracking works like it does for a single Freelist2 (pOwner/child_header), except that an owner may live
+    in a different chunk than the allocation it owns. Because of that, compaction does not move blocks one at a
+    time like freelist2_defragment does. It runs in three phases, each one parallel over the chunks, with all threads
+    joined in between:
+        1. plan:   every chunk works out where each of its allocations slides down to.
+        2. fix up: every chunk patches the owners of its moved allocations and forwards the pOwner/child_header links
+                   in its own headers, looking up the new address of anything in another chunk in that chunk's plan.
+                   Nothing has moved yet, so every write lands at an old address and gets carried along in phase 3.
+        3. move:   every chunk slides its allocations down and rebuilds its free lists.
+*/
+
+/// @brief where one allocation block of a chunk ends up. Blocks that stay put are in the plan too.
+typedef struct Freelist2_Move {
+    uintptr_t old_block;
+    uintptr_t new_block;
+    size_t old_block_size;
+    size_t new_block_size;
+    size_t old_alignment_padding;
+    size_t new_alignment_padding;
+} Freelist2_Move;
+
+typedef struct Freelist2_Chunk_Plan {
+    Freelist2_Move *moves;
+    size_t count;
+    size_t capacity;
+} Freelist2_Chunk_Plan;
+
+typedef struct Freelist2_Chunks {
+    alloc_api api;
+
+    void *data;
+    size_t size;
+    size_t chunk_size;
+    size_t chunk_count;
+    Freelist2 *chunks;
+    Freelist2_Chunk_Plan *plans;
+
+    /// @brief chunk the last allocation came from, the next one starts looking there.
+    size_t current_chunk;
+} Freelist2_Chunks;
+
+void        freelist2_chunks_init(Freelist2_Chunks *fc, void *data, size_t size, size_t chunk_size, size_t alignment);
+alloc_api  *freelist2_chunks_get_api(Freelist2_Chunks *fc);
+void       *freelist2_chunks_alloc(void *fc, size_t size);
+void       *freelist2_chunks_alloc_align(void *fc, size_t size, size_t alignment);
+void        freelist2_chunks_free(void *fc, void *ptr);
+void       *freelist2_chunks_realloc(void *fc, void *ptr, size_t new_size);
+void       *freelist2_chunks_realloc_align(void *fc, void *ptr, size_t new_size, size_t alignment);
+void        freelist2_chunks_free_all(void *fc);
+bool        freelist2_chunks_set_allocation_owner(Freelist2_Chunks *fc, void *ptr, void **owner);
+Freelist2  *freelist2_chunks_find(Freelist2_Chunks *fc, void *ptr);
+void        freelist2_chunks_defragment(Freelist2_Chunks *fc, unsigned thread_count);
+void        freelist2_chunks_destroy(Freelist2_Chunks *fc);
+
+#ifdef FREELIST2_CHUNKS_UNIT_TESTS
+void freelist2_chunks_unit_tests();
+#endif
+
+#ifdef FREELIST2_CHUNKS_IMPLEMENTATION
+
+static inline bool
+freelist2_chunks_contains(Freelist2_Chunks *fc, uintptr_t address)
+{
+    return address >= (uintptr_t)fc->data && address < (uintptr_t)fc->data + fc->size;
+}
+
+static inline size_t
+freelist2_chunks_index(Freelist2_Chunks *fc, uintptr_t address)
+{
+    assert(freelist2_chunks_contains(fc, address));
+    return (size_t)(address - (uintptr_t)fc->data) / fc->chunk_size;
+}
+
+inline Freelist2 *
+freelist2_chunks_find(Freelist2_Chunks *fc, void *ptr)
+{
+    return &fc->chunks[freelist2_chunks_index(fc, (uintptr_t)ptr)];
+}
+
+inline void
+freelist2_chunks_init(Freelist2_Chunks *fc, void *data, size_t size, size_t chunk_size, size_t alignment)
+{
+    assert(chunk_size > 0 && chunk_size <= size);
+    memset(fc, 0, sizeof(Freelist2_Chunks));
+    fc->data = data;
+    fc->size = size;
+    fc->chunk_size = chunk_size;
+    fc->chunk_count = (size + chunk_size - 1) / chunk_size;
+    fc->chunks = (Freelist2 *)calloc(fc->chunk_count, sizeof(Freelist2));
+    fc->plans = (Freelist2_Chunk_Plan *)calloc(fc->chunk_count, sizeof(Freelist2_Chunk_Plan));
+    fc->current_chunk = 0;
+
+    for (size_t i = 0; i < fc->chunk_count; ++i) {
+        size_t offset = i * chunk_size;
+        size_t this_size = (size - offset) < chunk_size ? (size - offset) : chunk_size;
+        freelist2_init(&fc->chunks[i], (void *)((uintptr_t)data + offset), this_size, alignment);
+    }
+
+    fc->api.alloc = freelist2_chunks_alloc;
+    fc->api.alloc_align = freelist2_chunks_alloc_align;
+    fc->api.realloc = freelist2_chunks_realloc;
+    fc->api.realloc_align = freelist2_chunks_realloc_align;
+    fc->api.free = freelist2_chunks_free;
+    fc->api.free_all = freelist2_chunks_free_all;
+
+    fc->api.alignment = alignment;
+    fc->api.allocator = (void *)fc;
+}
+
+inline alloc_api *
+freelist2_chunks_get_api(Freelist2_Chunks *fc)
+{
+    return &fc->api;
+}
+
+inline void *
+freelist2_chunks_alloc(void *fc, size_t size)
+{
+    return freelist2_chunks_alloc_align(fc, size, DEFAULT_ALIGNMENT);
+}
+
+inline void *
+freelist2_chunks_alloc_align(void *fc, size_t size, size_t alignment)
+{
+    assert(fc != NULL);
+    Freelist2_Chunks *chunks = (Freelist2_Chunks *)fc;
+
+    for (size_t i = 0; i < chunks->chunk_count; ++i) {
+        size_t index = (chunks->current_chunk + i) % chunks->chunk_count;
+        Freelist2 *chunk = &chunks->chunks[index];
+        if (chunk->size - chunk->used < size + sizeof(Freelist2_Allocation_Header)) {
+            continue;
+        }
+
+        void *memory = freelist2_alloc_align(chunk, size, alignment);
+        if (memory != NULL) {
+            chunks->current_chunk = index;
+            return memory;
+        }
+    }
+    return NULL;
+}
+
+inline void
+freelist2_chunks_free(void *fc, void *ptr)
+{
+    assert(fc != NULL);
+    if (ptr == NULL) {
+        return;
+    }
+    Freelist2_Chunks *chunks = (Freelist2_Chunks *)fc;
+    Freelist2 *chunk = freelist2_chunks_find(chunks, ptr);
+
+    // freelist2_free only unlinks a parent in the same chunk.
+    Freelist2_Allocation_Header *header = freelist2_get_header(ptr);
+    if (freelist2_chunks_contains(chunks, (uintptr_t)header->pOwner) &&
+        freelist2_chunks_find(chunks, (void *)header->pOwner) != chunk)
+    {
+        Freelist2_Allocation_Header *parent_header = freelist2_get_header((void *)header->pOwner);
+        if (parent_header->child_header == header) {
+            parent_header->child_header = NULL;
+        }
+    }
+    freelist2_free(chunk, ptr);
+}
+
+/* NOTE: freelist2_owner_transfer for an allocation that moves to another chunk. Its owner and its child can be in any
+   chunk, so the parent is looked up in the whole heap instead of the allocation's own chunk. */
+static inline void
+freelist2_chunks_owner_transfer(Freelist2_Chunks *fc, Freelist2_Allocation_Header *old_header,
+                                Freelist2_Allocation_Header *new_header)
+{
+    void *new_memory = (void *)((uintptr_t)new_header + sizeof(Freelist2_Allocation_Header));
+    new_header->pOwner = old_header->pOwner;
+    new_header->child_header = old_header->child_header;
+    old_header->pOwner = NULL;
+    old_header->child_header = NULL;
+    if (freelist2_chunks_contains(fc, (uintptr_t)new_header->pOwner)) {
+        freelist2_get_header((void *)new_header->pOwner)->child_header = new_header;
+    }
+    if (new_header->child_header != NULL) {
+        new_header->child_header->pOwner = (void **)new_memory;
+    }
+    if (new_header->pOwner != NULL) {
+        *new_header->pOwner = new_memory;
+    }
+}
+
+inline void *
+freelist2_chunks_realloc(void *fc, void *ptr, size_t new_size)
+{
+    return freelist2_chunks_realloc_align(fc, ptr, new_size, DEFAULT_ALIGNMENT);
+}
+
+inline void *
+freelist2_chunks_realloc_align(void *fc, void *ptr, size_t new_size, size_t alignment)
+{
+    assert(fc != NULL);
+    Freelist2_Chunks *chunks = (Freelist2_Chunks *)fc;
+    if (ptr == NULL) {
+        return freelist2_chunks_alloc_align(fc, new_size, alignment);
+    }
+    if (new_size == 0) {
+        freelist2_chunks_free(fc, ptr);
+        return NULL;
+    }
+
+    Freelist2 *chunk = freelist2_chunks_find(chunks, ptr);
+    void *new_ptr = freelist2_realloc_align(chunk, ptr, new_size, alignment);
+    if (new_ptr != NULL) {
+        // freelist2_realloc_align only relinks a parent in the same chunk when it moves the allocation.
+        Freelist2_Allocation_Header *new_header = freelist2_get_header(new_ptr);
+        if (new_ptr != ptr && freelist2_chunks_contains(chunks, (uintptr_t)new_header->pOwner) &&
+            freelist2_chunks_find(chunks, (void *)new_header->pOwner) != chunk)
+        {
+            freelist2_get_header((void *)new_header->pOwner)->child_header = new_header;
+        }
+        return new_ptr;
+    }
+
+    // the allocation's own chunk is full, move it to another one.
+    Freelist2_Allocation_Header *header = freelist2_get_header(ptr);
+    size_t old_size = header->block_size - header->alignment_padding - sizeof(Freelist2_Allocation_Header);
+    if (alignment < header->alignment_requirement) {
+        alignment = header->alignment_requirement;
+    }
+
+    new_ptr = freelist2_chunks_alloc_align(fc, new_size, alignment);
+    if (new_ptr == NULL) {
+        return NULL;
+    }
+    shumemcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    // the new allocation takes over the owner and the links to parent and child, the old one leaves without any.
+    freelist2_chunks_owner_transfer(chunks, header, freelist2_get_header(new_ptr));
+    freelist2_chunks_free(fc, ptr);
+    return new_ptr;
+}
+
+inline void
+freelist2_chunks_free_all(void *fc)
+{
+    Freelist2_Chunks *chunks = (Freelist2_Chunks *)fc;
+    for (size_t i = 0; i < chunks->chunk_count; ++i) {
+        freelist2_free_all(&chunks->chunks[i]);
+    }
+    chunks->current_chunk = 0;
+}
+
+inline bool
+freelist2_chunks_set_allocation_owner(Freelist2_Chunks *fc, void *allocation, void **pOwner)
+{
+    assert(fc && pOwner);
+    if (allocation == NULL) {
+        return false;
+    }
+
+    // takes care of the owner and of a parent in the same chunk.
+    Freelist2 *chunk = freelist2_chunks_find(fc, allocation);
+    bool result = freelist2_set_allocation_owner(chunk, allocation, pOwner);
+
+    if (freelist2_chunks_contains(fc, (uintptr_t)pOwner) && freelist2_chunks_find(fc, (void *)pOwner) != chunk) {
+        Freelist2_Allocation_Header *parent_header = freelist2_get_header((void *)pOwner);
+        parent_header->child_header = freelist2_get_header(allocation);
+    }
+    return result;
+}
+
+// NOTE: new address of a byte inside the managed memory, given every chunk's plan. Anything else is returned as is.
+static inline uintptr_t
+freelist2_chunks_forward(Freelist2_Chunks *fc, uintptr_t address)
+{
+    if (!freelist2_chunks_contains(fc, address)) {
+        return address;
+    }
+
+    // last move whose block starts at or before address.
+    Freelist2_Chunk_Plan *plan = &fc->plans[freelist2_chunks_index(fc, address)];
+    size_t lo = 0, hi = plan->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (plan->moves[mid].old_block <= address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return address;
+    }
+
+    Freelist2_Move *move = &plan->moves[lo - 1];
+    if (address >= move->old_block + move->old_block_size) {
+        return address;
+    }
+    // the header and the payload move together, only the padding in front of them changes.
+    uintptr_t old_header = move->old_block + move->old_alignment_padding;
+    uintptr_t new_header = move->new_block + move->new_alignment_padding;
+    assert(address >= old_header);
+    return new_header + (address - old_header);
+}
+
+static inline void
+freelist2_chunks_plan_push(Freelist2_Chunk_Plan *plan, const Freelist2_Move *move)
+{
+    if (plan->count == plan->capacity) {
+        plan->capacity = plan->capacity ? plan->capacity * 2 : 64;
+        plan->moves = (Freelist2_Move *)realloc(plan->moves, plan->capacity * sizeof(Freelist2_Move));
+    }
+    plan->moves[plan->count++] = *move;
+}
+
+/* Phase 1: slide every allocation of the chunk down over the free space in front of it, in address order. The plan
+   ends up holding the final layout of the chunk. */
+static inline void
+freelist2_chunks_plan_chunk(Freelist2 *fl, Freelist2_Chunk_Plan *plan)
+{
+    plan->count = 0;
+    uintptr_t chunk_end = (uintptr_t)fl->data + fl->size;
+    uintptr_t cursor = (uintptr_t)fl->data;
+
+    uintptr_t block = (uintptr_t)fl->data;
+    while (block < chunk_end) {
+        if (freelist2_block_is_free(block)) {
+            block += ((Freelist2_Node *)block)->block_size;
+            continue;
+        }
+
+        Freelist2_Allocation_Header *header = freelist2_block_header(block);
+        size_t data_size = header->block_size - header->alignment_padding;
+        Freelist2_Move move = {block, block, header->block_size, header->block_size,
+                               header->alignment_padding, header->alignment_padding};
+        if (cursor != block) {
+            size_t new_padding = freelist2_calc_padding(cursor, header->alignment_requirement) -
+                                 sizeof(Freelist2_Allocation_Header);
+            // large alignments can need more padding than the free space in front of the block gives back.
+            if (cursor + new_padding + data_size <= block + header->block_size) {
+                move.new_block = cursor;
+                move.new_block_size = new_padding + data_size;
+                move.new_alignment_padding = new_padding;
+            }
+        }
+        freelist2_chunks_plan_push(plan, &move);
+        cursor = move.new_block + move.new_block_size;
+        block += header->block_size;
+    }
+
+    // a gap at the end too small to be a free block goes to the last allocation.
+    if (plan->count > 0 && chunk_end - cursor < sizeof(Freelist2_Node)) {
+        plan->moves[plan->count - 1].new_block_size += chunk_end - cursor;
+    }
+}
+
+/* Phase 2: for every allocation of the chunk, tell its owner where it is going and forward the links in its header to
+   wherever their targets are going. */
+static inline void
+freelist2_chunks_fix_up_chunk(Freelist2_Chunks *fc, Freelist2_Chunk_Plan *plan)
+{
+    for (size_t i = 0; i < plan->count; ++i) {
+        Freelist2_Move *move = &plan->moves[i];
+        Freelist2_Allocation_Header *header =
+            (Freelist2_Allocation_Header *)(move->old_block + move->old_alignment_padding);
+        if (header->pOwner != NULL) {
+            if (move->new_block != move->old_block || move->new_alignment_padding != move->old_alignment_padding) {
+                uintptr_t new_header = move->new_block + move->new_alignment_padding;
+                *header->pOwner = (void *)(new_header + sizeof(Freelist2_Allocation_Header));
+            }
+            header->pOwner = (void **)freelist2_chunks_forward(fc, (uintptr_t)header->pOwner);
+        }
+        if (header->child_header != NULL) {
+            header->child_header =
+                (Freelist2_Allocation_Header *)freelist2_chunks_forward(fc, (uintptr_t)header->child_header);
+        }
+    }
+}
+
+// Phase 3: carry out the chunk's plan, then rebuild its free lists from the gaps it leaves.
+static inline void
+freelist2_chunks_move_chunk(Freelist2 *fl, Freelist2_Chunk_Plan *plan)
+{
+    freelist2_reset_free_blocks(fl);
+
+    uintptr_t cursor = (uintptr_t)fl->data;
+    size_t used = 0;
+    for (size_t i = 0; i < plan->count; ++i) {
+        Freelist2_Move *move = &plan->moves[i];
+        Freelist2_Allocation_Header *old_header =
+            (Freelist2_Allocation_Header *)(move->old_block + move->old_alignment_padding);
+        Freelist2_Allocation_Header *new_header =
+            (Freelist2_Allocation_Header *)(move->new_block + move->new_alignment_padding);
+        if (new_header != old_header) {
+            // blocks only ever slide down and are moved in address order, so nothing is overwritten before it moved.
+            memmove((void *)new_header, (void *)old_header, move->old_block_size - move->old_alignment_padding);
+        }
+        new_header->block_size = move->new_block_size;
+        new_header->alignment_padding = move->new_alignment_padding;
+        freelist2_write_block_tag(move->new_block, move->new_alignment_padding);
+
+        if (move->new_block > cursor) {
+            Freelist2_Node *node = (Freelist2_Node *)cursor;
+            node->block_size = move->new_block - cursor;
+            freelist2_node_insert(fl, fl->tail, node);
+        }
+        cursor = move->new_block + move->new_block_size;
+        used += move->new_block_size;
+    }
+
+    uintptr_t chunk_end = (uintptr_t)fl->data + fl->size;
+    if (chunk_end > cursor) {
+        Freelist2_Node *node = (Freelist2_Node *)cursor;
+        node->block_size = chunk_end - cursor;
+        freelist2_node_insert(fl, fl->tail, node);
+    }
+    fl->used = used;
+}
+
+template <typename Fn>
+static inline void
+freelist2_chunks_parallel_for(Freelist2_Chunks *fc, unsigned thread_count, Fn &&fn)
+{
+    std::atomic<size_t> next_chunk{0};
+    auto worker = [&]() {
+        for (size_t i = next_chunk.fetch_add(1); i < fc->chunk_count; i = next_chunk.fetch_add(1)) {
+            fn(i);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < thread_count; ++t) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+/* NOTE: thread_count 0 uses every hardware thread. The calling thread is one of the workers. No other thread may use
+   the heap while this runs. */
+inline void
+freelist2_chunks_defragment(Freelist2_Chunks *fc, unsigned thread_count)
+{
+    if (thread_count == 0) {
+        thread_count = std::thread::hardware_concurrency();
+    }
+    if (thread_count > fc->chunk_count) {
+        thread_count = (unsigned)fc->chunk_count;
+    }
+
+    freelist2_chunks_parallel_for(fc, thread_count, [fc](size_t i) {
+        freelist2_chunks_plan_chunk(&fc->chunks[i], &fc->plans[i]);
+    });
+    freelist2_chunks_parallel_for(fc, thread_count, [fc](size_t i) {
+        freelist2_chunks_fix_up_chunk(fc, &fc->plans[i]);
+    });
+    freelist2_chunks_parallel_for(fc, thread_count, [fc](size_t i) {
+        freelist2_chunks_move_chunk(&fc->chunks[i], &fc->plans[i]);
+        fc->plans[i].count = 0;
+    });
+}
+
+inline void
+freelist2_chunks_destroy(Freelist2_Chunks *fc)
+{
+    for (size_t i = 0; i < fc->chunk_count; ++i) {
+        freelist2_destroy(&fc->chunks[i]);
+        free(fc->plans[i].moves);
+    }
+    free(fc->chunks);
+    free(fc->plans);
+    memset(fc, 0, sizeof(Freelist2_Chunks));
+}
+
+#ifdef FREELIST2_CHUNKS_UNIT_TESTS
+typedef struct Freelist2_Chunks_Test_Parent {
+    // NOTE: an owner slot inside a managed allocation has to be its first field.
+    unsigned char *child;
+    size_t child_size;
+    unsigned char pattern;
+} Freelist2_Chunks_Test_Parent;
+
+static void
+freelist2_chunks_verify_compacted(Freelist2_Chunks *fc)
+{
+    for (size_t i = 0; i < fc->chunk_count; ++i) {
+        Freelist2 *chunk = &fc->chunks[i];
+        // at most one free block, at the very end of the chunk.
+        assert(chunk->block_count <= 1);
+        if (chunk->head != NULL) {
+            assert((uintptr_t)chunk->head + chunk->head->block_size == (uintptr_t)chunk->data + chunk->size);
+            assert(chunk->head->block_size + chunk->used == chunk->size);
+        } else {
+            assert(chunk->used == chunk->size);
+        }
+    }
+}
+
+static void
+freelist2_chunks_test_parallel_defragment(unsigned thread_count)
+{
+    const size_t chunk_size = 64 * 1024;
+    const size_t mem_size = 16 * chunk_size;
+    void *memory = malloc(mem_size);
+
+    Freelist2_Chunks fc;
+    freelist2_chunks_init(&fc, memory, mem_size, chunk_size, DEFAULT_ALIGNMENT);
+
+    enum { PARENT_COUNT = 1200 };
+    static Freelist2_Chunks_Test_Parent *parents[PARENT_COUNT];
+    static bool live[PARENT_COUNT];
+
+    // parents and children get allocated in separate passes so most of the owner links cross chunks.
+    for (int i = 0; i < PARENT_COUNT; ++i) {
+        parents[i] = (Freelist2_Chunks_Test_Parent *)freelist2_chunks_alloc(&fc, sizeof(Freelist2_Chunks_Test_Parent));
+        assert(parents[i] != NULL);
+        freelist2_chunks_set_allocation_owner(&fc, parents[i], (void **)&parents[i]);
+        live[i] = true;
+    }
+    for (int i = 0; i < PARENT_COUNT; ++i) {
+        Freelist2_Chunks_Test_Parent *parent = parents[i];
+        parent->child_size = 16 + (i % 9) * 24;
+        parent->pattern = (unsigned char)i;
+        parent->child = (unsigned char *)freelist2_chunks_alloc_align(&fc, parent->child_size, (size_t)16 << (i % 3));
+        assert(parent->child != NULL);
+        freelist2_chunks_set_allocation_owner(&fc, parent->child, (void **)&parent->child);
+        memset(parent->child, parent->pattern, parent->child_size);
+    }
+
+    // free a third of the parents along with their children, and the children of another third.
+    for (int i = 0; i < PARENT_COUNT; ++i) {
+        if (i % 3 == 0) {
+            freelist2_chunks_free(&fc, parents[i]->child);
+            freelist2_chunks_free(&fc, parents[i]);
+            live[i] = false;
+        } else if (i % 3 == 1) {
+            freelist2_chunks_free(&fc, parents[i]->child);
+            parents[i]->child = NULL;
+        }
+    }
+
+    freelist2_chunks_defragment(&fc, thread_count);
+    freelist2_chunks_verify_compacted(&fc);
+
+    for (int i = 0; i < PARENT_COUNT; ++i) {
+        if (!live[i]) {
+            continue;
+        }
+        Freelist2_Chunks_Test_Parent *parent = parents[i];
+        Freelist2_Allocation_Header *parent_header = freelist2_get_header(parent);
+        assert(parent_header->pOwner == (void **)&parents[i]);
+        assert(parent->pattern == (unsigned char)i);
+        if (parent->child == NULL) {
+            continue;
+        }
+        for (size_t b = 0; b < parent->child_size; ++b) {
+            assert(parent->child[b] == parent->pattern);
+        }
+        assert(((uintptr_t)parent->child & (((size_t)16 << (i % 3)) - 1)) == 0);
+        // the links between the two headers followed both of them.
+        Freelist2_Allocation_Header *child_header = freelist2_get_header(parent->child);
+        assert(child_header->pOwner == (void **)&parent->child);
+        assert(parent_header->child_header == child_header);
+    }
+
+    // the heap is still fully usable afterwards.
+    for (int i = 0; i < PARENT_COUNT; ++i) {
+        if (live[i]) {
+            if (parents[i]->child != NULL) {
+                freelist2_chunks_free(&fc, parents[i]->child);
+            }
+            freelist2_chunks_free(&fc, parents[i]);
+        }
+    }
+    for (size_t i = 0; i < fc.chunk_count; ++i) {
+        assert(fc.chunks[i].used == 0 && fc.chunks[i].block_count == 1);
+    }
+
+    freelist2_chunks_destroy(&fc);
+    free(memory);
+}
+
+static void
+freelist2_chunks_test_realloc_across_chunks()
+{
+    const size_t chunk_size = 4 * 1024;
+    void *memory = malloc(4 * chunk_size);
+
+    Freelist2_Chunks fc;
+    freelist2_chunks_init(&fc, memory, 4 * chunk_size, chunk_size, DEFAULT_ALIGNMENT);
+
+    unsigned char *p = (unsigned char *)freelist2_chunks_alloc(&fc, 1024);
+    freelist2_chunks_set_allocation_owner(&fc, p, (void **)&p);
+    memset(p, 0x5a, 1024);
+    // fill the rest of the first chunk so growing has to leave it.
+    void *filler = freelist2_chunks_alloc(&fc, chunk_size - 1024 - 2 * sizeof(Freelist2_Allocation_Header) - 200);
+    assert(freelist2_chunks_find(&fc, filler) == freelist2_chunks_find(&fc, p));
+
+    Freelist2 *old_chunk = freelist2_chunks_find(&fc, p);
+    unsigned char *q = (unsigned char *)freelist2_chunks_realloc(&fc, p, 2048);
+    assert(q != NULL && q == p);
+    assert(freelist2_chunks_find(&fc, q) != old_chunk);
+    for (int i = 0; i < 1024; ++i) {
+        assert(q[i] == 0x5a);
+    }
+
+    freelist2_chunks_destroy(&fc);
+    free(memory);
+}
+
+static void
+freelist2_chunks_test_realloc_parent_across_chunks()
+{
+    const size_t chunk_size = 4 * 1024;
+    void *memory = malloc(4 * chunk_size);
+
+    Freelist2_Chunks fc;
+    freelist2_chunks_init(&fc, memory, 4 * chunk_size, chunk_size, DEFAULT_ALIGNMENT);
+    assert(fc.api.realloc_align == freelist2_chunks_realloc_align);
+
+    Freelist2_Chunks_Test_Parent *parent =
+        (Freelist2_Chunks_Test_Parent *)freelist2_chunks_alloc(&fc, sizeof(Freelist2_Chunks_Test_Parent));
+    freelist2_chunks_set_allocation_owner(&fc, parent, (void **)&parent);
+    parent->child_size = 64;
+    parent->pattern = 0x3c;
+    parent->child = (unsigned char *)freelist2_chunks_alloc(&fc, parent->child_size);
+    freelist2_chunks_set_allocation_owner(&fc, parent->child, (void **)&parent->child);
+    memset(parent->child, parent->pattern, parent->child_size);
+
+    // fill the rest of the first chunk, leaving a hole in front of the child for the defragmentor to close.
+    Freelist2 *old_chunk = freelist2_chunks_find(&fc, parent);
+    void *hole = freelist2_chunks_alloc(&fc, 256);
+    void *filler = freelist2_chunks_alloc(&fc, old_chunk->size - old_chunk->used -
+                                                   sizeof(Freelist2_Allocation_Header) - 256);
+    assert(freelist2_chunks_find(&fc, hole) == old_chunk && freelist2_chunks_find(&fc, filler) == old_chunk);
+    freelist2_chunks_free(&fc, hole);
+
+    Freelist2_Chunks_Test_Parent *old_parent = parent;
+    void *moved = freelist2_chunks_realloc(&fc, parent, 2048);
+    assert(moved != NULL && moved == parent && moved != old_parent);
+    assert(freelist2_chunks_find(&fc, parent) != old_chunk);
+
+    // the child now belongs to the new parent, and the new parent knows its child.
+    Freelist2_Allocation_Header *parent_header = freelist2_get_header(parent);
+    Freelist2_Allocation_Header *child_header = freelist2_get_header(parent->child);
+    assert(parent_header->pOwner == (void **)&parent);
+    assert(parent_header->child_header == child_header);
+    assert(child_header->pOwner == (void **)&parent->child);
+
+    freelist2_chunks_defragment(&fc, 2);
+    freelist2_chunks_verify_compacted(&fc);
+    parent_header = freelist2_get_header(parent);
+    child_header = freelist2_get_header(parent->child);
+    assert(parent_header->child_header == child_header);
+    assert(child_header->pOwner == (void **)&parent->child);
+    for (size_t b = 0; b < parent->child_size; ++b) {
+        assert(parent->child[b] == parent->pattern);
+    }
+
+    freelist2_chunks_destroy(&fc);
+    free(memory);
+}
+
+inline void
+freelist2_chunks_unit_tests()
+{
+    freelist2_chunks_test_parallel_defragment(1);
+    freelist2_chunks_test_parallel_defragment(4);
+    freelist2_chunks_test_realloc_across_chunks();
+    freelist2_chunks_test_realloc_parent_across_chunks();
+}
+#endif
+#endif
+#endif
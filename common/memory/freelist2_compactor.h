@@ -0,0 +1,256 @@
+#ifndef FREELIST2_COMPACTOR_H
+#define FREELIST2_COMPACTOR_H
+
+#include "memory.h"
+#include <cstdint>
+
+#ifdef FREELIST2_COMPACTOR_IMPLEMENTATION
+#ifndef FREELIST2_ALLOCATOR_IMPLEMENTATION
+#define FREELIST2_ALLOCATOR_IMPLEMENTATION
+#endif
+#endif
+#include <memory/freelist2_alloc.h>
+
+/*
+    Compaction scheduler for a Freelist2 whose allocations all have owners, which is every allocation made through
+    Handle<T> (and ImmutableArray<T> inside one). Instead of calling freelist2_defragment by hand, the program calls
+    freelist2_compactor_tick at its safe points, i.e. wherever no raw pointer into the heap is held across the call
+    (between frames, between requests, ...). A tick checks how fragmented the heap is and once that goes above the
+    threshold, starts a compaction pass and carries it on over the following ticks, moving at most step_budget bytes
+    per tick, until the heap is compacted again.
+
+    Fragmentation is 1 - largest free block / total free space: 0 when all free space is one block, close to 1 when
+    it is spread over many small ones.
+*/
+
+typedef struct Freelist2_Compaction_Stats {
+    /// @brief compaction passes started.
+    size_t passes;
+    size_t objects_moved;
+    size_t bytes_moved;
+    /// @brief how much the largest free block grew by, i.e. free space that became usable for bigger allocations.
+    size_t bytes_reclaimed;
+} Freelist2_Compaction_Stats;
+
+typedef struct Freelist2_Compactor {
+    Freelist2 *fl;
+
+    /// @brief a pass starts when the fragmentation goes above this.
+    float threshold;
+    /// @brief with less free space than this a pass never starts, there is nothing worth getting back.
+    size_t min_free_bytes;
+    /// @brief bytes moved per tick at most, 0 finishes a pass in the tick that starts it.
+    size_t step_budget;
+
+    bool compacting;
+    size_t pass_largest_free;
+
+    /// @brief the pass currently running, or the last one that finished.
+    Freelist2_Compaction_Stats last_pass;
+    /// @brief totals over the compactor's lifetime.
+    Freelist2_Compaction_Stats total;
+} Freelist2_Compactor;
+
+void  freelist2_compactor_init(Freelist2_Compactor *c, Freelist2 *fl, float threshold, size_t step_budget);
+float freelist2_fragmentation(Freelist2 *fl);
+bool  freelist2_compactor_tick(Freelist2_Compactor *c);
+void  freelist2_compactor_collect(Freelist2_Compactor *c);
+
+#ifdef FREELIST2_COMPACTOR_UNIT_TESTS
+void freelist2_compactor_unit_tests();
+#endif
+
+#ifdef FREELIST2_COMPACTOR_IMPLEMENTATION
+
+inline void
+freelist2_compactor_init(Freelist2_Compactor *c, Freelist2 *fl, float threshold, size_t step_budget)
+{
+    assert(c != NULL && fl != NULL);
+    assert(threshold >= 0.0f && threshold < 1.0f);
+    memset(c, 0, sizeof(Freelist2_Compactor));
+    c->fl = fl;
+    c->threshold = threshold;
+    c->min_free_bytes = 4 * sizeof(Freelist2_Node);
+    c->step_budget = step_budget;
+}
+
+inline float
+freelist2_fragmentation(Freelist2 *fl)
+{
+    size_t free_space = fl->size - fl->used;
+    if (free_space == 0 || fl->block_count <= 1) {
+        return 0.0f;
+    }
+    return 1.0f - (float)freelist2_largest_free_block(fl) / (float)free_space;
+}
+
+static inline void
+freelist2_compactor_begin_pass(Freelist2_Compactor *c)
+{
+    c->compacting = true;
+    c->pass_largest_free = freelist2_largest_free_block(c->fl);
+    memset(&c->last_pass, 0, sizeof(Freelist2_Compaction_Stats));
+    c->last_pass.passes = 1;
+    c->total.passes++;
+}
+
+// NOTE: moves allocations until the budget is used up or the heap is compacted, budget 0 means no limit.
+static inline void
+freelist2_compactor_run(Freelist2_Compactor *c, size_t budget)
+{
+    assert(c->compacting);
+    size_t moved = 0;
+    while (!freelist2_is_compacted(c->fl)) {
+        if (budget != 0 && moved >= budget) {
+            return;
+        }
+        size_t bytes = freelist2_defragment_move_next(c->fl);
+        moved += bytes;
+        c->last_pass.objects_moved++;
+        c->last_pass.bytes_moved += bytes;
+        c->total.objects_moved++;
+        c->total.bytes_moved += bytes;
+    }
+
+    size_t largest_free = freelist2_largest_free_block(c->fl);
+    if (largest_free > c->pass_largest_free) {
+        c->last_pass.bytes_reclaimed = largest_free - c->pass_largest_free;
+        c->total.bytes_reclaimed += c->last_pass.bytes_reclaimed;
+    }
+    c->compacting = false;
+}
+
+/// @brief call at a safe point. Returns true if it moved anything, every pointer into the heap not reached through
+/// an owner (Handle::owner, ...) is stale afterwards.
+inline bool
+freelist2_compactor_tick(Freelist2_Compactor *c)
+{
+    assert(c != NULL && c->fl != NULL);
+    if (!c->compacting) {
+        if (c->fl->size - c->fl->used < c->min_free_bytes ||
+            freelist2_fragmentation(c->fl) <= c->threshold)
+        {
+            return false;
+        }
+        freelist2_compactor_begin_pass(c);
+    }
+
+    size_t objects_before = c->last_pass.objects_moved;
+    freelist2_compactor_run(c, c->step_budget);
+    return c->last_pass.objects_moved != objects_before;
+}
+
+/// @brief compacts the heap completely right now, whatever its fragmentation. Finishes a pass already running.
+inline void
+freelist2_compactor_collect(Freelist2_Compactor *c)
+{
+    assert(c != NULL && c->fl != NULL);
+    if (!c->compacting) {
+        if (freelist2_is_compacted(c->fl)) {
+            return;
+        }
+        freelist2_compactor_begin_pass(c);
+    }
+    freelist2_compactor_run(c, 0);
+}
+
+#ifdef FREELIST2_COMPACTOR_UNIT_TESTS
+#include <memory/handle.h>
+
+struct Freelist2_Compactor_Test_Object
+{
+    int id;
+    unsigned char payload[100];
+};
+
+static inline void
+freelist2_compactor_test_handles()
+{
+    // small enough that the holes left below outweigh the free space at the end, with either header size.
+    const size_t mem_size = 160 * 1024;
+    void *memory = malloc(mem_size);
+    Freelist2 fl;
+    freelist2_init(&fl, memory, mem_size, DEFAULT_ALIGNMENT);
+
+    Freelist2_Compactor compactor;
+    freelist2_compactor_init(&compactor, &fl, 0.5f, 1024);
+
+    enum { HANDLE_COUNT = 1000 };
+    static Handle<Freelist2_Compactor_Test_Object> handles[HANDLE_COUNT];
+    for (int i = 0; i < HANDLE_COUNT; ++i) {
+        Freelist2_Compactor_Test_Object object;
+        object.id = i;
+        memset(object.payload, (unsigned char)i, sizeof(object.payload));
+#ifdef ALLOCATOR_DEBUG
+        EmplaceHandle(&handles[i], &fl.api, "compactor test object", object);
+#else
+        EmplaceHandle(&handles[i], &fl.api, object);
+#endif
+    }
+
+    // one big free block at the end, nothing to do.
+    assert(freelist2_fragmentation(&fl) == 0.0f);
+    assert(!freelist2_compactor_tick(&compactor) && compactor.total.passes == 0);
+
+    // free 3 out of every 4 objects: lots of small holes, most of the free space is not in the last block.
+    size_t freed_bytes = 0;
+    for (int i = 0; i < HANDLE_COUNT; ++i) {
+        if (i % 4 != 0) {
+            freed_bytes += freelist2_block_size(handles[i].owner);
+            handles[i].free();
+        }
+    }
+    float fragmentation = freelist2_fragmentation(&fl);
+    assert(fragmentation > compactor.threshold);
+    size_t largest_before = freelist2_largest_free_block(&fl);
+
+    // the pass is spread over several ticks, each one within the budget (plus the one object that crosses it).
+    int ticks = 0;
+    while (freelist2_compactor_tick(&compactor)) {
+        ++ticks;
+        assert(compactor.last_pass.bytes_moved <= (size_t)ticks * (compactor.step_budget + 256));
+        assert(compactor.compacting || freelist2_is_compacted(&fl));
+    }
+    assert(ticks > 1 && !compactor.compacting && freelist2_is_compacted(&fl));
+    assert(freelist2_fragmentation(&fl) == 0.0f);
+
+    assert(compactor.total.passes == 1);
+    assert(compactor.last_pass.objects_moved > 0 && compactor.last_pass.objects_moved < HANDLE_COUNT / 4);
+    assert(compactor.last_pass.bytes_reclaimed == freelist2_largest_free_block(&fl) - largest_before);
+    assert(freelist2_largest_free_block(&fl) == fl.size - fl.used);
+    assert(compactor.last_pass.bytes_reclaimed + largest_before >= freed_bytes);
+
+    // the handles followed their objects.
+    for (int i = 0; i < HANDLE_COUNT; i += 4) {
+        assert(handles[i]->id == i);
+        for (size_t b = 0; b < sizeof(handles[i]->payload); ++b) {
+            assert(handles[i]->payload[b] == (unsigned char)i);
+        }
+    }
+
+    // below the threshold nothing starts, collect compacts anyway.
+    handles[HANDLE_COUNT / 2].free();
+    assert(freelist2_fragmentation(&fl) <= compactor.threshold);
+    assert(!freelist2_compactor_tick(&compactor) && compactor.total.passes == 1);
+    freelist2_compactor_collect(&compactor);
+    assert(freelist2_is_compacted(&fl) && compactor.total.passes == 2);
+    assert(compactor.total.objects_moved > compactor.last_pass.objects_moved);
+
+    for (int i = 0; i < HANDLE_COUNT; i += 4) {
+        handles[i].free();
+    }
+    assert(fl.used == 0 && fl.block_count == 1);
+    freelist2_destroy(&fl);
+    free(memory);
+}
+
+inline void
+freelist2_compactor_unit_tests()
+{
+    freelist2_compactor_test_handles();
+}
+#endif
+
+#endif // FREELIST2_COMPACTOR_IMPLEMENTATION
+
+#endif // FREELIST2_COMPACTOR_H
@@ -0,0 +1,694 @@
+#ifndef FREELIST2_CONCURRENT_H
+#define FREELIST2_CONCURRENT_H
+
+// standard headers first, memory.h defines min/max as macros.
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "memory.h"
+
+#ifdef FREELIST2_CONCURRENT_IMPLEMENTATION
+#ifndef FREELIST2_ALLOCATOR_IMPLEMENTATION
+#define FREELIST2_ALLOCATOR_IMPLEMENTATION
+#endif
+#ifndef SMALL_CACHE_ALLOCATOR_IMPLEMENTATION
+#define SMALL_CACHE_ALLOCATOR_IMPLEMENTATION
+#endif
+#endif
+#include <memory/freelist2_alloc.h>
+#include <memory/small_cache_alloc.h>
+
+/*
+    Freelist2 that can be shared by any number of threads through one alloc_api. The heap is split into arenas,
+    each one a Freelist2 of its own behind its own lock, and every thread gets a home arena (round robin) that it
+    allocates from. A full arena sends the allocation on to the next one.
+
+    On top of that every thread keeps a cache of small blocks, the same LIFO bins as Small_Cache, so most small
+    allocations and frees take no lock at all. A block that does have to go back to its arena and whose arena lock
+    is held by someone else (always the case for a block of a foreign arena, unless its lock happens to be free) is
+    not waited on: it is pushed on the arena's deferred list, lock free, and freed for real by the next thread that
+    takes the lock.
+
+    Blocks sitting in a thread cache or on a deferred list still count as used in their arena. A thread's cached
+    blocks go back when the thread exits, or on freelist2_concurrent_flush_thread_cache. Owners and defragmentation
+    are not supported, blocks of a shared heap never move.
+
+    Like free_all, freelist2_concurrent_destroy must not run while any other thread still uses the heap. Threads that
+    used it may go on running and using other heaps, their caches for this one are detached.
+*/
+
+#define FREELIST2_CONCURRENT_MAX_ARENAS 64
+/// @brief an arena is never made smaller than this, a small heap gets fewer arenas instead.
+#define FREELIST2_CONCURRENT_MIN_ARENA_SIZE (64 * 1024)
+/// @brief shared heaps a thread keeps a cache for at once, a thread using more goes without a cache on the rest.
+#define FREELIST2_CONCURRENT_THREAD_CACHES 4
+
+typedef struct Freelist2_Concurrent_Arena {
+    alignas(64) std::mutex lock;
+    Freelist2 fl;
+    /// @brief freed by threads that did not get the lock, freed into fl by the next one that does.
+    alignas(64) std::atomic<Small_Cache_Block *> deferred;
+} Freelist2_Concurrent_Arena;
+
+struct Freelist2_Concurrent;
+
+typedef struct Freelist2_Concurrent_Thread_Cache {
+    /// @brief NULL when the slot is unused, or once the heap has been destroyed. Atomic because destroy clears it
+    /// from another thread while the owning thread may be looking through its slots for a different heap.
+    std::atomic<struct Freelist2_Concurrent *> heap;
+    uint32_t arena;
+    uint64_t epoch;
+
+    Small_Cache_Block *bins[SMALL_CACHE_CLASS_COUNT];
+    uint32_t bin_counts[SMALL_CACHE_CLASS_COUNT];
+
+    /// @brief all thread caches of a heap, so that destroy can detach them.
+    struct Freelist2_Concurrent_Thread_Cache *prev;
+    struct Freelist2_Concurrent_Thread_Cache *next;
+} Freelist2_Concurrent_Thread_Cache;
+
+typedef struct Freelist2_Concurrent {
+    alloc_api api;
+
+    void *data;
+    size_t size;
+    size_t arena_size;
+    Freelist2_Concurrent_Arena *arenas;
+    uint32_t arena_count;
+
+    std::atomic<uint32_t> next_arena;
+    /// @brief bumped by free_all, thread caches from an older epoch hold blocks that do not exist anymore.
+    std::atomic<uint64_t> epoch;
+    Freelist2_Concurrent_Thread_Cache *thread_caches;
+} Freelist2_Concurrent;
+
+void        freelist2_concurrent_init(Freelist2_Concurrent *heap, void *data, size_t size, size_t alignment,
+                                      uint32_t arena_count);
+alloc_api  *freelist2_concurrent_get_api(Freelist2_Concurrent *heap);
+void       *freelist2_concurrent_alloc(void *heap, size_t size);
+void       *freelist2_concurrent_alloc_align(void *heap, size_t size, size_t alignment);
+void       *freelist2_concurrent_realloc(void *heap, void *ptr, size_t new_size);
+void       *freelist2_concurrent_realloc_align(void *heap, void *ptr, size_t new_size, size_t alignment);
+void        freelist2_concurrent_free(void *heap, void *ptr);
+void        freelist2_concurrent_free_all(void *heap);
+void        freelist2_concurrent_flush_thread_cache(Freelist2_Concurrent *heap);
+size_t      freelist2_concurrent_used(Freelist2_Concurrent *heap);
+void        freelist2_concurrent_destroy(Freelist2_Concurrent *heap);
+
+#ifdef FREELIST2_CONCURRENT_UNIT_TESTS
+void freelist2_concurrent_unit_tests();
+#endif
+
+#ifdef FREELIST2_CONCURRENT_IMPLEMENTATION
+
+// NOTE: guards the links between heaps and thread caches, which only change when a thread attaches to a heap, exits
+// or the heap is destroyed. Never taken on the alloc/free path.
+inline std::mutex freelist2_concurrent_registry_lock;
+
+static inline void freelist2_concurrent_detach(Freelist2_Concurrent_Thread_Cache *cache);
+
+struct Freelist2_Concurrent_Thread_Caches {
+    Freelist2_Concurrent_Thread_Cache slots[FREELIST2_CONCURRENT_THREAD_CACHES];
+
+    ~Freelist2_Concurrent_Thread_Caches()
+    {
+        for (int i = 0; i < FREELIST2_CONCURRENT_THREAD_CACHES; ++i) {
+            freelist2_concurrent_detach(&slots[i]);
+        }
+    }
+};
+
+static inline Freelist2_Concurrent_Thread_Caches &
+freelist2_concurrent_thread_caches()
+{
+    static thread_local Freelist2_Concurrent_Thread_Caches caches = {};
+    return caches;
+}
+
+static inline Freelist2_Concurrent_Arena *
+freelist2_concurrent_arena_of(Freelist2_Concurrent *heap, void *ptr)
+{
+    assert((uintptr_t)ptr >= (uintptr_t)heap->data && (uintptr_t)ptr < (uintptr_t)heap->data + heap->size);
+    size_t index = ((uintptr_t)ptr - (uintptr_t)heap->data) / heap->arena_size;
+    // the last arena also takes the rest of the heap.
+    return &heap->arenas[index < heap->arena_count ? index : heap->arena_count - 1];
+}
+
+// NOTE: the caller holds the arena lock.
+static inline void
+freelist2_concurrent_drain(Freelist2_Concurrent_Arena *arena)
+{
+    if (arena->deferred.load(std::memory_order_relaxed) == NULL) {
+        return;
+    }
+    Small_Cache_Block *block = arena->deferred.exchange(NULL, std::memory_order_acquire);
+    while (block != NULL) {
+        Small_Cache_Block *next = block->next;
+        freelist2_free(&arena->fl, block);
+        block = next;
+    }
+}
+
+static inline void
+freelist2_concurrent_defer(Freelist2_Concurrent_Arena *arena, void *ptr)
+{
+    Small_Cache_Block *block = (Small_Cache_Block *)ptr;
+    block->next = arena->deferred.load(std::memory_order_relaxed);
+    while (!arena->deferred.compare_exchange_weak(block->next, block, std::memory_order_release,
+                                                  std::memory_order_relaxed))
+    {
+    }
+}
+
+/// @brief frees into the arena, waiting for its lock only if wait is set.
+static inline void
+freelist2_concurrent_release(Freelist2_Concurrent *heap, void *ptr, bool wait)
+{
+    Freelist2_Concurrent_Arena *arena = freelist2_concurrent_arena_of(heap, ptr);
+    if (wait) {
+        arena->lock.lock();
+    } else if (!arena->lock.try_lock()) {
+        freelist2_concurrent_defer(arena, ptr);
+        return;
+    }
+    freelist2_concurrent_drain(arena);
+    freelist2_free(&arena->fl, ptr);
+    arena->lock.unlock();
+}
+
+static inline void
+freelist2_concurrent_flush_bins(Freelist2_Concurrent *heap, Freelist2_Concurrent_Thread_Cache *cache)
+{
+    for (int i = 0; i < SMALL_CACHE_CLASS_COUNT; ++i) {
+        Small_Cache_Block *block = cache->bins[i];
+        while (block != NULL) {
+            Small_Cache_Block *next = block->next;
+            freelist2_concurrent_release(heap, block, false);
+            block = next;
+        }
+        cache->bins[i] = NULL;
+        cache->bin_counts[i] = 0;
+    }
+}
+
+// NOTE: the caller holds the registry lock. The slot is cleared before it is marked unused, so that whoever picks it
+// up next finds empty bins.
+static inline void
+freelist2_concurrent_clear_slot(Freelist2_Concurrent_Thread_Cache *cache)
+{
+    memset(cache->bins, 0, sizeof(cache->bins));
+    memset(cache->bin_counts, 0, sizeof(cache->bin_counts));
+    cache->arena = 0;
+    cache->epoch = 0;
+    cache->prev = NULL;
+    cache->next = NULL;
+    cache->heap.store(NULL, std::memory_order_release);
+}
+
+static inline void
+freelist2_concurrent_detach(Freelist2_Concurrent_Thread_Cache *cache)
+{
+    std::lock_guard<std::mutex> guard(freelist2_concurrent_registry_lock);
+    Freelist2_Concurrent *heap = cache->heap.load(std::memory_order_relaxed);
+    if (heap == NULL) {
+        return;
+    }
+    if (cache->epoch == heap->epoch.load(std::memory_order_relaxed)) {
+        freelist2_concurrent_flush_bins(heap, cache);
+    }
+    if (cache->prev != NULL) {
+        cache->prev->next = cache->next;
+    } else {
+        heap->thread_caches = cache->next;
+    }
+    if (cache->next != NULL) {
+        cache->next->prev = cache->prev;
+    }
+    freelist2_concurrent_clear_slot(cache);
+}
+
+/// @brief the calling thread's cache for the heap, attaching one on first use. NULL if the thread has no slot left.
+static inline Freelist2_Concurrent_Thread_Cache *
+freelist2_concurrent_thread_cache(Freelist2_Concurrent *heap)
+{
+    Freelist2_Concurrent_Thread_Caches &caches = freelist2_concurrent_thread_caches();
+    Freelist2_Concurrent_Thread_Cache *unused = NULL;
+    for (int i = 0; i < FREELIST2_CONCURRENT_THREAD_CACHES; ++i) {
+        Freelist2_Concurrent_Thread_Cache *cache = &caches.slots[i];
+        Freelist2_Concurrent *cache_heap = cache->heap.load(std::memory_order_acquire);
+        if (cache_heap == heap) {
+            if (cache->epoch != heap->epoch.load(std::memory_order_relaxed)) {
+                // free_all ran, the cached blocks went with it.
+                memset(cache->bins, 0, sizeof(cache->bins));
+                memset(cache->bin_counts, 0, sizeof(cache->bin_counts));
+                cache->epoch = heap->epoch.load(std::memory_order_relaxed);
+            }
+            return cache;
+        }
+        if (cache_heap == NULL && unused == NULL) {
+            unused = cache;
+        }
+    }
+    if (unused == NULL) {
+        return NULL;
+    }
+
+    std::lock_guard<std::mutex> guard(freelist2_concurrent_registry_lock);
+    unused->heap.store(heap, std::memory_order_relaxed);
+    unused->arena = heap->next_arena.fetch_add(1, std::memory_order_relaxed) % heap->arena_count;
+    unused->epoch = heap->epoch.load(std::memory_order_relaxed);
+    unused->prev = NULL;
+    unused->next = heap->thread_caches;
+    if (heap->thread_caches != NULL) {
+        heap->thread_caches->prev = unused;
+    }
+    heap->thread_caches = unused;
+    return unused;
+}
+
+static inline uint32_t
+freelist2_concurrent_home_arena(Freelist2_Concurrent *heap, Freelist2_Concurrent_Thread_Cache *cache)
+{
+    if (cache != NULL) {
+        return cache->arena;
+    }
+    // any per thread value spreads threads over the arenas, the address of its caches is at hand.
+    return (uint32_t)(((uintptr_t)&freelist2_concurrent_thread_caches() >> 6) % heap->arena_count);
+}
+
+inline void
+freelist2_concurrent_init(Freelist2_Concurrent *heap, void *data, size_t size, size_t alignment, uint32_t arena_count)
+{
+    assert(heap != NULL && data != NULL);
+    if (arena_count == 0) {
+        arena_count = std::thread::hardware_concurrency();
+    }
+    if (arena_count > FREELIST2_CONCURRENT_MAX_ARENAS) {
+        arena_count = FREELIST2_CONCURRENT_MAX_ARENAS;
+    }
+    if (arena_count > size / FREELIST2_CONCURRENT_MIN_ARENA_SIZE) {
+        arena_count = (uint32_t)(size / FREELIST2_CONCURRENT_MIN_ARENA_SIZE);
+    }
+    if (arena_count == 0) {
+        arena_count = 1;
+    }
+
+    heap->data = data;
+    heap->size = size;
+    heap->arena_count = arena_count;
+    // every arena starts on a cache line, the last one gets what is left over.
+    heap->arena_size = (size / arena_count) & ~(size_t)63;
+    heap->arenas = new Freelist2_Concurrent_Arena[arena_count];
+    for (uint32_t i = 0; i < arena_count; ++i) {
+        size_t offset = i * heap->arena_size;
+        size_t this_size = i + 1 < arena_count ? heap->arena_size : size - offset;
+        heap->arenas[i].fl = {};
+        freelist2_init(&heap->arenas[i].fl, (void *)((uintptr_t)data + offset), this_size, alignment);
+        heap->arenas[i].deferred.store(NULL, std::memory_order_relaxed);
+    }
+    heap->next_arena.store(0, std::memory_order_relaxed);
+    heap->epoch.store(0, std::memory_order_relaxed);
+    heap->thread_caches = NULL;
+
+    memset(&heap->api, 0, sizeof(alloc_api));
+    heap->api.alloc = freelist2_concurrent_alloc;
+    heap->api.alloc_align = freelist2_concurrent_alloc_align;
+    heap->api.realloc = freelist2_concurrent_realloc;
+    heap->api.realloc_align = freelist2_concurrent_realloc_align;
+    heap->api.free = freelist2_concurrent_free;
+    heap->api.free_all = freelist2_concurrent_free_all;
+
+    heap->api.alignment = alignment;
+    heap->api.allocator = (void *)heap;
+}
+
+inline alloc_api *
+freelist2_concurrent_get_api(Freelist2_Concurrent *heap)
+{
+    return &heap->api;
+}
+
+inline void *
+freelist2_concurrent_alloc(void *heap, size_t size)
+{
+    return freelist2_concurrent_alloc_align(heap, size, DEFAULT_ALIGNMENT);
+}
+
+inline void *
+freelist2_concurrent_alloc_align(void *h, size_t size, size_t alignment)
+{
+    assert(h != NULL);
+    Freelist2_Concurrent *heap = (Freelist2_Concurrent *)h;
+    Freelist2_Concurrent_Thread_Cache *cache = freelist2_concurrent_thread_cache(heap);
+
+    if (cache != NULL && size <= SMALL_CACHE_MAX_SIZE && alignment <= DEFAULT_ALIGNMENT) {
+        size_t size_class = size > SMALL_CACHE_GRANULE ? (size + SMALL_CACHE_GRANULE - 1) / SMALL_CACHE_GRANULE : 1;
+        // same as Small_Cache, small blocks can have been rounded up into the next class.
+        size_t last_class = size_class < SMALL_CACHE_CLASS_COUNT ? size_class + 1 : size_class;
+        for (size_t bin = size_class - 1; bin < last_class; ++bin) {
+            Small_Cache_Block *block = cache->bins[bin];
+            if (block != NULL) {
+                cache->bins[bin] = block->next;
+                cache->bin_counts[bin]--;
+                return (void *)block;
+            }
+        }
+        size = size_class * SMALL_CACHE_GRANULE;
+        alignment = DEFAULT_ALIGNMENT;
+    }
+
+    uint32_t home = freelist2_concurrent_home_arena(heap, cache);
+    for (uint32_t i = 0; i < heap->arena_count; ++i) {
+        Freelist2_Concurrent_Arena *arena = &heap->arenas[(home + i) % heap->arena_count];
+        std::lock_guard<std::mutex> guard(arena->lock);
+        freelist2_concurrent_drain(arena);
+        void *ptr = freelist2_alloc_align(&arena->fl, size, alignment);
+        if (ptr != NULL) {
+            return ptr;
+        }
+    }
+    return NULL;
+}
+
+inline void
+freelist2_concurrent_free(void *h, void *ptr)
+{
+    assert(h != NULL);
+    if (ptr == NULL) {
+        return;
+    }
+    Freelist2_Concurrent *heap = (Freelist2_Concurrent *)h;
+    Freelist2_Concurrent_Thread_Cache *cache = freelist2_concurrent_thread_cache(heap);
+
+    if (cache != NULL) {
+        size_t size_class = small_cache_freelist2_size(NULL, ptr) / SMALL_CACHE_GRANULE;
+        if (size_class != 0 && size_class <= SMALL_CACHE_CLASS_COUNT &&
+            ((uintptr_t)ptr & (DEFAULT_ALIGNMENT - 1)) == 0 &&
+            cache->bin_counts[size_class - 1] < SMALL_CACHE_BIN_CAPACITY)
+        {
+            Small_Cache_Block *block = (Small_Cache_Block *)ptr;
+            block->next = cache->bins[size_class - 1];
+            cache->bins[size_class - 1] = block;
+            cache->bin_counts[size_class - 1]++;
+            return;
+        }
+    }
+
+    // NOTE: a thread only waits for the lock of its home arena, anything else is deferred if the lock is taken.
+    Freelist2_Concurrent_Arena *home = &heap->arenas[freelist2_concurrent_home_arena(heap, cache)];
+    freelist2_concurrent_release(heap, ptr, freelist2_concurrent_arena_of(heap, ptr) == home);
+}
+
+inline void *
+freelist2_concurrent_realloc(void *h, void *ptr, size_t new_size)
+{
+    return freelist2_concurrent_realloc_align(h, ptr, new_size, DEFAULT_ALIGNMENT);
+}
+
+inline void *
+freelist2_concurrent_realloc_align(void *h, void *ptr, size_t new_size, size_t alignment)
+{
+    assert(h != NULL);
+    Freelist2_Concurrent *heap = (Freelist2_Concurrent *)h;
+    if (ptr == NULL) {
+        return freelist2_concurrent_alloc_align(h, new_size, alignment);
+    }
+    if (new_size == 0) {
+        freelist2_concurrent_free(h, ptr);
+        return NULL;
+    }
+
+    Freelist2_Allocation_Header *header =
+        (Freelist2_Allocation_Header *)((uintptr_t)ptr - sizeof(Freelist2_Allocation_Header));
+    size_t old_size = header->block_size - header->alignment_padding - sizeof(Freelist2_Allocation_Header);
+    if (new_size <= old_size && ((uintptr_t)ptr & (alignment - 1)) == 0) {
+        return ptr;
+    }
+
+    // grows in place, or moves within its arena, if the arena has the room.
+    Freelist2_Concurrent_Arena *arena = freelist2_concurrent_arena_of(heap, ptr);
+    {
+        std::lock_guard<std::mutex> guard(arena->lock);
+        freelist2_concurrent_drain(arena);
+        void *new_ptr = freelist2_realloc_align(&arena->fl, ptr, new_size, alignment);
+        if (new_ptr != NULL) {
+            return new_ptr;
+        }
+    }
+
+    void *new_ptr = freelist2_concurrent_alloc_align(h, new_size, alignment);
+    if (new_ptr != NULL) {
+        memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+        freelist2_concurrent_free(h, ptr);
+    }
+    return new_ptr;
+}
+
+/// @brief gives the calling thread's cached blocks back to their arenas.
+inline void
+freelist2_concurrent_flush_thread_cache(Freelist2_Concurrent *heap)
+{
+    assert(heap != NULL);
+    Freelist2_Concurrent_Thread_Cache *cache = freelist2_concurrent_thread_cache(heap);
+    if (cache != NULL) {
+        freelist2_concurrent_flush_bins(heap, cache);
+    }
+}
+
+/// @brief bytes in use over all arenas, including blocks sitting in thread caches.
+inline size_t
+freelist2_concurrent_used(Freelist2_Concurrent *heap)
+{
+    assert(heap != NULL);
+    size_t used = 0;
+    for (uint32_t i = 0; i < heap->arena_count; ++i) {
+        std::lock_guard<std::mutex> guard(heap->arenas[i].lock);
+        freelist2_concurrent_drain(&heap->arenas[i]);
+        used += heap->arenas[i].fl.used;
+    }
+    return used;
+}
+
+// NOTE: like free_all of any other allocator, no other thread may be using the heap meanwhile.
+inline void
+freelist2_concurrent_free_all(void *h)
+{
+    assert(h != NULL);
+    Freelist2_Concurrent *heap = (Freelist2_Concurrent *)h;
+    for (uint32_t i = 0; i < heap->arena_count; ++i) {
+        std::lock_guard<std::mutex> guard(heap->arenas[i].lock);
+        heap->arenas[i].deferred.store(NULL, std::memory_order_relaxed);
+        freelist2_free_all(&heap->arenas[i].fl);
+    }
+    heap->epoch.fetch_add(1, std::memory_order_relaxed);
+}
+
+/* NOTE: no other thread may use the heap while or after it is destroyed, the owners of the caches detached here
+   read their bins without any lock. Threads that used the heap may still be running, their caches drop the heap's
+   blocks. */
+inline void
+freelist2_concurrent_destroy(Freelist2_Concurrent *heap)
+{
+    assert(heap != NULL);
+    for (uint32_t i = 0; i < heap->arena_count; ++i) {
+        // a thread still in the middle of an alloc or free would be holding an arena lock.
+        bool idle = heap->arenas[i].lock.try_lock();
+        assert(idle && "Freelist2_Concurrent destroyed while another thread uses it!");
+        if (idle) {
+            heap->arenas[i].lock.unlock();
+        }
+    }
+    {
+        std::lock_guard<std::mutex> guard(freelist2_concurrent_registry_lock);
+        Freelist2_Concurrent_Thread_Cache *cache = heap->thread_caches;
+        while (cache != NULL) {
+            Freelist2_Concurrent_Thread_Cache *next = cache->next;
+            freelist2_concurrent_clear_slot(cache);
+            cache = next;
+        }
+        heap->thread_caches = NULL;
+    }
+    for (uint32_t i = 0; i < heap->arena_count; ++i) {
+        freelist2_destroy(&heap->arenas[i].fl);
+    }
+    delete[] heap->arenas;
+    heap->arenas = NULL;
+    heap->arena_count = 0;
+}
+
+#ifdef FREELIST2_CONCURRENT_UNIT_TESTS
+
+// NOTE: every thread allocates and frees its own blocks and hands some of them to its neighbour, which frees them.
+// Each block is filled with its owner's pattern, a block handed out twice shows up as a wrong byte.
+static inline void
+freelist2_concurrent_test_churn(Freelist2_Concurrent *heap, unsigned thread_count)
+{
+    enum { SLOT_COUNT = 64, ROUNDS = 4000, MAILBOX_SIZE = 256 };
+    struct Mailbox {
+        std::mutex lock;
+        void *blocks[MAILBOX_SIZE];
+        size_t sizes[MAILBOX_SIZE];
+        int count;
+    };
+    std::vector<Mailbox> mailboxes(thread_count);
+    for (Mailbox &mailbox : mailboxes) {
+        mailbox.count = 0;
+    }
+
+    auto worker = [&](unsigned id) {
+        void *slots[SLOT_COUNT] = {};
+        size_t sizes[SLOT_COUNT] = {};
+        uint32_t state = 0x9e3779b9u * (id + 1);
+        for (int round = 0; round < ROUNDS; ++round) {
+            state = state * 1664525u + 1013904223u;
+            int slot = (int)((state >> 8) % SLOT_COUNT);
+            if (slots[slot] != NULL) {
+                for (size_t b = 0; b < sizes[slot]; ++b) {
+                    assert(((unsigned char *)slots[slot])[b] == (unsigned char)(id + slot));
+                }
+                Mailbox &neighbour = mailboxes[(id + 1) % thread_count];
+                std::unique_lock<std::mutex> guard(neighbour.lock);
+                if ((state & 3) == 0 && neighbour.count < MAILBOX_SIZE) {
+                    neighbour.blocks[neighbour.count] = slots[slot];
+                    neighbour.sizes[neighbour.count++] = sizes[slot];
+                } else {
+                    guard.unlock();
+                    heap->api.free(heap->api.allocator, slots[slot]);
+                }
+                slots[slot] = NULL;
+            }
+            // mostly small blocks, now and then one too big for the thread cache.
+            sizes[slot] = (state >> 20) % 16 == 0 ? 300 + (state >> 12) % 2000 : 1 + (state >> 12) % 200;
+            slots[slot] = heap->api.alloc(heap->api.allocator, sizes[slot]);
+            assert(slots[slot] != NULL);
+            memset(slots[slot], (unsigned char)(id + slot), sizes[slot]);
+
+            if (round % 64 == 0) {
+                Mailbox &mine = mailboxes[id];
+                std::lock_guard<std::mutex> guard(mine.lock);
+                for (int i = 0; i < mine.count; ++i) {
+                    heap->api.free(heap->api.allocator, mine.blocks[i]);
+                }
+                mine.count = 0;
+            }
+        }
+        for (int slot = 0; slot < SLOT_COUNT; ++slot) {
+            heap->api.free(heap->api.allocator, slots[slot]);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned id = 0; id < thread_count; ++id) {
+        threads.emplace_back(worker, id);
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    for (Mailbox &mailbox : mailboxes) {
+        for (int i = 0; i < mailbox.count; ++i) {
+            heap->api.free(heap->api.allocator, mailbox.blocks[i]);
+        }
+    }
+    // the exited threads gave their caches back, only this thread's can still hold blocks.
+    freelist2_concurrent_flush_thread_cache(heap);
+    assert(freelist2_concurrent_used(heap) == 0);
+    for (uint32_t i = 0; i < heap->arena_count; ++i) {
+        assert(heap->arenas[i].fl.block_count == 1);
+    }
+}
+
+static inline void
+freelist2_concurrent_test_threads()
+{
+    const size_t mem_size = 32 * 1024 * 1024;
+    void *memory = malloc(mem_size);
+    Freelist2_Concurrent heap;
+    freelist2_concurrent_init(&heap, memory, mem_size, DEFAULT_ALIGNMENT, 8);
+    assert(heap.arena_count == 8);
+
+    for (unsigned threads = 1; threads <= 32; threads *= 2) {
+        freelist2_concurrent_test_churn(&heap, threads);
+    }
+    freelist2_concurrent_destroy(&heap);
+    free(memory);
+}
+
+static inline void
+freelist2_concurrent_test_single_thread()
+{
+    const size_t mem_size = 256 * 1024;
+    void *memory = malloc(mem_size);
+    Freelist2_Concurrent heap;
+    freelist2_concurrent_init(&heap, memory, mem_size, DEFAULT_ALIGNMENT, 16);
+    // too small for 16 arenas.
+    assert(heap.arena_count == mem_size / FREELIST2_CONCURRENT_MIN_ARENA_SIZE);
+
+    // a cached block comes back on the next allocation of its class.
+    void *a = freelist2_concurrent_alloc(&heap, 40);
+    freelist2_concurrent_free(&heap, a);
+    assert(freelist2_concurrent_alloc(&heap, 33) == a);
+
+    // a full arena sends the allocation on to the next one.
+    void *big[4];
+    for (int i = 0; i < 4; ++i) {
+        big[i] = freelist2_concurrent_alloc(&heap, 40 * 1024);
+        assert(big[i] != NULL);
+    }
+    assert(freelist2_concurrent_arena_of(&heap, big[0]) != freelist2_concurrent_arena_of(&heap, big[3]));
+
+    // growing keeps the contents, in place or not.
+    memset(a, 0x5a, 33);
+    a = freelist2_concurrent_realloc(&heap, a, 16 * 1024);
+    assert(a != NULL);
+    for (int b = 0; b < 33; ++b) {
+        assert(((unsigned char *)a)[b] == 0x5a);
+    }
+    freelist2_concurrent_free(&heap, a);
+    for (int i = 0; i < 4; ++i) {
+        freelist2_concurrent_free(&heap, big[i]);
+    }
+
+    // the api has a realloc_align, which is what shrealloc calls.
+    alloc_api *api = freelist2_concurrent_get_api(&heap);
+    assert(api->realloc_align != NULL);
+    unsigned char *p = (unsigned char *)shalloc(api, 24);
+    memset(p, 0x3c, 24);
+    p = (unsigned char *)shrealloc(api, p, 600);
+    p = (unsigned char *)shrealloc_a(api, p, 700, 256);
+    assert(p != NULL && ((uintptr_t)p & 255) == 0);
+    for (int b = 0; b < 24; ++b) {
+        assert(p[b] == 0x3c);
+    }
+    shfree(api, p);
+    freelist2_concurrent_flush_thread_cache(&heap);
+    assert(freelist2_concurrent_used(&heap) == 0);
+
+    // free_all drops the cached blocks too.
+    void *small = freelist2_concurrent_alloc(&heap, 64);
+    freelist2_concurrent_free(&heap, small);
+    freelist2_concurrent_free_all(&heap);
+    assert(freelist2_concurrent_used(&heap) == 0);
+    small = freelist2_concurrent_alloc(&heap, 64);
+    assert(freelist2_concurrent_used(&heap) > 0);
+    freelist2_concurrent_free(&heap, small);
+    freelist2_concurrent_flush_thread_cache(&heap);
+    assert(freelist2_concurrent_used(&heap) == 0);
+
+    freelist2_concurrent_destroy(&heap);
+    free(memory);
+}
+
+inline void
+freelist2_concurrent_unit_tests()
+{
+    freelist2_concurrent_test_single_thread();
+    freelist2_concurrent_test_threads();
+}
+#endif
+
+#endif // FREELIST2_CONCURRENT_IMPLEMENTATION
+
+#endif // FREELIST2_CONCURRENT_H
@@ -100,6 +100,8 @@ freelist_init(Freelist *fl, void *data, size_t size, size_t alignment)
 
     fl->api.alloc = freelist_alloc;
     fl->api.alloc_align = freelist_alloc_align;
+    // NOTE: freelist_realloc takes an alignment, there is no plain realloc.
+    fl->api.realloc = NULL;
     fl->api.realloc_align = freelist_realloc;
     fl->api.free = freelist_free;
     fl->api.free_all = freelist_free_all;
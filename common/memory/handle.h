@@ -372,11 +372,9 @@ handle_unit_tests(void *memory, size_t memory_size)
      *    basically the entire size the freelist is managing.
      * 3. fl.head == fl.data :- the head of the freelist (the only one) is the same as the start of the manged
      *    memory address which this freelist is managing.
-     * 4. fl.table.count == 0 :- the hashtable contains the entries pointing to allocations. Since every allocation
-     *    is freed upto this point, the hashtable should be empty.
      */
     assert(fl.used == 0 && fl.block_count == 1 && fl.head->block_size == fl.size &&
-           (uintptr_t)fl.head == (uintptr_t)fl.data && fl.table.count == 0);
+           (uintptr_t)fl.head == (uintptr_t)fl.data);
 
     freelist2_destroy(&fl);
 }
@@ -50,8 +50,8 @@ typedef enum Placement_Policy
 #define shrealloc_a(api,p,sz,a) (api != NULL ? api->realloc_align(api->allocator, p, sz, a) : realloc(p,sz))
 #define shrealloc(api,p,sz) shrealloc_a(api,p,sz,api->alignment)
 #define shfree(api,p) (api != NULL) ? api->free(api->allocator,p) : free(p)
-#define shalloc_arr(api,t,c) (t *)shalloc(api,c*sizeof(t))
-#define shrealloc_arr(api,p,t,c) (t *)shrealloc(api,p,c*sizeof(t))
+#define shalloc_arr(api,t,c) (t *)shalloc(api,(c)*sizeof(t))
+#define shrealloc_arr(api,p,t,c) (t *)shrealloc(api,p,(c)*sizeof(t))
 #define shalloc_t(api,t) (t *)shalloc(api,sizeof(t))
 
 typedef void *(*alloc_fn)(void *allocator, size_t size);
@@ -129,6 +129,63 @@ calc_padding_with_header(uintptr_t ptr, uintptr_t alignment, size_t header_size)
     return (size_t)padding;
 }
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// NOTE: index of the least/most significant set bit. mask should not be 0.
+inline uint32_t
+lsb_index32(uint32_t mask)
+{
+    assert(mask != 0);
+#ifdef _MSC_VER
+    unsigned long result;
+    _BitScanForward(&result, mask);
+    return (uint32_t)result;
+#else
+    return (uint32_t)__builtin_ctz(mask);
+#endif
+}
+
+inline uint32_t
+msb_index32(uint32_t mask)
+{
+    assert(mask != 0);
+#ifdef _MSC_VER
+    unsigned long result;
+    _BitScanReverse(&result, mask);
+    return (uint32_t)result;
+#else
+    return 31u - (uint32_t)__builtin_clz(mask);
+#endif
+}
+
+inline uint32_t
+lsb_index64(uint64_t mask)
+{
+    assert(mask != 0);
+#ifdef _MSC_VER
+    unsigned long result;
+    _BitScanForward64(&result, mask);
+    return (uint32_t)result;
+#else
+    return (uint32_t)__builtin_ctzll(mask);
+#endif
+}
+
+inline uint32_t
+msb_index64(uint64_t mask)
+{
+    assert(mask != 0);
+#ifdef _MSC_VER
+    unsigned long result;
+    _BitScanReverse64(&result, mask);
+    return (uint32_t)result;
+#else
+    return 63u - (uint32_t)__builtin_clzll(mask);
+#endif
+}
+
 
 inline void
 shumemcpy(void *destination, const void *src, size_t size)
@@ -136,16 +193,41 @@ shumemcpy(void *destination, const void *src, size_t size)
     unsigned char *d = (unsigned char *)destination;
     const unsigned char *s = (const unsigned char *)src;
 
-    // TODO: check if src and dst are aligned to apt boundary and use aligned SIMD instructions. Unaligned loadu and storeu instructions are slower.
-
+    // NOTE: src and destination are rarely aligned the same way, so the loads stay unaligned. The destination is
+    // brought to a vector boundary first, after that every store is an aligned one and no store splits a cache line.
+#if defined(HAS_SSE2) || defined(HAS_AVX)
+    if (size >= 64) {
+        while (((uintptr_t)d & 15) != 0) {
+            *d++ = *s++;
+            size--;
+        }
+    }
+#endif
 #ifdef HAS_AVX512F
+    while (size >= 64 && ((uintptr_t)d & 63) != 0) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)s);
+        _mm_store_si128((__m128i *)d, chunk);
+        s += 16; d += 16; size -= 16;
+    }
     while (size >= 64) {
-        __m512i chunk = _mm512_loadu_si512((const __m512i *)s);
-        _mm512_storeu_si512((__m512i *)d, chunk);
+        __m512i chunk = _mm512_loadu_si512((const void *)s);
+        _mm512_store_si512((void *)d, chunk);
         s += 64; d += 64; size -= 64;
     }
 #endif
 #if defined(HAS_AVX)
+    if (size >= 64 && ((uintptr_t)d & 31) != 0) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)s);
+        _mm_store_si128((__m128i *)d, chunk);
+        s += 16; d += 16; size -= 16;
+    }
+    while (size >= 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)s);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s + 32));
+        _mm256_store_si256((__m256i *)d, a);
+        _mm256_store_si256((__m256i *)(d + 32), b);
+        s += 64; d += 64; size -= 64;
+    }
     while (size >= 32) {
         __m256i chunk = _mm256_loadu_si256((const __m256i *)s);
         _mm256_storeu_si256((__m256i *)d, chunk);
@@ -154,13 +236,15 @@ shumemcpy(void *destination, const void *src, size_t size)
 #endif
 #if defined(HAS_SSE2)
     while (size >= 16) {
-        __m128i chunk = _mm_load_si128((const __m128i *)s);
+        __m128i chunk = _mm_loadu_si128((const __m128i *)s);
         _mm_storeu_si128((__m128i *)d, chunk);
         s += 16; d += 16; size -= 16;
     }
 #endif
-    while(size >= 8) {
-        *((uint64_t*)d) = *((uint64_t*)s);
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, s, sizeof(word));
+        memcpy(d, &word, sizeof(word));
         s += 8; d += 8; size -= 8;
     }
 
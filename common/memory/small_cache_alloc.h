@@ -0,0 +1,433 @@
+#ifndef SMALL_CACHE_ALLOC_H
+#define SMALL_CACHE_ALLOC_H
+
+#include "memory.h"
+#include <memory/freelist_alloc.h>
+#include <memory/freelist2_alloc.h>
+#include <stdint.h>
+
+/*
+    Front cache for small allocations, sitting in front of another allocator (Freelist, Freelist2) behind the same
+    alloc_api. Requests of up to SMALL_CACHE_MAX_SIZE bytes are rounded up to a multiple of SMALL_CACHE_GRANULE and
+    served from a LIFO bin per size class. A freed small block goes on its bin instead of back to the backing
+    allocator, so a hit never touches the backing allocator's free list and a miss costs one backing allocation.
+
+    Cached blocks are still allocated as far as the backing allocator is concerned, and pin the memory around them:
+    a Freelist can not coalesce across a cached block. In front of Freelist, whose searches walk every free block,
+    that costs more than the cache saves unless the free list is long anyway (bench/allocator_bench: power_law gains,
+    producer_consumer and frame_arena lose an order of magnitude). A bin that overflows is trimmed back to
+    SMALL_CACHE_BIN_TRIM_TO blocks, the ones freed longest ago going back to the backing allocator, so a burst of
+    frees does not leave a full bin pinned. Call small_cache_flush to give back everything, e.g. before defragmenting
+    a Freelist2 or to check that the backing allocator is empty.
+*/
+
+#define SMALL_CACHE_GRANULE 16
+#define SMALL_CACHE_MAX_SIZE 256
+#define SMALL_CACHE_CLASS_COUNT (SMALL_CACHE_MAX_SIZE / SMALL_CACHE_GRANULE)
+/// @brief blocks a bin holds at most. The free that would go past it trims the bin down to SMALL_CACHE_BIN_TRIM_TO.
+#define SMALL_CACHE_BIN_CAPACITY 64
+#define SMALL_CACHE_BIN_TRIM_TO (SMALL_CACHE_BIN_CAPACITY / 4)
+
+/// @brief usable size of an allocation made by the backing allocator, or 0 if it must never be cached.
+typedef size_t (*cacheable_size_fn)(void *allocator, void *ptr);
+
+typedef struct Small_Cache_Block {
+    struct Small_Cache_Block *next;
+} Small_Cache_Block;
+
+typedef struct Small_Cache {
+    alloc_api api;
+
+    const alloc_api *backing;
+    cacheable_size_fn cacheable_size;
+
+    Small_Cache_Block *bins[SMALL_CACHE_CLASS_COUNT];
+    uint32_t bin_counts[SMALL_CACHE_CLASS_COUNT];
+
+    size_t hits;
+    size_t misses;
+} Small_Cache;
+
+void        small_cache_init(Small_Cache *c, const alloc_api *backing, cacheable_size_fn cacheable_size);
+void        small_cache_init_freelist(Small_Cache *c, Freelist *fl);
+void        small_cache_init_freelist2(Small_Cache *c, Freelist2 *fl);
+alloc_api  *small_cache_get_api(Small_Cache *c);
+void       *small_cache_alloc(void *c, size_t size);
+void       *small_cache_alloc_align(void *c, size_t size, size_t alignment);
+void       *small_cache_realloc(void *c, void *ptr, size_t new_size);
+void       *small_cache_realloc_align(void *c, void *ptr, size_t new_size, size_t alignment);
+void        small_cache_free(void *c, void *ptr);
+void        small_cache_free_all(void *c);
+void        small_cache_flush(Small_Cache *c);
+
+#ifdef SMALL_CACHE_ALLOCATOR_UNIT_TESTS
+void small_cache_unit_tests();
+#endif
+
+#ifdef SMALL_CACHE_ALLOCATOR_IMPLEMENTATION
+
+static inline size_t
+small_cache_freelist_size(void *fl, void *ptr)
+{
+    (void)fl;
+    Freelist_Allocation_Header *header =
+        (Freelist_Allocation_Header *)((uintptr_t)ptr - sizeof(Freelist_Allocation_Header));
+    return header->block_size - header->alignment_padding - sizeof(Freelist_Allocation_Header);
+}
+
+// NOTE: an allocation with an owner can be moved by the defragmentor, it has to be freed for real.
+static inline size_t
+small_cache_freelist2_size(void *fl, void *ptr)
+{
+    (void)fl;
+    Freelist2_Allocation_Header *header =
+        (Freelist2_Allocation_Header *)((uintptr_t)ptr - sizeof(Freelist2_Allocation_Header));
+#ifdef FREELIST2_COMPACT_HEADER
+    if (header->owner_index != 0) {
+        return 0;
+    }
+#else
+    if (header->pOwner != NULL) {
+        return 0;
+    }
+#endif
+    return header->block_size - header->alignment_padding - sizeof(Freelist2_Allocation_Header);
+}
+
+inline void
+small_cache_init(Small_Cache *c, const alloc_api *backing, cacheable_size_fn cacheable_size)
+{
+    assert(c != NULL && backing != NULL && cacheable_size != NULL);
+    memset(c, 0, sizeof(Small_Cache));
+    c->backing = backing;
+    c->cacheable_size = cacheable_size;
+
+    c->api.alloc = small_cache_alloc;
+    c->api.alloc_align = small_cache_alloc_align;
+    c->api.realloc = small_cache_realloc;
+    c->api.realloc_align = small_cache_realloc_align;
+    c->api.free = small_cache_free;
+    c->api.free_all = small_cache_free_all;
+
+    c->api.alignment = backing->alignment;
+    c->api.allocator = (void *)c;
+}
+
+inline void
+small_cache_init_freelist(Small_Cache *c, Freelist *fl)
+{
+    small_cache_init(c, freelist_get_api(fl), small_cache_freelist_size);
+}
+
+inline void
+small_cache_init_freelist2(Small_Cache *c, Freelist2 *fl)
+{
+    small_cache_init(c, freelist2_get_api(fl), small_cache_freelist2_size);
+}
+
+inline alloc_api *
+small_cache_get_api(Small_Cache *c)
+{
+    return &c->api;
+}
+
+inline void *
+small_cache_alloc(void *c, size_t size)
+{
+    return small_cache_alloc_align(c, size, DEFAULT_ALIGNMENT);
+}
+
+inline void *
+small_cache_alloc_align(void *c, size_t size, size_t alignment)
+{
+    assert(c != NULL);
+    Small_Cache *cache = (Small_Cache *)c;
+    const alloc_api *backing = cache->backing;
+
+    // cached blocks are only guaranteed the default alignment.
+    if (size > SMALL_CACHE_MAX_SIZE || alignment > DEFAULT_ALIGNMENT) {
+        return backing->alloc_align(backing->allocator, size, alignment);
+    }
+
+    size_t size_class = size > SMALL_CACHE_GRANULE ? (size + SMALL_CACHE_GRANULE - 1) / SMALL_CACHE_GRANULE : 1;
+    // NOTE: the backing allocator can round small blocks up into the next class (Freelist2's compact header has a
+    // 32 byte minimum), so that one is worth a look too.
+    size_t last_class = size_class < SMALL_CACHE_CLASS_COUNT ? size_class + 1 : size_class;
+    for (size_t bin = size_class - 1; bin < last_class; ++bin) {
+        Small_Cache_Block *block = cache->bins[bin];
+        if (block != NULL) {
+            cache->bins[bin] = block->next;
+            cache->bin_counts[bin]--;
+            cache->hits++;
+            return (void *)block;
+        }
+    }
+
+    // the whole class size, so the block can serve any request of its class once it is cached.
+    cache->misses++;
+    return backing->alloc_align(backing->allocator, size_class * SMALL_CACHE_GRANULE, DEFAULT_ALIGNMENT);
+}
+
+// NOTE: keeps the keep blocks freed last, the rest of the bin goes back to the backing allocator.
+static inline void
+small_cache_trim_bin(Small_Cache *c, size_t bin, uint32_t keep)
+{
+    Small_Cache_Block **link = &c->bins[bin];
+    for (uint32_t i = 0; i < keep && *link != NULL; ++i) {
+        link = &(*link)->next;
+    }
+    Small_Cache_Block *block = *link;
+    *link = NULL;
+    while (block != NULL) {
+        Small_Cache_Block *next = block->next;
+        c->backing->free(c->backing->allocator, block);
+        c->bin_counts[bin]--;
+        block = next;
+    }
+}
+
+inline void
+small_cache_free(void *c, void *ptr)
+{
+    assert(c != NULL);
+    if (ptr == NULL) {
+        return;
+    }
+    Small_Cache *cache = (Small_Cache *)c;
+
+    // a block goes in the biggest class it can serve.
+    size_t size_class = cache->cacheable_size(cache->backing->allocator, ptr) / SMALL_CACHE_GRANULE;
+    if (size_class == 0 || size_class > SMALL_CACHE_CLASS_COUNT ||
+        ((uintptr_t)ptr & (DEFAULT_ALIGNMENT - 1)) != 0)
+    {
+        cache->backing->free(cache->backing->allocator, ptr);
+        return;
+    }
+
+    size_t bin = size_class - 1;
+    Small_Cache_Block *block = (Small_Cache_Block *)ptr;
+    block->next = cache->bins[bin];
+    cache->bins[bin] = block;
+    cache->bin_counts[bin]++;
+    if (cache->bin_counts[bin] > SMALL_CACHE_BIN_CAPACITY) {
+        small_cache_trim_bin(cache, bin, SMALL_CACHE_BIN_TRIM_TO);
+    }
+}
+
+inline void *
+small_cache_realloc(void *c, void *ptr, size_t new_size)
+{
+    return small_cache_realloc_align(c, ptr, new_size, DEFAULT_ALIGNMENT);
+}
+
+inline void *
+small_cache_realloc_align(void *c, void *ptr, size_t new_size, size_t alignment)
+{
+    assert(c != NULL);
+    Small_Cache *cache = (Small_Cache *)c;
+    if (ptr == NULL) {
+        return small_cache_alloc_align(c, new_size, alignment);
+    }
+    if (new_size == 0) {
+        small_cache_free(c, ptr);
+        return NULL;
+    }
+
+    size_t size = cache->cacheable_size(cache->backing->allocator, ptr);
+    bool aligned = ((uintptr_t)ptr & (alignment - 1)) == 0;
+    if (size != 0 && new_size <= size && aligned) {
+        return ptr;
+    }
+    // the backing allocator can grow in place, and knows how to carry an owner over. Freelist can not make a block
+    // more aligned than it is though, that takes a new block.
+    if (aligned || size == 0) {
+        if (cache->backing->realloc_align != NULL) {
+            return cache->backing->realloc_align(cache->backing->allocator, ptr, new_size, alignment);
+        }
+        if (cache->backing->realloc != NULL && alignment <= DEFAULT_ALIGNMENT) {
+            return cache->backing->realloc(cache->backing->allocator, ptr, new_size);
+        }
+    }
+
+    assert(size != 0);
+    void *new_ptr = small_cache_alloc_align(c, new_size, alignment);
+    if (new_ptr != NULL) {
+        memcpy(new_ptr, ptr, size < new_size ? size : new_size);
+        small_cache_free(c, ptr);
+    }
+    return new_ptr;
+}
+
+inline void
+small_cache_flush(Small_Cache *c)
+{
+    assert(c != NULL);
+    for (size_t i = 0; i < SMALL_CACHE_CLASS_COUNT; ++i) {
+        small_cache_trim_bin(c, i, 0);
+    }
+}
+
+inline void
+small_cache_free_all(void *c)
+{
+    assert(c != NULL);
+    Small_Cache *cache = (Small_Cache *)c;
+    memset(cache->bins, 0, sizeof(cache->bins));
+    memset(cache->bin_counts, 0, sizeof(cache->bin_counts));
+    cache->backing->free_all(cache->backing->allocator);
+}
+
+#ifdef SMALL_CACHE_ALLOCATOR_UNIT_TESTS
+
+static inline void
+small_cache_test_churn(Small_Cache *c, size_t *backing_used)
+{
+    enum { SLOT_COUNT = 256 };
+    void *slots[SLOT_COUNT] = {};
+    size_t sizes[SLOT_COUNT] = {};
+
+    // warm up: every class gets some blocks cached.
+    for (int i = 0; i < SLOT_COUNT; ++i) {
+        sizes[i] = 1 + (i * 37) % SMALL_CACHE_MAX_SIZE;
+        slots[i] = small_cache_alloc(c, sizes[i]);
+        assert(slots[i] != NULL && ((uintptr_t)slots[i] & (DEFAULT_ALIGNMENT - 1)) == 0);
+        memset(slots[i], i, sizes[i]);
+    }
+    for (int i = 0; i < SLOT_COUNT; ++i) {
+        small_cache_free(c, slots[i]);
+    }
+
+    // the same sizes again are all hits, and the backing allocator does not move.
+    size_t used = *backing_used;
+    size_t hits = c->hits;
+    for (int round = 0; round < 8; ++round) {
+        for (int i = 0; i < SLOT_COUNT; ++i) {
+            slots[i] = small_cache_alloc(c, sizes[i]);
+            memset(slots[i], i, sizes[i]);
+        }
+        for (int i = 0; i < SLOT_COUNT; ++i) {
+            for (size_t b = 0; b < sizes[i]; ++b) {
+                assert(((unsigned char *)slots[i])[b] == (unsigned char)i);
+            }
+        }
+        for (int i = SLOT_COUNT - 1; i >= 0; --i) {
+            small_cache_free(c, slots[i]);
+        }
+    }
+    assert(c->hits == hits + 8 * SLOT_COUNT);
+    assert(*backing_used == used);
+
+    // LIFO: the block freed last comes back first.
+    void *a = small_cache_alloc(c, 40);
+    small_cache_free(c, a);
+    assert(small_cache_alloc(c, 33) == a);
+    small_cache_free(c, a);
+
+    // big and over-aligned requests go around the cache.
+    hits = c->hits;
+    size_t misses = c->misses;
+    void *big = small_cache_alloc(c, SMALL_CACHE_MAX_SIZE + 1);
+    void *aligned = small_cache_alloc_align(c, 32, 64);
+    assert(big != NULL && aligned != NULL && ((uintptr_t)aligned & 63) == 0);
+    assert(c->hits == hits && c->misses == misses);
+    assert(*backing_used > used);
+    small_cache_free(c, big);
+    small_cache_free(c, aligned);
+
+    // a bin that overflows is trimmed, keeping the blocks freed last.
+    small_cache_flush(c);
+    size_t bin = (100 + SMALL_CACHE_GRANULE - 1) / SMALL_CACHE_GRANULE - 1;
+    void *many[SMALL_CACHE_BIN_CAPACITY + 16];
+    for (int i = 0; i < SMALL_CACHE_BIN_CAPACITY + 16; ++i) {
+        many[i] = small_cache_alloc(c, 100);
+    }
+    for (int i = 0; i < SMALL_CACHE_BIN_CAPACITY; ++i) {
+        small_cache_free(c, many[i]);
+    }
+    assert(c->bin_counts[bin] == SMALL_CACHE_BIN_CAPACITY);
+    used = *backing_used;
+    small_cache_free(c, many[SMALL_CACHE_BIN_CAPACITY]);
+    assert(c->bin_counts[bin] == SMALL_CACHE_BIN_TRIM_TO);
+    assert(*backing_used < used);
+    assert(small_cache_alloc(c, 100) == many[SMALL_CACHE_BIN_CAPACITY]);
+    small_cache_free(c, many[SMALL_CACHE_BIN_CAPACITY]);
+    for (int i = SMALL_CACHE_BIN_CAPACITY + 1; i < SMALL_CACHE_BIN_CAPACITY + 16; ++i) {
+        small_cache_free(c, many[i]);
+    }
+    assert(c->bin_counts[bin] == SMALL_CACHE_BIN_TRIM_TO + 15);
+
+    // growing keeps the contents.
+    unsigned char *p = (unsigned char *)small_cache_alloc(c, 24);
+    memset(p, 0x5a, 24);
+    p = (unsigned char *)small_cache_realloc(c, p, 200);
+    p = (unsigned char *)small_cache_realloc(c, p, 4000);
+    for (int b = 0; b < 24; ++b) {
+        assert(p[b] == 0x5a);
+    }
+    small_cache_free(c, p);
+
+    // the api has a realloc_align, which is what shrealloc calls.
+    alloc_api *api = small_cache_get_api(c);
+    assert(api->realloc_align != NULL);
+    p = (unsigned char *)shalloc(api, 24);
+    memset(p, 0x3c, 24);
+    p = (unsigned char *)shrealloc(api, p, 600);
+    p = (unsigned char *)shrealloc_a(api, p, 700, 64);
+    assert(p != NULL && ((uintptr_t)p & 63) == 0);
+    for (int b = 0; b < 24; ++b) {
+        assert(p[b] == 0x3c);
+    }
+    shfree(api, p);
+
+    small_cache_flush(c);
+    assert(*backing_used == 0);
+}
+
+static inline void
+small_cache_test_freelist()
+{
+    const size_t mem_size = 1024 * 1024;
+    void *memory = malloc(mem_size);
+    Freelist fl;
+    freelist_init(&fl, memory, mem_size, DEFAULT_ALIGNMENT);
+    fl.policy = PLACEMENT_POLICY_FIND_FIRST;
+
+    Small_Cache cache;
+    small_cache_init_freelist(&cache, &fl);
+    small_cache_test_churn(&cache, &fl.used);
+    free(memory);
+}
+
+static inline void
+small_cache_test_freelist2()
+{
+    const size_t mem_size = 1024 * 1024;
+    void *memory = malloc(mem_size);
+    Freelist2 fl = {};
+    freelist2_init(&fl, memory, mem_size, DEFAULT_ALIGNMENT);
+
+    Small_Cache cache;
+    small_cache_init_freelist2(&cache, &fl);
+    small_cache_test_churn(&cache, &fl.used);
+
+    // an allocation with an owner is never cached, the defragmentor has to see it freed.
+    void *owned = small_cache_alloc(&cache, 64);
+    freelist2_set_allocation_owner(&fl, owned, &owned);
+    small_cache_free(&cache, owned);
+    assert(fl.used == 0 && fl.block_count == 1);
+
+    freelist2_destroy(&fl);
+    free(memory);
+}
+
+inline void
+small_cache_unit_tests()
+{
+    small_cache_test_freelist();
+    small_cache_test_freelist2();
+}
+#endif
+
+#endif // SMALL_CACHE_ALLOCATOR_IMPLEMENTATION
+
+#endif // SMALL_CACHE_ALLOC_H
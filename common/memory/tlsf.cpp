@@ -1,42 +1,46 @@
 #include "tlsf.h"
 #include "memory.h"
+#include "virtual_memory.h"
+#include <cstdio>
 #include <cstring>
 #include <iostream>
-#include <memoryapi.h>
 
 namespace Tlsf
 {
 
+template <typename Offset_t>
 inline uint32_t
-Allocator::msbIndex(uint32_t mask)
+BasicAllocator<Offset_t>::msbIndex(Offset_t mask) const
 {
-    assert(mask != 0);
-
-    DWORD result = 0;
-    _BitScanReverse(&result, mask);
-    return result;
+    if constexpr (sizeof(Offset_t) == 8)
+    {
+        return msb_index64(mask);
+    }
+    return msb_index32((uint32_t)mask);
 }
 
+template <typename Offset_t>
 inline uint32_t
-Allocator::lsbIndex(uint32_t mask)
+BasicAllocator<Offset_t>::lsbIndex(Offset_t mask) const
 {
-    assert(mask != 0);
-
-    DWORD result;
-    _BitScanForward(&result, mask);
-    return result;
+    if constexpr (sizeof(Offset_t) == 8)
+    {
+        return lsb_index64(mask);
+    }
+    return lsb_index32((uint32_t)mask);
 }
 
+template <typename Offset_t>
 uint32_t
-Allocator::indexRounddown(uint32_t size)
+BasicAllocator<Offset_t>::indexRounddown(Offset_t size) const
 {
     assert(size >= 8);
 
     uint32_t l1Index = msbIndex(size);
     assert(l1Index >= 3 && l1Index < L1_BIN_COUNT);
 
-    uint32_t diff = size - (1u << l1Index);
-    uint32_t l2Index = (diff >> (l1Index - L2_LOG2_BINCOUNT));
+    Offset_t diff = size - ((Offset_t)1 << l1Index);
+    uint32_t l2Index = (uint32_t)(diff >> (l1Index - L2_LOG2_BINCOUNT));
     assert(l2Index < L2_BIN_COUNT);
 
     // NOTE: minimum alloc size is 8 which is 2^3. not storing bytes less than 8.
@@ -46,19 +50,20 @@ Allocator::indexRounddown(uint32_t size)
     return freelistIndex;
 }
 
+template <typename Offset_t>
 uint32_t
-Allocator::indexRoundup(uint32_t size)
+BasicAllocator<Offset_t>::indexRoundup(Offset_t size) const
 {
     assert(size >= 8);
 
     /* round-up NOTE: We are snapping size to the next TLSF bucket boundary. */
-    uint32_t sz = size + ((1 << (msbIndex(size) - L2_LOG2_BINCOUNT)) - 1);
+    Offset_t sz = size + (((Offset_t)1 << (msbIndex(size) - L2_LOG2_BINCOUNT)) - 1);
 
     uint32_t l1Index = msbIndex(sz); // floor(log2(sz))
     assert(l1Index >= 3 && l1Index < L1_BIN_COUNT);
 
-    uint32_t diff = sz - (1 << l1Index);
-    uint32_t l2Index = (diff >> (l1Index - L2_LOG2_BINCOUNT));
+    Offset_t diff = sz - ((Offset_t)1 << l1Index);
+    uint32_t l2Index = (uint32_t)(diff >> (l1Index - L2_LOG2_BINCOUNT));
     assert(l2Index < L2_BIN_COUNT);
 
     // NOTE: minimum alloc size is 8 which is 2^3. not storing bytes less than 8.
@@ -68,36 +73,114 @@ Allocator::indexRoundup(uint32_t size)
     return freelistIndex;
 }
 
+template <typename Offset_t>
+inline Offset_t
+BasicAllocator<Offset_t>::roundSize(Offset_t size)
+{
+    /// NOTE: every size is a multiple of MIN_SIZE_ALLOWED, which keeps every offset aligned to it as well.
+    return (size + (MIN_SIZE_ALLOWED - 1)) & ~(Offset_t)(MIN_SIZE_ALLOWED - 1);
+}
+
+template <typename Offset_t>
 inline uint32_t
-Allocator::getFreenodeIndex()
+BasicAllocator<Offset_t>::getFreenodeIndex()
 {
-    if (m_emptyNodeStackTop == 0)
+    if (m_emptyNodeCount == 0)
     {
-        assert(!"All freenodes have been consumed`!");
+        growNodeStorage(m_nodeCapacity * 2);
     }
-    uint32_t freeNodeIndex = m_emptyNodeStack[m_emptyNodeStackTop--];
+    uint32_t freeNodeIndex = m_emptyNodeStack[--m_emptyNodeCount];
     return freeNodeIndex;
 }
 
+template <typename Offset_t>
 inline void
-Allocator::addNodeToStore(uint32_t nodeIndex)
+BasicAllocator<Offset_t>::addNodeToStore(uint32_t nodeIndex)
+{
+    assert(m_emptyNodeCount < m_nodeCapacity);
+    m_emptyNodeStack[m_emptyNodeCount++] = nodeIndex;
+}
+
+template <typename Offset_t>
+inline bool
+BasicAllocator<Offset_t>::isAllocated(uint32_t nodeIndex) const
+{
+    return (m_allocatedBits[nodeIndex >> 6] >> (nodeIndex & 63)) & 1;
+}
+
+template <typename Offset_t>
+inline void
+BasicAllocator<Offset_t>::setAllocated(uint32_t nodeIndex, bool allocated)
+{
+    if (allocated)
+    {
+        m_allocatedBits[nodeIndex >> 6] |= (1ull << (nodeIndex & 63));
+    }
+    else
+    {
+        m_allocatedBits[nodeIndex >> 6] &= ~(1ull << (nodeIndex & 63));
+    }
+}
+
+template <typename Offset_t>
+void
+BasicAllocator<Offset_t>::growNodeStorage(uint32_t newCapacity)
 {
-    assert(m_emptyNodeStackTop < m_maxAllocs - 1);
-    m_emptyNodeStack[++m_emptyNodeStackTop] = nodeIndex;
+    uint32_t oldCapacity = m_nodeCapacity;
+    if (newCapacity > MAX_NODE_COUNT)
+    {
+        newCapacity = MAX_NODE_COUNT;
+    }
+    if (newCapacity <= oldCapacity)
+    {
+        assert(!"All freenodes have been consumed!");
+        return;
+    }
+
+    /// Every node array is reserved for MAX_NODE_COUNT entries, only the pages past the ones already committed are
+    /// committed here. Existing nodes never move.
+    size_t pageSize = vmem_page_size();
+    auto commitTail = [pageSize](void *base, size_t oldBytes, size_t newBytes)
+    {
+        size_t from = (oldBytes + pageSize - 1) & ~(pageSize - 1);
+        size_t to = (newBytes + pageSize - 1) & ~(pageSize - 1);
+        if (to > from && !vmem_commit((unsigned char *)base + from, to - from))
+        {
+            assert(!"Could not commit memory for the node storage!");
+        }
+    };
+    commitTail(m_ranges, oldCapacity * sizeof(Range), newCapacity * sizeof(Range));
+    commitTail(m_freeLinks, oldCapacity * sizeof(Link), newCapacity * sizeof(Link));
+    commitTail(m_aoLinks, oldCapacity * sizeof(Link), newCapacity * sizeof(Link));
+    commitTail(m_allocatedBits, ((oldCapacity + 63) / 64) * sizeof(uint64_t),
+               ((newCapacity + 63) / 64) * sizeof(uint64_t));
+    commitTail(m_emptyNodeStack, oldCapacity * sizeof(uint32_t), newCapacity * sizeof(uint32_t));
+
+    /// Push the new indices so that the lowest one is handed out first. Freshly committed pages are zeroed, so the
+    /// allocated bits of the new nodes are already clear.
+    for (uint32_t i = newCapacity; i > oldCapacity; --i)
+    {
+        m_ranges[i - 1] = {.offset = INVALID_OFFSET, .size = 0};
+        m_freeLinks[i - 1] = {.previous = NULLPTR, .next = NULLPTR};
+        m_aoLinks[i - 1] = {.previous = NULLPTR, .next = NULLPTR};
+        m_emptyNodeStack[m_emptyNodeCount++] = i - 1;
+    }
+    m_nodeCapacity = newCapacity;
 }
 
+template <typename Offset_t>
 void
-Allocator::findSuitableFreelist(uint32_t &l1Index, uint32_t &l2Index, uint32_t &freelistIndex)
+BasicAllocator<Offset_t>::findSuitableFreelist(uint32_t &l1Index, uint32_t &l2Index, uint32_t &freelistIndex)
 {
-    uint32_t mask = 1u << l1Index;
+    Offset_t mask = (Offset_t)1 << l1Index;
     if ((m_l1Bitmask & mask) == 0)
     {
     higher_l1_bin:
-        uint32_t b = m_l1Bitmask >> (l1Index + 1);
+        Offset_t b = m_l1Bitmask >> (l1Index + 1);
 
         if (!b)
         {
-            assert(!"INVALID_INDEX");
+            /// NOTE: callers decide whether this is fatal, allocateBatch() falls back to smaller requests.
             freelistIndex = INVALID_INDEX;
             return;
         }
@@ -122,56 +205,48 @@ Allocator::findSuitableFreelist(uint32_t &l1Index, uint32_t &l2Index, uint32_t &
     freelistIndex = (l1Index << L2_LOG2_BINCOUNT) + l2Index;
 }
 
-uint32_t
-Allocator::insertNode(uint32_t size, uint32_t offset)
+template <typename Offset_t>
+void
+BasicAllocator<Offset_t>::linkFreeNode(uint32_t nodeIndex)
 {
-    uint32_t freelistIndex = indexRounddown(size);
+    uint32_t freelistIndex = indexRounddown(m_ranges[nodeIndex].size);
 
     NodePtr_t headNodeIndex = m_freelistHeads[freelistIndex];
-    uint32_t newNodeIndex = getFreenodeIndex();
-    Node &newNode = m_nodes[newNodeIndex];
-    newNode.next = headNodeIndex;
-    newNode.prev = NULLPTR;
-    newNode.size = size;
-    newNode.offset = offset;
+    m_freeLinks[nodeIndex] = {.previous = NULLPTR, .next = headNodeIndex};
 
     if (headNodeIndex != NULLPTR)
     {
-        Node &headNode = m_nodes[headNodeIndex];
-        headNode.prev = newNodeIndex;
+        m_freeLinks[headNodeIndex].previous = nodeIndex;
     }
     else
     {
         uint32_t l1Index = freelistIndex >> L2_LOG2_BINCOUNT;
         uint32_t l2Index = freelistIndex & L2_MASK;
 
-        m_l1Bitmask |= (1u << l1Index);
+        m_l1Bitmask |= ((Offset_t)1 << l1Index);
         m_l2Bitmasks[l1Index] |= (1u << l2Index);
     }
 
-    m_freelistHeads[freelistIndex] = newNodeIndex;
-
-    return newNodeIndex;
+    m_freelistHeads[freelistIndex] = nodeIndex;
+    ++m_binNodeCounts[freelistIndex];
 }
 
+template <typename Offset_t>
 void
-Allocator::removeNode(uint32_t nodeIndex)
+BasicAllocator<Offset_t>::unlinkFreeNode(uint32_t nodeIndex)
 {
-    Node &node = m_nodes[nodeIndex];
-    /// NOTE: nodes with offset = NULLPTR are supposed to be invalid and already present in the empty node stack.
-    assert(!node.allocated && node.offset != NULLPTR &&
-           "this function is meant to remove only non-allocated free nodes.");
-
-    uint32_t index = indexRounddown(node.size);
-    if (node.prev == NULLPTR)
+    Link &link = m_freeLinks[nodeIndex];
+    uint32_t index = indexRounddown(m_ranges[nodeIndex].size);
+    assert(m_binNodeCounts[index] > 0);
+    --m_binNodeCounts[index];
+    if (link.previous == NULLPTR)
     {
         /// It is the first node its freelist.
         assert(m_freelistHeads[index] == nodeIndex);
-        if (node.next != NULLPTR)
+        if (link.next != NULLPTR)
         {
-            m_nodes[node.next].prev = NULLPTR;
-            m_freelistHeads[index] = node.next;
-            node.next = NULLPTR;
+            m_freeLinks[link.next].previous = NULLPTR;
+            m_freelistHeads[index] = link.next;
         }
         else
         {
@@ -181,49 +256,166 @@ Allocator::removeNode(uint32_t nodeIndex)
             m_l2Bitmasks[l1Index] &= ~(1 << l2Index);
             if (m_l2Bitmasks[l1Index] == 0)
             {
-                m_l1Bitmask &= ~(1 << l1Index);
+                m_l1Bitmask &= ~((Offset_t)1 << l1Index);
             }
         }
     }
     else
     {
-        if (node.next != NULLPTR)
+        if (link.next != NULLPTR)
         {
-            m_nodes[node.next].prev = node.prev;
+            m_freeLinks[link.next].previous = link.previous;
         }
-        m_nodes[node.prev].next = node.next;
-
-        node.prev = NULLPTR;
+        m_freeLinks[link.previous].next = link.next;
     }
+    link = {.previous = NULLPTR, .next = NULLPTR};
+}
 
+template <typename Offset_t>
+void
+BasicAllocator<Offset_t>::recycleNode(uint32_t nodeIndex)
+{
     /// Reset the node before returning it.
-    node.offset = INVALID_INDEX;
-    node.size = 0;
-    node.next = NULLPTR;
-    node.prev = NULLPTR;
-    node.aoPrevious = NULLPTR;
-    node.aoNext = NULLPTR;
-    node.allocated = false;
+    m_ranges[nodeIndex] = {.offset = INVALID_OFFSET, .size = 0};
+    m_freeLinks[nodeIndex] = {.previous = NULLPTR, .next = NULLPTR};
+    m_aoLinks[nodeIndex] = {.previous = NULLPTR, .next = NULLPTR};
 
     /// Return the node to the freestore.
-    m_emptyNodeStack[++m_emptyNodeStackTop] = nodeIndex;
+    addNodeToStore(nodeIndex);
+}
+
+template <typename Offset_t>
+uint32_t
+BasicAllocator<Offset_t>::insertNode(Offset_t size, Offset_t offset)
+{
+    uint32_t newNodeIndex = getFreenodeIndex();
+    m_ranges[newNodeIndex] = {.offset = offset, .size = size};
+    linkFreeNode(newNodeIndex);
+
+    return newNodeIndex;
 }
 
-Allocation
-Allocator::allocate(uint32_t size)
+template <typename Offset_t>
+void
+BasicAllocator<Offset_t>::removeNode(uint32_t nodeIndex)
+{
+    /// NOTE: nodes with offset = INVALID_OFFSET are supposed to be invalid and already present in the empty node stack.
+    assert(!isAllocated(nodeIndex) && m_ranges[nodeIndex].offset != INVALID_OFFSET &&
+           "this function is meant to remove only non-allocated free nodes.");
+
+    unlinkFreeNode(nodeIndex);
+    recycleNode(nodeIndex);
+}
+
+template <typename Offset_t>
+bool
+BasicAllocator<Offset_t>::commitRange(Offset_t offset, Offset_t size)
+{
+    uint64_t firstChunk = offset / COMMIT_GRANULARITY;
+    uint64_t lastChunk = ((uint64_t)offset + size - 1) / COMMIT_GRANULARITY;
+    assert(lastChunk < m_arenaSize / COMMIT_GRANULARITY);
+
+    /// Commit each run of not yet committed chunks with a single call. After warming up there are none, chunks are
+    /// never decommitted again.
+    uint64_t chunk = firstChunk;
+    while (chunk <= lastChunk)
+    {
+        if (m_commitBitmap[chunk >> 6] & (1ull << (chunk & 63)))
+        {
+            ++chunk;
+            continue;
+        }
+
+        uint64_t runStart = chunk;
+        while (chunk <= lastChunk && !(m_commitBitmap[chunk >> 6] & (1ull << (chunk & 63))))
+        {
+            ++chunk;
+        }
+        if (!vmem_commit(m_backBuffer + runStart * COMMIT_GRANULARITY, (chunk - runStart) * COMMIT_GRANULARITY))
+        {
+            return false;
+        }
+        for (uint64_t committed = runStart; committed < chunk; ++committed)
+        {
+            m_commitBitmap[committed >> 6] |= (1ull << (committed & 63));
+        }
+    }
+
+    /// A purged chunk needs no system call to be used again, its pages come back on first touch.
+    for (chunk = firstChunk; chunk <= lastChunk; ++chunk)
+    {
+        if (!(m_residentBitmap[chunk >> 6] & (1ull << (chunk & 63))))
+        {
+            m_residentBitmap[chunk >> 6] |= (1ull << (chunk & 63));
+            ++m_residentChunks;
+        }
+    }
+    return true;
+}
+
+template <typename Offset_t>
+void
+BasicAllocator<Offset_t>::decommitRange(Offset_t offset, Offset_t size)
+{
+    /// NOTE: as long as the resident memory nobody uses stays below the retained bytes, freed chunks keep their
+    /// pages. Past that, every chunk freed is purged until the next allocation makes it resident again.
+    if (m_residentChunks * COMMIT_GRANULARITY <= m_usedBytes + m_retainedBytes)
+    {
+        return;
+    }
+
+    /// Only chunks which lie completely inside the free range can be given back, the partially covered ones at
+    /// either end still hold bytes of the neighbouring allocations.
+    uint64_t firstChunk = ((uint64_t)offset + COMMIT_GRANULARITY - 1) / COMMIT_GRANULARITY;
+    uint64_t endChunk = ((uint64_t)offset + size) / COMMIT_GRANULARITY;
+
+    uint64_t chunk = firstChunk;
+    while (chunk < endChunk)
+    {
+        if (!(m_residentBitmap[chunk >> 6] & (1ull << (chunk & 63))))
+        {
+            ++chunk;
+            continue;
+        }
+
+        uint64_t runStart = chunk;
+        while (chunk < endChunk && (m_residentBitmap[chunk >> 6] & (1ull << (chunk & 63))))
+        {
+            m_residentBitmap[chunk >> 6] &= ~(1ull << (chunk & 63));
+            --m_residentChunks;
+            ++chunk;
+        }
+
+        vmem_purge(m_backBuffer + runStart * COMMIT_GRANULARITY, (chunk - runStart) * COMMIT_GRANULARITY);
+    }
+}
+
+template <typename Offset_t>
+void
+BasicAllocator<Offset_t>::setRetainedBytes(uint64_t bytes)
+{
+    m_retainedBytes = bytes;
+}
+
+template <typename Offset_t>
+BasicAllocation<Offset_t>
+BasicAllocator<Offset_t>::allocate(Offset_t size, Offset_t alignment)
 {
     if (size == 0)
     {
         assert(!"Size 0 is like free!");
     }
-    if (size < MIN_SIZE_ALLOWED)
+    assert(alignment != 0 && (alignment & (alignment - 1)) == 0 && "Alignment must be a power of 2!");
+    size = roundSize(size);
+    if (alignment < MIN_SIZE_ALLOWED)
     {
-        size = MIN_SIZE_ALLOWED;
+        alignment = MIN_SIZE_ALLOWED;
     }
 
-    std::cout << "***********  Allocating " << size << " bytes.  **********\n";
-
-    uint32_t candidateFreelistIndex = indexRoundup(size);
+    /// Offsets are multiples of MIN_SIZE_ALLOWED, so at most (alignment - MIN_SIZE_ALLOWED) bytes of padding are
+    /// needed in front of the allocation.
+    Offset_t searchSize = size + (alignment - MIN_SIZE_ALLOWED);
+    uint32_t candidateFreelistIndex = indexRoundup(searchSize);
     uint32_t l1Index = candidateFreelistIndex >> L2_LOG2_BINCOUNT;
     uint32_t l2Index = candidateFreelistIndex & L2_MASK;
 
@@ -233,141 +425,582 @@ Allocator::allocate(uint32_t size)
     if (freelistIndex == INVALID_INDEX)
     {
         assert(!"No memory left");
+        return {.offset = INVALID_OFFSET, .nodeIndex = INVALID_INDEX};
     }
 
     NodePtr_t headNodeIndex = m_freelistHeads[freelistIndex];
-    assert(headNodeIndex != INVALID_INDEX && headNodeIndex < m_maxAllocs);
-    Node &headNode = m_nodes[headNodeIndex];
-    assert(headNode.size >= size && !headNode.allocated);
+    assert(headNodeIndex != NULLPTR && headNodeIndex < m_nodeCapacity);
+    Range &headRange = m_ranges[headNodeIndex];
+    assert(headRange.size >= searchSize && !isAllocated(headNodeIndex));
+
+    /// Commit before touching anything, so that a failure leaves the allocator as it was.
+    Offset_t padding = ((headRange.offset + (alignment - 1)) & ~(alignment - 1)) - headRange.offset;
+    if (!commitRange(headRange.offset + padding, size))
+    {
+        return {.offset = INVALID_OFFSET, .nodeIndex = INVALID_INDEX};
+    }
 
-    NodePtr_t nextNodeIndex = headNode.next;
+    NodePtr_t nextNodeIndex = m_freeLinks[headNodeIndex].next;
     m_freelistHeads[freelistIndex] = nextNodeIndex;
+    --m_binNodeCounts[freelistIndex];
     if (nextNodeIndex != NULLPTR)
     {
-        m_nodes[nextNodeIndex].prev = NULLPTR;
+        m_freeLinks[nextNodeIndex].previous = NULLPTR;
     }
     else
     {
         m_l2Bitmasks[l1Index] &= ~(1 << l2Index);
         if (m_l2Bitmasks[l1Index] == 0)
         {
-            m_l1Bitmask &= ~(1 << l1Index);
+            m_l1Bitmask &= ~((Offset_t)1 << l1Index);
         }
     }
+    m_freeLinks[headNodeIndex] = {.previous = NULLPTR, .next = NULLPTR};
 
-    assert(headNode.size >= size);
-    uint32_t remainingSize = headNode.size - size;
+    if (padding != 0)
+    {
+        /// The leading padding becomes a free node of its own in front of the allocation instead of being wasted.
+        assert(padding >= MIN_SIZE_ALLOWED);
+        uint32_t paddingNodeIndex = insertNode(padding, headRange.offset);
+
+        Link &headAo = m_aoLinks[headNodeIndex];
+        if (headAo.previous != NULLPTR)
+        {
+            m_aoLinks[headAo.previous].next = paddingNodeIndex;
+        }
+
+        m_aoLinks[paddingNodeIndex] = {.previous = headAo.previous, .next = headNodeIndex};
+        headAo.previous = paddingNodeIndex;
+
+        headRange.offset += padding;
+        headRange.size -= padding;
+    }
+
+    assert(headRange.size >= size);
+    Offset_t remainingSize = headRange.size - size;
 
     if (remainingSize >= MIN_SIZE_ALLOWED)
     {
-        uint32_t newNodeIndex = insertNode(remainingSize, headNode.offset + size);
+        uint32_t newNodeIndex = insertNode(remainingSize, headRange.offset + size);
 
-        assert(headNode.size > size);
-        headNode.size -= remainingSize;
+        assert(headRange.size > size);
+        headRange.size -= remainingSize;
 
-        Node &newNode = m_nodes[newNodeIndex];
-        if (headNode.aoNext != NULLPTR)
+        Link &headAo = m_aoLinks[headNodeIndex];
+        if (headAo.next != NULLPTR)
         {
-            m_nodes[headNode.aoNext].aoPrevious = newNodeIndex;
+            m_aoLinks[headAo.next].previous = newNodeIndex;
         }
 
-        newNode.aoPrevious = headNodeIndex;
-        newNode.aoNext = headNode.aoNext;
-
-        headNode.aoNext = newNodeIndex;
+        m_aoLinks[newNodeIndex] = {.previous = headNodeIndex, .next = headAo.next};
+        headAo.next = newNodeIndex;
     }
 
-    headNode.allocated = true;
-    validate();
-    return {.offset = headNode.offset, .nodeIndex = headNodeIndex};
+    setAllocated(headNodeIndex, true);
+    trackAllocation(headRange.size, 1);
+#if TLSF_CHECKED
+    checkNode(headNodeIndex);
+#endif
+    return {.offset = headRange.offset, .nodeIndex = headNodeIndex};
 }
 
+template <typename Offset_t>
 void
-Allocator::free(Allocation allocation)
+BasicAllocator<Offset_t>::free(BasicAllocation<Offset_t> allocation)
 {
-    assert(allocation.nodeIndex != INVALID_INDEX);
-    std::cout << "***********  Freeing " << m_nodes[allocation.nodeIndex].size << " bytes at offset "
-              << allocation.offset << " *********\n";
+    assert(allocation.nodeIndex != INVALID_INDEX && allocation.nodeIndex < m_nodeCapacity);
 
-    Node &nodeToFree = m_nodes[allocation.nodeIndex];
-    if (!nodeToFree.allocated)
+    uint32_t nodeIndex = allocation.nodeIndex;
+    if (!isAllocated(nodeIndex))
     {
         assert(!"Double Free? or a valid allocated node was not marked as allocated.");
         return;
     }
 
-    if (nodeToFree.aoPrevious != NULLPTR && !m_nodes[nodeToFree.aoPrevious].allocated)
-    {
-        Node prevFreeNeighbor = m_nodes[nodeToFree.aoPrevious];
-        removeNode(nodeToFree.aoPrevious);
+    Range range = m_ranges[nodeIndex];
+    Link ao = m_aoLinks[nodeIndex];
 
-        nodeToFree.size += prevFreeNeighbor.size;
+    m_usedBytes -= range.size;
+    --m_allocationCount;
+
+    /// The allocated bits are all that is read of a neighbour which cannot be merged.
+    if (ao.previous != NULLPTR && !isAllocated(ao.previous))
+    {
+        Range prevFreeNeighbor = m_ranges[ao.previous];
+        NodePtr_t prevPrevious = m_aoLinks[ao.previous].previous;
+        removeNode(ao.previous);
 
-        assert(prevFreeNeighbor.offset < m_nodes[allocation.nodeIndex].offset);
-        nodeToFree.offset = prevFreeNeighbor.offset;
+        assert(prevFreeNeighbor.offset < range.offset);
+        range.offset = prevFreeNeighbor.offset;
+        range.size += prevFreeNeighbor.size;
 
-        nodeToFree.aoPrevious = prevFreeNeighbor.aoPrevious;
-        if (nodeToFree.aoPrevious != INVALID_INDEX)
+        ao.previous = prevPrevious;
+        if (ao.previous != NULLPTR)
         {
-            m_nodes[nodeToFree.aoPrevious].aoNext = allocation.nodeIndex;
+            m_aoLinks[ao.previous].next = nodeIndex;
         }
     }
 
-    if (nodeToFree.aoNext != NULLPTR && !m_nodes[nodeToFree.aoNext].allocated)
+    if (ao.next != NULLPTR && !isAllocated(ao.next))
     {
         /// cache the next node
-        Node nextFreeNeighbor = m_nodes[nodeToFree.aoNext];
+        Range nextFreeNeighbor = m_ranges[ao.next];
+        NodePtr_t nextNext = m_aoLinks[ao.next].next;
         /// remove
-        removeNode(nodeToFree.aoNext);
+        removeNode(ao.next);
 
-        nodeToFree.size += nextFreeNeighbor.size;
-        assert(nextFreeNeighbor.offset > m_nodes[allocation.nodeIndex].offset);
+        assert(nextFreeNeighbor.offset > range.offset);
+        range.size += nextFreeNeighbor.size;
 
-        nodeToFree.aoNext = nextFreeNeighbor.aoNext;
-        if (nodeToFree.aoNext != INVALID_INDEX)
+        ao.next = nextNext;
+        if (ao.next != NULLPTR)
         {
-            m_nodes[nodeToFree.aoNext].aoPrevious = allocation.nodeIndex;
+            m_aoLinks[ao.next].previous = nodeIndex;
         }
     }
 
-    NodePtr_t p = nodeToFree.aoPrevious;
-    NodePtr_t n = nodeToFree.aoNext;
+    decommitRange(range.offset, range.size);
 
-    addNodeToStore(allocation.nodeIndex);
-    uint32_t insertedNodeIndex = insertNode(nodeToFree.size, nodeToFree.offset);
+    /// The freed node itself becomes the merged free node, so the neighbours' links to nodeIndex stay valid.
+    setAllocated(nodeIndex, false);
+    m_ranges[nodeIndex] = range;
+    m_aoLinks[nodeIndex] = ao;
+    linkFreeNode(nodeIndex);
 
-    m_nodes[insertedNodeIndex].aoPrevious = p;
-    m_nodes[insertedNodeIndex].aoNext = n;
-    m_nodes[insertedNodeIndex].allocated = false;
+#if TLSF_CHECKED
+    checkNode(nodeIndex);
+#endif
+}
 
-    validate();
+template <typename Offset_t>
+BasicAllocation<Offset_t>
+BasicAllocator<Offset_t>::reallocate(BasicAllocation<Offset_t> allocation, Offset_t newSize, Offset_t alignment)
+{
+    assert(allocation.nodeIndex != INVALID_INDEX && allocation.nodeIndex < m_nodeCapacity);
+    assert(isAllocated(allocation.nodeIndex) && "Reallocating a block which is not allocated!");
+    if (newSize == 0)
+    {
+        assert(!"Size 0 is like free!");
+    }
+    newSize = roundSize(newSize);
+
+    uint32_t nodeIndex = allocation.nodeIndex;
+    Range &range = m_ranges[nodeIndex];
+    Link &ao = m_aoLinks[nodeIndex];
+    bool nextIsFree = ao.next != NULLPTR && !isAllocated(ao.next);
+
+    if (newSize <= range.size)
+    {
+        Offset_t tailSize = range.size - newSize;
+        if (tailSize < MIN_SIZE_ALLOWED)
+        {
+            return allocation;
+        }
+
+        /// Shrink: the tail becomes a free node, merged with the free neighbour behind it if there is one.
+        Offset_t tailOffset = range.offset + newSize;
+        NodePtr_t tailNext = ao.next;
+        if (nextIsFree)
+        {
+            Range nextFreeNeighbor = m_ranges[ao.next];
+            tailNext = m_aoLinks[ao.next].next;
+            removeNode(ao.next);
+            tailSize += nextFreeNeighbor.size;
+        }
+
+        uint32_t tailIndex = insertNode(tailSize, tailOffset);
+        m_aoLinks[tailIndex] = {.previous = nodeIndex, .next = tailNext};
+        if (tailNext != NULLPTR)
+        {
+            m_aoLinks[tailNext].previous = tailIndex;
+        }
+        ao.next = tailIndex;
+
+        m_usedBytes -= range.size - newSize;
+        range.size = newSize;
+        decommitRange(tailOffset, tailSize);
+#if TLSF_CHECKED
+        checkNode(nodeIndex);
+        checkNode(tailIndex);
+#endif
+        return allocation;
+    }
+
+    Offset_t growBy = newSize - range.size;
+    if (nextIsFree && m_ranges[ao.next].size >= growBy)
+    {
+        /// Grow: take the front of the free neighbour. Whatever is left of it stays a free node, rebinned for its
+        /// new size, unless it is too small to stand on its own.
+        uint32_t nextIndex = ao.next;
+        Range &next = m_ranges[nextIndex];
+        Offset_t leftover = next.size - growBy;
+        if (!commitRange(range.offset + range.size, leftover >= MIN_SIZE_ALLOWED ? growBy : next.size))
+        {
+            return {.offset = INVALID_OFFSET, .nodeIndex = INVALID_INDEX};
+        }
+        unlinkFreeNode(nextIndex);
+
+        if (leftover >= MIN_SIZE_ALLOWED)
+        {
+            next.offset += growBy;
+            next.size = leftover;
+            linkFreeNode(nextIndex);
+        }
+        else
+        {
+            growBy = next.size;
+            ao.next = m_aoLinks[nextIndex].next;
+            if (ao.next != NULLPTR)
+            {
+                m_aoLinks[ao.next].previous = nodeIndex;
+            }
+            recycleNode(nextIndex);
+        }
+
+        range.size += growBy;
+        trackAllocation(growBy, 0);
+#if TLSF_CHECKED
+        checkNode(nodeIndex);
+#endif
+        return allocation;
+    }
+
+    /// The neighbour cannot make up the difference, move the data.
+    Offset_t oldSize = range.size;
+    BasicAllocation<Offset_t> moved = allocate(newSize, alignment);
+    if (moved.nodeIndex == INVALID_INDEX)
+    {
+        return moved;
+    }
+    memcpy(m_backBuffer + moved.offset, m_backBuffer + allocation.offset, oldSize);
+    free(allocation);
+    return moved;
+}
+
+template <typename Offset_t>
+void
+BasicAllocator<Offset_t>::allocateBatch(std::span<const Offset_t> sizes, std::span<BasicAllocation<Offset_t>> out)
+{
+    assert(sizes.size() == out.size());
+    if (sizes.empty())
+    {
+        return;
+    }
+
+    /// NOTE: keep the total well below the top bin so rounding it up to a bin boundary cannot overflow.
+    constexpr Offset_t MAX_BATCH_SIZE = (Offset_t)1 << (L1_BIN_COUNT - 2);
+    Offset_t totalSize = 0;
+    for (Offset_t size : sizes)
+    {
+        assert(size != 0 && "Size 0 is like free!");
+        totalSize += roundSize(size);
+        if (totalSize >= MAX_BATCH_SIZE)
+        {
+            break;
+        }
+    }
+
+    uint32_t freelistIndex = INVALID_INDEX;
+    if (totalSize < MAX_BATCH_SIZE)
+    {
+        uint32_t candidateFreelistIndex = indexRoundup(totalSize);
+        uint32_t l1Index = candidateFreelistIndex >> L2_LOG2_BINCOUNT;
+        uint32_t l2Index = candidateFreelistIndex & L2_MASK;
+        findSuitableFreelist(l1Index, l2Index, freelistIndex);
+    }
+
+    if (freelistIndex == INVALID_INDEX)
+    {
+        for (size_t i = 0; i < sizes.size(); ++i)
+        {
+            out[i] = allocate(sizes[i]);
+        }
+        return;
+    }
+
+    NodePtr_t blockIndex = m_freelistHeads[freelistIndex];
+    assert(blockIndex != NULLPTR && !isAllocated(blockIndex) && m_ranges[blockIndex].size >= totalSize);
+    if (!commitRange(m_ranges[blockIndex].offset, totalSize))
+    {
+        for (size_t i = 0; i < sizes.size(); ++i)
+        {
+            out[i] = {.offset = INVALID_OFFSET, .nodeIndex = INVALID_INDEX};
+        }
+        return;
+    }
+    unlinkFreeNode(blockIndex);
+
+    Range block = m_ranges[blockIndex];
+    NodePtr_t blockAoNext = m_aoLinks[blockIndex].next;
+
+    /// The free block's node becomes the first allocation, every following one takes a fresh node and is linked in
+    /// address order right behind the previous one.
+    Offset_t offset = block.offset;
+    NodePtr_t previousIndex = m_aoLinks[blockIndex].previous;
+    for (size_t i = 0; i < sizes.size(); ++i)
+    {
+        Offset_t size = roundSize(sizes[i]);
+        uint32_t nodeIndex = (i == 0) ? blockIndex : getFreenodeIndex();
+
+        m_ranges[nodeIndex] = {.offset = offset, .size = size};
+        m_aoLinks[nodeIndex] = {.previous = previousIndex, .next = NULLPTR};
+        if (i > 0)
+        {
+            m_aoLinks[previousIndex].next = nodeIndex;
+        }
+        setAllocated(nodeIndex, true);
+
+        out[i] = {.offset = offset, .nodeIndex = nodeIndex};
+        offset += size;
+        previousIndex = nodeIndex;
+    }
+
+    Offset_t remainingSize = block.size - (offset - block.offset);
+    if (remainingSize >= MIN_SIZE_ALLOWED)
+    {
+        uint32_t remainderIndex = insertNode(remainingSize, offset);
+        m_aoLinks[remainderIndex] = {.previous = previousIndex, .next = blockAoNext};
+        m_aoLinks[previousIndex].next = remainderIndex;
+        previousIndex = remainderIndex;
+    }
+    else
+    {
+        /// Too small to stand on its own, the last block of the batch keeps it.
+        m_ranges[previousIndex].size += remainingSize;
+        offset += remainingSize;
+    }
+    m_aoLinks[previousIndex].next = blockAoNext;
+    if (blockAoNext != NULLPTR)
+    {
+        m_aoLinks[blockAoNext].previous = previousIndex;
+    }
+
+    trackAllocation(offset - block.offset, (uint32_t)sizes.size());
+#if TLSF_CHECKED
+    checkNode(blockIndex);
+    checkNode(previousIndex);
+#endif
+}
+
+template <typename Offset_t>
+void
+BasicAllocator<Offset_t>::freeBatch(std::span<const BasicAllocation<Offset_t>> allocations)
+{
+    /// First pass: mark every node of the batch as free but not binned yet.
+    for (const BasicAllocation<Offset_t> &allocation : allocations)
+    {
+        assert(allocation.nodeIndex != INVALID_INDEX && allocation.nodeIndex < m_nodeCapacity);
+        if (!isAllocated(allocation.nodeIndex))
+        {
+            assert(!"Double Free? or a valid allocated node was not marked as allocated.");
+            continue;
+        }
+        setAllocated(allocation.nodeIndex, false);
+        m_freeLinks[allocation.nodeIndex] = {.previous = PENDING_FREE, .next = NULLPTR};
+
+        m_usedBytes -= m_ranges[allocation.nodeIndex].size;
+        --m_allocationCount;
+    }
+
+    /// Second pass: every run of adjacent free nodes is merged into its leftmost node, which is binned once. A node
+    /// that is no longer pending was already merged into the run of an earlier one.
+    for (const BasicAllocation<Offset_t> &allocation : allocations)
+    {
+        uint32_t nodeIndex = allocation.nodeIndex;
+        if (m_freeLinks[nodeIndex].previous != PENDING_FREE)
+        {
+            continue;
+        }
+
+        uint32_t firstIndex = nodeIndex;
+        while (m_aoLinks[firstIndex].previous != NULLPTR && !isAllocated(m_aoLinks[firstIndex].previous))
+        {
+            firstIndex = m_aoLinks[firstIndex].previous;
+        }
+        if (m_freeLinks[firstIndex].previous != PENDING_FREE)
+        {
+            unlinkFreeNode(firstIndex);
+        }
+
+        Range &run = m_ranges[firstIndex];
+        NodePtr_t nextIndex = m_aoLinks[firstIndex].next;
+        while (nextIndex != NULLPTR && !isAllocated(nextIndex))
+        {
+            if (m_freeLinks[nextIndex].previous != PENDING_FREE)
+            {
+                unlinkFreeNode(nextIndex);
+            }
+            assert(run.offset + run.size == m_ranges[nextIndex].offset);
+            run.size += m_ranges[nextIndex].size;
+
+            NodePtr_t afterIndex = m_aoLinks[nextIndex].next;
+            recycleNode(nextIndex);
+            nextIndex = afterIndex;
+        }
+
+        m_aoLinks[firstIndex].next = nextIndex;
+        if (nextIndex != NULLPTR)
+        {
+            m_aoLinks[nextIndex].previous = firstIndex;
+        }
+
+        decommitRange(run.offset, run.size);
+        linkFreeNode(firstIndex);
+#if TLSF_CHECKED
+        checkNode(firstIndex);
+#endif
+    }
 }
 
+#if TLSF_CHECKED
+template <typename Offset_t>
 void
-Allocator::validate() const
+BasicAllocator<Offset_t>::checkNode(uint32_t nodeIndex) const
+{
+    /// Only looks at the node and its direct neighbours, so this stays O(1) per operation.
+    assert(nodeIndex < m_nodeCapacity);
+    const Range &range = m_ranges[nodeIndex];
+    const Link &ao = m_aoLinks[nodeIndex];
+    bool allocated = isAllocated(nodeIndex);
+    assert(range.offset != INVALID_OFFSET && range.size >= MIN_SIZE_ALLOWED);
+
+    if (ao.previous != NULLPTR)
+    {
+        const Range &prev = m_ranges[ao.previous];
+        assert(m_aoLinks[ao.previous].next == nodeIndex && "Broken address-order links!");
+        assert(prev.offset + prev.size == range.offset && "Address-order neighbours are not contiguous!");
+        assert((allocated || isAllocated(ao.previous)) && "Two adjacent free nodes were not coalesced!");
+    }
+    if (ao.next != NULLPTR)
+    {
+        const Range &next = m_ranges[ao.next];
+        assert(m_aoLinks[ao.next].previous == nodeIndex && "Broken address-order links!");
+        assert(range.offset + range.size == next.offset && "Address-order neighbours are not contiguous!");
+        assert((allocated || isAllocated(ao.next)) && "Two adjacent free nodes were not coalesced!");
+    }
+
+    if (!allocated)
+    {
+        const Link &link = m_freeLinks[nodeIndex];
+        uint32_t freelistIndex = indexRounddown(range.size);
+        uint32_t l1Index = freelistIndex >> L2_LOG2_BINCOUNT;
+        uint32_t l2Index = freelistIndex & L2_MASK;
+        assert((m_l1Bitmask & ((Offset_t)1 << l1Index)) && (m_l2Bitmasks[l1Index] & (1u << l2Index)) &&
+               "Free node sits in a bin whose bitmap bit is cleared!");
+        if (link.previous == NULLPTR)
+        {
+            assert(m_freelistHeads[freelistIndex] == nodeIndex && "Free node is not linked into its bin!");
+        }
+        else
+        {
+            assert(m_freeLinks[link.previous].next == nodeIndex && "Broken freelist links!");
+        }
+        if (link.next != NULLPTR)
+        {
+            assert(m_freeLinks[link.next].previous == nodeIndex && "Broken freelist links!");
+        }
+    }
+}
+#endif
+
+template <typename Offset_t>
+inline void
+BasicAllocator<Offset_t>::trackAllocation(uint64_t size, uint32_t count)
+{
+    m_usedBytes += size;
+    m_allocationCount += count;
+    if (m_usedBytes > m_peakUsedBytes)
+    {
+        m_peakUsedBytes = m_usedBytes;
+    }
+    if (m_allocationCount > m_peakAllocationCount)
+    {
+        m_peakAllocationCount = m_allocationCount;
+    }
+}
+
+template <typename Offset_t>
+typename BasicAllocator<Offset_t>::Stats
+BasicAllocator<Offset_t>::getStats() const
+{
+    Stats stats;
+    stats.usedBytes = m_usedBytes;
+    stats.freeBytes = m_managedSize - m_usedBytes;
+    stats.peakUsedBytes = m_peakUsedBytes;
+    stats.allocationCount = m_allocationCount;
+    stats.peakAllocationCount = m_peakAllocationCount;
+
+    stats.freeBlockCount = 0;
+    for (uint32_t i = 0; i < TOTAL_BIN_COUNT; ++i)
+    {
+        stats.freeBlocksPerBin[i] = m_binNodeCounts[i];
+        stats.freeBlockCount += m_binNodeCounts[i];
+    }
+
+    /// The largest free block sits in the highest non-empty bin, only that bin's list needs to be looked at.
+    stats.largestFreeBlock = 0;
+    if (m_l1Bitmask != 0)
+    {
+        uint32_t l1Index = msbIndex(m_l1Bitmask);
+        uint32_t l2Index = msb_index32(m_l2Bitmasks[l1Index]);
+        NodePtr_t nodeIndex = m_freelistHeads[(l1Index << L2_LOG2_BINCOUNT) + l2Index];
+        while (nodeIndex != NULLPTR)
+        {
+            if (m_ranges[nodeIndex].size > stats.largestFreeBlock)
+            {
+                stats.largestFreeBlock = m_ranges[nodeIndex].size;
+            }
+            nodeIndex = m_freeLinks[nodeIndex].next;
+        }
+    }
+
+    stats.externalFragmentation =
+        (stats.freeBytes == 0) ? 0.0f : 1.0f - (float)((double)stats.largestFreeBlock / (double)stats.freeBytes);
+    return stats;
+}
+
+template <typename Offset_t>
+uint64_t
+BasicAllocator<Offset_t>::binMinSize(uint32_t binIndex)
+{
+    assert(binIndex < TOTAL_BIN_COUNT);
+    uint32_t l1Index = (binIndex >> L2_LOG2_BINCOUNT) + 3;
+    uint32_t l2Index = binIndex & L2_MASK;
+    if (l1Index >= 64)
+    {
+        /// Bins past the top of a 64-bit offset can never hold anything.
+        return ~0ull;
+    }
+    return (1ull << l1Index) + ((uint64_t)l2Index << (l1Index - L2_LOG2_BINCOUNT));
+}
+
+template <typename Offset_t>
+void
+BasicAllocator<Offset_t>::validate() const
 {
     uint32_t numAllocs = 0, numFrees = 0;
     std::cout << "----------------------------------------------------------------\n";
     std::cout << "[ALLOCATIONS]: \n";
-    for (uint32_t nodeIndex = 0, count = 0; nodeIndex < m_maxAllocs; ++nodeIndex)
+    for (uint32_t nodeIndex = 0, count = 0; nodeIndex < m_nodeCapacity; ++nodeIndex)
     {
-        const Node &node = m_nodes[nodeIndex];
-        if (node.offset != INVALID_INDEX && node.allocated)
+        const Range &range = m_ranges[nodeIndex];
+        if (range.offset != INVALID_OFFSET && isAllocated(nodeIndex))
         {
             numAllocs++;
             ++count;
-            std::cout << count << ") offset: " << node.offset << ", size: " << node.size
+            std::cout << count << ") offset: " << range.offset << ", size: " << range.size
                       << ", nodeIndex: " << nodeIndex << "\n";
 
-            if (node.aoNext != NULLPTR && m_nodes[node.aoNext].offset != NULLPTR)
+            const Link &ao = m_aoLinks[nodeIndex];
+            if (ao.next != NULLPTR && m_ranges[ao.next].offset != INVALID_OFFSET)
             {
-                assert(m_nodes[node.aoNext].aoPrevious == nodeIndex);
-                assert(node.offset + node.size == m_nodes[node.aoNext].offset);
+                assert(m_aoLinks[ao.next].previous == nodeIndex);
+                assert(range.offset + range.size == m_ranges[ao.next].offset);
             }
-            if (node.aoPrevious != NULLPTR && m_nodes[node.aoPrevious].offset != NULLPTR)
+            if (ao.previous != NULLPTR && m_ranges[ao.previous].offset != INVALID_OFFSET)
             {
-                assert(m_nodes[node.aoPrevious].aoNext == nodeIndex);
-                assert(m_nodes[node.aoPrevious].offset + m_nodes[node.aoPrevious].size == node.offset);
+                assert(m_aoLinks[ao.previous].next == nodeIndex);
+                assert(m_ranges[ao.previous].offset + m_ranges[ao.previous].size == range.offset);
             }
         }
     }
@@ -376,34 +1009,75 @@ Allocator::validate() const
     std::cout << "----------------------------------------------------------------\n";
 }
 
-Allocator::Allocator(uint32_t maxAllocs) : m_maxAllocs(maxAllocs)
+template <typename Offset_t>
+void *
+BasicAllocator<Offset_t>::getPointer(BasicAllocation<Offset_t> allocation) const
 {
-    m_backBuffer = VirtualAlloc((LPVOID)TERABYTES(4), GIGABYTES(4), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    assert(allocation.nodeIndex != INVALID_INDEX && isAllocated(allocation.nodeIndex));
+    return m_backBuffer + allocation.offset;
+}
+
+template <typename Offset_t>
+void *
+BasicAllocator<Offset_t>::getPointerUnchecked(BasicAllocation<Offset_t> allocation) const
+{
+    assert(allocation.nodeIndex != INVALID_INDEX);
+    return m_backBuffer + allocation.offset;
+}
+
+template <typename Offset_t>
+BasicAllocator<Offset_t>::BasicAllocator(uint32_t initialNodeCount, uint64_t arenaSize)
+    : m_arenaSize(arenaSize), m_nodeCapacity(0), m_emptyNodeCount(0)
+{
+    assert(arenaSize > 0 && arenaSize % COMMIT_GRANULARITY == 0);
+    assert((sizeof(Offset_t) == 8 || arenaSize <= (1ull << 32)) && "32-bit offsets cannot address the arena!");
+    assert(COMMIT_GRANULARITY % vmem_page_size() == 0);
+
+    m_backBuffer = (unsigned char *)vmem_reserve(m_arenaSize);
     if (!m_backBuffer)
     {
-        puts("VirtualAlloc failed!");
+        puts("Reserving the address space for the arena failed!");
     }
+    uint64_t commitChunkCount = m_arenaSize / COMMIT_GRANULARITY;
+    m_commitBitmap = new uint64_t[(commitChunkCount + 63) / 64]();
+    m_residentBitmap = new uint64_t[(commitChunkCount + 63) / 64]();
 
     memset(m_l2Bitmasks, 0, sizeof(uint8_t) * L2_BITMASK_COUNT);
     memset(m_freelistHeads, 0xff, TOTAL_BIN_COUNT * sizeof(NodePtr_t));
-
-    m_nodes = new Node[m_maxAllocs];
-    m_emptyNodeStack = new uint32_t[m_maxAllocs];
-
-    for (uint32_t i = 0; i < m_maxAllocs; ++i)
+    memset(m_binNodeCounts, 0, TOTAL_BIN_COUNT * sizeof(uint32_t));
+
+    m_ranges = (Range *)vmem_reserve((size_t)MAX_NODE_COUNT * sizeof(Range));
+    m_freeLinks = (Link *)vmem_reserve((size_t)MAX_NODE_COUNT * sizeof(Link));
+    m_aoLinks = (Link *)vmem_reserve((size_t)MAX_NODE_COUNT * sizeof(Link));
+    m_allocatedBits = (uint64_t *)vmem_reserve((size_t)MAX_NODE_COUNT / 8);
+    m_emptyNodeStack = (uint32_t *)vmem_reserve((size_t)MAX_NODE_COUNT * sizeof(uint32_t));
+    if (!m_ranges || !m_freeLinks || !m_aoLinks || !m_allocatedBits || !m_emptyNodeStack)
     {
-        m_emptyNodeStack[i] = m_maxAllocs - i - 1;
+        puts("Reserving the address space for the node storage failed!");
     }
-    m_emptyNodeStackTop = m_maxAllocs - 1;
+    growNodeStorage(initialNodeCount > 0 ? initialNodeCount : 1);
 
-    insertNode(GIGABYTES(4) - 1, 0);
+    /// NOTE: a 4GiB arena of 32-bit offsets loses its last byte, its size would not fit in a node otherwise.
+    Offset_t initialSize = (m_arenaSize > (uint64_t)INVALID_OFFSET) ? INVALID_OFFSET : (Offset_t)m_arenaSize;
+    insertNode(initialSize, 0);
+    m_managedSize = initialSize;
 }
 
-Allocator::~Allocator()
+template <typename Offset_t>
+BasicAllocator<Offset_t>::~BasicAllocator()
 {
     assert(m_backBuffer != nullptr);
-    VirtualFree(m_backBuffer, 0, MEM_RELEASE);
-    delete[] m_nodes;
-    delete[] m_emptyNodeStack;
+    vmem_release(m_backBuffer, m_arenaSize);
+    vmem_release(m_ranges, (size_t)MAX_NODE_COUNT * sizeof(Range));
+    vmem_release(m_freeLinks, (size_t)MAX_NODE_COUNT * sizeof(Link));
+    vmem_release(m_aoLinks, (size_t)MAX_NODE_COUNT * sizeof(Link));
+    vmem_release(m_allocatedBits, (size_t)MAX_NODE_COUNT / 8);
+    vmem_release(m_emptyNodeStack, (size_t)MAX_NODE_COUNT * sizeof(uint32_t));
+    delete[] m_commitBitmap;
+    delete[] m_residentBitmap;
 }
-} // namespace Tlsf
\ No newline at end of file
+
+template class BasicAllocator<uint32_t>;
+template class BasicAllocator<uint64_t>;
+
+} // namespace Tlsf
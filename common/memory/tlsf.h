@@ -1,25 +1,45 @@
 #pragma once
 
-#include <Windows.h>
 #include <cassert>
 #include <cstdint>
+#include <span>
+
+/// NOTE: TLSF_CHECKED runs an O(1) invariant check on the nodes touched by every allocate/free. It is on by default
+/// whenever asserts are, define TLSF_CHECKED to 0 to compile it out of a debug build. validate() is never called
+/// from the hot paths, it is a full walk over every node meant for tests and debugging only.
+#ifndef TLSF_CHECKED
+#if defined(NDEBUG) && !defined(_DEBUG)
+#define TLSF_CHECKED 0
+#else
+#define TLSF_CHECKED 1
+#endif
+#endif
 
 namespace Tlsf
 {
 
-struct Allocation
+template <typename Offset_t>
+struct BasicAllocation
 {
-    uint32_t offset;
+    Offset_t offset;
     uint32_t nodeIndex;
 };
 
-class Allocator
+/// @brief Offset_t is the type of offsets and sizes inside the arena. uint32_t keeps nodes and allocations small and
+/// caps the arena at 4GiB, uint64_t lifts that cap at the cost of wider nodes.
+template <typename Offset_t>
+class BasicAllocator
 {
+    static_assert(sizeof(Offset_t) == 4 || sizeof(Offset_t) == 8, "Offsets must be 32 or 64 bits wide!");
+
     typedef uint32_t NodePtr_t;
     static constexpr NodePtr_t NULLPTR = 0xffffffff;
-    static constexpr NodePtr_t INVALID_INDEX = 0xffffffff;
+    static constexpr uint32_t INVALID_INDEX = 0xffffffff;
+    static constexpr Offset_t INVALID_OFFSET = (Offset_t)~(Offset_t)0;
+    /// NOTE: marks the free-list link of a node freed by freeBatch() which is not linked into any bin yet.
+    static constexpr NodePtr_t PENDING_FREE = 0xfffffffe;
 
-    static constexpr uint32_t L1_BIN_COUNT      = 32;
+    static constexpr uint32_t L1_BIN_COUNT      = sizeof(Offset_t) * 8;
     static constexpr uint32_t L2_LOG2_BINCOUNT  = 3;
     static constexpr uint32_t L2_BIN_COUNT      = (1 << L2_LOG2_BINCOUNT);
     static constexpr uint32_t L2_MASK           = L2_BIN_COUNT - 1;
@@ -27,50 +47,167 @@ class Allocator
     static constexpr uint32_t L2_BITMASK_COUNT  = TOTAL_BIN_COUNT / 8;
     static constexpr uint32_t MIN_SIZE_ALLOWED  = 8;
 
+    /// NOTE: The whole arena is only reserved up front. Physical memory is committed in chunks of
+    /// COMMIT_GRANULARITY bytes as offsets get handed out. A committed chunk stays committed, once it is entirely
+    /// free again its pages are only purged, and only while more than the retained bytes (setRetainedBytes) of
+    /// resident memory sit unused. Steady alloc/free churn below that watermark makes no system calls at all.
+    static constexpr uint64_t COMMIT_GRANULARITY  = 64 * 1024;
+
+    /// NOTE: The node arrays are reserved for MAX_NODE_COUNT nodes and committed as they grow, so node addresses
+    /// and indices never change once handed out.
+    static constexpr uint32_t MAX_NODE_COUNT = 1u << 22;
+
+  public:
+    static constexpr uint64_t DEFAULT_ARENA_SIZE = (sizeof(Offset_t) == 4) ? (4ull << 30) : (64ull << 30);
+    static constexpr uint64_t DEFAULT_RETAINED_BYTES = 4ull << 20;
+    static constexpr uint32_t BIN_COUNT = TOTAL_BIN_COUNT;
+
+    /// @brief Snapshot returned by getStats(). The counters are maintained in O(1) per operation, only
+    /// largestFreeBlock is looked up on request, from the highest non-empty bin.
+    struct Stats
+    {
+        uint64_t usedBytes;
+        uint64_t freeBytes;
+        uint64_t largestFreeBlock;
+        uint64_t peakUsedBytes;
+        uint32_t allocationCount;
+        uint32_t peakAllocationCount;
+        uint32_t freeBlockCount;
+        /// 1 - largestFreeBlock / freeBytes: 0 while all free memory is a single block, approaching 1 as it gets
+        /// split up into many small ones.
+        float    externalFragmentation;
+        /// Free blocks per bin, bin i holds blocks of at least binMinSize(i) bytes.
+        uint32_t freeBlocksPerBin[BIN_COUNT];
+    };
+
   private:
-    struct Node
+    /// NOTE: Node metadata is stored as a structure of arrays indexed by node index. Free-list walks only touch the
+    /// links, coalescing first checks the allocated bits of the neighbours, which for all nodes fit in a few cache
+    /// lines, and only then reads their ranges.
+    struct Range
+    {
+        Offset_t offset;
+        Offset_t size;
+    };
+
+    struct Link
     {
-        uint32_t  offset = INVALID_INDEX;
-        uint32_t  size = 0;
-        NodePtr_t next = NULLPTR;
-        NodePtr_t prev = NULLPTR;
-        NodePtr_t aoPrevious = NULLPTR;
-        NodePtr_t aoNext = NULLPTR;
-
-        bool allocated = false;
+        NodePtr_t previous;
+        NodePtr_t next;
     };
+    static_assert(sizeof(Range) == 2 * sizeof(Offset_t) && sizeof(Link) == 8, "Node arrays should stay packed!");
 
-    inline uint32_t msbIndex(uint32_t mask);
-    inline uint32_t lsbIndex(uint32_t mask);
+    inline uint32_t msbIndex(Offset_t mask) const;
+    inline uint32_t lsbIndex(Offset_t mask) const;
     
-    uint32_t indexRounddown(uint32_t size);
-    uint32_t indexRoundup(uint32_t size);
+    uint32_t indexRounddown(Offset_t size) const;
+    uint32_t indexRoundup(Offset_t size) const;
+    static inline Offset_t roundSize(Offset_t size);
     inline uint32_t getFreenodeIndex();
     inline void addNodeToStore(uint32_t nodeIndex);
+    inline bool isAllocated(uint32_t nodeIndex) const;
+    inline void setAllocated(uint32_t nodeIndex, bool allocated);
+    void growNodeStorage(uint32_t newCapacity);
     void findSuitableFreelist(uint32_t& l1Index, uint32_t& l2Index, uint32_t &freelistIndex);
-    uint32_t insertNode(uint32_t size, uint32_t offset);
+    uint32_t insertNode(Offset_t size, Offset_t offset);
+    void linkFreeNode(uint32_t nodeIndex);
+    void unlinkFreeNode(uint32_t nodeIndex);
+    void recycleNode(uint32_t nodeIndex);
 
     void removeNode(uint32_t nodeIndex);
 
+    inline void trackAllocation(uint64_t size, uint32_t count);
+
+#if TLSF_CHECKED
+    void checkNode(uint32_t nodeIndex) const;
+#endif
+
+    /// @brief false if the OS refused to commit, nothing is marked committed or resident then.
+    [[nodiscard]] bool commitRange(Offset_t offset, Offset_t size);
+    void decommitRange(Offset_t offset, Offset_t size);
+
   public:
-    Allocation allocate(uint32_t size);
-    void free(Allocation allocation);
+    /// @brief Sizes are rounded up to a multiple of 8, so offsets are always at least 8 byte aligned. A larger
+    /// alignment must be a power of 2, the padding in front of the aligned offset goes back to the free lists.
+    /// A failed allocation (no free block big enough, or the memory could not be committed) has all bits of its
+    /// offset and nodeIndex set, and leaves the allocator as it was.
+    BasicAllocation<Offset_t> allocate(Offset_t size, Offset_t alignment = MIN_SIZE_ALLOWED);
+    void free(BasicAllocation<Offset_t> allocation);
+
+    /// @brief Resizes the allocation, in place whenever possible. Shrinking splits the tail off into the free lists,
+    /// growing absorbs the free address-order neighbour behind the block. Only when that neighbour is allocated or
+    /// too small does the data move to a new allocation of the given alignment. The returned allocation replaces
+    /// the one passed in, unless it is a failed one, in which case the one passed in is left untouched.
+    BasicAllocation<Offset_t> reallocate(BasicAllocation<Offset_t> allocation, Offset_t newSize,
+                                         Offset_t alignment = MIN_SIZE_ALLOWED);
+
+    /// @brief Allocates sizes.size() blocks at once, out[i] receives the block for sizes[i]. The whole batch is
+    /// carved back to back out of a single free block found with one bin lookup, when no free block is large enough
+    /// for all of it this falls back to one allocate() per size. Blocks that could not be allocated come back failed,
+    /// like allocate()'s.
+    void allocateBatch(std::span<const Offset_t> sizes, std::span<BasicAllocation<Offset_t>> out);
+
+    /// @brief Frees every allocation of the batch. Runs of adjacent blocks are merged in a single pass and each
+    /// merged run goes into its bin once, instead of one coalesce and one bin update per block.
+    void freeBatch(std::span<const BasicAllocation<Offset_t>> allocations);
+
+    void *getPointer(BasicAllocation<Offset_t> allocation) const;
+    /// @brief getPointer without the isAllocated check, for threads that do not own this allocator (MultiHeap's
+    /// remote frees). The arena never moves, but the allocation bits are written by the owner without any locking.
+    void *getPointerUnchecked(BasicAllocation<Offset_t> allocation) const;
+
+    /// @brief Bytes of unused but resident memory kept around before freed chunks get purged, the hysteresis
+    /// between commit and purge. 0 purges every chunk as soon as it is entirely free.
+    void setRetainedBytes(uint64_t bytes);
+
+    Stats getStats() const;
+    static uint64_t binMinSize(uint32_t binIndex);
 
     void validate() const;
 
-    Allocator(uint32_t maxAllocs = 4096);
-    ~Allocator();
+    /// @param initialNodeCount number of nodes committed up front, the node storage grows past it on demand.
+    /// @param arenaSize bytes of address space to reserve, must be a multiple of 64KiB.
+    BasicAllocator(uint32_t initialNodeCount = 4096, uint64_t arenaSize = DEFAULT_ARENA_SIZE);
+    ~BasicAllocator();
+
+    BasicAllocator(const BasicAllocator &) = delete;
+    BasicAllocator &operator=(const BasicAllocator &) = delete;
 
   private:
-    void *m_backBuffer;
+    unsigned char *m_backBuffer;
+    uint64_t       m_arenaSize;
+    uint64_t      *m_commitBitmap;
+    /// @brief chunks whose pages may be backed by physical memory, every committed chunk not purged since.
+    uint64_t      *m_residentBitmap;
+    uint64_t       m_residentChunks = 0;
+    uint64_t       m_retainedBytes = DEFAULT_RETAINED_BYTES;
 
-    uint32_t   m_l1Bitmask = 0u;
+    Offset_t   m_l1Bitmask = 0u;
     uint8_t    m_l2Bitmasks[L2_BITMASK_COUNT];
     NodePtr_t  m_freelistHeads[TOTAL_BIN_COUNT];
-    uint32_t   m_maxAllocs;
-    Node      *m_nodes;
+    uint32_t   m_nodeCapacity;
+    Range     *m_ranges;
+    Link      *m_freeLinks;
+    Link      *m_aoLinks;
+    uint64_t  *m_allocatedBits;
     uint32_t  *m_emptyNodeStack;
-    uint32_t   m_emptyNodeStackTop;
+    uint32_t   m_emptyNodeCount;
+
+    uint64_t   m_managedSize;
+    uint64_t   m_usedBytes = 0;
+    uint64_t   m_peakUsedBytes = 0;
+    uint32_t   m_allocationCount = 0;
+    uint32_t   m_peakAllocationCount = 0;
+    uint32_t   m_binNodeCounts[TOTAL_BIN_COUNT];
 };
 
-}
\ No newline at end of file
+typedef BasicAllocation<uint32_t> Allocation;
+typedef BasicAllocator<uint32_t>  Allocator;
+
+typedef BasicAllocation<uint64_t> Allocation64;
+typedef BasicAllocator<uint64_t>  Allocator64;
+
+extern template class BasicAllocator<uint32_t>;
+extern template class BasicAllocator<uint64_t>;
+
+}
@@ -0,0 +1,290 @@
+#include "tlsf_multiheap.h"
+#include <mutex>
+#include <unordered_map>
+
+namespace Tlsf
+{
+
+namespace
+{
+
+constexpr uint32_t THREAD_CACHE_SIZE = 16;
+
+/// Maps the MultiHeap instances a thread has used to the heap it claimed in each of them. Ids are never reused,
+/// so an entry left over from a destroyed MultiHeap can never match a new one.
+struct ThreadHeapCache
+{
+    uint64_t setIds[THREAD_CACHE_SIZE];
+    uint32_t heapIndices[THREAD_CACHE_SIZE];
+};
+
+thread_local ThreadHeapCache t_heapCache = {};
+std::atomic<uint64_t> s_nextMultiHeapId{1};
+
+/// Never reused either, unlike thread ids or the address of t_heapCache, which a new thread can inherit.
+std::atomic<uint64_t> s_nextThreadToken{1};
+thread_local uint64_t t_threadToken = 0;
+
+/// NOTE: the MultiHeaps not destroyed yet, by id. Consulted when a thread's cache is full, to tell the entries it
+/// can evict from the ones it still needs, and when a thread exits, to release its heaps.
+std::mutex s_liveHeapsLock;
+std::unordered_map<uint64_t, MultiHeap *> s_liveHeaps;
+
+uint64_t
+threadToken()
+{
+    if (t_threadToken == 0)
+    {
+        t_threadToken = s_nextThreadToken.fetch_add(1, std::memory_order_relaxed);
+    }
+    return t_threadToken;
+}
+
+/// @brief an unused slot of the calling thread's cache, or one held by a destroyed MultiHeap. THREAD_CACHE_SIZE if
+/// every slot belongs to a live one.
+uint32_t
+freeCacheSlot()
+{
+    for (uint32_t i = 0; i < THREAD_CACHE_SIZE; ++i)
+    {
+        if (t_heapCache.setIds[i] == 0)
+        {
+            return i;
+        }
+    }
+    std::lock_guard<std::mutex> guard(s_liveHeapsLock);
+    for (uint32_t i = 0; i < THREAD_CACHE_SIZE; ++i)
+    {
+        if (s_liveHeaps.count(t_heapCache.setIds[i]) == 0)
+        {
+            t_heapCache.setIds[i] = 0;
+            return i;
+        }
+    }
+    return THREAD_CACHE_SIZE;
+}
+
+}
+
+/// @brief the heap the calling thread claimed earlier, found through the heaps' owner tokens instead of the cache.
+uint32_t
+MultiHeap::findOwnedHeap() const
+{
+    uint64_t token = threadToken();
+    uint32_t heapCount = m_heapCount.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < heapCount; ++i)
+    {
+        if (m_heaps[i].owner.load(std::memory_order_relaxed) == token)
+        {
+            return i;
+        }
+    }
+    return INVALID_HEAP;
+}
+
+/// @brief takes over a heap released by an exited thread, or claims one nobody had yet. INVALID_HEAP when every heap
+/// belongs to a live thread.
+uint32_t
+MultiHeap::claimHeap()
+{
+    uint64_t token = threadToken();
+    uint32_t heapCount = m_heapCount.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < heapCount; ++i)
+    {
+        /// NOTE: acquire pairs with the release in releaseHeap(), everything the exited thread did to the allocator
+        /// is visible from here on.
+        uint64_t released = RELEASED_OWNER;
+        if (m_heaps[i].owner.load(std::memory_order_relaxed) == RELEASED_OWNER &&
+            m_heaps[i].owner.compare_exchange_strong(released, token, std::memory_order_acquire,
+                                                     std::memory_order_relaxed))
+        {
+            registerThreadExit();
+            return i;
+        }
+    }
+
+    /// NOTE: a compare-exchange instead of a fetch_add, so threads turned away keep the count at m_maxHeaps.
+    do
+    {
+        if (heapCount >= m_maxHeaps)
+        {
+            return INVALID_HEAP;
+        }
+    } while (!m_heapCount.compare_exchange_weak(heapCount, heapCount + 1, std::memory_order_relaxed));
+
+    /// NOTE: only the claiming thread ever touches this allocator, so it can be created without synchronization.
+    m_heaps[heapCount].allocator = new Allocator(m_maxAllocsPerHeap);
+    m_heaps[heapCount].owner.store(token, std::memory_order_relaxed);
+    registerThreadExit();
+    return heapCount;
+}
+
+/// @brief hands the heap of the exiting thread over to whichever thread claims it next. Its live blocks stay where
+/// they are, frees of them that come in from now on wait on the remote-free list for the next owner's allocate(),
+/// or for the destructor.
+void
+MultiHeap::releaseHeap(Heap &heap)
+{
+    drainRemoteFrees(heap);
+    heap.owner.store(RELEASED_OWNER, std::memory_order_release);
+}
+
+void
+MultiHeap::registerThreadExit()
+{
+    thread_local ThreadExitHook hook;
+    (void)hook;
+}
+
+MultiHeap::ThreadExitHook::~ThreadExitHook()
+{
+    /// NOTE: holding the lock keeps every MultiHeap in the map alive until this is done, the destructor takes its
+    /// MultiHeap out of the map under the same lock before it frees anything.
+    std::lock_guard<std::mutex> guard(s_liveHeapsLock);
+    for (auto &[id, multiHeap] : s_liveHeaps)
+    {
+        uint32_t heapIndex = multiHeap->findOwnedHeap();
+        if (heapIndex != INVALID_HEAP)
+        {
+            multiHeap->releaseHeap(multiHeap->m_heaps[heapIndex]);
+        }
+    }
+}
+
+uint32_t
+MultiHeap::localHeapIndex()
+{
+    for (uint32_t i = 0; i < THREAD_CACHE_SIZE; ++i)
+    {
+        if (t_heapCache.setIds[i] == m_id)
+        {
+            return t_heapCache.heapIndices[i];
+        }
+    }
+
+    /// NOTE: not in the cache does not mean not claimed, the cache can have been full when the heap was claimed.
+    uint32_t heapIndex = findOwnedHeap();
+    if (heapIndex == INVALID_HEAP)
+    {
+        heapIndex = claimHeap();
+        if (heapIndex == INVALID_HEAP)
+        {
+            return INVALID_HEAP;
+        }
+    }
+
+    uint32_t slot = freeCacheSlot();
+    if (slot < THREAD_CACHE_SIZE)
+    {
+        t_heapCache.setIds[slot] = m_id;
+        t_heapCache.heapIndices[slot] = heapIndex;
+    }
+    return heapIndex;
+}
+
+void
+MultiHeap::drainRemoteFrees(Heap &heap)
+{
+    if (heap.remoteFreeHead.load(std::memory_order_relaxed) == NULL_ENTRY)
+    {
+        return;
+    }
+
+    /// Take the whole list in one go. Producers only ever push, so there is no ABA problem here.
+    uint64_t packed = heap.remoteFreeHead.exchange(NULL_ENTRY, std::memory_order_acquire);
+    while (packed != NULL_ENTRY)
+    {
+        Allocation allocation{.offset = (uint32_t)packed, .nodeIndex = (uint32_t)(packed >> 32)};
+        packed = ((const RemoteFree *)heap.allocator->getPointer(allocation))->next;
+
+        heap.allocator->free(allocation);
+    }
+}
+
+HeapAllocation
+MultiHeap::allocate(uint32_t size)
+{
+    uint32_t heapIndex = localHeapIndex();
+    if (heapIndex == INVALID_HEAP)
+    {
+        return {.allocation = {.offset = 0xffffffff, .nodeIndex = 0xffffffff}, .heapIndex = INVALID_HEAP};
+    }
+
+    Heap &heap = m_heaps[heapIndex];
+    drainRemoteFrees(heap);
+
+    HeapAllocation result;
+    result.allocation = heap.allocator->allocate(size);
+    result.heapIndex = heapIndex;
+    return result;
+}
+
+void
+MultiHeap::free(HeapAllocation allocation)
+{
+    assert(allocation.heapIndex < m_maxHeaps);
+    Heap &heap = m_heaps[allocation.heapIndex];
+
+    /// NOTE: the owner token says whether the block is ours, no cache lookup needed for that.
+    if (heap.owner.load(std::memory_order_relaxed) == threadToken())
+    {
+        heap.allocator->free(allocation.allocation);
+        return;
+    }
+
+    /// Foreign thread: hand the block back to the owning heap.
+    /// NOTE: unchecked, the allocation bits belong to the owning thread and must not be read from here.
+    RemoteFree *entry = (RemoteFree *)heap.allocator->getPointerUnchecked(allocation.allocation);
+    uint64_t packed = ((uint64_t)allocation.allocation.nodeIndex << 32) | allocation.allocation.offset;
+
+    uint64_t head = heap.remoteFreeHead.load(std::memory_order_relaxed);
+    do
+    {
+        entry->next = head;
+    } while (!heap.remoteFreeHead.compare_exchange_weak(head, packed, std::memory_order_release,
+                                                        std::memory_order_relaxed));
+}
+
+void *
+MultiHeap::getPointer(HeapAllocation allocation) const
+{
+    assert(allocation.heapIndex < m_maxHeaps);
+    const Heap &heap = m_heaps[allocation.heapIndex];
+    if (heap.owner.load(std::memory_order_relaxed) == threadToken())
+    {
+        return heap.allocator->getPointer(allocation.allocation);
+    }
+    return heap.allocator->getPointerUnchecked(allocation.allocation);
+}
+
+MultiHeap::MultiHeap(uint32_t maxHeaps, uint32_t maxAllocsPerHeap)
+    : m_id(s_nextMultiHeapId.fetch_add(1, std::memory_order_relaxed)), m_maxHeaps(maxHeaps),
+      m_maxAllocsPerHeap(maxAllocsPerHeap)
+{
+    m_heaps = new Heap[m_maxHeaps];
+
+    std::lock_guard<std::mutex> guard(s_liveHeapsLock);
+    s_liveHeaps.emplace(m_id, this);
+}
+
+MultiHeap::~MultiHeap()
+{
+    {
+        std::lock_guard<std::mutex> guard(s_liveHeapsLock);
+        s_liveHeaps.erase(m_id);
+    }
+
+    uint32_t heapCount = m_heapCount.load(std::memory_order_acquire);
+
+    for (uint32_t i = 0; i < heapCount; ++i)
+    {
+        if (m_heaps[i].allocator != nullptr)
+        {
+            drainRemoteFrees(m_heaps[i]);
+            delete m_heaps[i].allocator;
+        }
+    }
+    delete[] m_heaps;
+}
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "tlsf.h"
+#include <atomic>
+#include <cstdint>
+
+namespace Tlsf
+{
+
+struct HeapAllocation
+{
+    Allocation allocation;
+    uint32_t   heapIndex;
+};
+
+/// @brief Front end over one Tlsf::Allocator per thread. A thread only ever touches the allocator of its own heap,
+/// frees coming from any other thread are pushed onto a lock-free MPSC list owned by the heap the allocation came
+/// from, and that heap takes them back in its next allocate(). When a thread exits its heap is released, with its
+/// live blocks still in it, and the next thread that needs a heap takes it over instead of claiming a new one.
+class MultiHeap
+{
+    static constexpr uint64_t NULL_ENTRY = 0xffffffffffffffffull;
+    /// @brief owner of a heap whose thread has exited. Tokens count up from 1 and never get here.
+    static constexpr uint64_t RELEASED_OWNER = 0xffffffffffffffffull;
+
+    /// NOTE: a remotely freed block is linked into the remote-free list through its own memory. Links are whole
+    /// allocations packed as (nodeIndex << 32 | offset), TLSF blocks are never smaller than MIN_SIZE_ALLOWED (8
+    /// bytes) which is exactly what one link needs.
+    struct RemoteFree
+    {
+        uint64_t next;
+    };
+
+    struct alignas(64) Heap
+    {
+        Allocator            *allocator = nullptr;
+        std::atomic<uint64_t> remoteFreeHead{NULL_ENTRY};
+        /// @brief token of the thread that claimed the heap, 0 while unclaimed and RELEASED_OWNER once that thread
+        /// has exited. Lets a thread find its heap again when its thread_local cache has no room for this MultiHeap.
+        std::atomic<uint64_t> owner{0};
+    };
+
+    /// @brief releases the heaps of the exiting thread in every live MultiHeap, from its thread_local destructor.
+    struct ThreadExitHook
+    {
+        ~ThreadExitHook();
+    };
+
+    /// @brief the calling thread's heap, claimed on first use. INVALID_HEAP when all of them are taken.
+    uint32_t localHeapIndex();
+    uint32_t findOwnedHeap() const;
+    uint32_t claimHeap();
+    void releaseHeap(Heap &heap);
+    static void registerThreadExit();
+    void drainRemoteFrees(Heap &heap);
+
+  public:
+    static constexpr uint32_t INVALID_HEAP = 0xffffffff;
+
+    /// @brief A failed allocation has all bits of its offset and nodeIndex set, like Allocator::allocate()'s. When
+    /// more threads are alive than there are heaps, the heapIndex is INVALID_HEAP as well.
+    HeapAllocation allocate(uint32_t size);
+    void free(HeapAllocation allocation);
+    void *getPointer(HeapAllocation allocation) const;
+
+    explicit MultiHeap(uint32_t maxHeaps = 64, uint32_t maxAllocsPerHeap = 4096);
+    ~MultiHeap();
+
+    MultiHeap(const MultiHeap &) = delete;
+    MultiHeap &operator=(const MultiHeap &) = delete;
+
+  private:
+    uint64_t              m_id;
+    uint32_t              m_maxHeaps;
+    uint32_t              m_maxAllocsPerHeap;
+    std::atomic<uint32_t> m_heapCount{0};
+    Heap                 *m_heaps;
+};
+
+}
@@ -1,10 +1,14 @@
 #define TLSF_INCLUDE_TESTS
 #include "tlsf.h"
+#include "tlsf_multiheap.h"
+#include <barrier>
 #include <iostream>
 #include <map>
 #include <vector>
 #include <algorithm>
 #include <random>
+#include <cstring>
+#include <thread>
 
 
 #ifdef TLSF_INCLUDE_TESTS
@@ -478,6 +482,545 @@ testReuseAfterFree()
     return true;
 }
 
+bool
+testCommittedMemoryAccess()
+{
+    std::cout << "\n[TEST] Committed Memory Access" << std::endl;
+
+    Allocator allocator(1024);
+    AllocatorValidator validator;
+    // Purge chunks as soon as they are free, so the reuse below runs on purged pages.
+    allocator.setRetainedBytes(0);
+
+    // Sizes straddling the commit granularity so allocations span several committed chunks.
+    uint32_t sizes[] = {64, 4096, 65536, 200000, 1 << 20, 24};
+    std::vector<std::pair<Allocation, uint32_t>> allocations;
+
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+    {
+        Allocation alloc = allocator.allocate(sizes[i]);
+        assert(alloc.offset != 0xffffffff && "Allocation failed!");
+        validator.recordAllocation(alloc, sizes[i]);
+        allocations.push_back({alloc, sizes[i]});
+
+        // Writing to the memory would fault if the range was not committed.
+        memset(allocator.getPointer(alloc), (int)(i + 1), sizes[i]);
+    }
+
+    for (uint32_t i = 0; i < allocations.size(); ++i)
+    {
+        const unsigned char *bytes = (const unsigned char *)allocator.getPointer(allocations[i].first);
+        assert(bytes[0] == i + 1 && bytes[allocations[i].second - 1] == i + 1 && "Memory contents corrupted!");
+    }
+
+    // Free the big block in the middle so its chunks get purged, then reuse the range.
+    allocator.free(allocations[4].first);
+    validator.recordFree(allocations[4].first);
+
+    Allocation reuse = allocator.allocate(1 << 19);
+    assert(reuse.offset != 0xffffffff && "Allocation failed!");
+    validator.recordAllocation(reuse, 1 << 19);
+    memset(allocator.getPointer(reuse), 0xab, 1 << 19);
+
+    const unsigned char *neighbour = (const unsigned char *)allocator.getPointer(allocations[3].first);
+    assert(neighbour[allocations[3].second - 1] == 4 && "Decommit touched a live neighbour!");
+
+    allocator.free(reuse);
+    validator.recordFree(reuse);
+    for (uint32_t i = 0; i < allocations.size(); ++i)
+    {
+        if (i != 4)
+        {
+            allocator.free(allocations[i].first);
+            validator.recordFree(allocations[i].first);
+        }
+    }
+
+    assert(validator.getActiveAllocationCount() == 0 && "Memory leak detected!");
+
+    std::cout << "PASSED" << std::endl;
+    return true;
+}
+
+bool
+testNodeStorageGrowth()
+{
+    std::cout << "\n[TEST] Node Storage Growth" << std::endl;
+
+    // Start with room for a handful of nodes and go far past it.
+    Allocator allocator(16);
+    AllocatorValidator validator;
+
+    const uint32_t count = 100000;
+    std::vector<Allocation> allocations;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        Allocation alloc = allocator.allocate(16);
+        assert(alloc.offset != 0xffffffff && "Allocation failed!");
+        validator.recordAllocation(alloc, 16);
+        allocations.push_back(alloc);
+        *(uint32_t *)allocator.getPointer(alloc) = i;
+    }
+    assert(validator.checkNoOverlaps() && "Overlapping allocations detected!");
+
+    // Handles taken before the storage grew must still be valid.
+    for (uint32_t i = 0; i < count; i += 2)
+    {
+        assert(*(const uint32_t *)allocator.getPointer(allocations[i]) == i && "Memory contents corrupted!");
+        allocator.free(allocations[i]);
+        validator.recordFree(allocations[i]);
+    }
+    for (uint32_t i = 1; i < count; i += 2)
+    {
+        assert(*(const uint32_t *)allocator.getPointer(allocations[i]) == i && "Memory contents corrupted!");
+        allocator.free(allocations[i]);
+        validator.recordFree(allocations[i]);
+    }
+
+    assert(validator.getActiveAllocationCount() == 0 && "Memory leak detected!");
+
+    std::cout << "PASSED" << std::endl;
+    return true;
+}
+
+bool
+testAllocator64()
+{
+    std::cout << "\n[TEST] 64-bit Offsets" << std::endl;
+
+    Allocator64 allocator(64, 16ull << 30);
+
+    // Only the first and last bytes of each block are touched, so this stays cheap on physical memory.
+    const uint64_t size = 3ull << 30;
+    std::vector<Allocation64> allocations;
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        Allocation64 alloc = allocator.allocate(size);
+        unsigned char *bytes = (unsigned char *)allocator.getPointer(alloc);
+        bytes[0] = (unsigned char)(i + 1);
+        bytes[size - 1] = (unsigned char)(i + 1);
+        allocations.push_back(alloc);
+    }
+    assert(allocations.back().offset >= (4ull << 30) && "Offsets past 4GiB were never handed out!");
+
+    for (uint32_t i = 0; i < allocations.size(); ++i)
+    {
+        const unsigned char *bytes = (const unsigned char *)allocator.getPointer(allocations[i]);
+        assert(bytes[0] == i + 1 && bytes[size - 1] == i + 1 && "Memory contents corrupted!");
+        allocator.free(allocations[i]);
+    }
+
+    std::cout << "PASSED" << std::endl;
+    return true;
+}
+
+bool
+testBatchAllocFree()
+{
+    std::cout << "\n[TEST] Batched Allocation/Free" << std::endl;
+
+    Allocator allocator(256);
+    AllocatorValidator validator;
+
+    std::mt19937 gen(7);
+    std::uniform_int_distribution<uint32_t> sizeDist(1, 2048);
+
+    const uint32_t count = 2000;
+    std::vector<uint32_t> sizes(count);
+    std::vector<Allocation> allocations(count);
+    for (uint32_t &size : sizes)
+    {
+        size = sizeDist(gen);
+    }
+
+    allocator.allocateBatch(sizes, allocations);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        validator.recordAllocation(allocations[i], std::max(sizes[i], 8u));
+        memset(allocator.getPointer(allocations[i]), (int)(i & 0xff), sizes[i]);
+    }
+    assert(validator.checkNoOverlaps() && "Overlapping allocations detected!");
+
+    // A single free in the middle of the batch, then every other block, then the rest. The last batch has to
+    // merge with free neighbours on both sides.
+    allocator.free(allocations[count / 2]);
+    validator.recordFree(allocations[count / 2]);
+
+    std::vector<Allocation> evens, odds;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (i == count / 2)
+        {
+            continue;
+        }
+        const unsigned char *bytes = (const unsigned char *)allocator.getPointer(allocations[i]);
+        assert(bytes[sizes[i] - 1] == (i & 0xff) && "Memory contents corrupted!");
+        (i % 2 == 0 ? evens : odds).push_back(allocations[i]);
+    }
+
+    allocator.freeBatch(evens);
+    for (const Allocation &alloc : evens)
+    {
+        validator.recordFree(alloc);
+    }
+    allocator.freeBatch(odds);
+    for (const Allocation &alloc : odds)
+    {
+        validator.recordFree(alloc);
+    }
+    assert(validator.getActiveAllocationCount() == 0 && "Memory leak detected!");
+
+    // Everything must have merged back into one block.
+    Allocation whole = allocator.allocate(3u << 30);
+    assert(whole.offset == 0 && "Freed batch did not coalesce!");
+    allocator.free(whole);
+
+    std::cout << "PASSED" << std::endl;
+    return true;
+}
+
+bool
+testStats()
+{
+    std::cout << "\n[TEST] Statistics" << std::endl;
+
+    const uint64_t arenaSize = 1 << 20;
+    Allocator allocator(64, arenaSize);
+
+    Allocator::Stats stats = allocator.getStats();
+    assert(stats.usedBytes == 0 && stats.freeBytes == arenaSize && stats.largestFreeBlock == arenaSize);
+    assert(stats.freeBlockCount == 1 && stats.externalFragmentation == 0.0f);
+
+    std::vector<Allocation> allocations;
+    for (uint32_t i = 0; i < 16; ++i)
+    {
+        allocations.push_back(allocator.allocate(1024));
+    }
+    stats = allocator.getStats();
+    assert(stats.usedBytes == 16 * 1024 && stats.allocationCount == 16);
+    assert(stats.usedBytes + stats.freeBytes == arenaSize);
+
+    // Punch holes: every other block, none of them adjacent to each other or to the tail.
+    for (uint32_t i = 0; i < 16; i += 2)
+    {
+        allocator.free(allocations[i]);
+    }
+    stats = allocator.getStats();
+    assert(stats.usedBytes == 8 * 1024 && stats.allocationCount == 8);
+    assert(stats.peakUsedBytes == 16 * 1024 && stats.peakAllocationCount == 16);
+    assert(stats.freeBlockCount == 9 && stats.largestFreeBlock == arenaSize - 16 * 1024);
+    assert(stats.externalFragmentation > 0.0f && stats.externalFragmentation < 0.01f);
+
+    uint32_t histogramTotal = 0;
+    for (uint32_t bin = 0; bin < Allocator::BIN_COUNT; ++bin)
+    {
+        if (stats.freeBlocksPerBin[bin] != 0)
+        {
+            std::cout << "bin " << bin << " (>= " << Allocator::binMinSize(bin)
+                      << " bytes): " << stats.freeBlocksPerBin[bin] << " free blocks" << std::endl;
+        }
+        histogramTotal += stats.freeBlocksPerBin[bin];
+    }
+    assert(histogramTotal == stats.freeBlockCount);
+
+    for (uint32_t i = 1; i < 16; i += 2)
+    {
+        allocator.free(allocations[i]);
+    }
+    stats = allocator.getStats();
+    assert(stats.usedBytes == 0 && stats.freeBlockCount == 1 && stats.largestFreeBlock == arenaSize);
+
+    std::cout << "PASSED" << std::endl;
+    return true;
+}
+
+bool
+testAlignedAllocation()
+{
+    std::cout << "\n[TEST] Aligned Allocation" << std::endl;
+
+    Allocator allocator(256);
+    AllocatorValidator validator;
+
+    // Knock the free block off any large alignment first.
+    Allocation small = allocator.allocate(24);
+    validator.recordAllocation(small, 24);
+
+    Allocation page = allocator.allocate(100, 4096);
+    assert(page.offset % 4096 == 0 && "Allocation is not page aligned!");
+    validator.recordAllocation(page, 100);
+
+    // The padding in front of the page was handed back, so the next small block lands inside it.
+    Allocation filler = allocator.allocate(200);
+    assert(filler.offset < page.offset && "Alignment padding was wasted!");
+    validator.recordAllocation(filler, 200);
+
+    std::mt19937 gen(3);
+    std::uniform_int_distribution<uint32_t> sizeDist(1, 3000);
+    std::uniform_int_distribution<uint32_t> alignDist(0, 12);
+    std::vector<Allocation> allocations;
+    for (uint32_t i = 0; i < 500; ++i)
+    {
+        uint32_t size = sizeDist(gen);
+        uint32_t alignment = 1u << alignDist(gen);
+        Allocation alloc = allocator.allocate(size, alignment);
+        assert(alloc.offset % alignment == 0 && alloc.offset % 8 == 0 && "Misaligned allocation!");
+        validator.recordAllocation(alloc, size);
+        allocations.push_back(alloc);
+        memset(allocator.getPointer(alloc), 0x5a, size);
+    }
+    assert(validator.checkNoOverlaps() && "Overlapping allocations detected!");
+
+    for (const Allocation &alloc : allocations)
+    {
+        allocator.free(alloc);
+        validator.recordFree(alloc);
+    }
+    allocator.free(small);
+    validator.recordFree(small);
+    allocator.free(page);
+    validator.recordFree(page);
+    allocator.free(filler);
+    validator.recordFree(filler);
+
+    Allocator::Stats stats = allocator.getStats();
+    assert(stats.usedBytes == 0 && stats.freeBlockCount == 1 && "Padding nodes did not coalesce!");
+
+    std::cout << "PASSED" << std::endl;
+    return true;
+}
+
+bool
+testReallocate()
+{
+    std::cout << "\n[TEST] Reallocate" << std::endl;
+
+    Allocator allocator(256);
+
+    // Nothing behind the block yet, so it can grow in place.
+    Allocation buffer = allocator.allocate(100);
+    memset(allocator.getPointer(buffer), 0x11, 100);
+    Allocation grown = allocator.reallocate(buffer, 1000);
+    assert(grown.offset == buffer.offset && grown.nodeIndex == buffer.nodeIndex && "Did not grow in place!");
+    memset((unsigned char *)allocator.getPointer(grown) + 100, 0x22, 900);
+
+    // Shrinking hands the tail back, the next allocation lands in it.
+    Allocation shrunk = allocator.reallocate(grown, 400);
+    assert(shrunk.offset == buffer.offset && "Did not shrink in place!");
+    Allocation blocker = allocator.allocate(64);
+    assert(blocker.offset == shrunk.offset + 400 && "Shrunk tail was not returned to the free lists!");
+
+    // Now the neighbour is allocated, growing has to move the data.
+    Allocation moved = allocator.reallocate(shrunk, 4096);
+    assert(moved.offset != shrunk.offset && "Grew over a live neighbour!");
+    const unsigned char *bytes = (const unsigned char *)allocator.getPointer(moved);
+    assert(bytes[0] == 0x11 && bytes[99] == 0x11 && bytes[100] == 0x22 && bytes[399] == 0x22 &&
+           "Contents were not preserved by the move!");
+
+    Allocator::Stats stats = allocator.getStats();
+    assert(stats.usedBytes == 4096 + 64 && stats.allocationCount == 2);
+
+    allocator.free(blocker);
+    allocator.free(moved);
+    stats = allocator.getStats();
+    assert(stats.usedBytes == 0 && stats.freeBlockCount == 1 && "Reallocated blocks did not coalesce!");
+
+    std::cout << "PASSED" << std::endl;
+    return true;
+}
+
+bool
+testMultiHeapRemoteFrees()
+{
+    std::cout << "\n[TEST] MultiHeap Cross-Thread Frees" << std::endl;
+
+    constexpr uint32_t threadCount = 4;
+    constexpr uint32_t allocsPerThread = 256;
+
+    MultiHeap heaps(threadCount, 2048);
+    std::vector<HeapAllocation> handedOut[threadCount];
+    std::barrier sync(threadCount);
+
+    auto worker = [&](uint32_t t)
+    {
+        std::mt19937 gen(t);
+        std::uniform_int_distribution<uint32_t> sizeDist(8, 1024);
+
+        // Every thread fills its own heap...
+        for (uint32_t i = 0; i < allocsPerThread; ++i)
+        {
+            uint32_t size = sizeDist(gen);
+            HeapAllocation alloc = heaps.allocate(size);
+            assert(alloc.allocation.offset != 0xffffffff && "Allocation failed!");
+            memset(heaps.getPointer(alloc), (int)t, 8);
+            handedOut[t].push_back(alloc);
+        }
+        sync.arrive_and_wait();
+
+        // ...then frees everything its neighbour allocated, which all goes through the remote-free lists.
+        uint32_t neighbour = (t + 1) % threadCount;
+        for (const HeapAllocation &alloc : handedOut[neighbour])
+        {
+            assert(alloc.heapIndex != handedOut[t][0].heapIndex && "Threads should not share a heap!");
+            assert(*(const unsigned char *)heaps.getPointer(alloc) == neighbour && "Memory contents corrupted!");
+            heaps.free(alloc);
+        }
+        sync.arrive_and_wait();
+
+        // The next allocation on each heap drains its remote frees, the memory is reused and freed locally.
+        for (uint32_t i = 0; i < allocsPerThread; ++i)
+        {
+            HeapAllocation alloc = heaps.allocate(sizeDist(gen));
+            assert(alloc.allocation.offset != 0xffffffff && "Allocation failed!");
+            assert(alloc.heapIndex == handedOut[t][0].heapIndex && "Thread changed heaps!");
+            heaps.free(alloc);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < threadCount; ++t)
+    {
+        threads.emplace_back(worker, t);
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    std::cout << "PASSED" << std::endl;
+    return true;
+}
+
+bool
+testMultiHeapManyInstances()
+{
+    std::cout << "\n[TEST] MultiHeap More Instances Than Cache Slots" << std::endl;
+
+    // One heap each: a thread that lost track of its heap would claim a second one and trip the assert.
+    constexpr uint32_t instanceCount = 40;
+    std::vector<MultiHeap *> instances;
+    for (uint32_t i = 0; i < instanceCount; ++i)
+    {
+        instances.push_back(new MultiHeap(1, 256));
+    }
+
+    auto roundRobin = [&]()
+    {
+        for (int round = 0; round < 3; ++round)
+        {
+            for (MultiHeap *heaps : instances)
+            {
+                HeapAllocation alloc = heaps->allocate(64);
+                assert(alloc.allocation.offset != 0xffffffff && alloc.heapIndex == 0 && "Thread changed heaps!");
+                memset(heaps->getPointer(alloc), 0x5a, 64);
+                heaps->free(alloc);
+            }
+        }
+    };
+    roundRobin();
+
+    // Destroyed instances free up their cache slots for new ones.
+    for (uint32_t i = 0; i < instanceCount; i += 2)
+    {
+        delete instances[i];
+        instances[i] = new MultiHeap(1, 256);
+    }
+    roundRobin();
+
+    // A thread that never allocated from these instances still frees remotely, it owns none of their heaps.
+    std::vector<HeapAllocation> blocks;
+    for (MultiHeap *heaps : instances)
+    {
+        blocks.push_back(heaps->allocate(32));
+    }
+    std::thread([&]() {
+        for (uint32_t i = 0; i < instanceCount; ++i)
+        {
+            instances[i]->free(blocks[i]);
+        }
+    }).join();
+    roundRobin();
+
+    for (MultiHeap *heaps : instances)
+    {
+        delete heaps;
+    }
+
+    std::cout << "PASSED" << std::endl;
+    return true;
+}
+
+bool
+testMultiHeapThreadChurn()
+{
+    std::cout << "\n[TEST] MultiHeap Thread Churn" << std::endl;
+
+    // Ten times more threads over the table's lifetime than it has heaps: each one leaves blocks behind when it
+    // exits, the next thread takes its heap over and the stragglers are freed into it from here.
+    constexpr uint32_t heapCount = 2;
+    constexpr uint32_t threadRounds = 10 * heapCount;
+    MultiHeap heaps(heapCount, 256);
+    std::vector<HeapAllocation> leftOver;
+
+    for (uint32_t round = 0; round < threadRounds; ++round)
+    {
+        std::thread([&]() {
+            for (uint32_t i = 0; i < 64; ++i)
+            {
+                HeapAllocation alloc = heaps.allocate(128);
+                assert(alloc.heapIndex < heapCount && alloc.allocation.offset != 0xffffffff && "Allocation failed!");
+                memset(heaps.getPointer(alloc), (int)round, 128);
+                if (i % 4 == 0)
+                {
+                    leftOver.push_back(alloc);
+                }
+                else
+                {
+                    heaps.free(alloc);
+                }
+            }
+        }).join();
+
+        for (const HeapAllocation &alloc : leftOver)
+        {
+            assert(*(const unsigned char *)heaps.getPointer(alloc) == (unsigned char)round &&
+                   "Memory contents corrupted!");
+            heaps.free(alloc);
+        }
+        leftOver.clear();
+    }
+
+    // More threads alive at once than heaps: the ones left without a heap get a failed allocation, not a bad index.
+    std::atomic<uint32_t> failed{0};
+    std::barrier sync(heapCount + 1);
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < heapCount + 1; ++t)
+    {
+        threads.emplace_back([&]() {
+            sync.arrive_and_wait();
+            HeapAllocation alloc = heaps.allocate(64);
+            sync.arrive_and_wait();
+            if (alloc.heapIndex == MultiHeap::INVALID_HEAP)
+            {
+                assert(alloc.allocation.offset == 0xffffffff && alloc.allocation.nodeIndex == 0xffffffff);
+                failed.fetch_add(1, std::memory_order_relaxed);
+            }
+            else
+            {
+                heaps.free(alloc);
+            }
+        });
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    assert(failed.load() == 1 && "Exactly one thread should have been turned away!");
+
+    std::cout << "PASSED" << std::endl;
+    return true;
+}
+
 // ============================================================================
 // Test Runner
 // ============================================================================
@@ -520,6 +1063,16 @@ runAllTests()
     runTest(testStressAllocation, "Stress Test");
     runTest(testAlternatingPattern, "Alternating Pattern");
     runTest(testReuseAfterFree, "Memory Reuse");
+    runTest(testCommittedMemoryAccess, "Committed Memory Access");
+    runTest(testNodeStorageGrowth, "Node Storage Growth");
+    runTest(testAllocator64, "64-bit Offsets");
+    runTest(testBatchAllocFree, "Batched Alloc/Free");
+    runTest(testStats, "Statistics");
+    runTest(testAlignedAllocation, "Aligned Allocation");
+    runTest(testReallocate, "Reallocate");
+    runTest(testMultiHeapRemoteFrees, "MultiHeap Cross-Thread Frees");
+    runTest(testMultiHeapManyInstances, "MultiHeap More Instances Than Cache Slots");
+    runTest(testMultiHeapThreadChurn, "MultiHeap Thread Churn");
 
     std::cout << "\n========================================" << std::endl;
     std::cout << "Tests Passed: " << passed << "/" << total << std::endl;
@@ -0,0 +1,122 @@
+#ifndef VIRTUAL_MEMORY_H
+#define VIRTUAL_MEMORY_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/*
+    Thin platform layer over the OS virtual memory system. A range is first reserved (address space only, nothing
+    is backed by physical memory), then sub-ranges of it are committed as they are needed and decommitted once
+    they are not. Committed pages are zero-filled on first touch; decommitted pages give their physical memory
+    back to the OS but keep the address range reserved so the same offsets can be committed again later.
+
+    vmem_purge is the cheap half of decommit: the physical pages go back to the OS but the range stays committed and
+    accessible, its contents are undefined afterwards. It leaves the protection alone, so unlike decommitting and
+    committing sub-ranges over and over it does not split the mapping into more and more pieces (on Linux each one
+    counts against vm.max_map_count).
+
+    All ptr/size pairs passed to commit/decommit/purge must be page aligned.
+*/
+
+size_t vmem_page_size();
+void  *vmem_reserve(size_t size);
+bool   vmem_commit(void *ptr, size_t size);
+void   vmem_decommit(void *ptr, size_t size);
+void   vmem_purge(void *ptr, size_t size);
+void   vmem_release(void *ptr, size_t size);
+
+inline size_t
+vmem_page_size()
+{
+    static size_t page_size = 0;
+    if (page_size == 0) {
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        page_size = (size_t)info.dwPageSize;
+#else
+        page_size = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+    }
+    return page_size;
+}
+
+inline void *
+vmem_reserve(size_t size)
+{
+#ifdef _WIN32
+    void *result = VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+    void *result = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (result == MAP_FAILED) {
+        result = NULL;
+    }
+#endif
+    return result;
+}
+
+inline bool
+vmem_commit(void *ptr, size_t size)
+{
+    assert(((uintptr_t)ptr & (vmem_page_size() - 1)) == 0);
+#ifdef _WIN32
+    bool result = VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#else
+    bool result = mprotect(ptr, size, PROT_READ | PROT_WRITE) == 0;
+#endif
+    return result;
+}
+
+inline void
+vmem_decommit(void *ptr, size_t size)
+{
+    assert(((uintptr_t)ptr & (vmem_page_size() - 1)) == 0);
+#ifdef _WIN32
+    VirtualFree(ptr, size, MEM_DECOMMIT);
+#else
+    // NOTE: MADV_DONTNEED drops the physical pages right away (RSS goes down), the mprotect makes any stray access
+    // to a decommitted range fault instead of silently re-populating it.
+    madvise(ptr, size, MADV_DONTNEED);
+    mprotect(ptr, size, PROT_NONE);
+#endif
+}
+
+inline void
+vmem_purge(void *ptr, size_t size)
+{
+    assert(((uintptr_t)ptr & (vmem_page_size() - 1)) == 0);
+#ifdef _WIN32
+    VirtualAlloc(ptr, size, MEM_RESET, PAGE_READWRITE);
+#else
+    madvise(ptr, size, MADV_DONTNEED);
+#endif
+}
+
+inline void
+vmem_release(void *ptr, size_t size)
+{
+    if (ptr == NULL) {
+        return;
+    }
+#ifdef _WIN32
+    VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+    munmap(ptr, size);
+#endif
+}
+
+#endif